@@ -483,6 +483,7 @@ fi
 %defattr(-,root,root)
 /usr/sbin/checkrad
 /usr/sbin/raddebug
+/usr/sbin/raddict
 /usr/sbin/radiusd
 /usr/sbin/radmin
 # man-pages
@@ -512,6 +513,7 @@ fi
 %doc %{_mandir}/man5/users.5.gz
 %doc %{_mandir}/man8/radcrypt.8.gz
 %doc %{_mandir}/man8/raddebug.8.gz
+%doc %{_mandir}/man8/raddict.8.gz
 %doc %{_mandir}/man8/radiusd.8.gz
 %doc %{_mandir}/man8/radmin.8.gz
 %doc %{_mandir}/man8/radrelay.8.gz
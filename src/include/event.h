@@ -37,7 +37,12 @@ typedef	void (*fr_event_callback_t)(void *);
 typedef	void (*fr_event_status_t)(struct timeval *);
 typedef void (*fr_event_fd_handler_t)(fr_event_list_t *el, int sock, void *ctx);
 
-fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status);
+typedef enum fr_event_timer_t {
+	FR_EVENT_TIMER_HEAP = 0,	//!< Exact ordering, O(log n) insert and delete.
+	FR_EVENT_TIMER_WHEEL		//!< 1ms resolution, O(1) insert and delete.
+} fr_event_timer_t;
+
+fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status, fr_event_timer_t type);
 
 int fr_event_list_num_fds(fr_event_list_t *el);
 int fr_event_list_num_elements(fr_event_list_t *el);
@@ -467,6 +467,7 @@ int		dict_addvendor(char const *name, unsigned int value);
 int		dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type, ATTR_FLAGS flags);
 int		dict_addvalue(char const *namestr, char const *attrstr, int value);
 int		dict_init(char const *dir, char const *fn);
+int		dict_compile(char const *dir, char const *fn, char const *out);
 void		dict_free(void);
 int		dict_read(char const *dir, char const *filename);
 
@@ -508,6 +509,8 @@ int		rad_send(RADIUS_PACKET *, RADIUS_PACKET const *, char const *secret);
 bool		rad_packet_ok(RADIUS_PACKET *packet, int flags, decode_fail_t *reason);
 RADIUS_PACKET	*rad_recv(int fd, int flags);
 ssize_t rad_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port, int *code);
+ssize_t		rad_recv_datagram(int sockfd, RADIUS_PACKET *packet);
+bool		rad_recv_datagram_ok(RADIUS_PACKET *packet, int flags);
 void		rad_recv_discard(int sockfd);
 int		rad_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original,
 			   char const *secret);
@@ -578,6 +581,22 @@ int		rad_vp2attr(RADIUS_PACKET const *packet,
 			    RADIUS_PACKET const *original, char const *secret,
 			    VALUE_PAIR const **pvp, uint8_t *ptr, size_t room);
 
+/*
+ *	Batched UDP I/O, with recvmmsg() and sendmmsg().
+ */
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+#  define WITH_RADIUS_BATCH
+typedef struct fr_packet_batch fr_packet_batch_t;
+
+fr_packet_batch_t *rad_batch_alloc(TALLOC_CTX *ctx, int sockfd, uint32_t size);
+int		rad_batch_recv(fr_packet_batch_t *batch);
+ssize_t		rad_batch_datagram(fr_packet_batch_t *batch, RADIUS_PACKET **packet_p);
+uint32_t	rad_batch_pending(fr_packet_batch_t const *batch);
+int		rad_batch_send(fr_packet_batch_t *batch, RADIUS_PACKET *packet,
+			       RADIUS_PACKET const *original, char const *secret);
+int		rad_batch_flush(fr_packet_batch_t *batch);
+#endif
+
 /* pair.c */
 VALUE_PAIR	*pairalloc(TALLOC_CTX *ctx, DICT_ATTR const *da);
 VALUE_PAIR	*paircreate(TALLOC_CTX *ctx, unsigned int attr, unsigned int vendor);
@@ -889,6 +908,34 @@ void		*fr_fifo_pop(fr_fifo_t *fi);
 void		*fr_fifo_peek(fr_fifo_t *fi);
 int		fr_fifo_num_elements(fr_fifo_t *fi);
 
+/*
+ *	Log-linear histograms
+ */
+#define FR_HISTOGRAM_BITS	27	//!< Values up to 2^27 - 1, ~134s in microseconds.
+#define FR_HISTOGRAM_SUB_BITS	5	//!< 32 buckets per power of two.
+#define FR_HISTOGRAM_BUCKETS	((FR_HISTOGRAM_BITS - FR_HISTOGRAM_SUB_BITS + 1) << FR_HISTOGRAM_SUB_BITS)
+
+typedef struct fr_histogram_t {
+	uint64_t	max;				//!< Largest value recorded.
+	uint64_t	bucket[FR_HISTOGRAM_BUCKETS];	//!< 64 bit, as most are never reset.
+} fr_histogram_t;
+
+void		fr_histogram_add(fr_histogram_t *h, uint64_t value);
+void		fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src);
+uint64_t	fr_histogram_count(fr_histogram_t const *h);
+uint64_t	fr_histogram_percentile(fr_histogram_t const *h, double percentile);
+
+#ifdef HAVE_STDATOMIC_H
+/*
+ *	Lock-free queues
+ */
+typedef struct	fr_atomic_queue_t fr_atomic_queue_t;
+fr_atomic_queue_t *fr_atomic_queue_create(TALLOC_CTX *ctx, int size);
+bool		fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data);
+bool		fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data);
+int		fr_atomic_queue_num_elements(fr_atomic_queue_t *aq);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
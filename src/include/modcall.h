@@ -46,6 +46,25 @@ void add_to_modcallable(modcallable *parent, modcallable *this);
 
 void modcall_debug(modcallable *mc, int depth);
 
+/*
+ *	Counters for a module method, a policy, or a section, as
+ *	returned by modcall_stats_walk().  Times are wall clock, in
+ *	microseconds, and include the time spent in any children.
+ */
+typedef struct modcall_stats_t {
+	char const	*name;
+	uint64_t	calls;
+	uint64_t	usec;
+	uint64_t	max_usec;
+	uint64_t	rcode[RLM_MODULE_NUMCODES];
+} modcall_stats_t;
+
+typedef int (*modcall_stats_walk_t)(void *ctx, modcall_stats_t const *stats);
+
+void modcall_stats_section(modcallable *mc, char const *name);
+int modcall_stats_walk(modcall_stats_walk_t callback, void *ctx);
+void modcall_stats_free(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,16 +47,22 @@ typedef struct module_instance_t {
 	void			*insthandle;
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t		*mutex;
+	pthread_mutex_t		*thread_mutex;	//!< For RLM_TYPE_THREAD_INSTANCE.
+	pthread_key_t		thread_key;
 #endif
 	CONF_SECTION		*cs;
 	bool			force;
 	rlm_rcode_t		code;
 	fr_module_hup_t	       	*mh;
+	unsigned int		generation;	//!< Incremented on each HUP.
 } module_instance_t;
 
 module_instance_t	*find_module_instance(CONF_SECTION *modules, char const *askedname, bool do_link);
 int			find_module_sibling_section(CONF_SECTION **out, CONF_SECTION *module, char const *name);
 int			module_hup_module(CONF_SECTION *cs, module_instance_t *node, time_t when);
+#ifdef HAVE_PTHREAD_H
+int			module_thread_instance(void **insthandle, module_instance_t *node);
+#endif
 
 #ifdef __cplusplus
 }
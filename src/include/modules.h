@@ -85,6 +85,12 @@ extern const section_type_value_t section_type_value[];
 						//!< Server will instantiated
 						//!< new instance, and then
 						//!< destroy old instance.
+#define RLM_TYPE_THREAD_INSTANCE (1 << 3)	//!< Each thread gets its own data.
+						//!< Server will call
+						//!< thread_instantiate for each
+						//!< thread which calls the
+						//!< module, instead of protecting
+						//!< calls with a mutex.
 
 
 /* Stop people using different module/library/server versions together */
@@ -105,7 +111,7 @@ typedef rlm_rcode_t (*packetmethod)(void *instance, REQUEST *request);
  *
  * Is called once per module instance. Is not called when new threads are
  * spawned. Modules that require separate thread contexts should use the
- * connection pool API.
+ * connection pool API, or be RLM_TYPE_THREAD_INSTANCE.
  *
  * @param[in] mod_cs Module instance's configuration section.
  * @param[out] instance Module instance's configuration structure, should be
@@ -127,6 +133,36 @@ typedef int (*instantiate_t)(CONF_SECTION *mod_cs, void *instance);
  */
 typedef int (*detach_t)(void *instance);
 
+/** Module thread instantiation callback
+ *
+ * Is called for RLM_TYPE_THREAD_INSTANCE modules, the first time each thread
+ * calls the module, and again after the module has been reloaded on HUP.
+ * The section methods are then passed the thread's data, instead of the
+ * instance.
+ *
+ * The instance has already been parsed and instantiated, and is shared by
+ * every thread, so it must not be modified.  In particular, xlats and
+ * paircompares must only be registered by instantiate, with the instance.
+ * They may be called from any thread.
+ *
+ * @param[in] instance the module instance, which the data may point to.
+ * @param[in] ctx to allocate the thread's data in.
+ * @param[out] thread the thread's data.
+ * @return -1 if instantiation failed, else 0.
+ */
+typedef int (*thread_instantiate_t)(void *instance, TALLOC_CTX *ctx, void **thread);
+
+/** Module thread detach callback
+ *
+ * Is called when the thread exits, or replaces its data after a HUP, or
+ * when the module is freed.  The instance the data was created from may
+ * already have been freed, so it must not be used.
+ *
+ * @param[in] thread data to free.
+ * @return -1 if detach failed, else 0.
+ */
+typedef int (*thread_detach_t)(void *thread);
+
 /** Metadata exported by the module
  *
  * This determines the capabilities of the module, and maps internal functions
@@ -143,7 +179,9 @@ typedef struct module_t {
 	packetmethod		methods[RLM_COMPONENT_COUNT];	//!< Pointers to the various section functions, ordering
 								//!< determines which function is mapped to
 								//!< which section.
-
+	thread_instantiate_t	thread_instantiate;		//!< Function to create a thread's data,
+								//!< for RLM_TYPE_THREAD_INSTANCE.
+	thread_detach_t		thread_detach;			//!< Function to free a thread's data.
 } module_t;
 
 int modules_init(CONF_SECTION *);
@@ -37,6 +37,15 @@ void fr_request_from_reply(RADIUS_PACKET *request,
 int fr_socket(fr_ipaddr_t *ipaddr, uint16_t port);
 int fr_nonblock(int fd);
 
+typedef struct fr_packet_hash_t fr_packet_hash_t;
+
+fr_packet_hash_t *fr_packet_hash_create(TALLOC_CTX *ctx);
+bool fr_packet_hash_insert(fr_packet_hash_t *ph, RADIUS_PACKET **packet_p);
+RADIUS_PACKET **fr_packet_hash_find(fr_packet_hash_t *ph, RADIUS_PACKET const *packet);
+bool fr_packet_hash_yank(fr_packet_hash_t *ph, RADIUS_PACKET const *packet);
+uint32_t fr_packet_hash_num_elements(fr_packet_hash_t *ph);
+int fr_packet_hash_walk(fr_packet_hash_t *ph, void *ctx, rb_walker_t callback);
+
 typedef struct fr_packet_list_t fr_packet_list_t;
 
 fr_packet_list_t *fr_packet_list_create(int alloc_id);
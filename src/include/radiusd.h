@@ -226,6 +226,9 @@ struct rad_request {
 	VALUE_PAIR		*username;	//!< Cached username VALUE_PAIR.
 	VALUE_PAIR		*password;	//!< Cached password VALUE_PAIR.
 
+	TALLOC_CTX		*arena;		//!< Pool for the packets, and the attributes decoded
+						//!< into them.  May be NULL.
+
 	fr_request_process_t	process;	//!< The function to call to move the request through the state machine.
 
 	RAD_REQUEST_FUNP	handle;		//!< The function to call to move the request through the
@@ -337,6 +340,9 @@ struct rad_listen_t {
 	bool		synchronous;
 	uint32_t	workers;
 
+	fr_event_list_t	*el;		/* its own event loop, if it has one */
+	fr_packet_hash_t *requests;	/* requests tracked by that loop */
+
 #ifdef WITH_TLS
 	fr_tls_server_conf_t *tls;
 #endif
@@ -381,6 +387,20 @@ typedef struct listen_socket_t {
 
 	int		proto;
 
+	RADIUS_PACKET	*recv_packet;	/* UDP: the datagram being received */
+
+	uint32_t	reuseport;	/* UDP: sockets sharing this address */
+	uint32_t	reuseport_id;	/* which of those this one is */
+
+#ifdef WITH_RADIUS_BATCH
+	uint32_t	batch_size;	/* UDP: datagrams per recvmmsg() / sendmmsg() */
+	fr_packet_batch_t *batch;
+#ifdef WITH_STATS
+	fr_stats_batch_t batch_recv;
+	fr_stats_batch_t batch_send;
+#endif
+#endif
+
 #ifdef WITH_TCP
 	/* for a proxy connecting to home servers */
 	time_t		last_packet;
@@ -434,6 +454,7 @@ typedef struct main_config_t {
 	uint32_t	max_request_time;
 	uint32_t	cleanup_delay;
 	uint32_t	max_requests;
+	bool		module_statistics;
 	char const	*log_file;
 	char const	*dictionary_dir;
 	char const	*checkrad;
@@ -532,6 +553,7 @@ void		*rad_malloc(size_t size); /* calls exit(1) on error! */
 void		rad_const_free(void const *ptr);
 char		*rad_ajoin(TALLOC_CTX *ctx, char const **array, char c);
 REQUEST		*request_alloc(TALLOC_CTX *ctx);
+TALLOC_CTX	*request_arena_alloc(REQUEST *request);
 REQUEST		*request_alloc_fake(REQUEST *oldreq);
 REQUEST		*request_alloc_coa(REQUEST *request);
 int		request_data_add(REQUEST *request,
@@ -670,6 +692,17 @@ ssize_t radius_axlat_struct(char **out, REQUEST *request, xlat_exp_t const *xlat
 			    void *ctx)
 	CC_HINT(nonnull (1, 2, 3));
 
+typedef struct xlat_compiled_t xlat_compiled_t;
+
+xlat_compiled_t	*xlat_compile(TALLOC_CTX *ctx, char const *fmt, RADIUS_ESCAPE_STRING escape, void *escape_ctx);
+char const	*xlat_compiled_fmt(xlat_compiled_t const *xc);
+
+ssize_t radius_xlat_compiled(char *out, size_t outlen, REQUEST *request, xlat_compiled_t const *xc)
+	CC_HINT(nonnull (1, 3, 4));
+
+ssize_t radius_axlat_compiled(char **out, REQUEST *request, xlat_compiled_t const *xc)
+	CC_HINT(nonnull (1, 2, 3));
+
 typedef ssize_t (*RAD_XLAT_FUNC)(void *instance, REQUEST *, char const *, char *, size_t);
 int		xlat_register(char const *module, RAD_XLAT_FUNC func, RADIUS_ESCAPE_STRING escape,
 			      void *instance);
@@ -680,6 +713,18 @@ ssize_t		xlat_fmt_to_ref(uint8_t const **out, REQUEST *request, char const *fmt)
 void		xlat_free(void);
 
 /* threads.c */
+typedef struct thread_crypto_stats_t {
+	uint32_t	threads;	//!< Number of threads in the crypto pool.
+	uint32_t	max_queue_size;
+	uint32_t	queued;		//!< Requests currently waiting.
+	uint32_t	max_queued;	//!< Most requests ever waiting.
+	uint64_t	requests;	//!< Requests processed.
+	uint64_t	dropped;	//!< Requests dropped because the queue was full.
+	uint64_t	wait_usec;	//!< Total time from receiving a request to starting it.
+	uint64_t	max_wait_usec;	//!< Longest time a request waited.
+	uint64_t	run_usec;	//!< Total time spent processing requests.
+} thread_crypto_stats_t;
+
 int	thread_pool_init(CONF_SECTION *cs, bool *spawn_flag);
 void	thread_pool_stop(void);
 int	thread_pool_addrequest(REQUEST *, RAD_REQUEST_FUNP);
@@ -689,10 +734,15 @@ int	total_active_threads(void);
 void	thread_pool_lock(void);
 void	thread_pool_unlock(void);
 void	thread_pool_queue_stats(int array[RAD_LISTEN_MAX], int pps[2]);
+void	thread_pool_crypto_stats(thread_crypto_stats_t *stats);
+bool	thread_pool_active(void);
+uint32_t thread_pool_max_threads(void);
 
 #ifndef HAVE_PTHREAD_H
 #  define rad_fork(n) fork()
 #  define rad_waitpid(a,b) waitpid(a,b, 0)
+#  define thread_pool_active() (false)
+#  define thread_pool_max_threads() (1)
 #endif
 
 /* main_config.c */
@@ -720,6 +770,11 @@ RADCLIENT_LIST *listener_find_client_list(fr_ipaddr_t const *ipaddr, uint16_t po
 #endif
 rad_listen_t *listener_find_byipaddr(fr_ipaddr_t const *ipaddr, uint16_t port, int proto);
 int rad_status_server(REQUEST *request);
+#ifdef WITH_RADIUS_BATCH
+void listen_batch_flush(void);
+void listen_batch_hold(rad_listen_t *listener);
+void listen_batch_release(rad_listen_t *listener);
+#endif
 
 /* event.c */
 typedef enum event_corral_t {
@@ -732,6 +787,9 @@ int radius_event_init(TALLOC_CTX *ctx);
 int radius_event_start(CONF_SECTION *cs, bool spawn_flag);
 void radius_event_free(void);
 int radius_event_process(void);
+#ifdef HAVE_PTHREAD_H
+void *radius_event_worker(void *ctx);
+#endif
 void radius_update_listener(rad_listen_t *listener);
 void revive_home_server(void *ctx);
 void mark_home_server_dead(home_server_t *home, struct timeval *when);
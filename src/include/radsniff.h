@@ -36,6 +36,18 @@ RCSIDH(radsniff_h, "$Id$")
 #  include <collectd/client.h>
 #endif
 
+/*
+ *	Worker threads need pthreads, and thread local storage for the
+ *	request trees and event list each of them owns.
+ */
+#if defined(HAVE_PTHREAD_H) && defined(__THREAD)
+#  include <pthread.h>
+#  define WITH_RS_WORKERS (1)
+#  define RS_THREAD_LOCAL __THREAD
+#else
+#  define RS_THREAD_LOCAL
+#endif
+
 #define RS_DEFAULT_PREFIX	"radsniff"	//!< Default instance
 #define RS_DEFAULT_SECRET	"testing123"	//!< Default secret
 #define RS_DEFAULT_TIMEOUT	5200		//!< Standard timeout of 5s + 300ms to cover network latency
@@ -43,6 +55,10 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_PERCENTILES		4		//!< Latency percentiles we report (p50, p90, p99, p99.9).
+#define RS_WORKERS_MAX		64		//!< Maximum number of decode/correlate threads.
+#define RS_WORKER_QUEUE_SIZE	8192		//!< Packets which may be waiting for a single worker.
+#define RS_WORKER_WAKEUP	100		//!< How often an idle worker checks its timers (milliseconds).
 
 /*
  *	Logging macros
@@ -128,7 +144,11 @@ typedef struct rs_latency {
 
 		double			latency_high;		//!< Latency high water mark.
 		double			latency_low;		//!< Latency low water mark.
+		double			latency_pct[RS_PERCENTILES];	//!< Latency percentiles in milliseconds.
 	} interval;
+
+	fr_histogram_t		*latency_histogram;		//!< Latency of each request/response pair
+								//!< this interval, in microseconds.
 } rs_latency_t;
 
 typedef struct rs_malformed {
@@ -224,6 +244,45 @@ typedef struct rs_update {
 	rs_stats_t		*stats;			//!< Stats to process.
 } rs_update_t;
 
+#ifdef WITH_RS_WORKERS
+/** A packet copied out of the capture buffer, waiting for a worker
+ *
+ */
+typedef struct rs_queued {
+	uint64_t		count;			//!< Packet counter value assigned by the capture thread.
+	fr_pcap_t		*in;			//!< PCAP handle the packet was received on.
+	struct pcap_pkthdr	header;			//!< PCAP packet header.
+	uint8_t			*data;			//!< PCAP packet data (follows this struct).
+} rs_queued_t;
+
+/** A decode/correlate thread
+ *
+ * Packets are assigned to workers using a hash of their 5-tuple and RADIUS ID, which is the
+ * same for a request and its response, so each worker can link the packets it sees without
+ * reference to any of the others.
+ */
+typedef struct rs_worker {
+	int			id;			//!< Worker number, used for logging.
+	pthread_t		thread;			//!< The thread doing the decoding.
+	bool			running;		//!< Whether the thread was started.
+
+	pthread_mutex_t		mutex;			//!< Protects the queue.
+	pthread_cond_t		cond;			//!< Signalled when the queue becomes non-empty.
+	rs_queued_t		*queue[RS_WORKER_QUEUE_SIZE];	//!< Ring buffer of packets to process.
+	int			head;			//!< Next packet to process.
+	int			num;			//!< Number of packets in the queue.
+	uint64_t		dropped;		//!< Packets discarded because the queue was full.
+	bool			exit;			//!< Tells the thread to exit.
+
+	TALLOC_CTX		*ctx;			//!< Requests and decoded packets are allocated here.
+	fr_event_list_t		*events;		//!< Timers for the requests this worker is tracking.
+	rbtree_t		*request_tree;		//!< Requests this worker is tracking.
+	rbtree_t		*link_tree;		//!< Requests indexed by the linking attributes.
+
+	pthread_mutex_t		stats_mutex;		//!< Held while processing packets, or merging stats.
+	rs_stats_t		stats;			//!< Stats for the current interval.
+} rs_worker_t;
+#endif
 
 struct rs {
 	bool			from_file;		//!< Were reading pcap data from files.
@@ -268,6 +327,12 @@ struct rs {
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
 
+	int			workers;		//!< Number of decode/correlate threads, 0 to decode
+							//!< packets in the capture thread.
+#ifdef WITH_RS_WORKERS
+	rs_worker_t		*worker;		//!< Array of workers.
+#endif
+
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
 		stats_out_t		out;			//!< Where to write stats.
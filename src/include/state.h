@@ -30,8 +30,15 @@ RCSIDH(state_h, "$Id$")
 extern "C" {
 #endif
 
+/*
+ *	The state table is split into this many shards, each with its
+ *	own lock.  Must be a power of 2.
+ */
+#define FR_STATE_SHARDS		(16)
+
 bool fr_state_init(void);
 void fr_state_delete(void);
+void fr_state_shard_entries(uint32_t entries[FR_STATE_SHARDS]);
 
 void fr_state_discard(REQUEST *request, RADIUS_PACKET *original);
 
@@ -52,8 +52,20 @@ typedef struct fr_stats_t {
 	fr_uint_t	total_timeouts;
 	time_t		last_packet;
 	fr_uint_t	elapsed[8];
+	fr_histogram_t	*latency;	//!< Response times in microseconds.
 } fr_stats_t;
 
+/*
+ *	How full the batches of a socket using recvmmsg() and
+ *	sendmmsg() are.  fill[i] counts the system calls which moved
+ *	more than i/8 and at most (i + 1)/8 of the batch size.
+ */
+typedef struct fr_stats_batch_t {
+	fr_uint_t	calls;
+	fr_uint_t	packets;
+	fr_uint_t	fill[8];
+} fr_stats_batch_t;
+
 typedef struct fr_stats_ema_t {
 	uint32_t	window;
 
@@ -85,6 +97,14 @@ void request_stats_final(REQUEST *request);
 void request_stats_reply(REQUEST *request);
 void radius_stats_ema(fr_stats_ema_t *ema,
 		      struct timeval *start, struct timeval *end);
+void radius_stats_batch(fr_stats_batch_t *stats, uint32_t packets, uint32_t size);
+
+/*
+ *	The latency percentiles we report, and their names.
+ */
+#define FR_STATS_PERCENTILES	4
+extern double const	fr_stats_percentile[FR_STATS_PERCENTILES];
+extern char const	*fr_stats_percentile_names[FR_STATS_PERCENTILES];
 
 #define FR_STATS_INC(_x, _y) radius_ ## _x ## _stats._y++;if (listener) listener->stats._y++;if (client) client->_x._y++;
 #define FR_STATS_TYPE_INC(_x) _x++
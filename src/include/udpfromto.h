@@ -15,7 +15,14 @@ extern "C" {
 #endif
 
 #ifdef WITH_UDPFROMTO
+/*
+ *	Space for the control messages of one datagram.
+ */
+#define UDPFROMTO_CMSG_SIZE	(256)
+
 int udpfromto_init(int s);
+void udpfromto_cmsg_to(struct msghdr *msgh, struct sockaddr *to, socklen_t *tolen);
+int udpfromto_cmsg_from(struct msghdr *msgh, struct sockaddr const *from);
 int recvfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t *fromlen,
 	       struct sockaddr *to, socklen_t *tolen);
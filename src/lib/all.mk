@@ -33,10 +33,12 @@ SOURCES		:= cbuff.c \
 		   udpfromto.c \
 		   value.c \
 		   fifo.c \
+		   atomic_queue.c \
 		   packet.c \
 		   event.c \
 		   getaddrinfo.c \
 		   heap.c \
+		   histogram.c \
 		   tcp.c \
 		   base64.c \
 		   version.c
@@ -0,0 +1,215 @@
+/*
+ * atomic_queue.c	Thread-safe, lock-free, bounded queue.
+ *
+ * Version:	$Id$
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *  Copyright 2016  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+
+/*
+ *	Keep the head and tail on different cache lines, so that
+ *	readers and writers don't fight over them.
+ */
+#define CACHE_LINE_SIZE	(64)
+
+/*
+ *	Each entry has a sequence number, which says whose turn it
+ *	is to use the entry.  When "seq == pos", the entry is empty,
+ *	and a writer at "pos" may fill it.  When "seq == pos + 1",
+ *	the entry is full, and a reader at "pos" may empty it.  The
+ *	reader then sets "seq = pos + size", for the writer on the
+ *	next lap around the ring.
+ */
+typedef struct fr_atomic_queue_entry_t {
+	atomic_int_fast64_t	seq;
+	void			*data;
+} fr_atomic_queue_entry_t;
+
+struct fr_atomic_queue_t {
+	atomic_int_fast64_t	head;		//!< Next position to read.
+	char			pad1[CACHE_LINE_SIZE - sizeof(atomic_int_fast64_t)];
+
+	atomic_int_fast64_t	tail;		//!< Next position to write.
+	char			pad2[CACHE_LINE_SIZE - sizeof(atomic_int_fast64_t)];
+
+	int			size;		//!< Always a power of 2.
+
+	fr_atomic_queue_entry_t	entry[1];
+};
+
+/** Create a bounded, lock-free, multi-producer / multi-consumer queue
+ *
+ * @param ctx to allocate the queue in.
+ * @param size the minimum number of entries.  It is rounded up to the
+ *	next power of 2.
+ * @return the new queue, or NULL on error.
+ */
+fr_atomic_queue_t *fr_atomic_queue_create(TALLOC_CTX *ctx, int size)
+{
+	int i;
+	fr_atomic_queue_t *aq;
+
+	if ((size < 2) || (size > (1024 * 1024))) {
+		fr_strerror_printf("Queue size must be between 2 and 1048576");
+		return NULL;
+	}
+
+	for (i = 2; i < size; i <<= 1) {
+		/* nothing */
+	}
+	size = i;
+
+	aq = talloc_zero_size(ctx, sizeof(*aq) + (sizeof(aq->entry[0]) * (size - 1)));
+	if (!aq) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	talloc_set_name_const(aq, "fr_atomic_queue_t");
+
+	for (i = 0; i < size; i++) {
+		atomic_init(&aq->entry[i].seq, i);
+		aq->entry[i].data = NULL;
+	}
+
+	atomic_init(&aq->head, 0);
+	atomic_init(&aq->tail, 0);
+	aq->size = size;
+
+	return aq;
+}
+
+/** Push a pointer onto the tail of the queue
+ *
+ * @param aq the queue.
+ * @param data to push.
+ * @return true on success, false if the queue is full.
+ */
+bool fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data)
+{
+	int_fast64_t pos, seq, diff;
+	fr_atomic_queue_entry_t *entry;
+
+	if (!data) return false;
+
+	pos = atomic_load_explicit(&aq->tail, memory_order_relaxed);
+
+	for (;;) {
+		entry = &aq->entry[pos & (aq->size - 1)];
+		seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+		diff = seq - pos;
+
+		/*
+		 *	The entry is empty.  Try to claim it.  On
+		 *	failure, "pos" is updated to the new tail.
+		 */
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&aq->tail, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) break;
+			continue;
+		}
+
+		/*
+		 *	The entry hasn't been read since the last lap.
+		 */
+		if (diff < 0) return false;
+
+		/*
+		 *	Another writer claimed the entry.
+		 */
+		pos = atomic_load_explicit(&aq->tail, memory_order_relaxed);
+	}
+
+	entry->data = data;
+	atomic_store_explicit(&entry->seq, pos + 1, memory_order_release);
+
+	return true;
+}
+
+/** Pop a pointer from the head of the queue
+ *
+ * @param aq the queue.
+ * @param p_data where to write the pointer.
+ * @return true on success, false if the queue is empty.
+ */
+bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
+{
+	int_fast64_t pos, seq, diff;
+	fr_atomic_queue_entry_t *entry;
+
+	pos = atomic_load_explicit(&aq->head, memory_order_relaxed);
+
+	for (;;) {
+		entry = &aq->entry[pos & (aq->size - 1)];
+		seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+		diff = seq - (pos + 1);
+
+		/*
+		 *	The entry is full.  Try to claim it.
+		 */
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&aq->head, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) break;
+			continue;
+		}
+
+		/*
+		 *	The entry hasn't been written yet.
+		 */
+		if (diff < 0) return false;
+
+		/*
+		 *	Another reader claimed the entry.
+		 */
+		pos = atomic_load_explicit(&aq->head, memory_order_relaxed);
+	}
+
+	*p_data = entry->data;
+	entry->data = NULL;
+	atomic_store_explicit(&entry->seq, pos + aq->size, memory_order_release);
+
+	return true;
+}
+
+/** The number of entries in the queue
+ *
+ * This is only a snapshot, as other threads may be pushing or
+ * popping at the same time.
+ *
+ * @param aq the queue.
+ * @return the number of entries.
+ */
+int fr_atomic_queue_num_elements(fr_atomic_queue_t *aq)
+{
+	int_fast64_t head, tail;
+
+	head = atomic_load_explicit(&aq->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&aq->tail, memory_order_relaxed);
+
+	if (tail <= head) return 0;
+
+	return tail - head;
+}
+#endif	/* HAVE_STDATOMIC_H */
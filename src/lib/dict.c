@@ -37,6 +37,12 @@ RCSID("$Id$")
 #include	<sys/stat.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include	<sys/mman.h>
+#endif
+
+#include	<fcntl.h>
+
 static fr_hash_table_t *vendors_byname = NULL;
 static fr_hash_table_t *vendors_byvalue = NULL;
 
@@ -50,6 +56,51 @@ static fr_hash_table_t *values_byname = NULL;
 
 static DICT_ATTR *dict_base_attrs[256];
 
+/*
+ *	The same thing for the VSAs (and extended attributes) numbered
+ *	0..255 of each vendor.  The vendors are found by linear
+ *	probing, and each has an array as large as its highest
+ *	attribute number.  Anything else is looked up in the hash
+ *	tables.
+ */
+#define DICT_VENDOR_INDEX_SIZE	(1024)
+
+typedef struct dict_vendor_index_t {
+	unsigned int	vendor;			//!< 0 if the slot is empty.
+	unsigned int	num_attrs;		//!< Entries in attrs.
+	DICT_ATTR const	**attrs;
+} dict_vendor_index_t;
+
+static dict_vendor_index_t *dict_vendor_index = NULL;
+static int dict_vendor_index_used = 0;
+
+static int dict_max_attr = 0;
+
+/*
+ *	The tables above, as numbered in a compiled dictionary.
+ */
+typedef enum dict_table_t {
+	DICT_VENDORS_BYNAME = 0,
+	DICT_VENDORS_BYVALUE,
+	DICT_ATTRIBUTES_BYNAME,
+	DICT_ATTRIBUTES_BYVALUE,
+	DICT_ATTRIBUTES_COMBO,
+	DICT_VALUES_BYNAME,
+	DICT_VALUES_BYVALUE,
+	DICT_TABLE_MAX
+} dict_table_t;
+
+/*
+ *	A compiled dictionary, mapped from disk.  Lookups check the
+ *	hash tables above first, and then the snapshot.  Anything
+ *	added after the snapshot was loaded (e.g. raddb/dictionary)
+ *	therefore takes precedence, as if it had been read later.
+ */
+static uint8_t *dict_snapshot = NULL;
+static size_t dict_snapshot_len = 0;
+
+static void *dict_snapshot_find(dict_table_t which, void const *data);
+
 /*
  *	For faster HUP's, we cache the stat information for
  *	files we've $INCLUDEd
@@ -57,6 +108,7 @@ static DICT_ATTR *dict_base_attrs[256];
 typedef struct dict_stat_t {
 	struct dict_stat_t *next;
 	struct stat stat_buf;
+	char	name[1];		//!< Full path of the file.
 } dict_stat_t;
 
 static dict_stat_t *stat_head = NULL;
@@ -326,6 +378,76 @@ static int dict_value_value_cmp(void const *one, void const *two)
 }
 
 
+/*
+ *	Hash and comparison functions for each table, so that a
+ *	compiled dictionary can use the same ones.
+ */
+static fr_hash_table_hash_t const dict_table_hash[DICT_TABLE_MAX] = {
+	dict_vendor_name_hash,
+	dict_vendor_value_hash,
+	dict_attr_name_hash,
+	dict_attr_value_hash,
+	dict_attr_combo_hash,
+	dict_value_name_hash,
+	dict_value_value_hash
+};
+
+static fr_hash_table_cmp_t const dict_table_cmp[DICT_TABLE_MAX] = {
+	dict_vendor_name_cmp,
+	dict_vendor_value_cmp,
+	dict_attr_name_cmp,
+	dict_attr_value_cmp,
+	dict_attr_combo_cmp,
+	dict_value_name_cmp,
+	dict_value_value_cmp
+};
+
+/*
+ *	Look in one of the tables, and then in the same table of the
+ *	compiled dictionary.
+ */
+static void *dict_find(fr_hash_table_t *ht, dict_table_t which, void const *data)
+{
+	void *found;
+
+	found = fr_hash_table_finddata(ht, data);
+	if (found || !dict_snapshot) return found;
+
+	return dict_snapshot_find(which, data);
+}
+
+/*
+ *	Find the slot for a vendor in the direct index, optionally
+ *	creating it.
+ */
+static dict_vendor_index_t *dict_vendor_index_find(unsigned int vendor, bool create)
+{
+	uint32_t hash, i;
+
+	if (!dict_vendor_index || !vendor) return NULL;
+
+	hash = ((uint32_t) vendor * 2654435761U) >> 22;	/* top 10 bits */
+	for (i = 0; i < DICT_VENDOR_INDEX_SIZE; i++) {
+		dict_vendor_index_t *idx;
+
+		idx = &dict_vendor_index[(hash + i) & (DICT_VENDOR_INDEX_SIZE - 1)];
+		if (idx->vendor == vendor) return idx;
+		if (idx->vendor) continue;
+
+		/*
+		 *	Keep it at most half full, so that probing is
+		 *	short.  Any other vendors use the hash tables.
+		 */
+		if (!create || (dict_vendor_index_used >= (DICT_VENDOR_INDEX_SIZE / 2))) return NULL;
+
+		idx->vendor = vendor;
+		dict_vendor_index_used++;
+		return idx;
+	}
+
+	return NULL;
+}
+
 /*
  *	Free the list of stat buffers
  */
@@ -350,15 +472,17 @@ static void dict_stat_free(void)
 /*
  *	Add an entry to the list of stat buffers.
  */
-static void dict_stat_add(struct stat const *stat_buf)
+static void dict_stat_add(char const *name, struct stat const *stat_buf)
 {
 	dict_stat_t *this;
+	size_t len = strlen(name);
 
-	this = malloc(sizeof(*this));
+	this = malloc(sizeof(*this) + len);
 	if (!this) return;
 	memset(this, 0, sizeof(*this));
 
 	memcpy(&(this->stat_buf), stat_buf, sizeof(this->stat_buf));
+	memcpy(this->name, name, len + 1);
 
 	if (!stat_head) {
 		stat_head = stat_tail = this;
@@ -524,8 +648,23 @@ void dict_free(void)
 
 	memset(dict_base_attrs, 0, sizeof(dict_base_attrs));
 
+	if (dict_vendor_index) {
+		int i;
+
+		for (i = 0; i < DICT_VENDOR_INDEX_SIZE; i++) free(dict_vendor_index[i].attrs);
+		free(dict_vendor_index);
+		dict_vendor_index = NULL;
+	}
+	dict_vendor_index_used = 0;
+
 	fr_pool_delete(&dict_pool);
 
+#ifdef HAVE_SYS_MMAN_H
+	if (dict_snapshot) munmap(dict_snapshot, dict_snapshot_len);
+#endif
+	dict_snapshot = NULL;
+	dict_snapshot_len = 0;
+
 	dict_stat_free();
 }
 
@@ -535,7 +674,7 @@ void dict_free(void)
 int dict_addvendor(char const *name, unsigned int value)
 {
 	size_t length;
-	DICT_VENDOR *dv;
+	DICT_VENDOR *dv, *old_dv;
 
 	if (value >= FR_MAX_VENDOR) {
 		fr_strerror_printf("dict_addvendor: Cannot handle vendor ID larger than 2^24");
@@ -556,9 +695,21 @@ int dict_addvendor(char const *name, unsigned int value)
 	dv->vendorpec  = value;
 	dv->type = dv->length = 1; /* defaults */
 
-	if (!fr_hash_table_insert(vendors_byname, dv)) {
-		DICT_VENDOR *old_dv;
+	/*
+	 *	Already in the compiled dictionary.
+	 */
+	old_dv = dict_snapshot_find(DICT_VENDORS_BYNAME, dv);
+	if (old_dv && !fr_hash_table_finddata(vendors_byname, dv)) {
+		fr_pool_free(dv);
+
+		if (old_dv->vendorpec != value) {
+			fr_strerror_printf("dict_addvendor: Duplicate vendor name %s", name);
+			return -1;
+		}
+		return 0;
+	}
 
+	if (!fr_hash_table_insert(vendors_byname, dv)) {
 		old_dv = fr_hash_table_finddata(vendors_byname, dv);
 		if (!old_dv) {
 			fr_strerror_printf("dict_addvendor: Failed inserting vendor name %s", name);
@@ -642,7 +793,6 @@ int dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type,
 		 ATTR_FLAGS flags)
 {
 	size_t namelen;
-	static int      max_attr = 0;
 	DICT_ATTR const	*da;
 	DICT_ATTR *n;
 
@@ -672,14 +822,14 @@ int dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type,
 			return 0; /* exists, don't add it again */
 		}
 
-		attr = ++max_attr;
+		attr = ++dict_max_attr;
 
 	} else if (vendor == 0) {
 		/*
 		 *  Update 'max_attr'
 		 */
-		if (attr > max_attr) {
-			max_attr = attr;
+		if (attr > dict_max_attr) {
+			dict_max_attr = attr;
 		}
 	}
 
@@ -878,6 +1028,17 @@ int dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type,
 	n->type = type;
 	n->flags = flags;
 
+	/*
+	 *	The compiled dictionary can't be changed, but a
+	 *	duplicate in it is still an error.
+	 */
+	da = dict_snapshot_find(DICT_ATTRIBUTES_BYNAME, n);
+	if (da && (da->attr != n->attr)) {
+		fr_strerror_printf("dict_addattr: Duplicate attribute name %s", name);
+		fr_pool_free(n);
+		return -1;
+	}
+
 	/*
 	 *	Insert the attribute, only if it's not a duplicate.
 	 */
@@ -960,6 +1121,17 @@ int dict_addattr(char const *name, int attr, unsigned int vendor, PW_TYPE type,
 		 dict_base_attrs[attr] = n;
 	}
 
+	/*
+	 *	Keep the direct index in sync.  Vendors which aren't
+	 *	in it use the hash tables.
+	 */
+	if (n->vendor && (n->attr < 256)) {
+		dict_vendor_index_t *idx;
+
+		idx = dict_vendor_index_find(n->vendor, false);
+		if (idx && (n->attr < idx->num_attrs)) idx->attrs[n->attr] = n;
+	}
+
 	return 0;
 }
 
@@ -1079,6 +1251,24 @@ int dict_addvalue(char const *namestr, char const *attrstr, int value)
 		return 0;
 	}
 
+	/*
+	 *	Suppress duplicates of values in the compiled
+	 *	dictionary, as below.
+	 */
+	{
+		DICT_VALUE *old;
+
+		old = dict_snapshot_find(DICT_VALUES_BYNAME, dval);
+		if (old && !fr_hash_table_finddata(values_byname, dval)) {
+			fr_pool_free(dval);
+
+			if (old->value == value) return 0;
+
+			fr_strerror_printf("dict_addvalue: Duplicate value name %s for attribute %s", namestr, attrstr);
+			return -1;
+		}
+	}
+
 	/*
 	 *	Add the value into the dictionary.
 	 */
@@ -2107,7 +2297,7 @@ static int my_dict_init(char const *parent, char const *filename,
 	}
 #endif
 
-	dict_stat_add(&statbuf);
+	dict_stat_add(fn, &statbuf);
 
 	/*
 	 *	Seed the random pool with data.
@@ -2399,21 +2589,475 @@ static int null_callback(UNUSED void *ctx, UNUSED void *data)
  *	Initialize the directory, then fix the attr member of
  *	all attributes.
  */
-int dict_init(char const *dir, char const *fn)
+/*
+ *	Compiled dictionaries.
+ *
+ *	The image is the header, followed by the list of files which
+ *	were read to create it, the DICT_VENDOR, DICT_ATTR, and
+ *	DICT_VALUE records in their in-memory layout, and then one
+ *	index per table.  Each index is a power of two array of
+ *	record offsets, using linear probing and the same hash and
+ *	comparison functions as the tables above.  An offset of zero
+ *	is an empty slot.
+ *
+ *	The records are used directly from the mapped file, so the
+ *	image is only valid for the same build of the library.
+ */
+#define DICT_SNAPSHOT_MAGIC	(0x46524443)	/* "FRDC" */
+#define DICT_SNAPSHOT_VERSION	(1)
+#define DICT_SNAPSHOT_ALIGN(_x)	(((_x) + 7) & ~((size_t) 7))
+
+typedef struct dict_snapshot_hdr_t {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	lib_magic;		//!< RADIUSD_MAGIC_NUMBER of the writer.
+
+	uint32_t	attr_size;		//!< sizeof(DICT_ATTR) of the writer.
+	uint32_t	value_size;		//!< sizeof(DICT_VALUE) of the writer.
+	uint32_t	vendor_size;		//!< sizeof(DICT_VENDOR) of the writer.
+	uint32_t	stat_size;		//!< sizeof(struct stat) of the writer.
+
+	uint64_t	length;			//!< Of the whole image.
+	int32_t		max_attr;		//!< Highest auto-numbered attribute.
+
+	uint32_t	num_files;
+	uint32_t	files;			//!< Offset of the file list.
+
+	struct {
+		uint32_t	num_buckets;
+		uint32_t	buckets;	//!< Offset of the index.
+	} table[DICT_TABLE_MAX];
+} dict_snapshot_hdr_t;
+
+typedef struct dict_snapshot_file_t {
+	struct stat	stat_buf;
+	char		name[256];
+} dict_snapshot_file_t;
+
+/*
+ *	The offset of the name, and the minimum size of a record in
+ *	a table.
+ */
+static size_t dict_snapshot_name_offset(dict_table_t which)
+{
+	switch (which) {
+	case DICT_VENDORS_BYNAME:
+	case DICT_VENDORS_BYVALUE:
+		return offsetof(DICT_VENDOR, name);
+
+	case DICT_VALUES_BYNAME:
+	case DICT_VALUES_BYVALUE:
+		return offsetof(DICT_VALUE, name);
+
+	default:
+		return offsetof(DICT_ATTR, name);
+	}
+}
+
+static size_t dict_snapshot_min_size(dict_table_t which)
+{
+	switch (which) {
+	case DICT_VENDORS_BYNAME:
+	case DICT_VENDORS_BYVALUE:
+		return sizeof(DICT_VENDOR);
+
+	case DICT_VALUES_BYNAME:
+	case DICT_VALUES_BYVALUE:
+		return sizeof(DICT_VALUE);
+
+	default:
+		return sizeof(DICT_ATTR);
+	}
+}
+
+static void *dict_snapshot_find(dict_table_t which, void const *data)
+{
+	dict_snapshot_hdr_t const *hdr;
+	uint32_t const *buckets;
+	uint32_t i, hash, mask;
+
+	if (!dict_snapshot) return NULL;
+
+	hdr = (dict_snapshot_hdr_t const *) dict_snapshot;
+	buckets = (uint32_t const *) (dict_snapshot + hdr->table[which].buckets);
+	mask = hdr->table[which].num_buckets - 1;
+
+	hash = dict_table_hash[which](data);
+	for (i = 0; i <= mask; i++) {
+		uint32_t offset;
+
+		offset = buckets[(hash + i) & mask];
+		if (!offset) return NULL;
+
+		if (dict_table_cmp[which](data, dict_snapshot + offset) == 0) {
+			return dict_snapshot + offset;
+		}
+	}
+
+	return NULL;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/*
+ *	Check that the header, the file list, and every index entry
+ *	of a mapped image are within bounds.
+ */
+static bool dict_snapshot_verify(uint8_t const *image, size_t len)
 {
+	dict_snapshot_hdr_t const *hdr = (dict_snapshot_hdr_t const *) image;
+	uint32_t i;
+	int which;
+
+	if (len < sizeof(*hdr)) return false;
+
+	if ((hdr->magic != DICT_SNAPSHOT_MAGIC) ||
+	    (hdr->version != DICT_SNAPSHOT_VERSION) ||
+	    (hdr->lib_magic != RADIUSD_MAGIC_NUMBER) ||
+	    (hdr->attr_size != sizeof(DICT_ATTR)) ||
+	    (hdr->value_size != sizeof(DICT_VALUE)) ||
+	    (hdr->vendor_size != sizeof(DICT_VENDOR)) ||
+	    (hdr->stat_size != sizeof(struct stat)) ||
+	    (hdr->length != len)) return false;
+
+	if ((hdr->files < sizeof(*hdr)) || (hdr->files > len) ||
+	    (hdr->num_files > ((len - hdr->files) / sizeof(dict_snapshot_file_t)))) return false;
+
+	for (which = 0; which < DICT_TABLE_MAX; which++) {
+		uint32_t num_buckets = hdr->table[which].num_buckets;
+		uint32_t const *buckets;
+		size_t name_offset = dict_snapshot_name_offset(which);
+		size_t min_size = dict_snapshot_min_size(which);
+
+		if (!num_buckets || ((num_buckets & (num_buckets - 1)) != 0)) return false;
+		if ((hdr->table[which].buckets < sizeof(*hdr)) ||
+		    ((hdr->table[which].buckets & 3) != 0) ||
+		    (hdr->table[which].buckets > len) ||
+		    (num_buckets > ((len - hdr->table[which].buckets) / sizeof(uint32_t)))) return false;
+
+		buckets = (uint32_t const *) (image + hdr->table[which].buckets);
+		for (i = 0; i < num_buckets; i++) {
+			uint32_t offset = buckets[i];
+
+			if (!offset) continue;
+
+			if ((offset < sizeof(*hdr)) || ((offset & 7) != 0) ||
+			    (offset > len) || (min_size > (len - offset))) return false;
+
+			if (!memchr(image + offset + name_offset, '\0', len - offset - name_offset)) return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ *	Map a compiled dictionary, if there is one, and it is newer
+ *	than all of the files it was created from.
+ *
+ *	Returns 0 if the dictionary was loaded, -1 if the text files
+ *	should be read instead.
+ */
+static int dict_snapshot_load(char const *dir, char const *fn)
+{
+	int fd;
+	uint32_t i;
+	struct stat stat_buf;
+	char buffer[2048];
+	uint8_t *image;
+	dict_snapshot_hdr_t const *hdr;
+	dict_snapshot_file_t const *files;
+
+	snprintf(buffer, sizeof(buffer), "%s/%s.snapshot", dir, fn);
+
+	fd = open(buffer, O_RDONLY);
+	if (fd < 0) return -1;
+
 	/*
-	 *	Check if we need to change anything.  If not, don't do
-	 *	anything.
+	 *	The records are trusted once the image is loaded, so
+	 *	ignore anything which other users could have written.
 	 */
-	if (dict_stat_check(dir, fn)) {
-		return 0;
+	if ((fstat(fd, &stat_buf) < 0) || !S_ISREG(stat_buf.st_mode) ||
+	    ((stat_buf.st_mode & S_IWOTH) != 0) ||
+	    (stat_buf.st_size < (off_t) sizeof(dict_snapshot_hdr_t))) {
+		close(fd);
+		return -1;
 	}
 
 	/*
-	 *	Free the dictionaries, and the stat cache.
+	 *	Private, so that updating a record in place
+	 *	(e.g. VENDOR format) doesn't change the file.
 	 */
-	dict_free();
+	image = mmap(NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) return -1;
+
+	if (!dict_snapshot_verify(image, stat_buf.st_size)) {
+		munmap(image, stat_buf.st_size);
+		return -1;
+	}
+
+	hdr = (dict_snapshot_hdr_t const *) image;
+	files = (dict_snapshot_file_t const *) (image + hdr->files);
 
+	/*
+	 *	Cache the stat information for every file the image
+	 *	was created from, and then check that none of them
+	 *	have changed since.
+	 */
+	for (i = 0; i < hdr->num_files; i++) {
+		if (!memchr(files[i].name, '\0', sizeof(files[i].name))) goto stale;
+
+		dict_stat_add(files[i].name, &files[i].stat_buf);
+	}
+
+	for (i = 0; i < hdr->num_files; i++) {
+		char *p;
+
+		strlcpy(buffer, files[i].name, sizeof(buffer));
+		p = strrchr(buffer, FR_DIR_SEP);
+		if (!p) goto stale;
+		*p = '\0';
+
+		if (!dict_stat_check(buffer, p + 1)) goto stale;
+	}
+
+	dict_snapshot = image;
+	dict_snapshot_len = stat_buf.st_size;
+
+	if (hdr->max_attr > dict_max_attr) dict_max_attr = hdr->max_attr;
+
+	for (i = 1; i < 256; i++) {
+		DICT_ATTR find;
+
+		find.attr = i;
+		find.vendor = 0;
+		dict_base_attrs[i] = dict_snapshot_find(DICT_ATTRIBUTES_BYVALUE, &find);
+	}
+
+	return 0;
+
+stale:
+	munmap(image, stat_buf.st_size);
+	dict_stat_free();
+	return -1;
+}
+#else
+static int dict_snapshot_load(UNUSED char const *dir, UNUSED char const *fn)
+{
+	return -1;
+}
+#endif
+
+/*
+ *	State for writing a compiled dictionary.
+ */
+typedef struct dict_snapshot_out_t {
+	TALLOC_CTX	*ctx;
+
+	uint8_t		*buffer;
+	size_t		len;
+	size_t		alloced;
+
+	fr_hash_table_t	*offsets;		//!< Of records already written.
+
+	dict_table_t	which;
+	uint32_t	*buckets;
+	uint32_t	num_buckets;
+} dict_snapshot_out_t;
+
+typedef struct dict_snapshot_offset_t {
+	void const	*data;
+	uint32_t	offset;
+} dict_snapshot_offset_t;
+
+static uint32_t dict_snapshot_offset_hash(void const *data)
+{
+	dict_snapshot_offset_t const *a = data;
+
+	return fr_hash(&a->data, sizeof(a->data));
+}
+
+static int dict_snapshot_offset_cmp(void const *one, void const *two)
+{
+	dict_snapshot_offset_t const *a = one;
+	dict_snapshot_offset_t const *b = two;
+
+	if (a->data < b->data) return -1;
+	if (a->data > b->data) return +1;
+
+	return 0;
+}
+
+/*
+ *	Append data to the image, returning its offset.
+ */
+static ssize_t dict_snapshot_append(dict_snapshot_out_t *out, void const *data, size_t len)
+{
+	size_t offset = DICT_SNAPSHOT_ALIGN(out->len);
+
+	if ((offset + len) > UINT32_MAX) {
+		fr_strerror_printf("dict_compile: Dictionary is too large");
+		return -1;
+	}
+
+	if ((offset + len) > out->alloced) {
+		size_t alloced = out->alloced ? out->alloced : 65536;
+		uint8_t *buffer;
+
+		while ((offset + len) > alloced) alloced *= 2;
+
+		buffer = talloc_realloc(out->ctx, out->buffer, uint8_t, alloced);
+		if (!buffer) {
+			fr_strerror_printf("dict_compile: Out of memory");
+			return -1;
+		}
+		out->buffer = buffer;
+		out->alloced = alloced;
+	}
+
+	memset(out->buffer + out->len, 0, offset - out->len);
+	if (data) {
+		memcpy(out->buffer + offset, data, len);
+	} else {
+		memset(out->buffer + offset, 0, len);
+	}
+	out->len = offset + len;
+
+	return offset;
+}
+
+/*
+ *	Write one entry of a table to the image, and add it to the
+ *	index for that table.
+ */
+static int dict_snapshot_add(void *ctx, void *data)
+{
+	dict_snapshot_out_t *out = ctx;
+	dict_snapshot_offset_t find, *found;
+	uint32_t hash, mask;
+
+	find.data = data;
+	found = fr_hash_table_finddata(out->offsets, &find);
+	if (!found) {
+		size_t name_offset = dict_snapshot_name_offset(out->which);
+		size_t len;
+		ssize_t offset;
+
+		len = name_offset + strlen((char const *) data + name_offset) + 1;
+		if (len < dict_snapshot_min_size(out->which)) len = dict_snapshot_min_size(out->which);
+
+		offset = dict_snapshot_append(out, data, len);
+		if (offset < 0) return -1;
+
+		found = talloc_zero(out->ctx, dict_snapshot_offset_t);
+		if (!found) {
+			fr_strerror_printf("dict_compile: Out of memory");
+			return -1;
+		}
+		found->data = data;
+		found->offset = offset;
+
+		if (!fr_hash_table_insert(out->offsets, found)) {
+			fr_strerror_printf("dict_compile: Failed tracking record");
+			return -1;
+		}
+	}
+
+	mask = out->num_buckets - 1;
+	hash = dict_table_hash[out->which](data);
+	while (out->buckets[hash & mask] != 0) hash++;
+	out->buckets[hash & mask] = found->offset;
+
+	return 0;
+}
+
+static int dict_vendor_index_size(UNUSED void *ctx, void *data)
+{
+	DICT_ATTR const *da = data;
+	dict_vendor_index_t *idx;
+
+	if (!da->vendor || (da->attr > 255)) return 0;
+
+	idx = dict_vendor_index_find(da->vendor, true);
+	if (idx && (da->attr >= idx->num_attrs)) idx->num_attrs = da->attr + 1;
+
+	return 0;
+}
+
+static int dict_vendor_index_fill(UNUSED void *ctx, void *data)
+{
+	DICT_ATTR const *da = data;
+	dict_vendor_index_t *idx;
+
+	if (!da->vendor || (da->attr > 255)) return 0;
+
+	idx = dict_vendor_index_find(da->vendor, false);
+	if (idx && (da->attr < idx->num_attrs)) idx->attrs[da->attr] = da;
+
+	return 0;
+}
+
+/*
+ *	Call a function for every attribute by value, in the compiled
+ *	dictionary and then in the table, so that later definitions
+ *	win.
+ */
+static int dict_attr_walk(fr_hash_table_walk_t callback)
+{
+	if (dict_snapshot) {
+		dict_snapshot_hdr_t const *hdr = (dict_snapshot_hdr_t const *) dict_snapshot;
+		uint32_t const *buckets;
+		uint32_t i;
+
+		buckets = (uint32_t const *) (dict_snapshot + hdr->table[DICT_ATTRIBUTES_BYVALUE].buckets);
+		for (i = 0; i < hdr->table[DICT_ATTRIBUTES_BYVALUE].num_buckets; i++) {
+			int rcode;
+
+			if (!buckets[i]) continue;
+
+			rcode = callback(NULL, dict_snapshot + buckets[i]);
+			if (rcode != 0) return rcode;
+		}
+	}
+
+	return fr_hash_table_walk(attributes_byvalue, callback, NULL);
+}
+
+/*
+ *	Build the direct index of vendor attributes.
+ */
+static int dict_vendor_index_build(void)
+{
+	int i;
+
+	dict_vendor_index = calloc(DICT_VENDOR_INDEX_SIZE, sizeof(*dict_vendor_index));
+	if (!dict_vendor_index) {
+	oom:
+		fr_strerror_printf("dict_init: out of memory");
+		return -1;
+	}
+	dict_vendor_index_used = 0;
+
+	dict_attr_walk(dict_vendor_index_size);
+
+	for (i = 0; i < DICT_VENDOR_INDEX_SIZE; i++) {
+		if (!dict_vendor_index[i].num_attrs) continue;
+
+		dict_vendor_index[i].attrs = calloc(dict_vendor_index[i].num_attrs, sizeof(DICT_ATTR const *));
+		if (!dict_vendor_index[i].attrs) goto oom;
+	}
+
+	dict_attr_walk(dict_vendor_index_fill);
+
+	return 0;
+}
+
+/*
+ *	Read the text dictionaries into empty tables, optionally
+ *	using a compiled dictionary instead.
+ */
+static int dict_load(char const *dir, char const *fn, bool use_snapshot)
+{
 	/*
 	 *	Create the table of vendor by name.   There MAY NOT
 	 *	be multiple vendors of the same name.
@@ -2490,6 +3134,8 @@ int dict_init(char const *dir, char const *fn)
 
 	value_fixup = NULL;	/* just to be safe. */
 
+	if (use_snapshot && (dict_snapshot_load(dir, fn) == 0)) return dict_vendor_index_build();
+
 	if (my_dict_init(dir, fn, NULL, 0) < 0)
 		return -1;
 
@@ -2552,7 +3198,199 @@ int dict_init(char const *dir, char const *fn)
 	fr_hash_table_walk(values_byvalue, null_callback, NULL);
 	fr_hash_table_walk(values_byname, null_callback, NULL);
 
+	return dict_vendor_index_build();
+}
+
+/** Initialise the dictionaries
+ *
+ * If @verbatim <dir>/<fn>.snapshot @endverbatim exists, and none of the files it was
+ * compiled from have changed, it is mapped instead of reading the text dictionaries.
+ *
+ * @param dir containing the dictionaries.
+ * @param fn of the top level dictionary.
+ * @return 0 on success, -1 on error.
+ */
+int dict_init(char const *dir, char const *fn)
+{
+	/*
+	 *	Check if we need to change anything.  If not, don't do
+	 *	anything.
+	 */
+	if (dict_stat_check(dir, fn)) {
+		return 0;
+	}
+
+	/*
+	 *	Free the dictionaries, and the stat cache.
+	 */
+	dict_free();
+
+	return dict_load(dir, fn, true);
+}
+
+/** Compile the text dictionaries into an image which dict_init can map
+ *
+ * The image is only valid for the same build of libfreeradius-radius, and
+ * is ignored by dict_init if any of the text files are modified.
+ *
+ * @note Replaces the currently loaded dictionaries with the text dictionaries.
+ *
+ * @param dir containing the dictionaries.
+ * @param fn of the top level dictionary.
+ * @param out file to write, usually @verbatim <dir>/<fn>.snapshot @endverbatim.
+ * @return 0 on success, -1 on error.
+ */
+int dict_compile(char const *dir, char const *fn, char const *out)
+{
+	int			fd = -1;
+	int			which;
+	ssize_t			offset;
+	char			buffer[2048];
+	uint8_t const		*p, *end;
+	dict_snapshot_hdr_t	hdr;
+	dict_snapshot_file_t	file;
+	dict_snapshot_out_t	state;
+	dict_stat_t		*this;
+	fr_hash_table_t		*tables[DICT_TABLE_MAX];
+
+	dict_free();
+	if (dict_load(dir, fn, false) < 0) return -1;
+
+	tables[DICT_VENDORS_BYNAME] = vendors_byname;
+	tables[DICT_VENDORS_BYVALUE] = vendors_byvalue;
+	tables[DICT_ATTRIBUTES_BYNAME] = attributes_byname;
+	tables[DICT_ATTRIBUTES_BYVALUE] = attributes_byvalue;
+	tables[DICT_ATTRIBUTES_COMBO] = attributes_combo;
+	tables[DICT_VALUES_BYNAME] = values_byname;
+	tables[DICT_VALUES_BYVALUE] = values_byvalue;
+
+	memset(&state, 0, sizeof(state));
+	state.ctx = talloc_init("dict_compile");
+	if (!state.ctx) {
+		fr_strerror_printf("dict_compile: Out of memory");
+		return -1;
+	}
+
+	state.offsets = fr_hash_table_create(dict_snapshot_offset_hash, dict_snapshot_offset_cmp, NULL);
+	if (!state.offsets) {
+		fr_strerror_printf("dict_compile: Out of memory");
+		talloc_free(state.ctx);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (dict_snapshot_append(&state, &hdr, sizeof(hdr)) < 0) goto error;
+
+	/*
+	 *	The files the image was created from.
+	 */
+	for (this = stat_head; this != NULL; this = this->next) {
+		memset(&file, 0, sizeof(file));
+		memcpy(&file.stat_buf, &this->stat_buf, sizeof(file.stat_buf));
+		if (strlcpy(file.name, this->name, sizeof(file.name)) >= sizeof(file.name)) {
+			fr_strerror_printf("dict_compile: Path %s is too long", this->name);
+			goto error;
+		}
+
+		offset = dict_snapshot_append(&state, &file, sizeof(file));
+		if (offset < 0) goto error;
+
+		if (!hdr.num_files) hdr.files = offset;
+		hdr.num_files++;
+	}
+	if (!hdr.num_files) hdr.files = sizeof(hdr);
+
+	/*
+	 *	The records, and an index for each table.  Records
+	 *	in more than one table are only written once.
+	 */
+	for (which = 0; which < DICT_TABLE_MAX; which++) {
+		uint32_t num_buckets = 16;
+
+		while (num_buckets < (2 * (uint32_t) fr_hash_table_num_elements(tables[which]))) num_buckets <<= 1;
+
+		state.which = which;
+		state.num_buckets = num_buckets;
+		state.buckets = talloc_zero_array(state.ctx, uint32_t, num_buckets);
+		if (!state.buckets) {
+			fr_strerror_printf("dict_compile: Out of memory");
+			goto error;
+		}
+
+		if (fr_hash_table_walk(tables[which], dict_snapshot_add, &state) != 0) goto error;
+
+		offset = dict_snapshot_append(&state, state.buckets, num_buckets * sizeof(uint32_t));
+		if (offset < 0) goto error;
+
+		hdr.table[which].num_buckets = num_buckets;
+		hdr.table[which].buckets = offset;
+
+		talloc_free(state.buckets);
+		state.buckets = NULL;
+	}
+
+	hdr.magic = DICT_SNAPSHOT_MAGIC;
+	hdr.version = DICT_SNAPSHOT_VERSION;
+	hdr.lib_magic = RADIUSD_MAGIC_NUMBER;
+	hdr.attr_size = sizeof(DICT_ATTR);
+	hdr.value_size = sizeof(DICT_VALUE);
+	hdr.vendor_size = sizeof(DICT_VENDOR);
+	hdr.stat_size = sizeof(struct stat);
+	hdr.length = state.len;
+	hdr.max_attr = dict_max_attr;
+	memcpy(state.buffer, &hdr, sizeof(hdr));
+
+	/*
+	 *	Write it to a temporary file, and rename it, so that
+	 *	nothing ever sees a partial image.
+	 */
+	snprintf(buffer, sizeof(buffer), "%s.tmp", out);
+	fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fr_strerror_printf("dict_compile: Failed opening %s: %s", buffer, fr_syserror(errno));
+		goto error;
+	}
+
+	p = state.buffer;
+	end = p + state.len;
+	while (p < end) {
+		ssize_t rcode;
+
+		rcode = write(fd, p, end - p);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("dict_compile: Failed writing %s: %s", buffer, fr_syserror(errno));
+			goto error;
+		}
+		p += rcode;
+	}
+
+	if (close(fd) < 0) {
+		fd = -1;
+		fr_strerror_printf("dict_compile: Failed writing %s: %s", buffer, fr_syserror(errno));
+		goto error;
+	}
+	fd = -1;
+
+	if (rename(buffer, out) < 0) {
+		fr_strerror_printf("dict_compile: Failed renaming %s to %s: %s", buffer, out, fr_syserror(errno));
+		goto error;
+	}
+
+	fr_hash_table_free(state.offsets);
+	talloc_free(state.ctx);
+
 	return 0;
+
+error:
+	if (fd >= 0) {
+		close(fd);
+		unlink(buffer);
+	}
+	fr_hash_table_free(state.offsets);
+	talloc_free(state.ctx);
+	return -1;
 }
 
 static size_t print_attr_oid(char *buffer, size_t size, unsigned int attr,
@@ -3025,10 +3863,17 @@ DICT_ATTR const *dict_attrbyvalue(unsigned int attr, unsigned int vendor)
 
 	if ((attr > 0) && (attr < 256) && !vendor) return dict_base_attrs[attr];
 
+	if (vendor && (attr < 256)) {
+		dict_vendor_index_t const *idx;
+
+		idx = dict_vendor_index_find(vendor, false);
+		if (idx && (attr < idx->num_attrs)) return idx->attrs[attr];
+	}
+
 	da.attr = attr;
 	da.vendor = vendor;
 
-	return fr_hash_table_finddata(attributes_byvalue, &da);
+	return dict_find(attributes_byvalue, DICT_ATTRIBUTES_BYVALUE, &da);
 }
 
 
@@ -3047,7 +3892,7 @@ DICT_ATTR const *dict_attrbytype(unsigned int attr, unsigned int vendor,
 	da.vendor = vendor;
 	da.type = type;
 
-	return fr_hash_table_finddata(attributes_combo, &da);
+	return dict_find(attributes_combo, DICT_ATTRIBUTES_COMBO, &da);
 }
 
 /** Using a parent and attr/vendor, find a child attr/vendor
@@ -3149,7 +3994,7 @@ DICT_ATTR const *dict_attrbyparent(DICT_ATTR const *parent, unsigned int attr, u
 	da.attr = my_attr;
 	da.vendor = my_vendor;
 
-	return fr_hash_table_finddata(attributes_byvalue, &da);
+	return dict_find(attributes_byvalue, DICT_ATTRIBUTES_BYVALUE, &da);
 }
 
 
@@ -3166,7 +4011,7 @@ DICT_ATTR const *dict_attrbyname(char const *name)
 	da = (DICT_ATTR *) buffer;
 	strlcpy(da->name, name, DICT_ATTR_MAX_NAME_LEN + 1);
 
-	return fr_hash_table_finddata(attributes_byname, da);
+	return dict_find(attributes_byname, DICT_ATTRIBUTES_BYNAME, da);
 }
 
 /** Look up a dictionary attribute by name embedded in another string
@@ -3213,7 +4058,7 @@ DICT_ATTR const *dict_attrbyname_substr(char const **name)
 	}
 	strlcpy(find->name, *name, len + 1);
 
-	da = fr_hash_table_finddata(attributes_byname, find);
+	da = dict_find(attributes_byname, DICT_ATTRIBUTES_BYNAME, find);
 	if (!da) {
 		fr_strerror_printf("Unknown attribute \"%s\"", find->name);
 		return NULL;
@@ -3241,12 +4086,12 @@ DICT_VALUE *dict_valbyattr(unsigned int attr, unsigned int vendor, int value)
 	 *	Look up the attribute alias target, and use
 	 *	the correct attribute number if found.
 	 */
-	dv = fr_hash_table_finddata(values_byname, &dval);
+	dv = dict_find(values_byname, DICT_VALUES_BYNAME, &dval);
 	if (dv)	dval.attr = dv->value;
 
 	dval.value = value;
 
-	return fr_hash_table_finddata(values_byvalue, &dval);
+	return dict_find(values_byvalue, DICT_VALUES_BYVALUE, &dval);
 }
 
 /*
@@ -3281,12 +4126,12 @@ DICT_VALUE *dict_valbyname(unsigned int attr, unsigned int vendor, char const *n
 	 *	Look up the attribute alias target, and use
 	 *	the correct attribute number if found.
 	 */
-	dv = fr_hash_table_finddata(values_byname, my_dv);
+	dv = dict_find(values_byname, DICT_VALUES_BYNAME, my_dv);
 	if (dv) my_dv->attr = dv->value;
 
 	strlcpy(my_dv->name, name, DICT_VALUE_MAX_NAME_LEN + 1);
 
-	return fr_hash_table_finddata(values_byname, my_dv);
+	return dict_find(values_byname, DICT_VALUES_BYNAME, my_dv);
 }
 
 /*
@@ -3304,7 +4149,7 @@ int dict_vendorbyname(char const *name)
 	dv = (DICT_VENDOR *) buffer;
 	strlcpy(dv->name, name, DICT_VENDOR_MAX_NAME_LEN + 1);
 
-	dv = fr_hash_table_finddata(vendors_byname, dv);
+	dv = dict_find(vendors_byname, DICT_VENDORS_BYNAME, dv);
 	if (!dv) return 0;
 
 	return dv->vendorpec;
@@ -3319,7 +4164,7 @@ DICT_VENDOR *dict_vendorbyvalue(int vendorpec)
 
 	dv.vendorpec = vendorpec;
 
-	return fr_hash_table_finddata(vendors_byvalue, &dv);
+	return dict_find(vendors_byvalue, DICT_VENDORS_BYVALUE, &dv);
 }
 
 /** Converts an unknown to a known by adding it to the internal dictionaries.
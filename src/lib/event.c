@@ -37,20 +37,60 @@ RCSID("$Id$")
 #endif
 #endif	/* HAVE_KQUEUE */
 
+/*
+ *	On Linux, use epoll.  The wait cost is then proportional to
+ *	the number of ready FDs, not to the number of FDs we watch.
+ */
+#if !defined(HAVE_KQUEUE) && defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+#define HAVE_EPOLL (1)
+#include <sys/epoll.h>
+#include <fcntl.h>
+#endif
+
 typedef struct fr_event_fd_t {
 	int			fd;
 	fr_event_fd_handler_t	handler;
 	void			*ctx;
 } fr_event_fd_t;
 
+/*
+ *	For kqueue, this is the fixed size of the reader table.  For
+ *	everything else, it's the initial size of the table, which
+ *	grows as needed.
+ */
 #define FR_EV_MAX_FDS (256)
 
 #undef USEC
 #define USEC (1000000)
 
+/*
+ *	The timer wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots.
+ *	Each slot in level 0 holds the events for one tick of
+ *	WHEEL_TICK microseconds.  Each slot in level N holds the
+ *	events for WHEEL_SLOTS slots of level N - 1, and is moved
+ *	down a level when the wheel gets to it.
+ *
+ *	The last "level" is the list of events which have expired,
+ *	but which haven't been run yet.
+ */
+#define WHEEL_BITS	(8)
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	(4)
+#define WHEEL_EXPIRED	WHEEL_LEVELS
+#define WHEEL_TICK	(1000)
+
 struct fr_event_list_t {
+	fr_event_timer_t type;
+
 	fr_heap_t	*times;
 
+	uint64_t	wheel_tick;	/* the next tick to process */
+	int		wheel_count[WHEEL_LEVELS + 1];
+	int		num_wheel;
+	fr_event_t	*wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+	fr_event_t	*expired;
+
 	int		exit;
 
 	fr_event_status_t status;
@@ -64,13 +104,34 @@ struct fr_event_list_t {
 
 	bool		changed;
 
+	fr_event_fd_t	*readers;	/* indexed by FD, grows as needed */
+
+#ifdef HAVE_EPOLL
+	int		epfd;		/* -1 means we fall back to select() */
+	int		num_events;
+	struct epoll_event *events;	/* so it doesn't go on the stack every time */
+#endif
+
 #else
 	int		kq;
 	struct kevent	events[FR_EV_MAX_FDS]; /* so it doesn't go on the stack every time */
-#endif
 	fr_event_fd_t	readers[FR_EV_MAX_FDS];
+#endif
 };
 
+#ifdef HAVE_EPOLL
+#define USE_SELECT(_el) ((_el)->epfd < 0)
+#else
+#define USE_SELECT(_el) (true)
+#endif
+
+#if defined(HAVE_EPOLL) && defined(TESTING)
+/*
+ *	So that the benchmark can compare epoll with select.
+ */
+static bool event_force_select = false;
+#endif
+
 /*
  *	Internal structure for managing events.
  */
@@ -80,6 +141,11 @@ struct fr_event_t {
 	struct timeval		when;
 	fr_event_t		**parent;
 	int			heap;
+
+	uint64_t		tick;	/* for the timer wheel */
+	int			level;
+	fr_event_t		*next;
+	fr_event_t		**pprev;
 };
 
 
@@ -98,11 +164,234 @@ static int fr_event_list_time_cmp(void const *one, void const *two)
 }
 
 
+/*
+ *	Convert a time to ticks of the timer wheel.  Events are put
+ *	into the tick which ends at or after the event time, so that
+ *	they are never run early.
+ */
+static uint64_t wheel_tick_ceil(struct timeval const *when)
+{
+	return (((uint64_t) when->tv_sec) * (USEC / WHEEL_TICK)) + ((when->tv_usec + WHEEL_TICK - 1) / WHEEL_TICK);
+}
+
+static uint64_t wheel_tick_floor(struct timeval const *when)
+{
+	return (((uint64_t) when->tv_sec) * (USEC / WHEEL_TICK)) + (when->tv_usec / WHEEL_TICK);
+}
+
+static void wheel_link(fr_event_list_t *el, fr_event_t **head, fr_event_t *ev, int level)
+{
+	ev->level = level;
+	ev->next = *head;
+	if (ev->next) ev->next->pprev = &ev->next;
+	ev->pprev = head;
+	*head = ev;
+
+	el->wheel_count[level]++;
+}
+
+static void wheel_unlink(fr_event_list_t *el, fr_event_t *ev)
+{
+	*ev->pprev = ev->next;
+	if (ev->next) ev->next->pprev = ev->pprev;
+	ev->next = NULL;
+	ev->pprev = NULL;
+
+	el->wheel_count[ev->level]--;
+}
+
+/*
+ *	Put the event into the slot for its tick, or into the
+ *	lowest level which covers that tick.
+ */
+static void wheel_insert(fr_event_list_t *el, fr_event_t *ev)
+{
+	int level;
+	uint64_t tick, delta;
+
+	tick = ev->tick;
+	if (tick < el->wheel_tick) {
+		wheel_link(el, &el->expired, ev, WHEEL_EXPIRED);
+		return;
+	}
+
+	delta = tick - el->wheel_tick;
+	for (level = 0; level < (WHEEL_LEVELS - 1); level++) {
+		if (delta < ((uint64_t) 1 << (WHEEL_BITS * (level + 1)))) break;
+	}
+
+	/*
+	 *	Events which are further away than the wheel can
+	 *	represent go into the top level, and are moved around
+	 *	again when the wheel gets to them.
+	 */
+	if (delta >= ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))) {
+		tick = el->wheel_tick + ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	}
+
+	wheel_link(el, &el->wheel[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK], ev, level);
+}
+
+/*
+ *	Move the events in the current slot of a level down to the
+ *	levels below it.
+ */
+static void wheel_cascade(fr_event_list_t *el, int level)
+{
+	fr_event_t *ev, *next;
+	fr_event_t **head;
+
+	head = &el->wheel[level][(el->wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+	for (ev = *head; ev != NULL; ev = next) {
+		next = ev->next;
+
+		wheel_unlink(el, ev);
+		wheel_insert(el, ev);
+	}
+}
+
+/*
+ *	Turn the wheel until some events expire, or until we pass
+ *	"tick".
+ */
+static void wheel_advance(fr_event_list_t *el, uint64_t tick)
+{
+	int level;
+	fr_event_t *ev, *next;
+
+	while (!el->expired && (el->wheel_tick <= tick)) {
+		uint64_t mask;
+
+		if (el->num_wheel == 0) {
+			el->wheel_tick = tick + 1;
+			break;
+		}
+
+		/*
+		 *	If the lower levels are empty, nothing happens
+		 *	until the next slot of the first level which
+		 *	has events, so skip straight to it.
+		 */
+		for (level = 0; level < (WHEEL_LEVELS - 1); level++) {
+			if (el->wheel_count[level] > 0) break;
+		}
+
+		if (level > 0) {
+			mask = ((uint64_t) 1 << (WHEEL_BITS * level)) - 1;
+
+			if (((el->wheel_tick + mask) & ~mask) > tick) {
+				el->wheel_tick = tick + 1;
+				break;
+			}
+			el->wheel_tick = (el->wheel_tick + mask) & ~mask;
+		}
+
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if (((el->wheel_tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) != 0) break;
+
+			wheel_cascade(el, level);
+		}
+
+		for (ev = el->wheel[0][el->wheel_tick & WHEEL_MASK]; ev != NULL; ev = next) {
+			next = ev->next;
+
+			wheel_unlink(el, ev);
+			wheel_link(el, &el->expired, ev, WHEEL_EXPIRED);
+		}
+
+		el->wheel_tick++;
+	}
+}
+
+/*
+ *	Find when the wheel next has something to do.  This may be
+ *	earlier than the next event, if that event is in one of the
+ *	upper levels.  We then just wake up, and move it down.
+ */
+static void wheel_next(fr_event_list_t *el, struct timeval *when)
+{
+	int i, level;
+	uint64_t tick, next = 0;
+	bool found = false;
+
+	if (el->expired) {
+		*when = el->expired->when;
+		return;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		uint64_t slot;
+
+		if (el->wheel_count[level] == 0) continue;
+
+		slot = el->wheel_tick >> (WHEEL_BITS * level);
+
+		/*
+		 *	The current slot of the upper levels was
+		 *	emptied when the wheel got to it, so anything
+		 *	in it is for the next time around.
+		 */
+		for (i = (level == 0) ? 0 : 1; i <= WHEEL_SLOTS; i++) {
+			if (el->wheel[level][(slot + i) & WHEEL_MASK]) break;
+		}
+
+		tick = (slot + i) << (WHEEL_BITS * level);
+		if (!found || (tick < next)) {
+			next = tick;
+			found = true;
+		}
+	}
+
+	when->tv_sec = next / (USEC / WHEEL_TICK);
+	when->tv_usec = (next % (USEC / WHEEL_TICK)) * WHEEL_TICK;
+}
+
+/*
+ *	Get the time of the next event, or of the next time the
+ *	timer wheel needs to turn.  Returns false if there are no
+ *	events.
+ */
+static bool event_next(fr_event_list_t *el, struct timeval *when)
+{
+	fr_event_t *ev;
+
+	if (el->type == FR_EVENT_TIMER_WHEEL) {
+		if (el->num_wheel == 0) return false;
+
+		wheel_next(el, when);
+		return true;
+	}
+
+	ev = fr_heap_peek(el->times);
+	if (!ev) return false;
+
+	*when = ev->when;
+	return true;
+}
+
 static int _event_list_free(fr_event_list_t *list)
 {
+	int i, j;
 	fr_event_list_t *el = list;
 	fr_event_t *ev;
 
+	if (el->type == FR_EVENT_TIMER_WHEEL) {
+		for (i = 0; i < WHEEL_LEVELS; i++) {
+			for (j = 0; j < WHEEL_SLOTS; j++) {
+				while ((ev = el->wheel[i][j]) != NULL) {
+					fr_event_delete(el, &ev);
+				}
+			}
+		}
+
+		while ((ev = el->expired) != NULL) {
+			fr_event_delete(el, &ev);
+		}
+
+		return 0;
+	}
+
 	while ((ev = fr_heap_peek(el->times)) != NULL) {
 		fr_event_delete(el, &ev);
 	}
@@ -113,11 +402,26 @@ static int _event_list_free(fr_event_list_t *list)
 	close(el->kq);
 #endif
 
+#ifdef HAVE_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+#endif
+
 	return 0;
 }
 
 
-fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status)
+/** Create an event list
+ *
+ * @param ctx to allocate the list in.
+ * @param status callback, called with the time until the next event
+ *	before the event loop waits.
+ * @param type how to keep track of timers.  A heap runs events in
+ *	the exact order of their times.  A timer wheel has O(1) insert
+ *	and delete, but runs events up to one millisecond late, in no
+ *	particular order within that millisecond.
+ * @return the new event list, or NULL on error.
+ */
+fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status, fr_event_timer_t type)
 {
 	int i;
 	fr_event_list_t *el;
@@ -128,11 +432,28 @@ fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status)
 	}
 	talloc_set_destructor(el, _event_list_free);
 
-	el->times = fr_heap_create(fr_event_list_time_cmp, offsetof(fr_event_t, heap));
-	if (!el->times) {
+	el->type = type;
+	if (type == FR_EVENT_TIMER_WHEEL) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		el->wheel_tick = wheel_tick_floor(&now);
+
+	} else {
+		el->times = fr_heap_create(fr_event_list_time_cmp, offsetof(fr_event_t, heap));
+		if (!el->times) {
+			talloc_free(el);
+			return NULL;
+		}
+	}
+
+#ifndef HAVE_KQUEUE
+	el->readers = talloc_array(el, fr_event_fd_t, FR_EV_MAX_FDS);
+	if (!el->readers) {
 		talloc_free(el);
 		return NULL;
 	}
+#endif
 
 	for (i = 0; i < FR_EV_MAX_FDS; i++) {
 		el->readers[i].fd = -1;
@@ -141,6 +462,36 @@ fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status)
 #ifndef HAVE_KQUEUE
 	el->changed = true;	/* force re-set of fds's */
 
+#ifdef HAVE_EPOLL
+	el->epfd = -1;
+
+#ifdef TESTING
+	if (!event_force_select)
+#endif
+	{
+		/*
+		 *	The size is only a hint, and is ignored by
+		 *	modern kernels.
+		 */
+		el->epfd = epoll_create(FR_EV_MAX_FDS);
+		if (el->epfd < 0) {
+			fr_strerror_printf("Failed creating epoll set: %s", fr_syserror(errno));
+			talloc_free(el);
+			return NULL;
+		}
+#ifdef FD_CLOEXEC
+		(void) fcntl(el->epfd, F_SETFD, FD_CLOEXEC);
+#endif
+
+		el->num_events = FR_EV_MAX_FDS;
+		el->events = talloc_array(el, struct epoll_event, el->num_events);
+		if (!el->events) {
+			talloc_free(el);
+			return NULL;
+		}
+	}
+#endif
+
 #else
 	el->kq = kqueue();
 	if (el->kq < 0) {
@@ -165,6 +516,8 @@ int fr_event_list_num_elements(fr_event_list_t *el)
 {
 	if (!el) return 0;
 
+	if (el->type == FR_EVENT_TIMER_WHEEL) return el->num_wheel;
+
 	return fr_heap_num_elements(el->times);
 }
 
@@ -193,8 +546,15 @@ int fr_event_delete(fr_event_list_t *el, fr_event_t **parent)
 	}
 	*parent = NULL;
 
-	ret = fr_heap_extract(el->times, ev);
-	fr_assert(ret == 1);	/* events MUST be in the heap */
+	if (el->type == FR_EVENT_TIMER_WHEEL) {
+		fr_assert(ev->pprev != NULL);	/* events MUST be in the wheel */
+		wheel_unlink(el, ev);
+		el->num_wheel--;
+		ret = 1;
+	} else {
+		ret = fr_heap_extract(el->times, ev);
+		fr_assert(ret == 1);	/* events MUST be in the heap */
+	}
 	talloc_free(ev);
 
 	return ret;
@@ -234,7 +594,12 @@ int fr_event_insert(fr_event_list_t *el, fr_event_callback_t callback, void *ctx
 	ev->when = *when;
 	ev->parent = parent;
 
-	if (!fr_heap_insert(el->times, ev)) {
+	if (el->type == FR_EVENT_TIMER_WHEEL) {
+		ev->tick = wheel_tick_ceil(when);
+		wheel_insert(el, ev);
+		el->num_wheel++;
+
+	} else if (!fr_heap_insert(el->times, ev)) {
 		talloc_free(ev);
 		return 0;
 	}
@@ -252,13 +617,24 @@ int fr_event_run(fr_event_list_t *el, struct timeval *when)
 
 	if (!el) return 0;
 
-	if (fr_heap_num_elements(el->times) == 0) {
+	if (fr_event_list_num_elements(el) == 0) {
 		when->tv_sec = 0;
 		when->tv_usec = 0;
 		return 0;
 	}
 
-	ev = fr_heap_peek(el->times);
+	if (el->type == FR_EVENT_TIMER_WHEEL) {
+		if (!el->expired) wheel_advance(el, wheel_tick_floor(when));
+
+		ev = el->expired;
+		if (!ev) {
+			wheel_next(el, when);
+			return 0;
+		}
+	} else {
+		ev = fr_heap_peek(el->times);
+	}
+
 	if (!ev) {
 		when->tv_sec = 0;
 		when->tv_usec = 0;
@@ -302,10 +678,37 @@ int fr_event_now(fr_event_list_t *el, struct timeval *when)
 }
 
 
+#ifndef HAVE_KQUEUE
+/*
+ *	Grow the reader table so that it can be indexed by "fd".
+ */
+static int event_readers_grow(fr_event_list_t *el, int fd)
+{
+	int i, old, size;
+	fr_event_fd_t *readers;
+
+	old = talloc_array_length(el->readers);
+	size = old;
+	while (size <= fd) size *= 2;
+
+	readers = talloc_realloc(el, el->readers, fr_event_fd_t, size);
+	if (!readers) {
+		fr_strerror_printf("Out of memory");
+		return 0;
+	}
+
+	for (i = old; i < size; i++) {
+		readers[i].fd = -1;
+	}
+	el->readers = readers;
+
+	return 1;
+}
+#endif
+
 int fr_event_fd_insert(fr_event_list_t *el, int type, int fd,
 		       fr_event_fd_handler_t handler, void *ctx)
 {
-	int i;
 	fr_event_fd_t *ef;
 
 	if (!el) {
@@ -333,79 +736,122 @@ int fr_event_fd_insert(fr_event_list_t *el, int type, int fd,
 		return 0;
 	}
 
-	if (el->num_readers >= FR_EV_MAX_FDS) {
-		fr_strerror_printf("Too many readers");
-		return 0;
-	}
 	ef = NULL;
 
 #ifdef HAVE_KQUEUE
-	/*
-	 *	We need to store TWO fields with the event.  kqueue
-	 *	only lets us store one.  If we put the two fields into
-	 *	a malloc'd structure, that would help.  Except that
-	 *	kqueue can silently delete the event when the socket
-	 *	is closed, and not give us the opportunity to free it.
-	 *	<sigh>
-	 *
-	 *	The solution is to put the fields into an array, and
-	 *	do a linear search on addition/deletion of the FDs.
-	 *	However, to avoid MOST linear issues, we start off the
-	 *	search at "FD" offset.  Since FDs are unique, AND
-	 *	usually less than 256, we do "FD & 0xff", which is a
-	 *	good guess, and makes the lookups mostly O(1).
-	 */
-	for (i = 0; i < FR_EV_MAX_FDS; i++) {
-		int j;
-		struct kevent evset;
-
-		j = (i + fd) & (FR_EV_MAX_FDS - 1);
+	{
+		int i;
 
-		if (el->readers[j].fd >= 0) continue;
+		if (el->num_readers >= FR_EV_MAX_FDS) {
+			fr_strerror_printf("Too many readers");
+			return 0;
+		}
 
 		/*
-		 *	We want to read from the FD.
+		 *	We need to store TWO fields with the event.  kqueue
+		 *	only lets us store one.  If we put the two fields into
+		 *	a malloc'd structure, that would help.  Except that
+		 *	kqueue can silently delete the event when the socket
+		 *	is closed, and not give us the opportunity to free it.
+		 *	<sigh>
+		 *
+		 *	The solution is to put the fields into an array, and
+		 *	do a linear search on addition/deletion of the FDs.
+		 *	However, to avoid MOST linear issues, we start off the
+		 *	search at "FD" offset.  Since FDs are unique, AND
+		 *	usually less than 256, we do "FD & 0xff", which is a
+		 *	good guess, and makes the lookups mostly O(1).
 		 */
-		EV_SET(&evset, fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, &el->readers[j]);
-		if (kevent(el->kq, &evset, 1, NULL, 0, NULL) < 0) {
-			fr_strerror_printf("Failed inserting event for FD %i: %s", fd, fr_syserror(errno));
-			return 0;
-		}
+		for (i = 0; i < FR_EV_MAX_FDS; i++) {
+			int j;
+			struct kevent evset;
 
-		ef = &el->readers[j];
-		el->num_readers++;
-		break;
+			j = (i + fd) & (FR_EV_MAX_FDS - 1);
+
+			if (el->readers[j].fd >= 0) continue;
+
+			/*
+			 *	We want to read from the FD.
+			 */
+			EV_SET(&evset, fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, &el->readers[j]);
+			if (kevent(el->kq, &evset, 1, NULL, 0, NULL) < 0) {
+				fr_strerror_printf("Failed inserting event for FD %i: %s", fd, fr_syserror(errno));
+				return 0;
+			}
+
+			ef = &el->readers[j];
+			el->num_readers++;
+			break;
+		}
 	}
 
 #else  /* HAVE_KQUEUE */
 
-	for (i = 0; i <= el->max_readers; i++) {
+	if (USE_SELECT(el) && (fd >= FD_SETSIZE)) {
+		fr_strerror_printf("FD %i is too large for select()", fd);
+		return 0;
+	}
+
+	/*
+	 *	The reader table is indexed by FD, so there are no
+	 *	searches on insert, delete, or dispatch.
+	 */
+	if ((fd >= (int) talloc_array_length(el->readers)) &&
+	    !event_readers_grow(el, fd)) return 0;
+
+	/*
+	 *	Be fail-safe on multiple inserts.
+	 */
+	if (el->readers[fd].fd == fd) {
+		if ((el->readers[fd].handler != handler) ||
+		    (el->readers[fd].ctx != ctx)) {
+			fr_strerror_printf("Multiple handlers for same FD");
+			return 0;
+		}
+
 		/*
-		 *	Be fail-safe on multiple inserts.
+		 *	No change.
 		 */
-		if (el->readers[i].fd == fd) {
-			if ((el->readers[i].handler != handler) ||
-			    (el->readers[i].ctx != ctx)) {
-				fr_strerror_printf("Multiple handlers for same FD");
-				return 0;
-			}
+		return 1;
+	}
 
-			/*
-			 *	No change.
-			 */
-			return 1;
+#ifdef HAVE_EPOLL
+	if (!USE_SELECT(el)) {
+		struct epoll_event evset;
+
+		memset(&evset, 0, sizeof(evset));
+		evset.events = EPOLLIN;
+		evset.data.fd = fd;
+
+		if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, fd, &evset) < 0) {
+			fr_strerror_printf("Failed inserting event for FD %i: %s", fd, fr_syserror(errno));
+			return 0;
 		}
 
-		if (el->readers[i].fd < 0) {
-			ef = &el->readers[i];
-			el->num_readers++;
+		/*
+		 *	Allow one call to epoll_wait() to return all
+		 *	of the readers.  If we can't grow the array,
+		 *	the remaining events are returned on the next
+		 *	call.
+		 */
+		if (el->num_readers >= el->num_events) {
+			struct epoll_event *events;
 
-			if (i == el->max_readers) el->max_readers = i + 1;
-			break;
+			events = talloc_realloc(el, el->events, struct epoll_event, el->num_events * 2);
+			if (events) {
+				el->events = events;
+				el->num_events *= 2;
+			}
 		}
 	}
 #endif
 
+	ef = &el->readers[fd];
+	el->num_readers++;
+
+	if (fd >= el->max_readers) el->max_readers = fd + 1;
+#endif
+
 	if (!ef) {
 		fr_strerror_printf("Failed assigning FD");
 		return 0;
@@ -424,49 +870,71 @@ int fr_event_fd_insert(fr_event_list_t *el, int type, int fd,
 
 int fr_event_fd_delete(fr_event_list_t *el, int type, int fd)
 {
-	int i;
-
 	if (!el || (fd < 0)) return 0;
 
 	if (type != 0) return 0;
 
 #ifdef HAVE_KQUEUE
-	for (i = 0; i < FR_EV_MAX_FDS; i++) {
-		int j;
-		struct kevent evset;
+	{
+		int i;
 
-		j = (i + fd) & (FR_EV_MAX_FDS - 1);
+		for (i = 0; i < FR_EV_MAX_FDS; i++) {
+			int j;
+			struct kevent evset;
 
-		if (el->readers[j].fd != fd) continue;
+			j = (i + fd) & (FR_EV_MAX_FDS - 1);
 
-		/*
-		 *	Tell the kernel to delete it from the list.
-		 *
-		 *	The caller MAY have closed it, in which case
-		 *	the kernel has removed it from the list.  So
-		 *	we ignore the return code from kevent().
-		 */
-		EV_SET(&evset, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-		(void) kevent(el->kq, &evset, 1, NULL, 0, NULL);
+			if (el->readers[j].fd != fd) continue;
 
-		el->readers[j].fd = -1;
-		el->num_readers--;
+			/*
+			 *	Tell the kernel to delete it from the list.
+			 *
+			 *	The caller MAY have closed it, in which case
+			 *	the kernel has removed it from the list.  So
+			 *	we ignore the return code from kevent().
+			 */
+			EV_SET(&evset, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+			(void) kevent(el->kq, &evset, 1, NULL, 0, NULL);
 
-		return 1;
+			el->readers[j].fd = -1;
+			el->num_readers--;
+
+			return 1;
+		}
 	}
 
 #else
 
-	for (i = 0; i < el->max_readers; i++) {
-		if (el->readers[i].fd == fd) {
-			el->readers[i].fd = -1;
-			el->num_readers--;
+	if ((fd >= el->max_readers) || (el->readers[fd].fd != fd)) return 0;
 
-			if ((i + 1) == el->max_readers) el->max_readers = i;
-			el->changed = true;
-			return 1;
+#ifdef HAVE_EPOLL
+	if (!USE_SELECT(el)) {
+		struct epoll_event evset;
+
+		/*
+		 *	The caller MAY have closed it, in which case
+		 *	the kernel has removed it from the set.  So we
+		 *	ignore the return code from epoll_ctl().
+		 *
+		 *	Older kernels require a non-NULL event, even
+		 *	though it's ignored.
+		 */
+		memset(&evset, 0, sizeof(evset));
+		(void) epoll_ctl(el->epfd, EPOLL_CTL_DEL, fd, &evset);
+	}
+#endif
+
+	el->readers[fd].fd = -1;
+	el->num_readers--;
+
+	if ((fd + 1) == el->max_readers) {
+		while ((el->max_readers > 0) &&
+		       (el->readers[el->max_readers - 1].fd < 0)) {
+			el->max_readers--;
 		}
 	}
+	el->changed = true;
+	return 1;
 #endif	/* HAVE_KQUEUE */
 
 	return 0;
@@ -506,7 +974,7 @@ int fr_event_loop(fr_event_list_t *el)
 		/*
 		 *	Cache the list of FD's to watch.
 		 */
-		if (el->changed) {
+		if (USE_SELECT(el) && el->changed) {
 #ifdef __clang_analyzer__
 			memset(&master_fds, 0, sizeof(master_fds));
 #else
@@ -532,18 +1000,17 @@ int fr_event_loop(fr_event_list_t *el)
 		when.tv_sec = 0;
 		when.tv_usec = 0;
 
-		if (fr_heap_num_elements(el->times) > 0) {
-			fr_event_t *ev;
+		if (fr_event_list_num_elements(el) > 0) {
+			struct timeval next;
 
-			ev = fr_heap_peek(el->times);
-			if (!ev) {
+			if (!event_next(el, &next)) {
 				fr_exit_now(42);
 			}
 
 			gettimeofday(&el->now, NULL);
 
-			if (timercmp(&el->now, &ev->when, <)) {
-				when = ev->when;
+			if (timercmp(&el->now, &next, <)) {
+				when = next;
 				when.tv_sec -= el->now.tv_sec;
 
 				if (when.tv_sec > 0) {
@@ -573,12 +1040,32 @@ int fr_event_loop(fr_event_list_t *el)
 		if (el->status) el->status(wake);
 
 #ifndef HAVE_KQUEUE
-		read_fds = master_fds;
-		rcode = select(maxfd + 1, &read_fds, NULL, NULL, wake);
-		if ((rcode < 0) && (errno != EINTR)) {
-			fr_strerror_printf("Failed in select: %s", fr_syserror(errno));
-			el->dispatch = false;
-			return -1;
+#ifdef HAVE_EPOLL
+		if (!USE_SELECT(el)) {
+			int timeout = -1;
+
+			/*
+			 *	Round up, so that we don't spin until
+			 *	the timer expires.
+			 */
+			if (wake) timeout = (wake->tv_sec * 1000) + ((wake->tv_usec + 999) / 1000);
+
+			rcode = epoll_wait(el->epfd, el->events, el->num_events, timeout);
+			if ((rcode < 0) && (errno != EINTR)) {
+				fr_strerror_printf("Failed in epoll_wait: %s", fr_syserror(errno));
+				el->dispatch = false;
+				return -1;
+			}
+		} else
+#endif
+		{
+			read_fds = master_fds;
+			rcode = select(maxfd + 1, &read_fds, NULL, NULL, wake);
+			if ((rcode < 0) && (errno != EINTR)) {
+				fr_strerror_printf("Failed in select: %s", fr_syserror(errno));
+				el->dispatch = false;
+				return -1;
+			}
 		}
 
 #else  /* HAVE_KQUEUE */
@@ -594,7 +1081,7 @@ int fr_event_loop(fr_event_list_t *el)
 		rcode = kevent(el->kq, NULL, 0, el->events, FR_EV_MAX_FDS, ts_wake);
 #endif	/* HAVE_KQUEUE */
 
-		if (fr_heap_num_elements(el->times) > 0) {
+		if (fr_event_list_num_elements(el) > 0) {
 			do {
 				gettimeofday(&el->now, NULL);
 				when = el->now;
@@ -604,6 +1091,37 @@ int fr_event_loop(fr_event_list_t *el)
 		if (rcode <= 0) continue;
 
 #ifndef HAVE_KQUEUE
+#ifdef HAVE_EPOLL
+		/*
+		 *	Loop over only the sockets which are ready.
+		 */
+		if (!USE_SELECT(el)) {
+			el->changed = false;
+
+			for (i = 0; i < rcode; i++) {
+				int fd = el->events[i].data.fd;
+				fr_event_fd_t *ef;
+
+				/*
+				 *	A previous handler may have
+				 *	deleted this FD.
+				 */
+				if ((fd >= el->max_readers) || (el->readers[fd].fd != fd)) continue;
+
+				ef = &el->readers[fd];
+				ef->handler(el, ef->fd, ef->ctx);
+
+				/*
+				 *	epoll is level-triggered, so
+				 *	any events we skip here will
+				 *	be returned by the next call.
+				 */
+				if (el->changed) break;
+			}
+			continue;
+		}
+#endif
+
 		/*
 		 *	Loop over all of the sockets to see if there's
 		 *	an event for that socket.
@@ -674,13 +1192,30 @@ int fr_event_loop(fr_event_list_t *el)
  *  OR
  *
  *   valgrind --tool=memcheck --leak-check=full --show-reachable=yes ./event
+ *
+ *  OR
+ *
+ *   ./event -b
+ *
+ *  which benchmarks the cost of one trip through fr_event_loop()
+ *  with 10, 100, and 1000 idle FDs.  On Linux, it compares epoll
+ *  with select.
+ *
+ *  OR
+ *
+ *   ./event -t
+ *
+ *  which benchmarks inserting, deleting, and running timers with
+ *  the heap, and with the timer wheel.
+ *
+ *  Add "-w" to the first form to use the timer wheel.
  */
 
 static void print_time(void *ctx)
 {
 	struct timeval *when = ctx;
 
-	printf("%d.%06d\n", when->tv_sec, when->tv_usec);
+	printf("%d.%06d\n", (int) when->tv_sec, (int) when->tv_usec);
 	fflush(stdout);
 }
 
@@ -699,17 +1234,231 @@ static uint32_t event_rand(void)
 	return num;
 }
 
+#define BENCH_LOOPS (100000)
+
+typedef struct event_bench_t {
+	int		pipe[2];
+	int		count;
+} event_bench_t;
+
+/*
+ *	Read the byte we were woken up for, and write another one so
+ *	that we're woken up again on the next trip through the loop.
+ */
+static void bench_read(fr_event_list_t *el, int sock, void *ctx)
+{
+	event_bench_t *bench = ctx;
+	char c;
+
+	if (read(sock, &c, 1) != 1) {
+		fr_event_loop_exit(el, -1);
+		return;
+	}
+
+	if (++bench->count >= BENCH_LOOPS) {
+		fr_event_loop_exit(el, 1);
+		return;
+	}
+
+	if (write(bench->pipe[1], &c, 1) != 1) fr_event_loop_exit(el, -1);
+}
+
+static void bench_idle(UNUSED fr_event_list_t *el, UNUSED int sock, UNUSED void *ctx)
+{
+}
+
+static int event_bench(char const *name, int num_idle)
+{
+	int i, rcode = -1;
+	int *idle;
+	fr_event_list_t *el;
+	event_bench_t bench;
+	struct timeval start, end;
+	uint64_t usec;
+
+	el = fr_event_list_create(NULL, NULL, FR_EVENT_TIMER_HEAP);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list: %s\n", fr_strerror());
+		return -1;
+	}
+
+	idle = talloc_array(el, int, num_idle);
+	for (i = 0; i < num_idle; i++) idle[i] = -1;
+
+	/*
+	 *	Unbound UDP sockets are never readable.
+	 */
+	for (i = 0; i < num_idle; i++) {
+		idle[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (idle[i] < 0) {
+			fprintf(stderr, "Failed opening socket: %s\n", fr_syserror(errno));
+			goto done;
+		}
+
+		if (!fr_event_fd_insert(el, 0, idle[i], bench_idle, el)) {
+			fprintf(stderr, "Failed inserting FD: %s\n", fr_strerror());
+			goto done;
+		}
+	}
+
+	/*
+	 *	Open the active pipe last, so that it has the highest
+	 *	FD.  This is the worst case for select().
+	 */
+	if (pipe(bench.pipe) < 0) {
+		fprintf(stderr, "Failed opening pipe: %s\n", fr_syserror(errno));
+		goto done;
+	}
+	bench.count = 0;
+
+	if (!fr_event_fd_insert(el, 0, bench.pipe[0], bench_read, &bench) ||
+	    (write(bench.pipe[1], "x", 1) != 1)) {
+		fprintf(stderr, "Failed starting benchmark: %s\n", fr_strerror());
+		goto close_pipe;
+	}
+
+	gettimeofday(&start, NULL);
+	rcode = fr_event_loop(el);
+	gettimeofday(&end, NULL);
+
+	if (rcode == 1) {
+		usec = (end.tv_sec - start.tv_sec) * USEC;
+		usec += end.tv_usec;
+		usec -= start.tv_usec;
+
+		printf("%-6s %5d idle FDs: %8.3f usec/wakeup\n", name, num_idle,
+		       ((double) usec) / BENCH_LOOPS);
+		rcode = 0;
+	}
+
+	fr_event_fd_delete(el, 0, bench.pipe[0]);
+
+close_pipe:
+	close(bench.pipe[0]);
+	close(bench.pipe[1]);
+
+done:
+	for (i = 0; i < num_idle; i++) {
+		if (idle[i] < 0) break;
+
+		fr_event_fd_delete(el, 0, idle[i]);
+		close(idle[i]);
+	}
+	talloc_free(el);
+
+	return rcode;
+}
+
+static int event_bench_all(void)
+{
+	int i;
+	static int const sizes[] = { 10, 100, 1000 };
+
+	for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+#ifdef HAVE_EPOLL
+		event_force_select = false;
+		if (event_bench("epoll", sizes[i]) < 0) return 1;
+
+		event_force_select = true;
+#endif
+		if (event_bench("select", sizes[i]) < 0) return 1;
+	}
+
+	return 0;
+}
+
+static void timer_bench_run(void *ctx)
+{
+	int *count = ctx;
+
+	(*count)++;
+}
+
+/*
+ *	Insert timers over the next minute, which is about what the
+ *	server does with cleanup_delay and max_request_time.  Then
+ *	reschedule half of them, and run them all.
+ */
+static int timer_bench(char const *name, fr_event_timer_t type, int num)
+{
+	int i, count = 0;
+	fr_event_list_t *el;
+	fr_event_t **events;
+	struct timeval now, when, end, start, stop;
+	uint64_t usec;
+
+	el = fr_event_list_create(NULL, NULL, type);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list: %s\n", fr_strerror());
+		return -1;
+	}
+
+	events = talloc_zero_array(el, fr_event_t *, num);
+
+	gettimeofday(&now, NULL);
+	end = now;
+	end.tv_sec += 61;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		when = now;
+		when.tv_sec += event_rand() % 60;
+		when.tv_usec = event_rand() % USEC;
+
+		if (!fr_event_insert(el, timer_bench_run, &count, &when, &events[i])) {
+			fprintf(stderr, "Failed inserting timer: %s\n", fr_strerror());
+			talloc_free(el);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < num; i += 2) {
+		when = now;
+		when.tv_sec += event_rand() % 60;
+		when.tv_usec = event_rand() % USEC;
+
+		fr_event_insert(el, timer_bench_run, &count, &when, &events[i]);
+	}
+
+	do {
+		when = end;
+	} while (fr_event_run(el, &when) == 1);
+	gettimeofday(&stop, NULL);
+
+	usec = (stop.tv_sec - start.tv_sec) * USEC;
+	usec += stop.tv_usec;
+	usec -= start.tv_usec;
+
+	printf("%-6s %8d timers: %8.3f usec/timer%s\n", name, num, ((double) usec) / num,
+	       (count == num) ? "" : " (MISSED SOME)");
+
+	talloc_free(el);
+
+	return (count == num) ? 0 : -1;
+}
+
+static int timer_bench_all(void)
+{
+	int i;
+	static int const sizes[] = { 1000, 100000, 1000000 };
+
+	for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		if (timer_bench("heap", FR_EVENT_TIMER_HEAP, sizes[i]) < 0) return 1;
+		if (timer_bench("wheel", FR_EVENT_TIMER_WHEEL, sizes[i]) < 0) return 1;
+	}
+
+	return 0;
+}
 
 #define MAX 100
 int main(int argc, char **argv)
 {
-	int i, rcode;
+	int i;
 	struct timeval array[MAX];
+	fr_event_t *events[MAX];
 	struct timeval now, when;
 	fr_event_list_t *el;
-
-	el = fr_event_list_create(NULL, NULL);
-	if (!el) exit(1);
+	fr_event_timer_t type = FR_EVENT_TIMER_HEAP;
 
 	memset(&rand_pool, 0, sizeof(rand_pool));
 	rand_pool.randrsl[1] = time(NULL);
@@ -717,6 +1466,15 @@ int main(int argc, char **argv)
 	fr_randinit(&rand_pool, 1);
 	rand_pool.randcnt = 0;
 
+	if ((argc > 1) && (strcmp(argv[1], "-b") == 0)) return event_bench_all();
+	if ((argc > 1) && (strcmp(argv[1], "-t") == 0)) return timer_bench_all();
+	if ((argc > 1) && (strcmp(argv[1], "-w") == 0)) type = FR_EVENT_TIMER_WHEEL;
+
+	el = fr_event_list_create(NULL, NULL, type);
+	if (!el) exit(1);
+
+	memset(events, 0, sizeof(events));
+
 	gettimeofday(&array[0], NULL);
 	for (i = 1; i < MAX; i++) {
 		array[i] = array[i - 1];
@@ -726,7 +1484,7 @@ int main(int argc, char **argv)
 			array[i].tv_usec -= 1000000;
 			array[i].tv_sec++;
 		}
-		fr_event_insert(el, print_time, &array[i], &array[i]);
+		fr_event_insert(el, print_time, &array[i], &array[i], &events[i]);
 	}
 
 	while (fr_event_list_num_elements(el)) {
@@ -0,0 +1,156 @@
+/*
+ * histogram.c	Log-linear histograms, for latency percentiles.
+ *
+ * Version:	$Id$
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *  Copyright 2026  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+/*
+ *	Values smaller than 2^(SUB_BITS + 1) each get their own
+ *	bucket.  Above that, every power of two is split into
+ *	2^SUB_BITS buckets of equal width.  So the width of a bucket
+ *	is never more than 1/32 of the values it holds, whatever the
+ *	magnitude, and the whole range fits in a fixed array.
+ */
+#define SUB_BITS	FR_HISTOGRAM_SUB_BITS
+#define LINEAR_MAX	(1 << (SUB_BITS + 1))
+#define VALUE_MAX	((UINT64_C(1) << FR_HISTOGRAM_BITS) - 1)
+
+static unsigned int histogram_index(uint64_t value)
+{
+	unsigned int shift = 0;
+	uint64_t top;
+
+	if (value < LINEAR_MAX) return value;
+	if (value > VALUE_MAX) value = VALUE_MAX;
+
+	for (top = value >> (SUB_BITS + 1); top != 0; top >>= 1) shift++;
+
+	return (shift << SUB_BITS) + (value >> shift);
+}
+
+/*
+ *	The largest value which lands in a bucket.
+ */
+static uint64_t histogram_value(unsigned int idx)
+{
+	unsigned int shift;
+	uint64_t mantissa;
+
+	if (idx < LINEAR_MAX) return idx;
+
+	shift = (idx >> SUB_BITS) - 1;
+	mantissa = idx - (shift << SUB_BITS);
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/** Record one value
+ *
+ * Only one thread may add values to a histogram.  Other threads may
+ * read it at the same time, and will see a count which is at most a
+ * few values out of date.
+ *
+ * @param h histogram to update.
+ * @param value to record, usually in microseconds.  Values above
+ *	2^FR_HISTOGRAM_BITS - 1 are counted in the last bucket.
+ */
+void fr_histogram_add(fr_histogram_t *h, uint64_t value)
+{
+	h->bucket[histogram_index(value)]++;
+	if (value > h->max) h->max = value;
+}
+
+/** Add the values of one histogram to another
+ *
+ * @param dst histogram to update.
+ * @param src histogram to read.
+ */
+void fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) {
+		dst->bucket[i] += src->bucket[i];
+	}
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+/** Return how many values have been recorded
+ *
+ * @param h histogram to read.
+ * @return the number of values.
+ */
+uint64_t fr_histogram_count(fr_histogram_t const *h)
+{
+	unsigned int i;
+	uint64_t count = 0;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) {
+		count += h->bucket[i];
+	}
+
+	return count;
+}
+
+/** Return a percentile of the recorded values
+ *
+ * The result is the largest value of the bucket holding the
+ * percentile, so it over-estimates by at most 1/32.  It is never
+ * more than the largest value recorded.
+ *
+ * @param h histogram to read.
+ * @param percentile to return, e.g. 99.9.
+ * @return the value, or 0 if nothing has been recorded.
+ */
+uint64_t fr_histogram_percentile(fr_histogram_t const *h, double percentile)
+{
+	unsigned int i;
+	uint64_t count, rank, seen = 0;
+	uint64_t value;
+	double exact;
+
+	count = fr_histogram_count(h);
+	if (count == 0) return 0;
+
+	if (percentile >= 100.0) return h->max;
+
+	/*
+	 *	Nearest rank: the smallest value which is at least
+	 *	"percentile" percent of the values.
+	 */
+	exact = (count * percentile) / 100.0;
+	rank = (uint64_t) exact;
+	if ((double) rank < exact) rank++;
+	if (rank == 0) rank = 1;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= rank) break;
+	}
+	if (i == FR_HISTOGRAM_BUCKETS) return h->max;
+
+	value = histogram_value(i);
+	if (value > h->max) value = h->max;
+
+	return value;
+}
@@ -118,6 +118,292 @@ void fr_request_from_reply(RADIUS_PACKET *request,
 	request->dst_ipaddr = reply->src_ipaddr;
 }
 
+/*
+ *	An open addressing hash table of packets, keyed on the same
+ *	fields as fr_packet_cmp().  Collisions use linear probing, and
+ *	deletions shift the following entries back, so there are no
+ *	tombstones.  The table is never more than half full.
+ *
+ *	Each slot caches the hash of its packet, so that probing and
+ *	growing the table rarely have to look at the packets.
+ */
+typedef struct fr_packet_slot_t {
+	uint32_t	hash;
+	RADIUS_PACKET	**packet_p;	//!< NULL if the slot is empty.
+} fr_packet_slot_t;
+
+struct fr_packet_hash_t {
+	uint32_t		num_elements;
+	uint32_t		mask;		//!< Number of slots - 1.
+	fr_packet_slot_t	*slots;
+};
+
+#define FR_PACKET_HASH_MIN_SLOTS	(256)
+
+static uint32_t packet_ipaddr_hash(fr_ipaddr_t const *ipaddr, uint32_t hash)
+{
+	hash = fr_hash_update(&ipaddr->af, sizeof(ipaddr->af), hash);
+	hash = fr_hash_update(&ipaddr->prefix, sizeof(ipaddr->prefix), hash);
+
+	switch (ipaddr->af) {
+	case AF_INET:
+		return fr_hash_update(&ipaddr->ipaddr.ip4addr, sizeof(ipaddr->ipaddr.ip4addr), hash);
+
+#ifdef HAVE_STRUCT_SOCKADDR_IN6
+	case AF_INET6:
+		hash = fr_hash_update(&ipaddr->scope, sizeof(ipaddr->scope), hash);
+		return fr_hash_update(&ipaddr->ipaddr.ip6addr, sizeof(ipaddr->ipaddr.ip6addr), hash);
+#endif
+
+	default:
+		break;
+	}
+
+	return hash;
+}
+
+/*
+ *	Packets which are equal according to fr_packet_cmp() MUST
+ *	have the same hash.
+ */
+static uint32_t packet_hash(RADIUS_PACKET const *packet)
+{
+	uint32_t hash;
+
+	hash = fr_hash(&packet->id, sizeof(packet->id));
+	hash = fr_hash_update(&packet->src_port, sizeof(packet->src_port), hash);
+	hash = fr_hash_update(&packet->dst_port, sizeof(packet->dst_port), hash);
+	hash = fr_hash_update(&packet->sockfd, sizeof(packet->sockfd), hash);
+	hash = packet_ipaddr_hash(&packet->src_ipaddr, hash);
+
+	return packet_ipaddr_hash(&packet->dst_ipaddr, hash);
+}
+
+/*
+ *	Return the slot holding the packet, or the empty slot where
+ *	it would go.
+ */
+static uint32_t packet_hash_slot(fr_packet_hash_t *ph, RADIUS_PACKET const *packet, uint32_t hash)
+{
+	uint32_t i;
+
+	for (i = hash & ph->mask; ph->slots[i].packet_p; i = (i + 1) & ph->mask) {
+		if ((ph->slots[i].hash == hash) &&
+		    (fr_packet_cmp(*ph->slots[i].packet_p, packet) == 0)) break;
+	}
+
+	return i;
+}
+
+static bool packet_hash_grow(fr_packet_hash_t *ph)
+{
+	uint32_t i, j, num_slots;
+	fr_packet_slot_t *slots;
+
+	num_slots = (ph->mask + 1) * 2;
+	if (num_slots < (ph->mask + 1)) return false;
+
+	slots = talloc_zero_array(ph, fr_packet_slot_t, num_slots);
+	if (!slots) return false;
+
+	for (i = 0; i <= ph->mask; i++) {
+		if (!ph->slots[i].packet_p) continue;
+
+		j = ph->slots[i].hash & (num_slots - 1);
+		while (slots[j].packet_p) j = (j + 1) & (num_slots - 1);
+
+		slots[j] = ph->slots[i];
+	}
+
+	talloc_free(ph->slots);
+	ph->slots = slots;
+	ph->mask = num_slots - 1;
+
+	return true;
+}
+
+/*
+ *	Empty a slot, and move the entries after it back, so that
+ *	lookups don't stop early at the hole.
+ */
+static void packet_hash_delete_slot(fr_packet_hash_t *ph, uint32_t i)
+{
+	uint32_t j, home;
+
+	for (j = (i + 1) & ph->mask; ph->slots[j].packet_p; j = (j + 1) & ph->mask) {
+		home = ph->slots[j].hash & ph->mask;
+
+		/*
+		 *	The entry is already between its home slot
+		 *	and the hole, so it can stay where it is.
+		 */
+		if (i <= j) {
+			if ((i < home) && (home <= j)) continue;
+		} else {
+			if ((i < home) || (home <= j)) continue;
+		}
+
+		ph->slots[i] = ph->slots[j];
+		i = j;
+	}
+
+	ph->slots[i].packet_p = NULL;
+	ph->slots[i].hash = 0;
+	ph->num_elements--;
+}
+
+/** Create a hash table of packets
+ *
+ * The caller is responsible for managing the packets.  The table
+ * only holds pointers to the callers RADIUS_PACKET * members.
+ *
+ * @param ctx to allocate the table in.
+ * @return the new table, or NULL on error.
+ */
+fr_packet_hash_t *fr_packet_hash_create(TALLOC_CTX *ctx)
+{
+	fr_packet_hash_t *ph;
+
+	ph = talloc_zero(ctx, fr_packet_hash_t);
+	if (!ph) return NULL;
+
+	ph->slots = talloc_zero_array(ph, fr_packet_slot_t, FR_PACKET_HASH_MIN_SLOTS);
+	if (!ph->slots) {
+		talloc_free(ph);
+		return NULL;
+	}
+	ph->mask = FR_PACKET_HASH_MIN_SLOTS - 1;
+
+	return ph;
+}
+
+/** Insert a packet into the table
+ *
+ * @param ph the table.
+ * @param packet_p pointer to the callers RADIUS_PACKET * member.
+ * @return true on success, false if an equal packet is already in
+ *	the table, or on error.
+ */
+bool fr_packet_hash_insert(fr_packet_hash_t *ph, RADIUS_PACKET **packet_p)
+{
+	uint32_t i, hash;
+
+	if (!ph || !packet_p || !*packet_p) return false;
+
+	if (((ph->num_elements + 1) * 2) > (ph->mask + 1)) {
+		if (!packet_hash_grow(ph)) return false;
+	}
+
+	hash = packet_hash(*packet_p);
+	i = packet_hash_slot(ph, *packet_p, hash);
+	if (ph->slots[i].packet_p) return false;
+
+	ph->slots[i].hash = hash;
+	ph->slots[i].packet_p = packet_p;
+	ph->num_elements++;
+
+	return true;
+}
+
+/** Find a packet which is equal to the given one
+ *
+ * @param ph the table.
+ * @param packet to look for.
+ * @return the callers RADIUS_PACKET * member, or NULL if not found.
+ */
+RADIUS_PACKET **fr_packet_hash_find(fr_packet_hash_t *ph, RADIUS_PACKET const *packet)
+{
+	uint32_t i;
+
+	if (!ph || !packet) return NULL;
+
+	i = packet_hash_slot(ph, packet, packet_hash(packet));
+
+	return ph->slots[i].packet_p;
+}
+
+/** Remove a packet which is equal to the given one
+ *
+ * @param ph the table.
+ * @param packet to remove.
+ * @return true if it was removed, false if not found.
+ */
+bool fr_packet_hash_yank(fr_packet_hash_t *ph, RADIUS_PACKET const *packet)
+{
+	uint32_t i;
+
+	if (!ph || !packet) return false;
+
+	i = packet_hash_slot(ph, packet, packet_hash(packet));
+	if (!ph->slots[i].packet_p) return false;
+
+	packet_hash_delete_slot(ph, i);
+
+	return true;
+}
+
+uint32_t fr_packet_hash_num_elements(fr_packet_hash_t *ph)
+{
+	if (!ph) return 0;
+
+	return ph->num_elements;
+}
+
+/** Walk over the packets in the table
+ *
+ * The callback is passed the callers RADIUS_PACKET * member.  Like
+ * rbtree_walk() with RBTREE_DELETE_ORDER, it returns:
+ *
+ *	<0 means error, stop
+ *	0  means OK, continue
+ *	1  means delete current entry and stop
+ *	2  means delete current entry and continue
+ *
+ * The callback MUST NOT otherwise insert or remove packets.
+ *
+ * @param ph the table.
+ * @param ctx passed to the callback.
+ * @param callback to call for each packet.
+ * @return the last value returned by the callback.
+ */
+int fr_packet_hash_walk(fr_packet_hash_t *ph, void *ctx, rb_walker_t callback)
+{
+	uint32_t i, k, start;
+	int rcode = 0;
+
+	if (!ph || !callback || !ph->num_elements) return 0;
+
+	/*
+	 *	Start after an empty slot.  Entries then never move
+	 *	from the part of the table we haven't walked, to the
+	 *	part we have.
+	 */
+	for (start = 0; ph->slots[start].packet_p; start++) {
+		/* nothing */
+	}
+
+	for (k = 1; k <= (ph->mask + 1); k++) {
+		i = (start + k) & ph->mask;
+
+	again:
+		if (!ph->slots[i].packet_p) continue;
+
+		rcode = callback(ctx, ph->slots[i].packet_p);
+		if (rcode < 0) return rcode;
+		if (rcode == 0) continue;
+
+		/*
+		 *	Deleting the entry may move a later one into
+		 *	this slot.  So we look at it again.
+		 */
+		packet_hash_delete_slot(ph, i);
+		if (rcode != 2) return rcode;
+		goto again;
+	}
+
+	return rcode;
+}
+
 #ifdef O_NONBLOCK
 int fr_nonblock(int fd)
 {
@@ -249,6 +535,20 @@ int fr_socket(fr_ipaddr_t *ipaddr, uint16_t port)
 /*
  *	We need to keep track of the socket & it's IP/port.
  */
+/*
+ *	The sockets which send to one destination.  The ones which have
+ *	free IDs are kept on a circular list, so that allocating an ID
+ *	doesn't have to look at any other sockets.
+ */
+typedef struct fr_packet_dst_t {
+	int		proto;
+	fr_ipaddr_t	ipaddr;		//!< All zeros for "any address".
+	uint16_t	port;		//!< 0 for "any port".
+
+	int		num_sockets;
+	struct fr_packet_socket_t *available;	//!< Next socket to allocate from.
+} fr_packet_dst_t;
+
 typedef struct fr_packet_socket_t {
 	int		sockfd;
 	void		*ctx;
@@ -270,6 +570,19 @@ typedef struct fr_packet_socket_t {
 #endif
 
 	uint8_t		id[32];
+
+	fr_packet_dst_t	*dst;
+	struct fr_packet_socket_t *prev;	//!< In dst->available.
+	struct fr_packet_socket_t *next;	//!< In dst->available.
+	bool		available;
+
+	/*
+	 *	Free IDs, in the order they were freed.  The oldest
+	 *	one is used first, so that IDs are re-used as late as
+	 *	possible.
+	 */
+	uint8_t		free_head;
+	uint8_t		free_ids[256];
 } fr_packet_socket_t;
 
 
@@ -285,7 +598,8 @@ typedef struct fr_packet_socket_t {
  *	that should be managed.
  */
 struct fr_packet_list_t {
-	rbtree_t	*tree;
+	fr_packet_hash_t *ph;
+	fr_hash_table_t	*dsts;
 
 	int		alloc_id;
 	uint32_t	num_outgoing;
@@ -296,6 +610,89 @@ struct fr_packet_list_t {
 };
 
 
+static void packet_dst_key(fr_packet_dst_t *key, int proto,
+			   fr_ipaddr_t const *ipaddr, uint16_t port, bool any)
+{
+	memset(key, 0, sizeof(*key));
+
+#ifdef WITH_TCP
+	key->proto = proto;
+#else
+	key->proto = 0;		/* everything is UDP */
+#endif
+
+	key->ipaddr.af = ipaddr->af;
+	if (!any) {
+		key->ipaddr.ipaddr = ipaddr->ipaddr;
+		key->ipaddr.scope = ipaddr->scope;
+	}
+	key->port = port;
+}
+
+static uint32_t packet_dst_hash(void const *data)
+{
+	fr_packet_dst_t const *dst = data;
+	uint32_t hash;
+
+	hash = fr_hash(&dst->proto, sizeof(dst->proto));
+	hash = fr_hash_update(&dst->port, sizeof(dst->port), hash);
+
+	return packet_ipaddr_hash(&dst->ipaddr, hash);
+}
+
+static int packet_dst_cmp(void const *one, void const *two)
+{
+	fr_packet_dst_t const *a = one;
+	fr_packet_dst_t const *b = two;
+
+	if (a->proto != b->proto) return a->proto - b->proto;
+	if (a->port != b->port) return (int) a->port - (int) b->port;
+
+	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+}
+
+/*
+ *	Put the socket on its destination's list of sockets with free
+ *	IDs, or take it off, as appropriate.
+ */
+static void packet_socket_available(fr_packet_socket_t *ps)
+{
+	bool available;
+	fr_packet_dst_t *dst = ps->dst;
+
+	available = (ps->sockfd >= 0) && !ps->dont_use && (ps->num_outgoing < 256);
+	if (available == ps->available) return;
+
+	ps->available = available;
+
+	if (available) {
+		if (!dst->available) {
+			ps->next = ps->prev = ps;
+			dst->available = ps;
+			return;
+		}
+
+		/*
+		 *	Add it at the end, just before the next socket
+		 *	we'll use.
+		 */
+		ps->next = dst->available;
+		ps->prev = dst->available->prev;
+		ps->prev->next = ps;
+		ps->next->prev = ps;
+		return;
+	}
+
+	if (ps->next == ps) {
+		dst->available = NULL;
+	} else {
+		ps->prev->next = ps->next;
+		ps->next->prev = ps->prev;
+		if (dst->available == ps) dst->available = ps->next;
+	}
+	ps->next = ps->prev = NULL;
+}
+
 /*
  *	Ugh.  Doing this on every sent/received packet is not nice.
  */
@@ -331,6 +728,7 @@ bool fr_packet_list_socket_freeze(fr_packet_list_t *pl, int sockfd)
 	}
 
 	ps->dont_use = true;
+	packet_socket_available(ps);
 	return true;
 }
 
@@ -344,6 +742,7 @@ bool fr_packet_list_socket_thaw(fr_packet_list_t *pl, int sockfd)
 	if (!ps) return false;
 
 	ps->dont_use = false;
+	packet_socket_available(ps);
 	return true;
 }
 
@@ -360,6 +759,12 @@ bool fr_packet_list_socket_del(fr_packet_list_t *pl, int sockfd)
 	if (ps->num_outgoing != 0) return false;
 
 	ps->sockfd = -1;
+	packet_socket_available(ps);
+
+	ps->dst->num_sockets--;
+	if (ps->dst->num_sockets == 0) fr_hash_table_delete(pl->dsts, ps->dst);
+	ps->dst = NULL;
+
 	pl->num_sockets--;
 
 	return true;
@@ -374,6 +779,7 @@ bool fr_packet_list_socket_add(fr_packet_list_t *pl, int sockfd, int proto,
 	struct sockaddr_storage	src;
 	socklen_t		sizeof_src;
 	fr_packet_socket_t	*ps;
+	fr_packet_dst_t		my_dst, *dst;
 
 	if (!pl || !dst_ipaddr || (dst_ipaddr->af == AF_UNSPEC)) {
 		fr_strerror_printf("Invalid argument");
@@ -410,6 +816,7 @@ bool fr_packet_list_socket_add(fr_packet_list_t *pl, int sockfd, int proto,
 	}
 
 	memset(ps, 0, sizeof(*ps));
+	ps->sockfd = -1;	/* until we're done */
 	ps->ctx = ctx;
 #ifdef WITH_TCP
 	ps->proto = proto;
@@ -445,28 +852,56 @@ bool fr_packet_list_socket_add(fr_packet_list_t *pl, int sockfd, int proto,
 	ps->dst_any = fr_inaddr_any(&ps->dst_ipaddr);
 	if (ps->dst_any < 0) return false;
 
+	packet_dst_key(&my_dst, proto, &ps->dst_ipaddr, ps->dst_port, ps->dst_any);
+	dst = fr_hash_table_finddata(pl->dsts, &my_dst);
+	if (!dst) {
+		dst = malloc(sizeof(*dst));
+		if (!dst) {
+			fr_strerror_printf("Out of memory");
+			return false;
+		}
+		*dst = my_dst;
+
+		if (!fr_hash_table_insert(pl->dsts, dst)) {
+			free(dst);
+			fr_strerror_printf("Failed adding destination");
+			return false;
+		}
+	}
+
+	/*
+	 *	Hand out the IDs in a random order.
+	 */
+	for (i = 0; i < 256; i++) {
+		ps->free_ids[i] = i;
+	}
+	for (i = 255; i > 0; i--) {
+		int j = fr_rand() % (i + 1);
+		uint8_t tmp = ps->free_ids[i];
+
+		ps->free_ids[i] = ps->free_ids[j];
+		ps->free_ids[j] = tmp;
+	}
+
 	/*
 	 *	As the last step before returning.
 	 */
+	ps->dst = dst;
+	dst->num_sockets++;
+
 	ps->sockfd = sockfd;
+	packet_socket_available(ps);
 	pl->num_sockets++;
 
 	return true;
 }
 
-static int packet_entry_cmp(void const *one, void const *two)
-{
-	RADIUS_PACKET const * const *a = one;
-	RADIUS_PACKET const * const *b = two;
-
-	return fr_packet_cmp(*a, *b);
-}
-
 void fr_packet_list_free(fr_packet_list_t *pl)
 {
 	if (!pl) return;
 
-	rbtree_free(pl->tree);
+	talloc_free(pl->ph);
+	fr_hash_table_free(pl->dsts);
 	free(pl);
 }
 
@@ -483,8 +918,14 @@ fr_packet_list_t *fr_packet_list_create(int alloc_id)
 	if (!pl) return NULL;
 	memset(pl, 0, sizeof(*pl));
 
-	pl->tree = rbtree_create(NULL, packet_entry_cmp, NULL, 0);
-	if (!pl->tree) {
+	pl->ph = fr_packet_hash_create(NULL);
+	if (!pl->ph) {
+		fr_packet_list_free(pl);
+		return NULL;
+	}
+
+	pl->dsts = fr_hash_table_create(packet_dst_hash, packet_dst_cmp, free);
+	if (!pl->dsts) {
 		fr_packet_list_free(pl);
 		return NULL;
 	}
@@ -508,7 +949,7 @@ bool fr_packet_list_insert(fr_packet_list_t *pl,
 {
 	if (!pl || !request_p || !*request_p) return 0;
 
-	return rbtree_insert(pl->tree, request_p);
+	return fr_packet_hash_insert(pl->ph, request_p);
 }
 
 RADIUS_PACKET **fr_packet_list_find(fr_packet_list_t *pl,
@@ -516,7 +957,7 @@ RADIUS_PACKET **fr_packet_list_find(fr_packet_list_t *pl,
 {
 	if (!pl || !request) return 0;
 
-	return rbtree_finddata(pl->tree, &request);
+	return fr_packet_hash_find(pl->ph, request);
 }
 
 
@@ -527,7 +968,7 @@ RADIUS_PACKET **fr_packet_list_find(fr_packet_list_t *pl,
 RADIUS_PACKET **fr_packet_list_find_byreply(fr_packet_list_t *pl,
 					      RADIUS_PACKET *reply)
 {
-	RADIUS_PACKET my_request, *request;
+	RADIUS_PACKET my_request;
 	fr_packet_socket_t *ps;
 
 	if (!pl || !reply) return NULL;
@@ -554,33 +995,57 @@ RADIUS_PACKET **fr_packet_list_find_byreply(fr_packet_list_t *pl,
 	my_request.dst_ipaddr = reply->src_ipaddr;
 	my_request.dst_port = reply->src_port;
 
-	request = &my_request;
-
-	return rbtree_finddata(pl->tree, &request);
+	return fr_packet_hash_find(pl->ph, &my_request);
 }
 
 
 bool fr_packet_list_yank(fr_packet_list_t *pl, RADIUS_PACKET *request)
 {
-	rbnode_t *node;
-
 	if (!pl || !request) return false;
 
-	node = rbtree_find(pl->tree, &request);
-	if (!node) return false;
-
-	rbtree_delete(pl->tree, node);
-	return true;
+	return fr_packet_hash_yank(pl->ph, request);
 }
 
 uint32_t fr_packet_list_num_elements(fr_packet_list_t *pl)
 {
 	if (!pl) return 0;
 
-	return rbtree_num_elements(pl->tree);
+	return fr_packet_hash_num_elements(pl->ph);
 }
 
 
+static bool packet_socket_match(fr_packet_socket_t const *ps, RADIUS_PACKET const *request,
+				int src_any)
+{
+	/*
+	 *	Address families don't match, skip it.
+	 */
+	if (ps->src_ipaddr.af != request->dst_ipaddr.af) return false;
+
+	/*
+	 *	MUST match requested src port, if one has been given.
+	 */
+	if ((request->src_port != 0) &&
+	    (ps->src_port != request->src_port)) return false;
+
+	/*
+	 *	We're sourcing from *, and they asked for a
+	 *	specific source address: ignore it.
+	 */
+	if (ps->src_any && !src_any) return false;
+
+	/*
+	 *	We're sourcing from a specific IP, and they
+	 *	asked for a source IP that isn't us: ignore
+	 *	it.
+	 */
+	if (!ps->src_any && !src_any &&
+	    (fr_ipaddr_cmp(&request->src_ipaddr,
+			   &ps->src_ipaddr) != 0)) return false;
+
+	return true;
+}
+
 /*
  *	1 == ID was allocated & assigned
  *	0 == couldn't allocate ID.
@@ -603,7 +1068,7 @@ uint32_t fr_packet_list_num_elements(fr_packet_list_t *pl)
 bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 			    RADIUS_PACKET **request_p, void **pctx)
 {
-	int i, j, k, fd, id, start_i, start_j, start_k;
+	int i, id;
 	int src_any = 0;
 	fr_packet_socket_t *ps;
 	RADIUS_PACKET *request = *request_p;
@@ -644,135 +1109,46 @@ bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 	}
 
 	/*
-	 *	FIXME: Go to an LRU system.  This prevents ID re-use
-	 *	for as long as possible.  The main problem with that
-	 *	approach is that it requires us to populate the
-	 *	LRU/FIFO when we add a new socket, or a new destination,
-	 *	which can be expensive.
-	 *
-	 *	The LRU can be avoided if the caller takes care to free
-	 *	Id's only when all responses have been received, OR after
-	 *	a timeout.
-	 *
-	 *	Right now, the random approach is almost OK... it's
-	 *	brute-force over all of the available ID's, BUT using
-	 *	random numbers for everything spreads the load a bit.
-	 *
-	 *	The old method had a hash lookup on allocation AND
-	 *	on free.  The new method has brute-force on allocation,
-	 *	and near-zero cost on free.
+	 *	Look for a socket which sends to this address and
+	 *	port, then to this address and any port, then to any
+	 *	address and this port, and finally to anywhere.  Each
+	 *	destination has a list of the sockets which have free
+	 *	IDs, so we don't look at any full sockets.
 	 */
+	for (i = 0; i < 4; i++) {
+		fr_packet_dst_t my_dst, *dst;
 
-	id = fd = -1;
-	start_i = fr_rand() & SOCKOFFSET_MASK;
-
-#define ID_i ((i + start_i) & SOCKOFFSET_MASK)
-	for (i = 0; i < MAX_SOCKETS; i++) {
-		if (pl->sockets[ID_i].sockfd == -1) continue; /* paranoia */
-
-		ps = &(pl->sockets[ID_i]);
-
-		/*
-		 *	This socket is marked as "don't use for new
-		 *	packets".  But we can still receive packets
-		 *	that are outstanding.
-		 */
-		if (ps->dont_use) continue;
-
-		/*
-		 *	All IDs are allocated: ignore it.
-		 */
-		if (ps->num_outgoing == 256) continue;
-
-#ifdef WITH_TCP
-		if (ps->proto != proto) continue;
-#endif
-
-		/*
-		 *	Address families don't match, skip it.
-		 */
-		if (ps->src_ipaddr.af != request->dst_ipaddr.af) continue;
-
-		/*
-		 *	MUST match dst port, if we have one.
-		 */
-		if ((ps->dst_port != 0) &&
-		    (ps->dst_port != request->dst_port)) continue;
-
-		/*
-		 *	MUST match requested src port, if one has been given.
-		 */
-		if ((request->src_port != 0) &&
-		    (ps->src_port != request->src_port)) continue;
-
-		/*
-		 *	We're sourcing from *, and they asked for a
-		 *	specific source address: ignore it.
-		 */
-		if (ps->src_any && !src_any) continue;
-
-		/*
-		 *	We're sourcing from a specific IP, and they
-		 *	asked for a source IP that isn't us: ignore
-		 *	it.
-		 */
-		if (!ps->src_any && !src_any &&
-		    (fr_ipaddr_cmp(&request->src_ipaddr,
-				   &ps->src_ipaddr) != 0)) continue;
-
-		/*
-		 *	UDP sockets are allowed to match
-		 *	destination IPs exactly, OR a socket
-		 *	with destination * is allowed to match
-		 *	any requested destination.
-		 *
-		 *	TCP sockets must match the destination
-		 *	exactly.  They *always* have dst_any=0,
-		 *	so the first check always matches.
-		 */
-		if (!ps->dst_any &&
-		    (fr_ipaddr_cmp(&request->dst_ipaddr,
-				   &ps->dst_ipaddr) != 0)) continue;
-
-		/*
-		 *	Otherwise, this socket is OK to use.
-		 */
-
-		/*
-		 *	Look for a free Id, starting from a random number.
-		 */
-		start_j = fr_rand() & 0x1f;
-#define ID_j ((j + start_j) & 0x1f)
-		for (j = 0; j < 32; j++) {
-			if (ps->id[ID_j] == 0xff) continue;
+		packet_dst_key(&my_dst, proto, &request->dst_ipaddr,
+			       (i & 0x01) ? 0 : request->dst_port, (i & 0x02) != 0);
 
+		dst = fr_hash_table_finddata(pl->dsts, &my_dst);
+		if (!dst || !dst->available) continue;
 
-			start_k = fr_rand() & 0x07;
-#define ID_k ((k + start_k) & 0x07)
-			for (k = 0; k < 8; k++) {
-				if ((ps->id[ID_j] & (1 << ID_k)) != 0) continue;
-
-				ps->id[ID_j] |= (1 << ID_k);
-				id = (ID_j * 8) + ID_k;
-				fd = i;
-				break;
-			}
-			if (fd >= 0) break;
-		}
-#undef ID_i
-#undef ID_j
-#undef ID_k
-		if (fd >= 0) break;
-		break;
+		ps = dst->available;
+		do {
+			if (packet_socket_match(ps, request, src_any)) goto found;
+			ps = ps->next;
+		} while (ps != dst->available);
 	}
 
 	/*
 	 *	Ask the caller to allocate a new ID.
 	 */
-	if (fd < 0) {
-		fr_strerror_printf("Failed finding socket, caller must allocate a new one");
-		return false;
-	}
+	fr_strerror_printf("Failed finding socket, caller must allocate a new one");
+	return false;
+
+found:
+	/*
+	 *	Use the next socket for the next packet, so that the
+	 *	packets are spread across all of them.
+	 */
+	ps->dst->available = ps->next;
+
+	/*
+	 *	Take the ID which has been free for the longest time.
+	 */
+	id = ps->free_ids[ps->free_head++];
+	ps->id[(id >> 3) & 0x1f] |= (1 << (id & 0x07));
 
 	/*
 	 *	Set the ID, source IP, and source port.
@@ -790,14 +1166,16 @@ bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 		if (pctx) *pctx = ps->ctx;
 		ps->num_outgoing++;
 		pl->num_outgoing++;
+		packet_socket_available(ps);
 		return true;
 	}
 
 	/*
-	 *	Mark the ID as free.  This is the one line from
-	 *	id_free() that we care about here.
+	 *	Mark the ID as free, and put it back where we found
+	 *	it.
 	 */
 	ps->id[(request->id >> 3) & 0x1f] &= ~(1 << (request->id & 0x07));
+	ps->free_head--;
 
 	request->id = -1;
 	request->sockfd = -1;
@@ -820,19 +1198,33 @@ bool fr_packet_list_id_free(fr_packet_list_t *pl,
 
 	if (yank && !fr_packet_list_yank(pl, request)) return false;
 
+	if ((request->id < 0) || (request->id > 255)) {
+		fr_strerror_printf("Invalid ID %d", request->id);
+		return false;
+	}
+
 	ps = fr_socket_find(pl, request->sockfd);
 	if (!ps) return false;
 
-#if 0
-	if (!ps->id[(request->id >> 3) & 0x1f] & (1 << (request->id & 0x07))) {
-		fr_exit(1);
+	/*
+	 *	Freeing an ID twice would put it on the free list
+	 *	twice.
+	 */
+	if ((ps->id[(request->id >> 3) & 0x1f] & (1 << (request->id & 0x07))) == 0) {
+		fr_strerror_printf("ID %d is not allocated", request->id);
+		return false;
 	}
-#endif
 
 	ps->id[(request->id >> 3) & 0x1f] &= ~(1 << (request->id & 0x07));
 
+	/*
+	 *	Add the ID to the end of the free list.
+	 */
+	ps->free_ids[(ps->free_head + 256 - ps->num_outgoing) & 0xff] = request->id;
+
 	ps->num_outgoing--;
 	pl->num_outgoing--;
+	packet_socket_available(ps);
 
 	request->id = -1;
 	request->src_ipaddr.af = AF_UNSPEC; /* id_alloc checks this */
@@ -842,7 +1234,7 @@ bool fr_packet_list_id_free(fr_packet_list_t *pl,
 }
 
 /*
- *	We always walk RBTREE_DELETE_ORDER, which is like RBTREE_IN_ORDER, except that
+ *	The packets are walked in no particular order.  The callback returns
  *	<0 means error, stop
  *	0  means OK, continue
  *	1  means delete current node and stop
@@ -852,7 +1244,7 @@ int fr_packet_list_walk(fr_packet_list_t *pl, void *ctx, rb_walker_t callback)
 {
 	if (!pl || !callback) return 0;
 
-	return rbtree_walk(pl->tree, RBTREE_DELETE_ORDER, callback, ctx);
+	return fr_packet_hash_walk(pl->ph, ctx, callback);
 }
 
 int fr_packet_list_fd_set(fr_packet_list_t *pl, fd_set *set)
@@ -924,7 +1316,7 @@ uint32_t fr_packet_list_num_incoming(fr_packet_list_t *pl)
 
 	if (!pl) return 0;
 
-	num_elements = rbtree_num_elements(pl->tree);
+	num_elements = fr_packet_hash_num_elements(pl->ph);
 	if (num_elements < pl->num_outgoing) return 0; /* panic! */
 
 	return num_elements - pl->num_outgoing;
@@ -936,3 +1328,134 @@ uint32_t fr_packet_list_num_outgoing(fr_packet_list_t *pl)
 
 	return pl->num_outgoing;
 }
+
+#ifdef TESTING
+/*
+ *  Compare the packet hash table with an rbtree, for the inserts,
+ *  lookups and deletes done by request and proxy tracking.
+ *
+ *  cc -g -O2 -DTESTING -I .. packet.c -o packet -lfreeradius-radius
+ *
+ *  ./packet [num_packets ...]
+ */
+static int packet_entry_cmp(void const *one, void const *two)
+{
+	RADIUS_PACKET const * const *a = one;
+	RADIUS_PACKET const * const *b = two;
+
+	return fr_packet_cmp(*a, *b);
+}
+
+static double elapsed(struct timeval const *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) + ((now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+static void benchmark(uint32_t num)
+{
+	uint32_t i;
+	RADIUS_PACKET *packets, **ptrs;
+	rbtree_t *tree;
+	fr_packet_hash_t *ph;
+	struct timeval start;
+	double insert, find, yank;
+
+	packets = calloc(num, sizeof(*packets));
+	ptrs = calloc(num, sizeof(*ptrs));
+	if (!packets || !ptrs) fr_exit(1);
+
+	/*
+	 *	Many clients, each using many source ports, all
+	 *	sending to one socket.
+	 */
+	for (i = 0; i < num; i++) {
+		RADIUS_PACKET *packet = &packets[i];
+
+		packet->id = i & 0xff;
+		packet->sockfd = 3;
+		packet->src_port = 1024 + ((i >> 8) & 0x3fff);
+		packet->src_ipaddr.af = AF_INET;
+		packet->src_ipaddr.prefix = 32;
+		packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(0x0a000000 | (i >> 22));
+		packet->dst_port = 1812;
+		packet->dst_ipaddr.af = AF_INET;
+		packet->dst_ipaddr.prefix = 32;
+		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl(0x7f000001);
+		ptrs[i] = packet;
+	}
+
+	tree = rbtree_create(NULL, packet_entry_cmp, NULL, 0);
+	if (!tree) fr_exit(1);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!rbtree_insert(tree, &ptrs[i])) fr_exit(1);
+	}
+	insert = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (rbtree_finddata(tree, &ptrs[(i * 7919) % num]) != &ptrs[(i * 7919) % num]) fr_exit(1);
+	}
+	find = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!rbtree_deletebydata(tree, &ptrs[i])) fr_exit(1);
+	}
+	yank = elapsed(&start);
+
+	printf("%8u rbtree\tinsert %.3fs\tfind %.3fs\tdelete %.3fs\n", num, insert, find, yank);
+	rbtree_free(tree);
+
+	ph = fr_packet_hash_create(NULL);
+	if (!ph) fr_exit(1);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!fr_packet_hash_insert(ph, &ptrs[i])) fr_exit(1);
+	}
+	insert = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (fr_packet_hash_find(ph, ptrs[(i * 7919) % num]) != &ptrs[(i * 7919) % num]) fr_exit(1);
+	}
+	find = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num; i++) {
+		if (!fr_packet_hash_yank(ph, ptrs[i])) fr_exit(1);
+	}
+	yank = elapsed(&start);
+
+	if (fr_packet_hash_num_elements(ph) != 0) fr_exit(1);
+
+	printf("%8u hash\tinsert %.3fs\tfind %.3fs\tdelete %.3fs\n", num, insert, find, yank);
+	talloc_free(ph);
+
+	free(ptrs);
+	free(packets);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2) {
+		benchmark(100000);
+		benchmark(1000000);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		benchmark(atoi(argv[i]));
+	}
+
+	return 0;
+}
+#endif
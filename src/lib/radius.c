@@ -32,6 +32,10 @@ RCSID("$Id$")
 #include	<fcntl.h>
 #include	<ctype.h>
 
+#if defined(WITH_RADIUS_BATCH) && defined(HAVE_PTHREAD_H)
+#  include	<pthread.h>
+#endif
+
 #ifdef WITH_UDPFROMTO
 #include	<freeradius-devel/udpfromto.h>
 #endif
@@ -381,6 +385,64 @@ ssize_t rad_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
 }
 
 
+/** Read a datagram into a buffer, and get the source and destination addresses
+ *
+ */
+static ssize_t rad_recvfrom_buffer(int sockfd, uint8_t *data, size_t len, int flags,
+				   fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+				   fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port)
+{
+	struct sockaddr_storage	src;
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_src = sizeof(src);
+	socklen_t		sizeof_dst = sizeof(dst);
+	ssize_t			data_len;
+	uint16_t		port;
+
+	memset(&src, 0, sizeof_src);
+	memset(&dst, 0, sizeof_dst);
+
+	/*
+	 *	Receive the packet.  The OS will discard any data in the
+	 *	packet after "len" bytes.
+	 */
+#ifdef WITH_UDPFROMTO
+	data_len = recvfromto(sockfd, data, len, flags,
+			      (struct sockaddr *)&src, &sizeof_src,
+			      (struct sockaddr *)&dst, &sizeof_dst);
+#else
+	data_len = recvfrom(sockfd, data, len, flags,
+			    (struct sockaddr *)&src, &sizeof_src);
+
+	/*
+	 *	Get the destination address, too.
+	 */
+	if (getsockname(sockfd, (struct sockaddr *)&dst,
+			&sizeof_dst) < 0) return -1;
+#endif
+	if (data_len < 0) {
+		return data_len;
+	}
+
+	if (!fr_sockaddr2ipaddr(&src, sizeof_src, src_ipaddr, &port)) {
+		return -1;	/* Unknown address family, Die Die Die! */
+	}
+	*src_port = port;
+
+	fr_sockaddr2ipaddr(&dst, sizeof_dst, dst_ipaddr, &port);
+	*dst_port = port;
+
+	/*
+	 *	Different address families should never happen.
+	 */
+	if (src.ss_family != dst.ss_family) {
+		return -1;
+	}
+
+	return data_len;
+}
+
+
 /** Wrapper for recvfrom, which handles recvfromto, IPv6, and all possible combinations
  *
  */
@@ -389,16 +451,12 @@ static ssize_t rad_recvfrom(int sockfd, RADIUS_PACKET *packet, int flags,
 			    fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port)
 {
 	struct sockaddr_storage	src;
-	struct sockaddr_storage	dst;
 	socklen_t		sizeof_src = sizeof(src);
-	socklen_t		sizeof_dst = sizeof(dst);
 	ssize_t			data_len;
 	uint8_t			header[4];
 	size_t			len;
-	uint16_t		port;
 
 	memset(&src, 0, sizeof_src);
-	memset(&dst, 0, sizeof_dst);
 
 	/*
 	 *	Read the length of the packet, from the packet.
@@ -449,44 +507,8 @@ static ssize_t rad_recvfrom(int sockfd, RADIUS_PACKET *packet, int flags,
 	packet->data = talloc_array(packet, uint8_t, len);
 	if (!packet->data) return -1;
 
-	/*
-	 *	Receive the packet.  The OS will discard any data in the
-	 *	packet after "len" bytes.
-	 */
-#ifdef WITH_UDPFROMTO
-	data_len = recvfromto(sockfd, packet->data, len, flags,
-			      (struct sockaddr *)&src, &sizeof_src,
-			      (struct sockaddr *)&dst, &sizeof_dst);
-#else
-	data_len = recvfrom(sockfd, packet->data, len, flags,
-			    (struct sockaddr *)&src, &sizeof_src);
-
-	/*
-	 *	Get the destination address, too.
-	 */
-	if (getsockname(sockfd, (struct sockaddr *)&dst,
-			&sizeof_dst) < 0) return -1;
-#endif
-	if (data_len < 0) {
-		return data_len;
-	}
-
-	if (!fr_sockaddr2ipaddr(&src, sizeof_src, src_ipaddr, &port)) {
-		return -1;	/* Unknown address family, Die Die Die! */
-	}
-	*src_port = port;
-
-	fr_sockaddr2ipaddr(&dst, sizeof_dst, dst_ipaddr, &port);
-	*dst_port = port;
-
-	/*
-	 *	Different address families should never happen.
-	 */
-	if (src.ss_family != dst.ss_family) {
-		return -1;
-	}
-
-	return data_len;
+	return rad_recvfrom_buffer(sockfd, packet->data, len, flags,
+				   src_ipaddr, src_port, dst_ipaddr, dst_port);
 }
 
 
@@ -1971,20 +1993,12 @@ int rad_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 	return 0;
 }
 
-/** Reply to the request
+/** Encode and sign a packet, if that hasn't been done already
  *
- * Also attach reply attribute value pairs and any user message provided.
  */
-int rad_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-	     char const *secret)
+static int rad_send_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
+			   char const *secret)
 {
-	/*
-	 *	Maybe it's a fake packet.  Don't send it.
-	 */
-	if (!packet || (packet->sockfd < 0)) {
-		return 0;
-	}
-
 	/*
 	 *  First time through, allocate room for the packet
 	 */
@@ -2014,6 +2028,25 @@ int rad_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 	if ((fr_debug_flag > 3) && fr_log_fp) rad_print_hex(packet);
 #endif
 
+	return 0;
+}
+
+/** Reply to the request
+ *
+ * Also attach reply attribute value pairs and any user message provided.
+ */
+int rad_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
+	     char const *secret)
+{
+	/*
+	 *	Maybe it's a fake packet.  Don't send it.
+	 */
+	if (!packet || (packet->sockfd < 0)) {
+		return 0;
+	}
+
+	if (rad_send_encode(packet, original, secret) < 0) return -1;
+
 #ifdef WITH_TCP
 	/*
 	 *	If the socket is TCP, call write().  Calling sendto()
@@ -2641,6 +2674,533 @@ RADIUS_PACKET *rad_recv(int fd, int flags)
 }
 
 
+/** Check the header of a datagram which has been read into packet->data
+ *
+ */
+static ssize_t rad_recv_datagram_check(int sockfd, RADIUS_PACKET *packet, ssize_t data_len)
+{
+	ssize_t packet_len;
+
+	/*
+	 *	Too little data is available, discard the packet.
+	 */
+	if (data_len < 4) return 1;
+
+	/*
+	 *	See how long the packet says it is.  It's malformed
+	 *	if that's less than a RADIUS header, or more than the
+	 *	RFC limit of 4k.
+	 */
+	packet_len = (packet->data[2] * 256) + packet->data[3];
+	if ((packet_len < RADIUS_HDR_LEN) || (packet_len > MAX_PACKET_LEN)) return 1;
+
+	packet->data_len = data_len;
+	packet->code = packet->data[0];
+	packet->sockfd = sockfd;
+
+	/*
+	 *	The packet says it's this long, but the actual UDP
+	 *	size could still be smaller.  rad_packet_ok() checks
+	 *	that.
+	 */
+	return packet_len;
+}
+
+
+/** Receive a UDP datagram into a RADIUS_PACKET, with one system call
+ *
+ * rad_recv_header() peeks at the datagram, and rad_recv() then reads
+ * it again.  This function instead reads the whole datagram into
+ * packet->data, which is a buffer of MAX_PACKET_LEN bytes.  The caller
+ * can then check the client and packet code, and either call
+ * rad_recv_datagram_ok() to keep the packet, or call this function
+ * again with the same packet, re-using the buffer.
+ *
+ * @param sockfd to read from.
+ * @param packet to read into.  Allocate it with rad_alloc().
+ * @return
+ *	- -1 on error.
+ *	- 0 if the socket had no data.
+ *	- 1 if the packet is malformed.
+ *	- The length of the RADIUS packet (from its header) otherwise.
+ */
+ssize_t rad_recv_datagram(int sockfd, RADIUS_PACKET *packet)
+{
+	ssize_t data_len;
+
+	if (!packet->data) {
+		packet->data = talloc_array(packet, uint8_t, MAX_PACKET_LEN);
+		if (!packet->data) {
+			fr_strerror_printf("out of memory");
+			return -1;
+		}
+	}
+
+	packet->data_len = 0;
+	packet->code = 0;
+
+	data_len = rad_recvfrom_buffer(sockfd, packet->data, MAX_PACKET_LEN, 0,
+				       &packet->src_ipaddr, &packet->src_port,
+				       &packet->dst_ipaddr, &packet->dst_port);
+	if (data_len < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR)) return 0;
+		return -1;
+	}
+
+	return rad_recv_datagram_check(sockfd, packet, data_len);
+}
+
+/** Check a packet read by rad_recv_datagram()
+ *
+ * Does the same checks as rad_recv(), and trims the receive buffer
+ * down to the size of the packet.
+ *
+ * @param packet read by rad_recv_datagram().
+ * @param flags as for rad_recv().
+ * @return true if the packet is well-formed, false otherwise.
+ */
+bool rad_recv_datagram_ok(RADIUS_PACKET *packet, int flags)
+{
+	uint8_t *data;
+
+	if ((packet->data_len == 0) || !packet->data) {
+		fr_strerror_printf("Empty packet: Socket is not ready");
+		return false;
+	}
+
+	if (!rad_packet_ok(packet, flags, NULL)) return false;
+
+	/*
+	 *	Shrinking a buffer is done in place by most allocators,
+	 *	so this doesn't copy the packet.
+	 */
+	data = talloc_realloc(packet, packet->data, uint8_t, packet->data_len);
+	if (data) packet->data = data;
+
+	packet->vps = NULL;
+
+#ifndef NDEBUG
+	if ((fr_debug_flag > 3) && fr_log_fp) rad_print_hex(packet);
+#endif
+
+	return true;
+}
+
+
+#ifdef WITH_RADIUS_BATCH
+/*
+ *	Batched I/O for UDP sockets.  recvmmsg() reads many datagrams
+ *	with one system call, and sendmmsg() writes many.
+ */
+struct fr_packet_batch {
+	int			sockfd;
+	uint32_t		size;		//!< Maximum number of datagrams per system call.
+	bool			bound_any;	//!< Socket is bound to a wildcard address.
+	struct sockaddr_storage	me;		//!< Address the socket is bound to.
+	socklen_t		sizeof_me;
+
+	/*
+	 *	Receive side.  Only the thread reading the socket
+	 *	touches these.
+	 */
+	uint32_t		received;	//!< Number of datagrams read by the last recvmmsg().
+	uint32_t		next;		//!< The next one to return.
+	RADIUS_PACKET		**packets;
+	struct mmsghdr		*in;
+	struct iovec		*in_iov;
+	struct sockaddr_storage	*in_src;
+	uint8_t			*in_cmsg;
+
+	/*
+	 *	Send side.  Replies may be queued by many threads.
+	 */
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;
+#endif
+	uint32_t		queued;		//!< Number of replies waiting for sendmmsg().
+	struct mmsghdr		*out;
+	struct iovec		*out_iov;
+	struct sockaddr_storage	*out_dst;
+	uint8_t			*out_cmsg;
+	uint8_t			*out_data;
+};
+
+#ifdef HAVE_PTHREAD_H
+#  define BATCH_LOCK(_x)	pthread_mutex_lock(&(_x)->mutex)
+#  define BATCH_UNLOCK(_x)	pthread_mutex_unlock(&(_x)->mutex)
+#else
+#  define BATCH_LOCK(_x)
+#  define BATCH_UNLOCK(_x)
+#endif
+
+#ifdef WITH_UDPFROMTO
+#  define BATCH_CMSG_SIZE UDPFROMTO_CMSG_SIZE
+#else
+#  define BATCH_CMSG_SIZE 0
+#endif
+
+static int _batch_free(fr_packet_batch_t *batch)
+{
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&batch->mutex);
+#endif
+	return 0;
+}
+
+/** Allocate the buffers for batched I/O on a UDP socket
+ *
+ * @param ctx to allocate the batch in.
+ * @param sockfd the UDP socket.
+ * @param size maximum number of datagrams read or written with one
+ *	system call.
+ * @return the new batch, or NULL on error.
+ */
+fr_packet_batch_t *rad_batch_alloc(TALLOC_CTX *ctx, int sockfd, uint32_t size)
+{
+	fr_packet_batch_t	*batch;
+	struct sockaddr_storage	me;
+	socklen_t		sizeof_me = sizeof(me);
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+	uint32_t		i;
+
+	if (size == 0) {
+		fr_strerror_printf("Batch size must be greater than zero");
+		return NULL;
+	}
+
+	memset(&me, 0, sizeof(me));
+	if (getsockname(sockfd, (struct sockaddr *) &me, &sizeof_me) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return NULL;
+	}
+
+	if (!fr_sockaddr2ipaddr(&me, sizeof_me, &ipaddr, &port)) {
+		fr_strerror_printf("Socket has unsupported address family");
+		return NULL;
+	}
+
+	batch = talloc_zero(ctx, fr_packet_batch_t);
+	if (!batch) goto oom;
+	batch->sockfd = sockfd;
+	batch->size = size;
+	batch->bound_any = fr_inaddr_any(&ipaddr) == 1;
+
+	/*
+	 *	recvmmsg() doesn't give us the destination port, and
+	 *	it doesn't give the destination IP unless udpfromto
+	 *	is in use.  The socket is already bound, so remember
+	 *	its address for the received datagrams.
+	 */
+	batch->me = me;
+	batch->sizeof_me = sizeof_me;
+
+	batch->packets = talloc_zero_array(batch, RADIUS_PACKET *, size);
+	batch->in = talloc_zero_array(batch, struct mmsghdr, size);
+	batch->in_iov = talloc_zero_array(batch, struct iovec, size);
+	batch->in_src = talloc_zero_array(batch, struct sockaddr_storage, size);
+	batch->out = talloc_zero_array(batch, struct mmsghdr, size);
+	batch->out_iov = talloc_zero_array(batch, struct iovec, size);
+	batch->out_dst = talloc_zero_array(batch, struct sockaddr_storage, size);
+	batch->out_data = talloc_array(batch, uint8_t, size * MAX_PACKET_LEN);
+	if (!batch->packets || !batch->in || !batch->in_iov || !batch->in_src ||
+	    !batch->out || !batch->out_iov || !batch->out_dst || !batch->out_data) goto oom;
+
+#ifdef WITH_UDPFROMTO
+	batch->in_cmsg = talloc_array(batch, uint8_t, size * BATCH_CMSG_SIZE);
+	batch->out_cmsg = talloc_array(batch, uint8_t, size * BATCH_CMSG_SIZE);
+	if (!batch->in_cmsg || !batch->out_cmsg) goto oom;
+#endif
+
+	for (i = 0; i < size; i++) {
+		batch->in[i].msg_hdr.msg_iov = &batch->in_iov[i];
+		batch->in[i].msg_hdr.msg_iovlen = 1;
+
+		batch->out_iov[i].iov_base = batch->out_data + (i * MAX_PACKET_LEN);
+		batch->out[i].msg_hdr.msg_iov = &batch->out_iov[i];
+		batch->out[i].msg_hdr.msg_iovlen = 1;
+		batch->out[i].msg_hdr.msg_name = &batch->out_dst[i];
+	}
+
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&batch->mutex, NULL) != 0) {
+		fr_strerror_printf("Failed initializing mutex");
+		talloc_free(batch);
+		return NULL;
+	}
+#endif
+	talloc_set_destructor(batch, _batch_free);
+
+	return batch;
+
+oom:
+	fr_strerror_printf("out of memory");
+	talloc_free(batch);
+	return NULL;
+}
+
+/** Read up to batch->size datagrams with one system call
+ *
+ * The datagrams are then returned one at a time by rad_batch_datagram().
+ * Any which haven't been returned yet are discarded.
+ *
+ * @param batch to read into.
+ * @return
+ *	- -1 on error.
+ *	- 0 if the socket had no data.
+ *	- The number of datagrams read otherwise.
+ */
+int rad_batch_recv(fr_packet_batch_t *batch)
+{
+	int			rcode;
+	uint32_t		i;
+
+	batch->received = batch->next = 0;
+
+	for (i = 0; i < batch->size; i++) {
+		RADIUS_PACKET *packet = batch->packets[i];
+
+		/*
+		 *	The caller took the packet which was here.
+		 */
+		if (!packet) {
+			packet = batch->packets[i] = rad_alloc(batch, false);
+			if (!packet) goto oom;
+		}
+
+		/*
+		 *	Or it swapped in one with a trimmed buffer.
+		 */
+		if (!packet->data || (talloc_array_length(packet->data) < MAX_PACKET_LEN)) {
+			talloc_free(packet->data);
+			packet->data = talloc_array(packet, uint8_t, MAX_PACKET_LEN);
+			if (!packet->data) goto oom;
+		}
+
+		batch->in_iov[i].iov_base = packet->data;
+		batch->in_iov[i].iov_len = MAX_PACKET_LEN;
+		batch->in[i].msg_hdr.msg_name = &batch->in_src[i];
+		batch->in[i].msg_hdr.msg_namelen = sizeof(batch->in_src[i]);
+#ifdef WITH_UDPFROMTO
+		batch->in[i].msg_hdr.msg_control = batch->in_cmsg + (i * BATCH_CMSG_SIZE);
+		batch->in[i].msg_hdr.msg_controllen = BATCH_CMSG_SIZE;
+#endif
+		batch->in[i].msg_hdr.msg_flags = 0;
+		batch->in[i].msg_len = 0;
+	}
+
+	/*
+	 *	Block for the first datagram only.  The caller has
+	 *	usually been told that the socket is readable.
+	 */
+	rcode = recvmmsg(batch->sockfd, batch->in, batch->size, MSG_WAITFORONE, NULL);
+	if (rcode < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR)) return 0;
+		fr_strerror_printf("recvmmsg failed: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < (uint32_t) rcode; i++) {
+		RADIUS_PACKET		*packet = batch->packets[i];
+		struct sockaddr_storage	dst = batch->me;
+		socklen_t		sizeof_dst = batch->sizeof_me;
+
+#ifdef WITH_UDPFROMTO
+		udpfromto_cmsg_to(&batch->in[i].msg_hdr, (struct sockaddr *) &dst, &sizeof_dst);
+#endif
+
+		/*
+		 *	Unknown address family.  Make the datagram look
+		 *	malformed, so that it is ignored.
+		 */
+		if (!fr_sockaddr2ipaddr(&batch->in_src[i], batch->in[i].msg_hdr.msg_namelen,
+					&packet->src_ipaddr, &packet->src_port) ||
+		    !fr_sockaddr2ipaddr(&dst, sizeof_dst, &packet->dst_ipaddr, &packet->dst_port)) {
+			batch->in[i].msg_len = 0;
+		}
+	}
+	batch->received = rcode;
+
+	return rcode;
+
+oom:
+	fr_strerror_printf("out of memory");
+	return -1;
+}
+
+/** Return the next datagram read by rad_batch_recv()
+ *
+ * This is the batched version of rad_recv_datagram().  The packet
+ * in *packet_p is swapped with the next one in the batch, without
+ * copying any data.  *packet_p may be NULL, if the caller took the
+ * previous packet for itself.
+ *
+ * @param batch to read from.
+ * @param packet_p where the datagram is returned.
+ * @return as for rad_recv_datagram().  0 means the batch is empty.
+ */
+ssize_t rad_batch_datagram(fr_packet_batch_t *batch, RADIUS_PACKET **packet_p)
+{
+	uint32_t	i;
+	RADIUS_PACKET	*packet;
+
+	if (batch->next >= batch->received) return 0;
+
+	i = batch->next++;
+	packet = batch->packets[i];
+	batch->packets[i] = *packet_p;
+	*packet_p = packet;
+
+	packet->data_len = 0;
+	packet->code = 0;
+
+	return rad_recv_datagram_check(batch->sockfd, packet, batch->in[i].msg_len);
+}
+
+/** The number of datagrams read by rad_batch_recv() which haven't been returned yet
+ *
+ */
+uint32_t rad_batch_pending(fr_packet_batch_t const *batch)
+{
+	return batch->received - batch->next;
+}
+
+/*
+ *	Send the queued replies.  The caller must hold the lock.
+ */
+static int rad_batch_flush_locked(fr_packet_batch_t *batch)
+{
+	int		rcode;
+	uint32_t	sent = 0, failed = 0;
+
+	while (sent < batch->queued) {
+		rcode = sendmmsg(batch->sockfd, batch->out + sent, batch->queued - sent, 0);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+
+			/*
+			 *	The first datagram couldn't be sent.
+			 *	Skip it, and try the rest.
+			 */
+			fr_strerror_printf("sendmmsg failed: %s", fr_syserror(errno));
+			sent++;
+			failed++;
+			continue;
+		}
+		sent += rcode;
+	}
+	batch->queued = 0;
+
+	if (failed > 0) return -1;
+
+	return sent;
+}
+
+/** Send all of the queued replies, with one system call
+ *
+ * @param batch to flush.
+ * @return
+ *	- -1 if any reply couldn't be sent.
+ *	- The number of replies sent otherwise.
+ */
+int rad_batch_flush(fr_packet_batch_t *batch)
+{
+	int rcode;
+
+	BATCH_LOCK(batch);
+	rcode = rad_batch_flush_locked(batch);
+	BATCH_UNLOCK(batch);
+
+	return rcode;
+}
+
+/** Queue a reply, which is sent by a later call to rad_batch_flush()
+ *
+ * This is the batched version of rad_send().  The packet is encoded
+ * and signed as usual, and then copied to the batch, so the caller
+ * can free it.  If the batch is full, all of the queued replies are
+ * sent.
+ *
+ * @param batch to queue the reply in.
+ * @param packet to send.
+ * @param original the request, if packet is a reply.
+ * @param secret shared with the other end.
+ * @return
+ *	- -1 on error.
+ *	- 0 if the reply was queued.
+ *	- The number of replies sent, if the batch was flushed.
+ */
+int rad_batch_send(fr_packet_batch_t *batch, RADIUS_PACKET *packet,
+		   RADIUS_PACKET const *original, char const *secret)
+{
+	int		rcode = 0;
+	uint32_t	i;
+	struct msghdr	*msgh;
+	socklen_t	sizeof_dst;
+
+	/*
+	 *	Maybe it's a fake packet.  Don't send it.
+	 */
+	if (!packet || (packet->sockfd < 0)) {
+		return 0;
+	}
+
+	if (rad_send_encode(packet, original, secret) < 0) return -1;
+
+	if (packet->data_len > MAX_PACKET_LEN) {
+		fr_strerror_printf("Packet is too large to send");
+		return -1;
+	}
+
+	BATCH_LOCK(batch);
+	i = batch->queued;
+	msgh = &batch->out[i].msg_hdr;
+
+	if (!fr_ipaddr2sockaddr(&packet->dst_ipaddr, packet->dst_port,
+				&batch->out_dst[i], &sizeof_dst)) {
+		BATCH_UNLOCK(batch);
+		return -1;
+	}
+	msgh->msg_namelen = sizeof_dst;
+	msgh->msg_control = NULL;
+	msgh->msg_controllen = 0;
+
+#ifdef WITH_UDPFROMTO
+	/*
+	 *	Only say which source address to use if the socket
+	 *	could send from more than one.  As with rad_send(),
+	 *	if there's no source address, let the OS decide.
+	 */
+	if (batch->bound_any &&
+	    (packet->src_ipaddr.af != AF_UNSPEC) &&
+	    !fr_inaddr_any(&packet->src_ipaddr)) {
+		struct sockaddr_storage	src;
+		socklen_t		sizeof_src;
+
+		if (fr_ipaddr2sockaddr(&packet->src_ipaddr, packet->src_port, &src, &sizeof_src)) {
+			msgh->msg_control = batch->out_cmsg + (i * BATCH_CMSG_SIZE);
+			memset(msgh->msg_control, 0, BATCH_CMSG_SIZE);
+
+			if (udpfromto_cmsg_from(msgh, (struct sockaddr *) &src) < 0) {
+				msgh->msg_control = NULL;
+				msgh->msg_controllen = 0;
+			}
+		}
+	}
+#endif
+
+	memcpy(batch->out_iov[i].iov_base, packet->data, packet->data_len);
+	batch->out_iov[i].iov_len = packet->data_len;
+
+	batch->queued++;
+	if (batch->queued == batch->size) rcode = rad_batch_flush_locked(batch);
+	BATCH_UNLOCK(batch);
+
+	return rcode;
+}
+#endif	/* WITH_RADIUS_BATCH */
+
+
 /** Verify the Request/Response Authenticator (and Message-Authenticator if present) of a packet
  *
  */
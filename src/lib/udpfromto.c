@@ -160,14 +160,64 @@ int udpfromto_init(int s)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Get the destination address of a datagram from its control messages
+ *
+ * @param msgh as filled in by recvmsg() or recvmmsg().
+ * @param to initialised to the address the socket is bound to.  It may
+ *	be INADDR_ANY, in which case the more specific address from the
+ *	control messages is written here.
+ * @param tolen length of to.
+ */
+void udpfromto_cmsg_to(struct msghdr *msgh, struct sockaddr *to, socklen_t *tolen)
+{
+	struct cmsghdr *cmsg;
+
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh,cmsg)) {
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i =
+				(struct in_pktinfo *) CMSG_DATA(cmsg);
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*tolen = sizeof(struct sockaddr_in);
+			return;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+			((struct sockaddr_in *)to)->sin_addr = *i;
+			*tolen = sizeof(struct sockaddr_in);
+			return;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i =
+				(struct in6_pktinfo *) CMSG_DATA(cmsg);
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*tolen = sizeof(struct sockaddr_in6);
+			return;
+		}
+#endif
+	}
+}
+
 int recvfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t *fromlen,
 	       struct sockaddr *to, socklen_t *tolen)
 {
 	struct msghdr msgh;
-	struct cmsghdr *cmsg;
 	struct iovec iov;
-	char cbuf[256];
+	char cbuf[UDPFROMTO_CMSG_SIZE];
 	int err;
 	struct sockaddr_storage si;
 	socklen_t si_len = sizeof(si);
@@ -266,45 +316,95 @@ int recvfromto(int s, void *buf, size_t len, int flags,
 
 	if (fromlen) *fromlen = msgh.msg_namelen;
 
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh,cmsg)) {
+	udpfromto_cmsg_to(&msgh, to, tolen);
 
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i =
-				(struct in_pktinfo *) CMSG_DATA(cmsg);
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*tolen = sizeof(struct sockaddr_in);
-			break;
-		}
-#endif
+	return err;
+}
 
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
-			((struct sockaddr_in *)to)->sin_addr = *i;
-			*tolen = sizeof(struct sockaddr_in);
-			break;
-		}
-#endif
+/** Add the source address of an outgoing datagram to its control messages
+ *
+ * @param msgh to be sent with sendmsg() or sendmmsg().  msg_control
+ *	must point to a zeroed buffer of UDPFROMTO_CMSG_SIZE bytes.  If
+ *	the system can't set the source address, msg_control is set to
+ *	NULL, and the datagram goes out as if sent with sendto().
+ * @param from the source address.
+ * @return 0 on success, -1 if the address family is unknown.
+ */
+int udpfromto_cmsg_from(struct msghdr *msgh, struct sockaddr const *from)
+{
+	struct cmsghdr *cmsg;
 
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i =
-				(struct in6_pktinfo *) CMSG_DATA(cmsg);
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*tolen = sizeof(struct sockaddr_in6);
-			break;
-		}
+	if (from->sa_family == AF_INET) {
+#if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
+		msgh->msg_control = NULL;
+		return 0;
+#else
+		struct sockaddr_in const *s4 = (struct sockaddr_in const *) from;
+
+#  ifdef IP_PKTINFO
+		struct in_pktinfo *pkt;
+
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = SOL_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi_spec_dst = s4->sin_addr;
+#  endif
+
+#  ifdef IP_SENDSRCADDR
+		struct in_addr *in;
+
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_SENDSRCADDR;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
+
+		in = (struct in_addr *) CMSG_DATA(cmsg);
+		*in = s4->sin_addr;
+#  endif
+#endif	/* IP_PKTINFO or IP_SENDSRCADDR */
+	}
+
+#ifdef AF_INET6
+	else if (from->sa_family == AF_INET6) {
+#  if !defined(IPV6_PKTINFO)
+		msgh->msg_control = NULL;
+		return 0;
+#  else
+		struct sockaddr_in6 const *s6 = (struct sockaddr_in6 const *) from;
+
+		struct in6_pktinfo *pkt;
+
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi6_addr = s6->sin6_addr;
+#  endif	/* IPV6_PKTINFO */
+	}
 #endif
+
+	/*
+	 *	Unknown address family.
+	 */
+	else {
+		errno = EINVAL;
+		return -1;
 	}
 
-	return err;
+	return 0;
 }
 
 int sendfromto(int s, void *buf, size_t len, int flags,
@@ -312,9 +412,8 @@ int sendfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *to, socklen_t tolen)
 {
 	struct msghdr msgh;
-	struct cmsghdr *cmsg;
 	struct iovec iov;
-	char cbuf[256];
+	char cbuf[UDPFROMTO_CMSG_SIZE];
 
 #ifdef __FreeBSD__
 	/*
@@ -370,77 +469,9 @@ int sendfromto(int s, void *buf, size_t len, int flags,
 	msgh.msg_iovlen = 1;
 	msgh.msg_name = to;
 	msgh.msg_namelen = tolen;
+	msgh.msg_control = cbuf;
 
-	if (from->sa_family == AF_INET) {
-#if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
-		return sendto(s, buf, len, flags, to, tolen);
-#else
-		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
-
-#  ifdef IP_PKTINFO
-		struct in_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = SOL_IP;
-		cmsg->cmsg_type = IP_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi_spec_dst = s4->sin_addr;
-#  endif
-
-#  ifdef IP_SENDSRCADDR
-		struct in_addr *in;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IP;
-		cmsg->cmsg_type = IP_SENDSRCADDR;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
-
-		in = (struct in_addr *) CMSG_DATA(cmsg);
-		*in = s4->sin_addr;
-#  endif
-#endif	/* IP_PKTINFO or IP_SENDSRCADDR */
-	}
-
-#ifdef AF_INET6
-	else if (from->sa_family == AF_INET6) {
-#  if !defined(IPV6_PKTINFO)
-		return sendto(s, buf, len, flags, to, tolen);
-#  else
-		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
-
-		struct in6_pktinfo *pkt;
-
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
-
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IPV6;
-		cmsg->cmsg_type = IPV6_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
-
-		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi6_addr = s6->sin6_addr;
-#  endif	/* IPV6_PKTINFO */
-	}
-#endif
-
-	/*
-	 *	Unknown address family.
-	 */
-	else {
-		errno = EINVAL;
-		return -1;
-	}
+	if (udpfromto_cmsg_from(&msgh, from) < 0) return -1;
 
 	return sendmsg(s, &msgh, flags);
 }
@@ -1,3 +1,3 @@
-SUBMAKEFILES := radclient.mk radiusd.mk radsniff.mk radmin.mk radattr.mk \
+SUBMAKEFILES := radclient.mk radiusd.mk radsniff.mk radmin.mk radattr.mk raddict.mk \
 	radwho.mk radlast.mk radtest.mk radzap.mk checkrad.mk \
 	libfreeradius-server.mk unittest.mk
@@ -38,12 +38,65 @@ RCSID("$Id$")
 #endif
 #endif
 
+/*
+ *	Lookups don't take any locks.  Nodes are fully initialised
+ *	before they are linked into the trie, and are never unlinked
+ *	or freed until the whole list is freed.  Deleted clients are
+ *	freed later (see client_free), so a reader which has just
+ *	found one can still use it.
+ */
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#  define ATOMIC_PTR(_type)		_Atomic(_type)
+#  define load_ptr(_p)			atomic_load_explicit(&(_p), memory_order_acquire)
+#  define store_ptr(_p, _v)		atomic_store_explicit(&(_p), _v, memory_order_release)
+#else
+#  define ATOMIC_PTR(_type)		_type
+#  define load_ptr(_p)			(_p)
+#  define store_ptr(_p, _v)		((_p) = (_v))
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+/*
+ *	Clients for the same network may differ by protocol.
+ */
+#define CLIENT_PROTO_ANY	(0)
+#define CLIENT_PROTO_UDP	(1)
+#define CLIENT_PROTO_TCP	(2)
+#define CLIENT_PROTO_MAX	(3)
+
+/*
+ *	A node of a path-compressed binary trie, keyed by network.
+ *	Each node holds the clients (if any) for exactly its network,
+ *	and its children hold longer networks which differ at the
+ *	first bit after it.
+ *
+ *	IPv6 networks with a scope (e.g. fe80::1%eth0) are different
+ *	clients from the same network on other interfaces.  Their
+ *	clients are in a list of nodes hanging off the unscoped one.
+ */
+typedef struct client_node_t {
+	uint8_t				addr[16];	//!< Network, masked to prefix bits.
+	uint8_t				prefix;
+	uint32_t			scope;		//!< IPv6 scope of the clients in this node.
+	ATOMIC_PTR(struct client_node_t *)	child[2];
+	ATOMIC_PTR(struct client_node_t *)	scoped;		//!< The same network, with another scope.
+	ATOMIC_PTR(RADCLIENT *)		client[CLIENT_PROTO_MAX];
+} client_node_t;
+
 struct radclient_list {
-	/*
-	 *	FIXME: One set of trees for IPv4, and another for IPv6?
-	 */
-	rbtree_t	*trees[129]; /* for 0..128, inclusive. */
-	uint32_t       	min_prefix;
+	client_node_t	*v4;		//!< Root of the IPv4 trie (0.0.0.0/0).
+	client_node_t	*v6;		//!< Root of the IPv6 trie (::/0).
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex;		//!< Serialises changes to the tries.
+#endif
 };
 
 
@@ -99,29 +152,214 @@ void client_free(RADCLIENT *client)
 }
 
 /*
- *	Callback for comparing two clients.
+ *	Which client slot in a node a protocol uses.
  */
-static int client_ipaddr_cmp(void const *one, void const *two)
+static int client_proto_slot(int proto)
 {
-	RADCLIENT const *a = one;
-	RADCLIENT const *b = two;
-#ifndef WITH_TCP
+#ifdef WITH_TCP
+	switch (proto) {
+	case IPPROTO_UDP:
+		return CLIENT_PROTO_UDP;
 
-	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-#else
-	int rcode;
+	case IPPROTO_TCP:
+		return CLIENT_PROTO_TCP;
 
-	rcode = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-	if (rcode != 0) return rcode;
+	default:
+		break;
+	}
+#endif
 
-	/*
-	 *	Wildcard match
-	 */
-	if ((a->proto == IPPROTO_IP) ||
-	    (b->proto == IPPROTO_IP)) return 0;
+	return CLIENT_PROTO_ANY;
+}
 
-	return (a->proto - b->proto);
+/*
+ *	Get the root, the address bytes, and the length in bits of an
+ *	address.
+ */
+static client_node_t *client_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
+				  uint8_t const **addr, int *bits)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		*addr = (uint8_t const *) &ipaddr->ipaddr.ip4addr;
+		*bits = 32;
+		return clients->v4;
+
+#ifdef HAVE_STRUCT_SOCKADDR_IN6
+	case AF_INET6:
+		*addr = (uint8_t const *) &ipaddr->ipaddr.ip6addr;
+		*bits = 128;
+		return clients->v6;
 #endif
+
+	default:
+		return NULL;
+	}
+}
+
+static inline int addr_bit(uint8_t const *addr, int bit)
+{
+	return (addr[bit >> 3] >> (7 - (bit & 0x07))) & 0x01;
+}
+
+/*
+ *	Number of leading bits (up to max) which are the same.
+ */
+static int addr_common(uint8_t const *a, uint8_t const *b, int max)
+{
+	int i, bits = 0;
+
+	for (i = 0; bits < max; i++, bits += 8) {
+		uint8_t diff = a[i] ^ b[i];
+
+		if (diff) {
+			while (!(diff & 0x80)) {
+				diff <<= 1;
+				bits++;
+			}
+			break;
+		}
+	}
+
+	return (bits < max) ? bits : max;
+}
+
+static client_node_t *client_node_alloc(RADCLIENT_LIST *clients, uint8_t const *addr, int prefix)
+{
+	client_node_t *node;
+	int i;
+
+	node = talloc_zero(clients, client_node_t);
+	if (!node) return NULL;
+
+	for (i = 0; i < (prefix + 7) / 8; i++) node->addr[i] = addr[i];
+	if (prefix & 0x07) node->addr[prefix / 8] &= (0xff << (8 - (prefix & 0x07)));
+	node->prefix = prefix;
+
+	return node;
+}
+
+/*
+ *	Find the node for exactly this network, optionally creating it.
+ *	Creating nodes must be done with the list mutex held.
+ */
+static client_node_t *client_node_find(RADCLIENT_LIST *clients, fr_ipaddr_t const *ipaddr, bool create)
+{
+	client_node_t *node, *child, *mid, *leaf;
+	uint8_t const *addr;
+	int bits, common, bit;
+
+	node = client_trie(clients, ipaddr, &addr, &bits);
+	if (!node || (ipaddr->prefix > bits)) return NULL;
+
+	while (node->prefix < ipaddr->prefix) {
+		bit = addr_bit(addr, node->prefix);
+		child = load_ptr(node->child[bit]);
+
+		if (!child) {
+			if (!create) return NULL;
+
+			leaf = client_node_alloc(clients, addr, ipaddr->prefix);
+			if (!leaf) return NULL;
+
+			store_ptr(node->child[bit], leaf);
+			return leaf;
+		}
+
+		common = addr_common(child->addr, addr, (child->prefix < ipaddr->prefix) ?
+						       child->prefix : ipaddr->prefix);
+		if (common == child->prefix) {
+			node = child;
+			continue;
+		}
+
+		if (!create) return NULL;
+
+		/*
+		 *	The child is for a longer network which
+		 *	diverges from this one, or contains it.  Put a
+		 *	node for the common part between them.
+		 */
+		mid = client_node_alloc(clients, addr, common);
+		if (!mid) return NULL;
+
+		store_ptr(mid->child[addr_bit(child->addr, common)], child);
+
+		if (common == ipaddr->prefix) {
+			leaf = mid;
+		} else {
+			leaf = client_node_alloc(clients, addr, ipaddr->prefix);
+			if (!leaf) {
+				talloc_free(mid);
+				return NULL;
+			}
+			store_ptr(mid->child[addr_bit(addr, common)], leaf);
+		}
+
+		store_ptr(node->child[bit], mid);
+		return leaf;
+	}
+
+	return node;
+}
+
+static inline uint32_t client_scope(fr_ipaddr_t const *ipaddr)
+{
+	return (ipaddr->af == AF_INET6) ? ipaddr->scope : 0;
+}
+
+/*
+ *	Find the node in the trie for a network with a particular scope.
+ */
+static client_node_t *client_node_scoped(client_node_t *node, uint32_t scope)
+{
+	while (node && (node->scope != scope)) node = load_ptr(node->scoped);
+
+	return node;
+}
+
+/*
+ *	Find or create the node for a network with a particular scope.
+ *	This must be done with the list mutex held.
+ */
+static client_node_t *client_node_scoped_add(RADCLIENT_LIST *clients, client_node_t *node, uint32_t scope)
+{
+	client_node_t *this;
+
+	this = client_node_scoped(node, scope);
+	if (this) return this;
+
+	this = client_node_alloc(clients, node->addr, node->prefix);
+	if (!this) return NULL;
+
+	this->scope = scope;
+	store_ptr(this->scoped, load_ptr(node->scoped));
+	store_ptr(node->scoped, this);
+
+	return this;
+}
+
+/*
+ *	Find a client in a node which matches the protocol.
+ */
+static RADCLIENT *client_node_match(client_node_t *node, int proto)
+{
+	RADCLIENT *client;
+	int i;
+
+	if (client_proto_slot(proto) != CLIENT_PROTO_ANY) {
+		client = load_ptr(node->client[client_proto_slot(proto)]);
+		if (client) return client;
+
+		return load_ptr(node->client[CLIENT_PROTO_ANY]);
+	}
+
+	for (i = 0; i < CLIENT_PROTO_MAX; i++) {
+		client = load_ptr(node->client[i]);
+		if (client) return client;
+	}
+
+	return NULL;
 }
 
 #ifdef WITH_STATS
@@ -139,15 +377,12 @@ static int client_num_cmp(void const *one, void const *two)
  */
 void clients_free(RADCLIENT_LIST *clients)
 {
-	int i;
-
 	if (!clients) clients = root_clients;
 	if (!clients) return;	/* Clients may not have been initialised yet */
 
-	for (i = 0; i <= 128; i++) {
-		if (clients->trees[i]) rbtree_free(clients->trees[i]);
-		clients->trees[i] = NULL;
-	}
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&clients->mutex);
+#endif
 
 	if (clients == root_clients) {
 #ifdef WITH_STATS
@@ -173,10 +408,24 @@ void clients_free(RADCLIENT_LIST *clients)
 RADCLIENT_LIST *clients_init(CONF_SECTION *cs)
 {
 	RADCLIENT_LIST *clients = talloc_zero(cs, RADCLIENT_LIST);
+	uint8_t zero[16];
 
 	if (!clients) return NULL;
 
-	clients->min_prefix = 128;
+	memset(zero, 0, sizeof(zero));
+	clients->v4 = client_node_alloc(clients, zero, 0);
+	clients->v6 = client_node_alloc(clients, zero, 0);
+	if (!clients->v4 || !clients->v6) {
+		talloc_free(clients);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&clients->mutex, NULL) != 0) {
+		talloc_free(clients);
+		return NULL;
+	}
+#endif
 
 	return clients;
 }
@@ -187,6 +436,8 @@ RADCLIENT_LIST *clients_init(CONF_SECTION *cs)
 int client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
 	RADCLIENT *old;
+	client_node_t *node;
+	int slot;
 	char buffer[INET6_ADDRSTRLEN + 3];
 
 	if (!client) return 0;
@@ -264,13 +515,14 @@ int client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	}
 
 	/*
-	 *	Create a tree for it.
+	 *	Find (or create) the node for its network.
 	 */
-	if (!clients->trees[client->ipaddr.prefix]) {
-		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
-		if (!clients->trees[client->ipaddr.prefix]) {
-			return 0;
-		}
+	PTHREAD_MUTEX_LOCK(&clients->mutex);
+	node = client_node_find(clients, &client->ipaddr, true);
+	if (node) node = client_node_scoped_add(clients, node, client_scope(&client->ipaddr));
+	if (!node) {
+		PTHREAD_MUTEX_UNLOCK(&clients->mutex);
+		return 0;
 	}
 
 #define namecmp(a) ((!old->a && !client->a) || (old->a && client->a && (strcmp(old->a, client->a) == 0)))
@@ -278,8 +530,11 @@ int client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	/*
 	 *	Cannot insert the same client twice.
 	 */
-	old = rbtree_finddata(clients->trees[client->ipaddr.prefix], client);
+	slot = client_proto_slot(client->proto);
+	old = client_node_match(node, client->proto);
 	if (old) {
+		PTHREAD_MUTEX_UNLOCK(&clients->mutex);
+
 		/*
 		 *	If it's a complete duplicate, then free the new
 		 *	one, and return "OK".
@@ -311,11 +566,10 @@ int client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #undef namecmp
 
 	/*
-	 *	Other error adding client: likely is fatal.
+	 *	Publish it.  Lookups may find it from here on.
 	 */
-	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) {
-		return 0;
-	}
+	store_ptr(node->client[slot], client);
+	PTHREAD_MUTEX_UNLOCK(&clients->mutex);
 
 #ifdef WITH_STATS
 	if (!tree_num) {
@@ -349,10 +603,6 @@ int client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	if (tree_num) rbtree_insert(tree_num, client);
 #endif
 
-	if (client->ipaddr.prefix < clients->min_prefix) {
-		clients->min_prefix = client->ipaddr.prefix;
-	}
-
 	(void) talloc_steal(clients, client); /* reparent it */
 
 	return 1;
@@ -362,6 +612,9 @@ int client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_DYNAMIC_CLIENTS
 void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
+	client_node_t *node;
+	int i;
+
 	if (!client) return;
 
 	if (!clients) clients = root_clients;
@@ -375,7 +628,14 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_STATS
 	rbtree_deletebydata(tree_num, client);
 #endif
-	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
+
+	PTHREAD_MUTEX_LOCK(&clients->mutex);
+	node = client_node_scoped(client_node_find(clients, &client->ipaddr, false),
+				  client_scope(&client->ipaddr));
+	if (node) for (i = 0; i < CLIENT_PROTO_MAX; i++) {
+		if (load_ptr(node->client[i]) == client) store_ptr(node->client[i], NULL);
+	}
+	PTHREAD_MUTEX_UNLOCK(&clients->mutex);
 }
 #endif
 
@@ -415,40 +675,39 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
  */
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-  int32_t i, max_prefix;
-	RADCLIENT myclient;
+	client_node_t *node, *scoped;
+	RADCLIENT *client, *found = NULL;
+	uint8_t const *addr;
+	uint32_t scope;
+	int bits;
 
 	if (!clients) clients = root_clients;
 
 	if (!clients || !ipaddr) return NULL;
 
-	switch (ipaddr->af) {
-	case AF_INET:
-		max_prefix = 32;
-		break;
-
-	case AF_INET6:
-		max_prefix = 128;
-		break;
-
-	default :
-		return NULL;
-	}
+	node = client_trie(clients, ipaddr, &addr, &bits);
+	scope = client_scope(ipaddr);
 
-	for (i = max_prefix; i >= (int32_t) clients->min_prefix; i--) {
-		void *data;
+	/*
+	 *	Walk down the trie, remembering the most specific
+	 *	network which has a client for this protocol and
+	 *	scope.
+	 */
+	while (node) {
+		if (addr_common(node->addr, addr, node->prefix) < node->prefix) break;
 
-		myclient.ipaddr = *ipaddr;
-		myclient.proto = proto;
-		fr_ipaddr_mask(&myclient.ipaddr, i);
+		scoped = client_node_scoped(node, scope);
+		if (scoped) {
+			client = client_node_match(scoped, proto);
+			if (client) found = client;
+		}
 
-		if (!clients->trees[i]) continue;
+		if (node->prefix >= bits) break;
 
-		data = rbtree_finddata(clients->trees[i], &myclient);
-		if (data) return data;
+		node = load_ptr(node->child[addr_bit(addr, node->prefix)]);
 	}
 
-	return NULL;
+	return found;
 }
 
 /*
@@ -1313,3 +1572,206 @@ RADCLIENT *client_read(char const *filename, int in_server, int flag)
 }
 #endif
 
+
+#ifdef TESTING
+/*
+ *  Compare client_find() with a brute-force search of every client,
+ *  and time it.
+ *
+ *  cc -DTESTING -I ../include -c client.c -o client_mine.o
+ *  cc client_mine.o -lfreeradius-server -lfreeradius-radius -ltalloc -lpthread -o client
+ *
+ *  ./client
+ */
+#include <sys/wait.h>
+
+struct main_config_t main_config;
+log_debug_t debug_flag = 0;
+
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+
+#ifdef WITH_COA
+home_server_t *home_server_byname(UNUSED char const *name, UNUSED int type)
+{
+	return NULL;
+}
+
+home_pool_t *home_pool_byname(UNUSED char const *name, UNUSED int type)
+{
+	return NULL;
+}
+#endif
+
+#define CLIENT_TEST_CLIENTS	(5000)
+#define CLIENT_TEST_PROBES	(1000)
+#define CLIENT_TEST_LOOPS	(2000000)
+
+static RADCLIENT *client_test[CLIENT_TEST_CLIENTS];
+static int client_test_num = 0;
+
+/*
+ *	The most specific network which contains the address, in the
+ *	same scope, for a compatible protocol.  For the same network,
+ *	prefer the same protocol, and then "any", UDP and TCP, in that
+ *	order.
+ */
+static RADCLIENT *client_test_find(fr_ipaddr_t const *ipaddr, int proto)
+{
+	int i, rank, best_rank = 0;
+	RADCLIENT *best = NULL;
+
+	for (i = 0; i < client_test_num; i++) {
+		RADCLIENT *c = client_test[i];
+		fr_ipaddr_t masked = *ipaddr;
+
+		if (c->ipaddr.af != ipaddr->af) continue;
+		if (client_scope(&c->ipaddr) != client_scope(ipaddr)) continue;
+
+		fr_ipaddr_mask(&masked, c->ipaddr.prefix);
+		if (memcmp(&masked.ipaddr, &c->ipaddr.ipaddr,
+			   (ipaddr->af == AF_INET) ? 4 : 16) != 0) continue;
+
+		if ((c->proto != IPPROTO_IP) && (proto != IPPROTO_IP) && (c->proto != proto)) continue;
+
+		rank = (c->proto == proto) ? -1 : client_proto_slot(c->proto);
+		if (!best || (c->ipaddr.prefix > best->ipaddr.prefix) ||
+		    ((c->ipaddr.prefix == best->ipaddr.prefix) && (rank < best_rank))) {
+			best = c;
+			best_rank = rank;
+		}
+	}
+
+	return best;
+}
+
+/*
+ *	10/8 for IPv4, 2001:db8::/32 for global IPv6, and a few
+ *	link-local addresses on several interfaces.
+ */
+static void client_test_addr(fr_ipaddr_t *ipaddr, int i)
+{
+	uint32_t a = htonl(0x0a000000 | (random() & 0x00ffffff));
+
+	memset(ipaddr, 0, sizeof(*ipaddr));
+
+	if ((i % 7) == 0) {
+		ipaddr->af = AF_INET6;
+		ipaddr->prefix = 128;
+		ipaddr->ipaddr.ip6addr.s6_addr[0] = 0x20;
+		ipaddr->ipaddr.ip6addr.s6_addr[1] = 0x01;
+		ipaddr->ipaddr.ip6addr.s6_addr[2] = 0x0d;
+		ipaddr->ipaddr.ip6addr.s6_addr[3] = 0xb8;
+		memcpy(&ipaddr->ipaddr.ip6addr.s6_addr[12], &a, 4);
+
+	} else if ((i % 11) == 0) {
+		ipaddr->af = AF_INET6;
+		ipaddr->prefix = 128;
+		ipaddr->ipaddr.ip6addr.s6_addr[0] = 0xfe;
+		ipaddr->ipaddr.ip6addr.s6_addr[1] = 0x80;
+		ipaddr->ipaddr.ip6addr.s6_addr[15] = random() & 0x0f;
+		ipaddr->scope = random() % 4;
+
+	} else {
+		ipaddr->af = AF_INET;
+		ipaddr->prefix = 32;
+		ipaddr->ipaddr.ip4addr.s_addr = a;
+	}
+}
+
+int main(void)
+{
+	int i, p, bad = 0;
+	RADCLIENT_LIST *clients;
+	fr_ipaddr_t probes[CLIENT_TEST_PROBES];
+	struct timeval start, end;
+	RADCLIENT *a, *b;
+	static int const protos[] = { IPPROTO_UDP, IPPROTO_TCP, IPPROTO_IP };
+
+	clients = clients_init(NULL);
+	if (!clients) {
+		fprintf(stderr, "Failed creating client list\n");
+		exit(1);
+	}
+
+	srandom(1);
+
+	for (i = 0; i < CLIENT_TEST_CLIENTS; i++) {
+		RADCLIENT *c;
+		int r = random() % 10;
+
+		c = talloc_zero(NULL, RADCLIENT);
+		client_test_addr(&c->ipaddr, i);
+
+		if (c->ipaddr.af == AF_INET) {
+			c->ipaddr.prefix = (r < 6) ? 32 : ((r < 8) ? 24 : 8 + (random() % 16));
+		} else if (!c->ipaddr.scope) {
+			c->ipaddr.prefix = (r < 6) ? 128 : 32 + (random() % 96);
+		}
+		fr_ipaddr_mask(&c->ipaddr, c->ipaddr.prefix);
+
+		c->proto = ((i % 13) == 0) ? IPPROTO_TCP : (((i % 17) == 0) ? IPPROTO_UDP : IPPROTO_IP);
+		c->longname = c->shortname = "test";
+		c->secret = talloc_typed_asprintf(c, "secret%d", i);
+
+		/*
+		 *	Duplicates are refused, or freed.
+		 */
+		client_test[client_test_num] = c;
+		if (client_add(clients, c) == 1) {
+			if (talloc_parent(c) == clients) client_test_num++;
+		}
+	}
+
+	for (i = 0; i < CLIENT_TEST_PROBES; i++) {
+		client_test_addr(&probes[i], random());
+
+		/*
+		 *	Some of them inside a client's network.
+		 */
+		if ((i % 3) == 0) {
+			RADCLIENT *c = client_test[random() % client_test_num];
+
+			probes[i] = c->ipaddr;
+			probes[i].prefix = (c->ipaddr.af == AF_INET) ? 32 : 128;
+		}
+	}
+
+	for (i = 0; i < CLIENT_TEST_PROBES; i++) {
+		for (p = 0; p < 3; p++) {
+			a = client_find(clients, &probes[i], protos[p]);
+			b = client_test_find(&probes[i], protos[p]);
+			if (a != b) {
+				char buffer[INET6_ADDRSTRLEN + 3];
+
+				fr_ntop(buffer, sizeof(buffer), &probes[i]);
+				fprintf(stderr, "Mismatch for %s%%%u proto %d: %s vs %s\n", buffer, probes[i].scope,
+					protos[p], a ? a->secret : "none", b ? b->secret : "none");
+				bad++;
+			}
+		}
+	}
+
+	printf("%d clients, %d probes, %d mismatches\n", client_test_num, CLIENT_TEST_PROBES * 3, bad);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < CLIENT_TEST_LOOPS; i++) {
+		a = client_find(clients, &probes[i % CLIENT_TEST_PROBES], IPPROTO_UDP);
+	}
+	gettimeofday(&end, NULL);
+
+	printf("%.3f usec/lookup\n", (((end.tv_sec - start.tv_sec) * 1000000.0) + (end.tv_usec - start.tv_usec)) /
+	       CLIENT_TEST_LOOPS);
+
+	clients_free(clients);
+
+	return (bad != 0);
+}
+#endif
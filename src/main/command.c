@@ -24,7 +24,9 @@
 #ifdef WITH_COMMAND_SOCKET
 
 #include <freeradius-devel/parser.h>
+#include <freeradius-devel/modcall.h>
 #include <freeradius-devel/md5.h>
+#include <freeradius-devel/state.h>
 
 #ifdef HAVE_INTTYPES_H
 #include <inttypes.h>
@@ -1685,9 +1687,41 @@ static int command_print_stats(rad_listen_t *listener, fr_stats_t *stats,
 			elapsed_names[i], stats->elapsed[i]);
 	}
 
+	/*
+	 *	Percentiles are in microseconds.
+	 */
+	if (stats->latency && (fr_histogram_count(stats->latency) > 0)) {
+		for (i = 0; i < FR_STATS_PERCENTILES; i++) {
+			cprintf(listener, "\tlatency.%s\t%" PRIu64 "\n",
+				fr_stats_percentile_names[i],
+				fr_histogram_percentile(stats->latency,
+							fr_stats_percentile[i]));
+		}
+		cprintf(listener, "\tlatency.max\t%" PRIu64 "\n", stats->latency->max);
+	}
+
 	return 1;
 }
 
+#ifdef WITH_RADIUS_BATCH
+static char const *batch_fill_names[8] = {
+	"12%", "25%", "37%", "50%", "62%", "75%", "87%", "100%"
+};
+
+static void command_print_batch(rad_listen_t *listener, char const *name,
+				fr_stats_batch_t *stats)
+{
+	int i;
+
+	cprintf(listener, "\tbatch.%s.calls\t" PU "\n", name, stats->calls);
+	cprintf(listener, "\tbatch.%s.packets\t" PU "\n", name, stats->packets);
+	for (i = 0; i < 8; i++) {
+		cprintf(listener, "\tbatch.%s.fill.%s\t" PU "\n",
+			name, batch_fill_names[i], stats->fill[i]);
+	}
+}
+#endif
+
 #ifdef WITH_DETAIL
 static FR_NAME_NUMBER state_names[] = {
 	{ "unopened", STATE_UNOPENED },
@@ -1894,8 +1928,144 @@ static int command_stats_socket(rad_listen_t *listener, int argc, char *argv[])
 
 	if (sock->type != RAD_LISTEN_AUTH) auth = false;
 
-	return command_print_stats(listener, &sock->stats, auth, 0);
+	command_print_stats(listener, &sock->stats, auth, 0);
+
+#ifdef WITH_RADIUS_BATCH
+	if ((sock->type == RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+	    || (sock->type == RAD_LISTEN_ACCT)
+#endif
+#ifdef WITH_PROXY
+	    || (sock->type == RAD_LISTEN_PROXY)
+#endif
+		) {
+		listen_socket_t *data = sock->data;
+
+		if (data->batch) {
+			command_print_batch(listener, "recv", &data->batch_recv);
+			command_print_batch(listener, "send", &data->batch_send);
+		}
+	}
+#endif
+
+	return 1;
+}
+
+typedef struct command_stats_modules_t {
+	rad_listen_t	*listener;
+	char const	*prefix;
+	size_t		prefix_len;
+} command_stats_modules_t;
+
+static int command_print_module_stats(void *ctx, modcall_stats_t const *stats)
+{
+	command_stats_modules_t *my_ctx = ctx;
+	int i;
+
+	if (my_ctx->prefix &&
+	    (strncmp(stats->name, my_ctx->prefix, my_ctx->prefix_len) != 0)) return 0;
+
+	cprintf(my_ctx->listener, "%s.calls\t%" PRIu64 "\n", stats->name, stats->calls);
+	cprintf(my_ctx->listener, "%s.usec\t%" PRIu64 "\n", stats->name, stats->usec);
+	cprintf(my_ctx->listener, "%s.max_usec\t%" PRIu64 "\n", stats->name, stats->max_usec);
+
+	for (i = 0; i < RLM_MODULE_NUMCODES; i++) {
+		if (!stats->rcode[i]) continue;
+
+		cprintf(my_ctx->listener, "%s.%s\t%" PRIu64 "\n", stats->name,
+			fr_int2str(mod_rcode_table, i, "<invalid>"), stats->rcode[i]);
+	}
+
+	return 0;
+}
+
+static int command_stats_modules(rad_listen_t *listener, int argc, char *argv[])
+{
+	command_stats_modules_t my_ctx;
+
+	if (!main_config.module_statistics) {
+		cprintf(listener, "ERROR: module_statistics is disabled\n");
+		return 0;
+	}
+
+	my_ctx.listener = listener;
+	my_ctx.prefix = NULL;
+	my_ctx.prefix_len = 0;
+
+	if (argc > 0) {
+		my_ctx.prefix = argv[0];
+		my_ctx.prefix_len = strlen(argv[0]);
+	}
+
+	modcall_stats_walk(command_print_module_stats, &my_ctx);
+
+	return 1;
+}
+
+static int command_stats_state(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	int i;
+	uint32_t total = 0;
+	uint32_t entries[FR_STATE_SHARDS];
+
+	fr_state_shard_entries(entries);
+
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		cprintf(listener, "shard%02d\t\t%u\n", i, entries[i]);
+		total += entries[i];
+	}
+	cprintf(listener, "total\t\t%u\n", total);
+
+	return 1;
+}
+
+#ifdef HAVE_PTHREAD_H
+static int command_stats_crypto_pool(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	thread_crypto_stats_t stats;
+
+	thread_pool_crypto_stats(&stats);
+
+	if (!stats.threads) {
+		cprintf(listener, "ERROR: The crypto pool is not enabled\n");
+		return 0;
+	}
+
+	cprintf(listener, "threads\t\t%u\n", stats.threads);
+	cprintf(listener, "queued\t\t%u\n", stats.queued);
+	cprintf(listener, "max_queued\t%u\n", stats.max_queued);
+	cprintf(listener, "max_queue_size\t%u\n", stats.max_queue_size);
+	cprintf(listener, "requests\t%" PRIu64 "\n", stats.requests);
+	cprintf(listener, "dropped\t\t%" PRIu64 "\n", stats.dropped);
+	cprintf(listener, "avg_wait_usec\t%" PRIu64 "\n", stats.requests ? stats.wait_usec / stats.requests : 0);
+	cprintf(listener, "max_wait_usec\t%" PRIu64 "\n", stats.max_wait_usec);
+	cprintf(listener, "avg_run_usec\t%" PRIu64 "\n", stats.requests ? stats.run_usec / stats.requests : 0);
+
+	return 1;
+}
+#endif
+
+#ifdef WITH_TLS
+static int command_stats_tls_cache(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	tls_cache_stats_t stats;
+	uint64_t handshakes;
+
+	tls_cache_stats(&stats);
+
+	handshakes = stats.full + stats.resumed;
+
+	cprintf(listener, "full\t\t%" PRIu64 "\n", stats.full);
+	cprintf(listener, "resumed\t\t%" PRIu64 "\n", stats.resumed);
+	cprintf(listener, "hit_rate\t%u%%\n", handshakes ? (unsigned int) ((stats.resumed * 100) / handshakes) : 0);
+	cprintf(listener, "lookups\t\t%" PRIu64 "\n", stats.lookups);
+	cprintf(listener, "hits\t\t%" PRIu64 "\n", stats.hits);
+	cprintf(listener, "stores\t\t%" PRIu64 "\n", stats.stores);
+	cprintf(listener, "failures\t%" PRIu64 "\n", stats.failures);
+
+	return 1;
 }
+#endif
 #endif	/* WITH_STATS */
 
 
@@ -2037,6 +2207,12 @@ static fr_command_table_t command_table_stats[] = {
 	  "- show statistics for given client, or for all clients (auth or acct)",
 	  command_stats_client, NULL },
 
+#ifdef HAVE_PTHREAD_H
+	{ "crypto-pool", FR_READ,
+	  "stats crypto-pool - show queue and latency statistics for the TLS crypto thread pool",
+	  command_stats_crypto_pool, NULL },
+#endif
+
 #ifdef WITH_DETAIL
 	{ "detail", FR_READ,
 	  "stats detail <filename> - show statistics for the given detail file",
@@ -2049,6 +2225,10 @@ static fr_command_table_t command_table_stats[] = {
 	  command_stats_home_server, NULL },
 #endif
 
+	{ "modules", FR_READ,
+	  "stats modules [<prefix>] - show calls, times and return codes for modules, policies and sections, e.g. \"stats modules module.ldap\"",
+	  command_stats_modules, NULL },
+
 	{ "socket", FR_READ,
 	  "stats socket <ipaddr> <port> "
 #ifdef WITH_TCP
@@ -2057,6 +2237,16 @@ static fr_command_table_t command_table_stats[] = {
 	  "- show statistics for given socket",
 	  command_stats_socket, NULL },
 
+	{ "state", FR_READ,
+	  "stats state - show the number of entries in each shard of the session-state table",
+	  command_stats_state, NULL },
+
+#ifdef WITH_TLS
+	{ "tls-cache", FR_READ,
+	  "stats tls-cache - show how many TLS handshakes resumed a cached session",
+	  command_stats_tls_cache, NULL },
+#endif
+
 	{ NULL, 0, NULL, NULL, NULL }
 };
 #endif
@@ -84,6 +84,26 @@ static fr_protocol_t master_listen[MAX_LISTENER];
 extern bool home_servers_udp;
 #endif
 
+#ifdef WITH_RADIUS_BATCH
+/*
+ *	Listeners which use recvmmsg() and sendmmsg().  Their queued
+ *	replies are sent before the server waits for more packets.
+ */
+static rad_listen_t **batch_listeners = NULL;
+static uint32_t num_batch_listeners = 0;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_t batch_main_thread;
+#endif
+
+/*
+ *	The listener whose request this thread is processing.
+ */
+fr_thread_local_setup(rad_listen_t *, batch_listener)	/* macro */
+
+static int udp_batch_recv(rad_listen_t *listener);
+#endif
+
 /*
  *	Xlat for %{listen:foo}
  */
@@ -252,7 +272,26 @@ RADCLIENT *client_listener_find(rad_listen_t *listener,
 
 	request->listener = listener;
 	request->client = client;
-	request->packet = rad_recv(listener->fd, 0x02); /* MSG_PEEK */
+	if (sock->recv_packet && sock->recv_packet->data_len) {
+		/*
+		 *	The datagram has already been read.  Check a
+		 *	copy of it, and leave the original for the
+		 *	caller.
+		 */
+		request->packet = rad_copy_packet(request, sock->recv_packet);
+		if (request->packet) {
+			request->packet->sockfd = listener->fd;
+			request->packet->data_len = sock->recv_packet->data_len;
+			request->packet->data = talloc_memdup(request->packet, sock->recv_packet->data,
+							      request->packet->data_len);
+			if (!rad_recv_datagram_ok(request->packet, 0)) {
+				talloc_free(request);
+				goto unknown;
+			}
+		}
+	} else {
+		request->packet = rad_recv(listener->fd, 0x02); /* MSG_PEEK */
+	}
 	if (!request->packet) {				/* badly formed, etc */
 		talloc_free(request);
 		goto unknown;
@@ -1086,6 +1125,110 @@ int common_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 #endif
 	}
 
+	/*
+	 *	Several sockets bound to the same address, each with
+	 *	its own receive thread.  The kernel spreads the
+	 *	clients across them.
+	 */
+	cp = cf_pair_find(cs, "reuseport");
+	if (cp) {
+#ifndef SO_REUSEPORT
+		cf_log_err_cp(cp,
+			   "System does not support SO_REUSEPORT.  Delete this line from the configuration file");
+		return -1;
+#else
+		rcode = cf_item_parse(cs, "reuseport", FR_ITEM_POINTER(PW_TYPE_INTEGER, &sock->reuseport), "0");
+		if (rcode < 0) return -1;
+
+		if ((this->type != RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+		    && (this->type != RAD_LISTEN_ACCT)
+#endif
+			) {
+			cf_log_err_cp(cp,
+				   "Setting 'reuseport' is only available for auth and acct sockets");
+			return -1;
+		}
+
+		if (sock->reuseport > 256) {
+			cf_log_err_cp(cp,
+				   "Invalid value for \"reuseport\"");
+			return -1;
+		}
+
+		if (sock->reuseport && (sock->proto != IPPROTO_UDP)) {
+			WARN("Setting 'reuseport' requires 'proto = udp'.  Disabling 'reuseport'");
+			sock->reuseport = 0;
+		}
+
+		if (sock->reuseport) {
+			if (this->workers) {
+				WARN("Setting 'reuseport' is incompatible with 'workers'.  Disabling 'workers'");
+				this->workers = 0;
+			}
+
+			if (sock->max_rate) {
+				WARN("Setting 'max_pps' is incompatible with 'reuseport'.  Disabling 'max_pps'");
+				sock->max_rate = 0;
+			}
+
+			/*
+			 *	Packets are processed by the thread
+			 *	which reads them.  That thread can't
+			 *	use the main list of requests.  It
+			 *	runs its own event loop, and catches
+			 *	duplicates itself.
+			 */
+			this->synchronous = true;
+			this->nodup = true;
+		}
+#endif
+	}
+
+	/*
+	 *	Read and write UDP packets in batches.
+	 */
+	cp = cf_pair_find(cs, "batch");
+	if (cp) {
+#ifndef WITH_RADIUS_BATCH
+		cf_log_err_cp(cp,
+			   "System does not support batched I/O.  Delete this line from the configuration file");
+		return -1;
+#else
+		rcode = cf_item_parse(cs, "batch", FR_ITEM_POINTER(PW_TYPE_INTEGER, &sock->batch_size), "0");
+		if (rcode < 0) return -1;
+
+		if ((this->type != RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+		    && (this->type != RAD_LISTEN_ACCT)
+#endif
+#ifdef WITH_PROXY
+		    && (this->type != RAD_LISTEN_PROXY)
+#endif
+			) {
+			cf_log_err_cp(cp,
+				   "Batched I/O is only available for auth, acct, and proxy sockets");
+			return -1;
+		}
+
+		if (sock->batch_size > 1024) {
+			cf_log_err_cp(cp,
+				   "Invalid value for \"batch\"");
+			return -1;
+		}
+
+		if (sock->batch_size && (sock->proto != IPPROTO_UDP)) {
+			WARN("Setting 'batch' requires 'proto = udp'.  Disabling 'batch'");
+			sock->batch_size = 0;
+		}
+
+		if (sock->batch_size && this->workers) {
+			WARN("Setting 'batch' is incompatible with 'workers'.  Disabling 'batch'");
+			sock->batch_size = 0;
+		}
+#endif
+	}
+
 	sock->my_ipaddr = ipaddr;
 	sock->my_port = listen_port;
 
@@ -1169,6 +1312,28 @@ int common_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 		return -1;
 	}
 
+#ifdef WITH_RADIUS_BATCH
+	if (sock->batch_size) {
+		rad_listen_t **listeners;
+
+		sock->batch = rad_batch_alloc(sock, this->fd, sock->batch_size);
+		if (!sock->batch) {
+			cf_log_err_cs(cs, "Failed setting up batched I/O: %s", fr_strerror());
+			return -1;
+		}
+
+		listeners = talloc_realloc(NULL, batch_listeners, rad_listen_t *, num_batch_listeners + 1);
+		if (!listeners) {
+			cf_log_err_cs(cs, "Out of memory");
+			return -1;
+		}
+		batch_listeners = listeners;
+		batch_listeners[num_batch_listeners++] = this;
+
+		this->recv = udp_batch_recv;
+	}
+#endif
+
 #ifdef WITH_PROXY
 	/*
 	 *	Proxy sockets don't have clients.
@@ -1245,6 +1410,73 @@ int common_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 	return 0;
 }
 
+#ifdef WITH_RADIUS_BATCH
+/*
+ *	Whether a reply which was just queued can wait for more
+ *	replies before the batch is sent.
+ */
+static bool udp_batch_defer(rad_listen_t *listener)
+{
+	/*
+	 *	The packet was processed by the thread which read
+	 *	it.  That thread sends the batch when it has
+	 *	processed all of the packets it read.
+	 */
+	if (listener->synchronous) return true;
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	The main thread always sends the queued replies before
+	 *	waiting for more packets.
+	 */
+	if (pthread_equal(pthread_self(), batch_main_thread)) return true;
+
+	/*
+	 *	A child thread.  If it's processing a request from
+	 *	this listener, it sends the batch when it's finished
+	 *	with the request.  Otherwise, send it now.
+	 */
+	return (fr_thread_local_get(batch_listener) == listener);
+#else
+	return true;
+#endif
+}
+#endif
+
+/*
+ *	Send a packet on a UDP socket, or queue it to be sent with
+ *	the rest of the batch.
+ */
+static int udp_send(
+#ifdef WITH_RADIUS_BATCH
+		    rad_listen_t *listener,
+#else
+		    UNUSED rad_listen_t *listener,
+#endif
+		    RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret)
+{
+#ifdef WITH_RADIUS_BATCH
+	listen_socket_t *sock = listener->data;
+
+	if (sock->batch) {
+		int rcode;
+
+		rcode = rad_batch_send(sock->batch, packet, original, secret);
+		if ((rcode == 0) && !udp_batch_defer(listener)) {
+			rcode = rad_batch_flush(sock->batch);
+		}
+		if (rcode < 0) return -1;
+
+#ifdef WITH_STATS
+		radius_stats_batch(&sock->batch_send, rcode, sock->batch_size);
+#endif
+		return 0;
+	}
+#endif
+
+	return rad_send(packet, original, secret);
+}
+
 /*
  *	Send an authentication response packet
  */
@@ -1267,7 +1499,7 @@ static int auth_socket_send(rad_listen_t *listener, REQUEST *request)
 	}
 #endif
 
-	if (rad_send(request->reply, request->packet,
+	if (udp_send(listener, request->reply, request->packet,
 		     request->client->secret) < 0) {
 		RERROR("Failed sending reply: %s",
 			       fr_strerror());
@@ -1307,7 +1539,7 @@ static int acct_socket_send(rad_listen_t *listener, REQUEST *request)
 	}
 #endif
 
-	if (rad_send(request->reply, request->packet,
+	if (udp_send(listener, request->reply, request->packet,
 		     request->client->secret) < 0) {
 		RERROR("Failed sending reply: %s",
 			       fr_strerror());
@@ -1329,7 +1561,7 @@ static int proxy_socket_send(rad_listen_t *listener, REQUEST *request)
 	rad_assert(request->proxy_listener == listener);
 	rad_assert(listener->send == proxy_socket_send);
 
-	if (rad_send(request->proxy, NULL,
+	if (udp_send(listener, request->proxy, NULL,
 		     request->home_server->secret) < 0) {
 		RERROR("Failed sending proxied request: %s",
 			       fr_strerror());
@@ -1340,6 +1572,136 @@ static int proxy_socket_send(rad_listen_t *listener, REQUEST *request)
 }
 #endif
 
+/*
+ *	Read the next datagram from a UDP socket, with one system call.
+ *	The caller can then check the client and packet code, and
+ *	either call udp_recv_packet() to keep the packet, or just
+ *	return, in which case the buffer is re-used for the next one.
+ */
+static ssize_t udp_recv_datagram(rad_listen_t *listener)
+{
+	listen_socket_t *sock = listener->data;
+
+#ifdef WITH_RADIUS_BATCH
+	if (sock->batch) return rad_batch_datagram(sock->batch, &sock->recv_packet);
+#endif
+
+	if (!sock->recv_packet) {
+		sock->recv_packet = rad_alloc(sock, false);
+		if (!sock->recv_packet) return -1;
+	}
+
+	return rad_recv_datagram(listener->fd, sock->recv_packet);
+}
+
+/*
+ *	Take the datagram read by udp_recv_datagram(), without copying it.
+ */
+static RADIUS_PACKET *udp_recv_packet(rad_listen_t *listener, int flags)
+{
+	listen_socket_t *sock = listener->data;
+	RADIUS_PACKET *packet = sock->recv_packet;
+
+	if (!rad_recv_datagram_ok(packet, flags)) return NULL;
+
+	sock->recv_packet = NULL;
+
+	return talloc_steal(NULL, packet);
+}
+
+#ifdef WITH_RADIUS_BATCH
+/*
+ *	Send the replies which are waiting in a listener's batch.
+ */
+static void udp_batch_flush(rad_listen_t *listener)
+{
+	int		rcode;
+	listen_socket_t	*sock = listener->data;
+
+	rcode = rad_batch_flush(sock->batch);
+	if (rcode < 0) {
+		ERROR("Failed sending replies: %s", fr_strerror());
+		return;
+	}
+
+#ifdef WITH_STATS
+	radius_stats_batch(&sock->batch_send, rcode, sock->batch_size);
+#endif
+}
+
+/*
+ *	Read a batch of datagrams with one system call, and then run
+ *	the normal receive function for each of them.
+ */
+static int udp_batch_recv(rad_listen_t *listener)
+{
+	int		rcode, i;
+	listen_socket_t	*sock = listener->data;
+	rad_listen_recv_t process = master_listen[listener->type].recv;
+
+	rcode = rad_batch_recv(sock->batch);
+	if (rcode < 0) {
+		ERROR("Failed reading from socket: %s", fr_strerror());
+		return 0;
+	}
+	if (rcode == 0) return 0;
+
+#ifdef WITH_STATS
+	radius_stats_batch(&sock->batch_recv, rcode, sock->batch_size);
+#endif
+
+	/*
+	 *	Each call takes one datagram from the batch.
+	 */
+	for (i = 0; i < rcode; i++) {
+		(void) process(listener);
+	}
+
+	if (listener->synchronous) udp_batch_flush(listener);
+
+	return 1;
+}
+
+/*
+ *	Send the replies which are waiting in each batch.
+ */
+void listen_batch_flush(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < num_batch_listeners; i++) {
+		udp_batch_flush(batch_listeners[i]);
+	}
+}
+
+/*
+ *	Called by a child thread before it processes a request which
+ *	arrived on "listener".  Replies it queues stay in the batch
+ *	until listen_batch_release().
+ */
+void listen_batch_hold(rad_listen_t *listener)
+{
+	if (!listener || (listener->recv != udp_batch_recv)) return;
+
+	(void) fr_thread_local_init(batch_listener, NULL);
+	(void) fr_thread_local_set(batch_listener, listener);
+}
+
+/*
+ *	Called by a child thread when it has finished with the
+ *	request.  The reply is sent now, along with any others which
+ *	were queued in the meantime, so that no reply waits for a
+ *	slower request.
+ */
+void listen_batch_release(rad_listen_t *listener)
+{
+	if (!listener || (listener->recv != udp_batch_recv)) return;
+
+	(void) fr_thread_local_set(batch_listener, NULL);
+	udp_batch_flush(listener);
+}
+#endif
+
 #ifdef WITH_STATS
 /*
  *	Check if an incoming request is "ok"
@@ -1353,10 +1715,11 @@ static int stats_socket_recv(rad_listen_t *listener)
 	int		code;
 	uint16_t	src_port;
 	RADIUS_PACKET	*packet;
+	listen_socket_t	*sock = listener->data;
 	RADCLIENT	*client = NULL;
 	fr_ipaddr_t	src_ipaddr;
 
-	rcode = rad_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	rcode = udp_recv_datagram(listener);
 	if (rcode < 0) return 0;
 
 	FR_STATS_INC(auth, total_requests);
@@ -1366,9 +1729,12 @@ static int stats_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
+	src_ipaddr = sock->recv_packet->src_ipaddr;
+	src_port = sock->recv_packet->src_port;
+	code = sock->recv_packet->code;
+
 	if ((client = client_listener_find(listener,
 					   &src_ipaddr, src_port)) == NULL) {
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(auth, total_invalid_requests);
 		return 0;
 	}
@@ -1381,16 +1747,15 @@ static int stats_socket_recv(rad_listen_t *listener)
 	if (code != PW_CODE_STATUS_SERVER) {
 		DEBUG("Ignoring packet code %d sent to Status-Server port",
 		      code);
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(auth, total_unknown_types);
 		return 0;
 	}
 
 	/*
-	 *	Now that we've sanity checked everything, receive the
+	 *	Now that we've sanity checked everything, take the
 	 *	packet.
 	 */
-	packet = rad_recv(listener->fd, 1); /* require message authenticator */
+	packet = udp_recv_packet(listener, 1); /* require message authenticator */
 	if (!packet) {
 		FR_STATS_INC(auth, total_malformed_requests);
 		DEBUG("%s", fr_strerror());
@@ -1420,11 +1785,12 @@ static int auth_socket_recv(rad_listen_t *listener)
 	int		code;
 	uint16_t	src_port;
 	RADIUS_PACKET	*packet;
+	listen_socket_t	*sock = listener->data;
 	RAD_REQUEST_FUNP fun = NULL;
 	RADCLIENT	*client = NULL;
 	fr_ipaddr_t	src_ipaddr;
 
-	rcode = rad_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	rcode = udp_recv_datagram(listener);
 	if (rcode < 0) return 0;
 
 	FR_STATS_INC(auth, total_requests);
@@ -1434,9 +1800,12 @@ static int auth_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
+	src_ipaddr = sock->recv_packet->src_ipaddr;
+	src_port = sock->recv_packet->src_port;
+	code = sock->recv_packet->code;
+
 	if ((client = client_listener_find(listener,
 					   &src_ipaddr, src_port)) == NULL) {
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(auth, total_invalid_requests);
 		return 0;
 	}
@@ -1453,7 +1822,6 @@ static int auth_socket_recv(rad_listen_t *listener)
 
 	case PW_CODE_STATUS_SERVER:
 		if (!main_config.status_server) {
-			rad_recv_discard(listener->fd);
 			FR_STATS_INC(auth, total_unknown_types);
 			WARN("Ignoring Status-Server request due to security configuration");
 			return 0;
@@ -1462,7 +1830,6 @@ static int auth_socket_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(auth,total_unknown_types);
 
 		DEBUG("Invalid packet code %d sent to authentication port from client %s port %d : IGNORED",
@@ -1472,10 +1839,10 @@ static int auth_socket_recv(rad_listen_t *listener)
 	} /* switch over packet types */
 
 	/*
-	 *	Now that we've sanity checked everything, receive the
+	 *	Now that we've sanity checked everything, take the
 	 *	packet.
 	 */
-	packet = rad_recv(listener->fd, client->message_authenticator);
+	packet = udp_recv_packet(listener, client->message_authenticator);
 	if (!packet) {
 		FR_STATS_INC(auth, total_malformed_requests);
 		DEBUG("%s", fr_strerror());
@@ -1527,11 +1894,12 @@ static int acct_socket_recv(rad_listen_t *listener)
 	int		code;
 	uint16_t	src_port;
 	RADIUS_PACKET	*packet;
+	listen_socket_t	*sock = listener->data;
 	RAD_REQUEST_FUNP fun = NULL;
 	RADCLIENT	*client = NULL;
 	fr_ipaddr_t	src_ipaddr;
 
-	rcode = rad_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	rcode = udp_recv_datagram(listener);
 	if (rcode < 0) return 0;
 
 	FR_STATS_INC(acct, total_requests);
@@ -1541,9 +1909,12 @@ static int acct_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
+	src_ipaddr = sock->recv_packet->src_ipaddr;
+	src_port = sock->recv_packet->src_port;
+	code = sock->recv_packet->code;
+
 	if ((client = client_listener_find(listener,
 					   &src_ipaddr, src_port)) == NULL) {
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(acct, total_invalid_requests);
 		return 0;
 	}
@@ -1560,7 +1931,6 @@ static int acct_socket_recv(rad_listen_t *listener)
 
 	case PW_CODE_STATUS_SERVER:
 		if (!main_config.status_server) {
-			rad_recv_discard(listener->fd);
 			FR_STATS_INC(acct, total_unknown_types);
 
 			WARN("Ignoring Status-Server request due to security configuration");
@@ -1570,7 +1940,6 @@ static int acct_socket_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(acct, total_unknown_types);
 
 		DEBUG("Invalid packet code %d sent to a accounting port from client %s port %d : IGNORED",
@@ -1579,10 +1948,10 @@ static int acct_socket_recv(rad_listen_t *listener)
 	} /* switch over packet types */
 
 	/*
-	 *	Now that we've sanity checked everything, receive the
+	 *	Now that we've sanity checked everything, take the
 	 *	packet.
 	 */
-	packet = rad_recv(listener->fd, 0);
+	packet = udp_recv_packet(listener, 0);
 	if (!packet) {
 		FR_STATS_INC(acct, total_malformed_requests);
 		ERROR("%s", fr_strerror());
@@ -1777,11 +2146,12 @@ static int coa_socket_recv(rad_listen_t *listener)
 	int		code;
 	uint16_t	src_port;
 	RADIUS_PACKET	*packet;
+	listen_socket_t	*sock = listener->data;
 	RAD_REQUEST_FUNP fun = NULL;
 	RADCLIENT	*client = NULL;
 	fr_ipaddr_t	src_ipaddr;
 
-	rcode = rad_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	rcode = udp_recv_datagram(listener);
 	if (rcode < 0) return 0;
 
 	if (rcode < 20) {	/* RADIUS_HDR_LEN */
@@ -1790,9 +2160,12 @@ static int coa_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
+	src_ipaddr = sock->recv_packet->src_ipaddr;
+	src_port = sock->recv_packet->src_port;
+	code = sock->recv_packet->code;
+
 	if ((client = client_listener_find(listener,
 					   &src_ipaddr, src_port)) == NULL) {
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(coa, total_requests);
 		FR_STATS_INC(coa, total_invalid_requests);
 		return 0;
@@ -1813,7 +2186,6 @@ static int coa_socket_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		rad_recv_discard(listener->fd);
 		FR_STATS_INC(coa, total_unknown_types);
 		DEBUG("Invalid packet code %d sent to coa port from client %s port %d : IGNORED",
 		      code, client->shortname, src_port);
@@ -1821,10 +2193,10 @@ static int coa_socket_recv(rad_listen_t *listener)
 	} /* switch over packet types */
 
 	/*
-	 *	Now that we've sanity checked everything, receive the
+	 *	Now that we've sanity checked everything, take the
 	 *	packet.
 	 */
-	packet = rad_recv(listener->fd, client->message_authenticator);
+	packet = udp_recv_packet(listener, client->message_authenticator);
 	if (!packet) {
 		FR_STATS_INC(coa, total_malformed_requests);
 		DEBUG("%s", fr_strerror());
@@ -1847,10 +2219,22 @@ static int coa_socket_recv(rad_listen_t *listener)
  */
 static int proxy_socket_recv(rad_listen_t *listener)
 {
+	ssize_t		rcode;
 	RADIUS_PACKET	*packet;
 	char		buffer[128];
 
-	packet = rad_recv(listener->fd, 0);
+	rcode = udp_recv_datagram(listener);
+	if (rcode < 0) {
+		ERROR("Error receiving packet: %s", fr_syserror(errno));
+		return 0;
+	}
+
+	if (rcode < 20) {	/* RADIUS_HDR_LEN */
+		if (rcode > 0) ERROR("Discarding malformed packet sent to a proxy port");
+		return 0;
+	}
+
+	packet = udp_recv_packet(listener, 0);
 	if (!packet) {
 		ERROR("%s", fr_strerror());
 		return 0;
@@ -2351,6 +2735,18 @@ static int listen_bind(rad_listen_t *this)
 	}
 #endif
 
+#ifdef SO_REUSEPORT
+	if (sock->reuseport) {
+		int on = 1;
+
+		if (setsockopt(this->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			close(this->fd);
+			ERROR("Failed to reuse port: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+#endif
+
 	/*
 	 *	Set up sockaddr stuff.
 	 */
@@ -2528,6 +2924,22 @@ static int listen_bind(rad_listen_t *this)
 
 static int _listener_free(rad_listen_t *this)
 {
+#ifdef WITH_RADIUS_BATCH
+	if (this->recv == udp_batch_recv) {
+		listen_socket_t *sock = this->data;
+		uint32_t i;
+
+		for (i = 0; i < num_batch_listeners; i++) {
+			if (batch_listeners[i] != this) continue;
+
+			batch_listeners[i] = batch_listeners[--num_batch_listeners];
+			break;
+		}
+
+		if (this->fd >= 0) (void) rad_batch_flush(sock->batch);
+	}
+#endif
+
 	/*
 	 *	Other code may have eaten the FD.
 	 */
@@ -2919,6 +3331,67 @@ static rad_listen_t *listen_parse(CONF_SECTION *cs, char const *server)
 		return NULL;
 	}
 
+#if defined(SO_REUSEPORT) && defined(WITH_PROXY)
+	/*
+	 *	Requests from "reuseport" sockets are processed
+	 *	synchronously, and can't be proxied.
+	 */
+	if (((this->type == RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+	     || (this->type == RAD_LISTEN_ACCT)
+#endif
+		    ) && ((listen_socket_t *) this->data)->reuseport &&
+	    main_config.proxy_requests) {
+		CONF_SECTION *subcs = server_cs ? server_cs : main_config.config;
+
+		if (cf_section_sub_find(subcs, "pre-proxy") ||
+		    cf_section_sub_find(subcs, "post-proxy")) {
+			WARN("Requests from 'reuseport' sockets cannot be proxied, but virtual server %s "
+			     "has a 'pre-proxy' or 'post-proxy' section", this->server ? this->server : "default");
+		}
+	}
+#endif
+
+#ifdef SO_REUSEPORT
+	/*
+	 *	Open the other sockets which share this address.
+	 *	They're returned as a list, after this one.
+	 */
+	if ((this->type == RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+	    || (this->type == RAD_LISTEN_ACCT)
+#endif
+		) {
+		listen_socket_t *sock = this->data;
+		rad_listen_t **last = &(this->next);
+		uint32_t i;
+
+		for (i = 1; i < sock->reuseport; i++) {
+			rad_listen_t *next;
+			listen_socket_t *next_sock;
+
+			next = listen_alloc(cs, type);
+			next->server = this->server;
+			next->fd = -1;
+#ifdef WITH_TCP
+			next->dual = this->dual;
+#endif
+
+			if (master_listen[type].parse(cs, next) < 0) {
+				listen_free(&next);
+				listen_free(&this);
+				return NULL;
+			}
+
+			next_sock = next->data;
+			next_sock->reuseport_id = i;
+
+			*last = next;
+			last = &(next->next);
+		}
+	}
+#endif
+
 	cf_log_info(cs, "}");
 
 	return this;
@@ -2965,6 +3438,71 @@ static void *recv_thread(void *arg)
 }
 #endif
 
+#ifdef SO_REUSEPORT
+/*
+ *	The number of sockets sharing this listener's address.
+ */
+static uint32_t listen_reuseport(rad_listen_t const *this)
+{
+	listen_socket_t const *sock = this->data;
+
+	if ((this->type != RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+	    && (this->type != RAD_LISTEN_ACCT)
+#endif
+		) return 0;
+
+	return sock->reuseport;
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ *	Start the thread for one of the "reuseport" sockets, and pin
+ *	it to a CPU.  The thread runs its own event loop.
+ */
+static void reuseport_thread_start(rad_listen_t *this)
+{
+	int rcode;
+	pthread_t id;
+	char buffer[256];
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	listen_socket_t *sock = this->data;
+	long num_cpus;
+#endif
+
+	this->print(this, buffer, sizeof(buffer));
+
+	rcode = pthread_create(&id, 0, radius_event_worker, this);
+	if (rcode != 0) {
+		ERROR("Thread create failed: %s", fr_syserror(rcode));
+		fr_exit(1);
+	}
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cpus > 0) {
+		cpu_set_t cpus;
+		unsigned int cpu = sock->reuseport_id % num_cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+
+		rcode = pthread_setaffinity_np(id, sizeof(cpus), &cpus);
+		if (rcode != 0) {
+			WARN("Failed pinning thread for %s to CPU %u: %s",
+			     buffer, cpu, fr_syserror(rcode));
+		} else {
+			DEBUG("Thread for %s on CPU %u", buffer, cpu);
+		}
+		return;
+	}
+#endif
+
+	DEBUG("Thread for %s", buffer);
+}
+#endif
+#endif
+
 
 /*
  *	Generate a list of listeners.  Takes an input list of
@@ -2994,6 +3532,13 @@ int listen_init(CONF_SECTION *config, rad_listen_t **head,
 	 */
 	rad_assert(head && (*head == NULL));
 
+#if defined(WITH_RADIUS_BATCH) && defined(HAVE_PTHREAD_H)
+	/*
+	 *	We're called from the thread which runs the event loop.
+	 */
+	batch_main_thread = pthread_self();
+#endif
+
 	memset(&server_ipaddr, 0, sizeof(server_ipaddr));
 
 	last = head;
@@ -3142,7 +3687,7 @@ int listen_init(CONF_SECTION *config, rad_listen_t **head,
 			}
 
 			*last = this;
-			last = &(this->next);
+			while (*last) last = &((*last)->next);
 		} /* loop over "listen" directives in server <foo> */
 
 		goto add_sockets;
@@ -3161,7 +3706,7 @@ int listen_init(CONF_SECTION *config, rad_listen_t **head,
 		}
 
 		*last = this;
-		last = &(this->next);
+		while (*last) last = &((*last)->next);
 	}
 
 	/*
@@ -3185,7 +3730,7 @@ int listen_init(CONF_SECTION *config, rad_listen_t **head,
 			}
 
 			*last = this;
-			last = &(this->next);
+			while (*last) last = &((*last)->next);
 		} /* loop over "listen" directives in virtual servers */
 	} /* loop over virtual servers */
 
@@ -3252,6 +3797,23 @@ add_sockets:
 				this->workers = 0;
 #endif
 
+#ifdef SO_REUSEPORT
+			} else if (listen_reuseport(this)) {
+#ifdef HAVE_PTHREAD_H
+				if (spawn_flag) {
+					reuseport_thread_start(this);
+					continue;
+				}
+#endif
+				/*
+				 *	The sockets still share the
+				 *	address, but they're all read
+				 *	by the main thread.
+				 */
+				WARN("Setting 'reuseport' requires threads.  Reading its sockets in the main thread");
+				radius_update_listener(this);
+#endif
+
 			} else {
 				radius_update_listener(this);
 			}
@@ -29,6 +29,42 @@ RCSID("$Id$")
 #include <freeradius-devel/rad_assert.h>
 
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#  define STATS_COUNTER			atomic_uint_fast64_t
+#  define stats_add(_x, _n)		atomic_fetch_add_explicit(&(_x), _n, memory_order_relaxed)
+#  define stats_get(_x)			atomic_load_explicit(&(_x), memory_order_relaxed)
+#else
+#  define STATS_COUNTER			uint64_t
+#  define stats_add(_x, _n)		((_x) += (_n))
+#  define stats_get(_x)			(_x)
+#endif
+
+/*
+ *	Counters for one module method, policy, or section.  They are
+ *	found by name when the sections are compiled, and then live
+ *	until the server exits, so that every compiled reference to
+ *	the same module method or policy updates the same counters.
+ */
+typedef struct modcall_counters_t {
+	char const		*name;
+	STATS_COUNTER		calls;
+	STATS_COUNTER		usec;
+	STATS_COUNTER		max_usec;
+	STATS_COUNTER		rcode[RLM_MODULE_NUMCODES];
+} modcall_counters_t;
+
+static rbtree_t *modcall_stats_tree = NULL;
+
+#if !defined(HAVE_STDATOMIC_H) && defined(HAVE_PTHREAD_H)
+static pthread_mutex_t modcall_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
 /* mutually-recursive static functions need a prototype up front */
 static modcallable *do_compile_modgroup(modcallable *,
 					rlm_components_t, CONF_SECTION *,
@@ -57,6 +93,7 @@ struct modcallable {
 	       MOD_POLICY, MOD_REFERENCE, MOD_XLAT } type;
 	rlm_components_t method;
 	int actions[RLM_MODULE_NUMCODES];
+	modcall_counters_t *stats;	/* NULL if not counted */
 };
 
 #define MOD_LOG_OPEN_BRACE RDEBUG2("%s {", c->debug_name)
@@ -139,6 +176,157 @@ static modcallable *mod_xlattocallable(modxlat *p)
 	return (modcallable *)p;
 }
 
+#define USEC (1000000)
+
+static int modcall_stats_cmp(void const *one, void const *two)
+{
+	modcall_counters_t const *a = one;
+	modcall_counters_t const *b = two;
+
+	return strcmp(a->name, b->name);
+}
+
+/*
+ *	Find the counters for a name, creating them if necessary.
+ *
+ *	Returns NULL if module statistics are disabled, in which case
+ *	nothing is timed or counted.
+ */
+static modcall_counters_t *modcall_stats_find(char const *name)
+{
+	modcall_counters_t my_stats, *stats;
+
+	if (!main_config.module_statistics) return NULL;
+
+	if (!modcall_stats_tree) {
+		modcall_stats_tree = rbtree_create(NULL, modcall_stats_cmp, NULL, RBTREE_FLAG_LOCK);
+		if (!modcall_stats_tree) return NULL;
+	}
+
+	my_stats.name = name;
+	stats = rbtree_finddata(modcall_stats_tree, &my_stats);
+	if (stats) return stats;
+
+	stats = talloc_zero(modcall_stats_tree, modcall_counters_t);
+	if (!stats) return NULL;
+
+	stats->name = talloc_typed_strdup(stats, name);
+	if (!rbtree_insert(modcall_stats_tree, stats)) {
+		talloc_free(stats);
+		return NULL;
+	}
+
+	return stats;
+}
+
+/*
+ *	Count one call, which started at "start".
+ */
+static void modcall_stats_update(modcall_counters_t *stats, struct timeval const *start, rlm_rcode_t rcode)
+{
+	struct timeval now;
+	int64_t elapsed;
+	uint64_t usec;
+
+	gettimeofday(&now, NULL);
+	elapsed = ((int64_t) (now.tv_sec - start->tv_sec) * USEC) + (now.tv_usec - start->tv_usec);
+	usec = (elapsed > 0) ? elapsed : 0;	/* the clock may have been stepped */
+
+#ifdef HAVE_STDATOMIC_H
+	{
+		uint_fast64_t max;
+
+		stats_add(stats->calls, 1);
+		stats_add(stats->usec, usec);
+		if (rcode < RLM_MODULE_NUMCODES) stats_add(stats->rcode[rcode], 1);
+
+		max = stats_get(stats->max_usec);
+		while ((usec > max) &&
+		       !atomic_compare_exchange_weak_explicit(&stats->max_usec, &max, usec,
+							      memory_order_relaxed, memory_order_relaxed));
+	}
+#else
+	PTHREAD_MUTEX_LOCK(&modcall_stats_mutex);
+	stats->calls++;
+	stats->usec += usec;
+	if (rcode < RLM_MODULE_NUMCODES) stats->rcode[rcode]++;
+	if (usec > stats->max_usec) stats->max_usec = usec;
+	PTHREAD_MUTEX_UNLOCK(&modcall_stats_mutex);
+#endif
+}
+
+/** Count calls to a section
+ *
+ * Sections are compiled without knowing which virtual server they
+ * belong to, so the caller names them.
+ *
+ * @param mc the compiled section.
+ * @param name to report the counters under, e.g. "server.default.authorize".
+ */
+void modcall_stats_section(modcallable *mc, char const *name)
+{
+	if (!mc) return;
+
+	mc->stats = modcall_stats_find(name);
+}
+
+typedef struct modcall_stats_walk_ctx_t {
+	modcall_stats_walk_t	callback;
+	void			*ctx;
+} modcall_stats_walk_ctx_t;
+
+static int modcall_stats_walk_cb(void *ctx, void *data)
+{
+	modcall_stats_walk_ctx_t *walk = ctx;
+	modcall_counters_t *counters = data;
+	modcall_stats_t stats;
+	int i;
+
+	stats.name = counters->name;
+
+	PTHREAD_MUTEX_LOCK(&modcall_stats_mutex);
+	stats.calls = stats_get(counters->calls);
+	stats.usec = stats_get(counters->usec);
+	stats.max_usec = stats_get(counters->max_usec);
+	for (i = 0; i < RLM_MODULE_NUMCODES; i++) {
+		stats.rcode[i] = stats_get(counters->rcode[i]);
+	}
+	PTHREAD_MUTEX_UNLOCK(&modcall_stats_mutex);
+
+	return walk->callback(walk->ctx, &stats);
+}
+
+/** Call a function for the counters of every module method, policy and section
+ *
+ * The counters are walked in name order.  Each one is a snapshot,
+ * which may be a few calls out of date.
+ *
+ * @param callback to call.  Return non-zero to stop walking.
+ * @param ctx to pass to the callback.
+ * @return 0 on success, or the non-zero value returned by the callback.
+ */
+int modcall_stats_walk(modcall_stats_walk_t callback, void *ctx)
+{
+	modcall_stats_walk_ctx_t walk;
+
+	if (!modcall_stats_tree) return 0;
+
+	walk.callback = callback;
+	walk.ctx = ctx;
+
+	return rbtree_walk(modcall_stats_tree, RBTREE_IN_ORDER, modcall_stats_walk_cb, &walk);
+}
+
+/*
+ *	Free the counters.  The compiled sections which point to them
+ *	must already have been freed.
+ */
+void modcall_stats_free(void)
+{
+	rbtree_free(modcall_stats_tree);
+	modcall_stats_tree = NULL;
+}
+
 /* modgroups are grown by adding a modcallable to the end */
 static void add_child(modgroup *g, modcallable *c)
 {
@@ -285,6 +473,7 @@ static rlm_rcode_t CC_HINT(nonnull) call_modsingle(rlm_components_t component, m
 {
 	int blocked;
 	int indent = request->log.indent;
+	void *instance;
 
 	/*
 	 *	If the request should stop, refuse to do anything.
@@ -302,13 +491,25 @@ static rlm_rcode_t CC_HINT(nonnull) call_modsingle(rlm_components_t component, m
 		goto fail;
 	}
 
+	instance = sp->modinst->insthandle;
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	The module has data for each thread.
+	 */
+	if (sp->modinst->thread_mutex &&
+	    (module_thread_instance(&instance, sp->modinst) < 0)) {
+		request->rcode = RLM_MODULE_FAIL;
+		goto fail;
+	}
+#endif
+
 	/*
 	 *	For logging unresponsive children.
 	 */
 	request->module = sp->modinst->name;
 
 	safe_lock(sp->modinst);
-	request->rcode = sp->modinst->entry->module->methods[component](sp->modinst->insthandle, request);
+	request->rcode = sp->modinst->entry->module->methods[component](instance, request);
 	safe_unlock(sp->modinst);
 
 	request->module = "";
@@ -585,7 +786,15 @@ redo:
 		 */
 		sp = mod_callabletosingle(c);
 
-		result = call_modsingle(c->method, sp, request);
+		if (c->stats) {
+			struct timeval start;
+
+			gettimeofday(&start, NULL);
+			result = call_modsingle(c->method, sp, request);
+			modcall_stats_update(c->stats, &start, result);
+		} else {
+			result = call_modsingle(c->method, sp, request);
+		}
 		RDEBUG2("[%s] = %s", c->name ? c->name : "",
 			fr_int2str(mod_rcode_table, result, "<invalid>"));
 		goto calculate_result;
@@ -790,9 +999,19 @@ redo:
 		}
 
 		MOD_LOG_OPEN_BRACE;
-		modcall_child(request, component,
-			      depth + 1, entry, g->children,
-			      &result);
+		if (c->stats) {
+			struct timeval start;
+
+			gettimeofday(&start, NULL);
+			modcall_child(request, component,
+				      depth + 1, entry, g->children,
+				      &result);
+			modcall_stats_update(c->stats, &start, result);
+		} else {
+			modcall_child(request, component,
+				      depth + 1, entry, g->children,
+				      &result);
+		}
 		MOD_LOG_CLOSE_BRACE;
 		goto calculate_result;
 	} /* MOD_GROUP */
@@ -2286,6 +2505,7 @@ static modcallable *do_compile_modsingle(modcallable *parent,
 	module_instance_t *this;
 	CONF_SECTION *cs, *subcs, *modules;
 	char const *realname;
+	char stats_name[MAX_STRING_LEN + 32];	/* module.<name>.<component> */
 
 	if (cf_item_is_section(ci)) {
 		char const *name2;
@@ -2502,11 +2722,16 @@ static modcallable *do_compile_modsingle(modcallable *parent,
 				/*
 				 *	foo {} is a group.
 				 */
-				return do_compile_modgroup(parent,
-							   component,
-							   subcs,
-							   GROUPTYPE_SIMPLE,
-							   grouptype, MOD_GROUP);
+				csingle = do_compile_modgroup(parent,
+							      component,
+							      subcs,
+							      GROUPTYPE_SIMPLE,
+							      grouptype, MOD_GROUP);
+				if (csingle) {
+					snprintf(stats_name, sizeof(stats_name), "policy.%s", modrefname);
+					csingle->stats = modcall_stats_find(stats_name);
+				}
+				return csingle;
 			}
 		}
 	}
@@ -2679,6 +2904,10 @@ static modcallable *do_compile_modsingle(modcallable *parent,
 
 	single->modinst = this;
 	*modname = this->entry->module->name;
+
+	snprintf(stats_name, sizeof(stats_name), "module.%s.%s", this->name, comp2str[component]);
+	csingle->stats = modcall_stats_find(stats_name);
+
 	return csingle;
 }
 
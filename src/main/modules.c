@@ -382,6 +382,16 @@ static void module_instance_free(void *data)
 		pthread_mutex_destroy(module->mutex);
 		talloc_free(module->mutex);
 	}
+
+	/*
+	 *	Threads which exit from now on won't free their
+	 *	data.  It's freed with the module.
+	 */
+	if (module->thread_mutex) {
+		pthread_key_delete(module->thread_key);
+		pthread_mutex_destroy(module->thread_mutex);
+		talloc_free(module->thread_mutex);
+	}
 #endif
 
 	/*
@@ -436,6 +446,7 @@ int modules_free(void)
 {
 	rbtree_free(instance_tree);
 	rbtree_free(module_tree);
+	modcall_stats_free();
 
 	return 0;
 }
@@ -558,6 +569,97 @@ static int module_conf_parse(module_instance_t *node, void **handle)
 	return 0;
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ *	One thread's data for a RLM_TYPE_THREAD_INSTANCE module.
+ */
+typedef struct module_thread_t {
+	module_instance_t	*node;
+	void			*data;		//!< Created by the module's thread_instantiate.
+	unsigned int		generation;	//!< Of the node, when the data was created.
+} module_thread_t;
+
+static int _module_thread_free(module_thread_t *thread)
+{
+	module_t const *module = thread->node->entry->module;
+
+	if (module->thread_detach) (module->thread_detach)(thread->data);
+
+	return 0;
+}
+
+/*
+ *	Free a thread's data when the thread exits.
+ */
+static void module_thread_free(void *data)
+{
+	module_thread_t *thread = data;
+	module_instance_t *node = thread->node;
+
+	pthread_mutex_lock(node->thread_mutex);
+	talloc_free(thread);
+	pthread_mutex_unlock(node->thread_mutex);
+}
+
+/** Get the calling thread's data for a RLM_TYPE_THREAD_INSTANCE module
+ *
+ * The first time a thread calls the module, the module's thread_instantiate
+ * function creates the thread's data from the module instance.  The data is
+ * used only by that thread, so calls with it don't need a mutex.  If the
+ * module has been reloaded on HUP, the thread's data is created again.
+ *
+ * @param[out] insthandle the data for this thread.
+ * @param[in] node the module instance.
+ * @return 0 on success, -1 if the data could not be created.
+ */
+int module_thread_instance(void **insthandle, module_instance_t *node)
+{
+	module_thread_t *thread;
+
+	thread = pthread_getspecific(node->thread_key);
+	if (thread && (thread->generation == node->generation)) {
+		*insthandle = thread->data;
+		return 0;
+	}
+
+	/*
+	 *	The data is allocated from the module instance, which
+	 *	other threads use, and a HUP may be replacing the
+	 *	instance data.
+	 */
+	pthread_mutex_lock(node->thread_mutex);
+	if (thread) {
+		pthread_setspecific(node->thread_key, NULL);
+		talloc_free(thread);
+	}
+
+	thread = talloc_zero(node, module_thread_t);
+	thread->node = node;
+	thread->generation = node->generation;
+
+	if ((node->entry->module->thread_instantiate)(node->insthandle, thread, &thread->data) < 0) {
+		talloc_free(thread);
+		goto error;
+	}
+	talloc_set_destructor(thread, _module_thread_free);
+
+	if (pthread_setspecific(node->thread_key, thread) != 0) {
+		talloc_free(thread);
+		goto error;
+	}
+	pthread_mutex_unlock(node->thread_mutex);
+
+	*insthandle = thread->data;
+	return 0;
+
+error:
+	pthread_mutex_unlock(node->thread_mutex);
+
+	ERROR("Failed instantiating module \"%s\" for thread", node->name);
+	return -1;
+}
+#endif
+
 /*
  *	Find a module instance.
  */
@@ -685,7 +787,32 @@ module_instance_t *find_module_instance(CONF_SECTION *modules,
 	 *
 	 *	If it isn't, we create a mutex.
 	 */
-	if ((node->entry->module->type & RLM_TYPE_THREAD_UNSAFE) != 0) {
+	if ((node->entry->module->type & RLM_TYPE_THREAD_INSTANCE) != 0) {
+		if (!node->entry->module->thread_instantiate) {
+			cf_log_err_cs(cs, "Module \"%s\" is RLM_TYPE_THREAD_INSTANCE, but has no thread_instantiate "
+				      "function", node->name);
+			talloc_free(node);
+
+			return NULL;
+		}
+
+		/*
+		 *	Each thread gets its own data for the module,
+		 *	so calls don't need a mutex.  This one only
+		 *	protects the creation of the data.
+		 */
+		if (pthread_key_create(&node->thread_key, module_thread_free) != 0) {
+			cf_log_err_cs(cs, "Failed creating thread key for module \"%s\"", node->name);
+			talloc_free(node);
+
+			return NULL;
+		}
+
+		node->thread_mutex = talloc_zero(node, pthread_mutex_t);
+		pthread_mutex_init(node->thread_mutex, NULL);
+		node->mutex = NULL;
+
+	} else if ((node->entry->module->type & RLM_TYPE_THREAD_UNSAFE) != 0) {
 		node->mutex = talloc_zero(node, pthread_mutex_t);
 
 		/*
@@ -699,6 +826,13 @@ module_instance_t *find_module_instance(CONF_SECTION *modules,
 		node->mutex = NULL;
 	}
 
+#else
+	if ((node->entry->module->type & RLM_TYPE_THREAD_INSTANCE) != 0) {
+		cf_log_err_cs(cs, "Module \"%s\" requires the server to be built with thread support", node->name);
+		talloc_free(node);
+
+		return NULL;
+	}
 #endif
 	rbtree_insert(instance_tree, node);
 
@@ -899,6 +1033,39 @@ rlm_rcode_t indexed_modcall(rlm_components_t comp, int idx, REQUEST *request)
 	return rcode;
 }
 
+/*
+ *	Count calls to a section, under the name of the virtual
+ *	server it's in, e.g. "server.default.authenticate.PAP".
+ */
+static void section_stats(modcallable *mc, CONF_SECTION *cs, rlm_components_t comp)
+{
+	char buffer[256];
+	char const *server = "default";
+	char const *name1, *name2;
+	CONF_SECTION *parent;
+
+	for (parent = cf_item_parent(cf_sectiontoitem(cs));
+	     parent != NULL;
+	     parent = cf_item_parent(cf_sectiontoitem(parent))) {
+		name1 = cf_section_name1(parent);
+		if (name1 && (strcmp(name1, "server") == 0)) {
+			server = cf_section_name2(parent);
+			break;
+		}
+	}
+
+	name2 = cf_section_name2(cs);
+	if (name2) {
+		snprintf(buffer, sizeof(buffer), "server.%s.%s.%s", server,
+			 section_type_value[comp].section, name2);
+	} else {
+		snprintf(buffer, sizeof(buffer), "server.%s.%s", server,
+			 section_type_value[comp].section);
+	}
+
+	modcall_stats_section(mc, buffer);
+}
+
 /*
  *	Load a sub-module list, as found inside an Auth-Type foo {}
  *	block
@@ -949,6 +1116,7 @@ static int load_subcomponent_section(CONF_SECTION *cs,
 	}
 
 	subcomp->modulelist = talloc_steal(subcomp, ml);
+	section_stats(ml, cs, comp);
 	return 1;		/* OK */
 }
 
@@ -1294,7 +1462,10 @@ static int load_byserver(CONF_SECTION *cs)
 		 *	put empty sections for some reason...
 		 */
 		c = lookup_by_index(components, comp, 0);
-		if (c) server->mc[comp] = c->modulelist;
+		if (c) {
+			server->mc[comp] = c->modulelist;
+			section_stats(c->modulelist, subcs, comp);
+		}
 
 		server->subcs[comp] = subcs;
 
@@ -1548,6 +1719,14 @@ int module_hup_module(CONF_SECTION *cs, module_instance_t *node, time_t when)
 
 	cf_log_module(cs, "Trying to reload module \"%s\"", node->name);
 
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Threads may be creating their own data for the
+	 *	module from the current instance.
+	 */
+	if (node->thread_mutex) pthread_mutex_lock(node->thread_mutex);
+#endif
+
 	/*
 	 *	Parse the module configuration, and setup destructors so the
 	 *	module's detach method is called when it's instance data is
@@ -1556,15 +1735,13 @@ int module_hup_module(CONF_SECTION *cs, module_instance_t *node, time_t when)
 	if (module_conf_parse(node, &insthandle) < 0) {
 		cf_log_err_cs(cs, "HUP failed for module \"%s\" (parsing config failed). "
 			      "Using old configuration", node->name);
-
-		return 0;
+		goto error;
 	}
 
 	if ((node->entry->module->instantiate)(cs, insthandle) < 0) {
 		cf_log_err_cs(cs, "HUP failed for module \"%s\".  Using old configuration.", node->name);
 		talloc_free(insthandle);
-
-		return 0;
+		goto error;
 	}
 
 	INFO(" Module: Reloaded module \"%s\"", node->name);
@@ -1583,12 +1760,27 @@ int module_hup_module(CONF_SECTION *cs, module_instance_t *node, time_t when)
 
 	node->insthandle = insthandle;
 
+	/*
+	 *	Threads with their own data will create it again.
+	 */
+	node->generation++;
+
+#ifdef HAVE_PTHREAD_H
+	if (node->thread_mutex) pthread_mutex_unlock(node->thread_mutex);
+#endif
+
 	/*
 	 *	FIXME: Set a timeout to come back in 60s, so that
 	 *	we can pro-actively clean up the old instances.
 	 */
 
 	return 1;
+
+error:
+#ifdef HAVE_PTHREAD_H
+	if (node->thread_mutex) pthread_mutex_unlock(node->thread_mutex);
+#endif
+	return 0;
 }
 
 
@@ -44,6 +44,10 @@ RCSID("$Id$")
 #	include <sys/wait.h>
 #endif
 
+#ifdef HAVE_STDATOMIC_H
+#	include <stdatomic.h>
+#endif
+
 extern pid_t radius_pid;
 extern bool check_config;
 extern fr_cond_t *debug_condition;
@@ -51,7 +55,7 @@ extern fr_cond_t *debug_condition;
 static bool spawn_flag = false;
 static bool just_started = true;
 time_t fr_start_time = (time_t)-1;
-static rbtree_t *pl = NULL;
+static fr_packet_hash_t *pl = NULL;
 static fr_event_list_t *el = NULL;
 
 fr_event_list_t *radius_event_list_corral(UNUSED event_corral_t hint) {
@@ -296,7 +300,14 @@ void radius_update_listener(rad_listen_t *this)
 #define FD_MUTEX_UNLOCK(_x)
 #endif
 
-static int request_num_counter = 1;
+#ifdef HAVE_STDATOMIC_H
+/*
+ *	The "reuseport" threads set up requests, too.
+ */
+static atomic_uint request_num_counter = 1;
+#else
+static unsigned int request_num_counter = 1;
+#endif
 #ifdef WITH_PROXY
 static int request_will_proxy(REQUEST *request);
 static int request_proxy(REQUEST *request, int retransmit);
@@ -312,6 +323,11 @@ static int insert_into_proxy_hash(REQUEST *request);
 static REQUEST *request_setup(rad_listen_t *listener, RADIUS_PACKET *packet,
 			      RADCLIENT *client, RAD_REQUEST_FUNP fun);
 
+#ifdef HAVE_PTHREAD_H
+static bool worker_request_track(REQUEST *request);
+static bool worker_request_dup(rad_listen_t *listener, RADIUS_PACKET *packet);
+#endif
+
 STATE_MACHINE_DECL(request_common);
 STATE_MACHINE_DECL(request_response_delay);
 STATE_MACHINE_DECL(request_cleanup_delay);
@@ -645,7 +661,7 @@ STATE_MACHINE_DECL(request_done)
 	 */
 	if (request->in_request_hash) {
 		ASSERT_MASTER;
-		if (!rbtree_deletebydata(pl, &request->packet)) {
+		if (!fr_packet_hash_yank(pl, request->packet)) {
 			rad_assert(0 == 1);
 		}
 		request->in_request_hash = false;
@@ -1652,12 +1668,20 @@ int request_receive(rad_listen_t *listener, RADIUS_PACKET *packet,
 		sock->last_packet = now.tv_sec;
 	}
 
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Listeners with their own event loop track their own
+	 *	requests.
+	 */
+	if (listener->requests && worker_request_dup(listener, packet)) return 0;
+#endif
+
 	/*
 	 *	Skip everything if required.
 	 */
 	if (listener->nodup) goto skip_dup;
 
-	packet_p = rbtree_finddata(pl, &packet);
+	packet_p = fr_packet_hash_find(pl, packet);
 	if (packet_p) {
 		request = fr_packet2myptr(REQUEST, packet, packet_p);
 		rad_assert(request->in_request_hash);
@@ -1735,7 +1759,7 @@ int request_receive(rad_listen_t *listener, RADIUS_PACKET *packet,
 	 *	Quench maximum number of outstanding requests.
 	 */
 	if (main_config.max_requests &&
-	    ((count = rbtree_num_elements(pl)) > main_config.max_requests)) {
+	    ((count = fr_packet_hash_num_elements(pl)) > main_config.max_requests)) {
 		RATE_LIMIT(ERROR("Dropping request (%d is too many): from client %s port %d - ID: %d", count,
 				 client->shortname,
 				 packet->src_port, packet->id);
@@ -1768,7 +1792,7 @@ skip_dup:
 	 *	Remember the request in the list.
 	 */
 	if (!listener->nodup) {
-		if (!rbtree_insert(pl, &request->packet)) {
+		if (!fr_packet_hash_insert(pl, &request->packet)) {
 			RERROR("Failed to insert request in the list of live requests: discarding it");
 			request_done(request, FR_ACTION_DONE);
 			return 1;
@@ -1796,6 +1820,11 @@ skip_dup:
 		} else {
 			RDEBUG("Not sending reply");
 		}
+
+#ifdef HAVE_PTHREAD_H
+		if (listener->requests && worker_request_track(request)) return 1;
+#endif
+
 		talloc_free(request);
 		return 1;
 	}
@@ -1810,16 +1839,51 @@ skip_dup:
 }
 
 
+/*
+ *	Move a received packet into the request's arena.  Anything
+ *	later allocated under the packet (e.g. the decoded attributes)
+ *	then comes from the arena, too.
+ */
+static RADIUS_PACKET *request_packet_move(TALLOC_CTX *ctx, RADIUS_PACKET *packet)
+{
+	RADIUS_PACKET *out;
+	VALUE_PAIR *vp;
+	vp_cursor_t cursor;
+
+	out = talloc(ctx, RADIUS_PACKET);
+	if (!out) return talloc_steal(ctx, packet);
+
+	memcpy(out, packet, sizeof(*out));
+
+	if (out->data && (talloc_parent(out->data) == packet)) {
+		talloc_steal(out, out->data);
+	}
+
+	for (vp = fr_cursor_init(&cursor, &out->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		if (talloc_parent(vp) == packet) talloc_steal(out, vp);
+	}
+
+	packet->data = NULL;
+	packet->vps = NULL;
+	talloc_free(packet);
+
+	return out;
+}
+
 static REQUEST *request_setup(rad_listen_t *listener, RADIUS_PACKET *packet,
 			      RADCLIENT *client, RAD_REQUEST_FUNP fun)
 {
 	REQUEST *request;
+	TALLOC_CTX *arena;
 
 	/*
 	 *	Create and initialize the new request.
 	 */
 	request = request_alloc(NULL);
-	request->reply = rad_alloc(request, false);
+	arena = request_arena_alloc(request);
+	request->reply = rad_alloc(arena, false);
 	if (!request->reply) {
 		ERROR("No memory");
 		talloc_free(request);
@@ -1828,7 +1892,7 @@ static REQUEST *request_setup(rad_listen_t *listener, RADIUS_PACKET *packet,
 
 	request->listener = listener;
 	request->client = client;
-	request->packet = talloc_steal(request, packet);
+	request->packet = request_packet_move(arena, packet);
 	request->number = request_num_counter++;
 	request->priority = listener->type;
 	if (request->priority >= RAD_LISTEN_MAX) {
@@ -1848,11 +1912,11 @@ static REQUEST *request_setup(rad_listen_t *listener, RADIUS_PACKET *packet,
 
 #ifdef WITH_STATS
 	request->listener->stats.last_packet = request->packet->timestamp.tv_sec;
-	if (packet->code == PW_CODE_ACCESS_REQUEST) {
+	if (request->packet->code == PW_CODE_ACCESS_REQUEST) {
 		request->client->auth.last_packet = request->packet->timestamp.tv_sec;
 		radius_auth_stats.last_packet = request->packet->timestamp.tv_sec;
 #ifdef WITH_ACCOUNTING
-	} else if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
+	} else if (request->packet->code == PW_CODE_ACCOUNTING_REQUEST) {
 		request->client->acct.last_packet = request->packet->timestamp.tv_sec;
 		radius_acct_stats.last_packet = request->packet->timestamp.tv_sec;
 #endif
@@ -2053,8 +2117,8 @@ static int eol_proxy_listener(void *ctx, void *data)
 	 *	Don't mark it as DONE.  The client can retransmit, and
 	 *	the packet SHOULD be re-proxied somewhere else.
 	 *
-	 *	Return "2" means that the rbtree code will remove it
-	 *	from the tree, and we don't need to do it ourselves.
+	 *	Return "2" means that the packet list code will remove it
+	 *	from the list, and we don't need to do it ourselves.
 	 */
 	return 2;
 }
@@ -4316,6 +4380,14 @@ static void event_status(struct timeval *wake)
 	int argval;
 #endif
 
+#ifdef WITH_RADIUS_BATCH
+	/*
+	 *	Send any replies which are waiting for a batch to
+	 *	fill up, before we sleep.
+	 */
+	listen_batch_flush();
+#endif
+
 	if (debug_flag == 0) {
 		if (just_started) {
 			INFO("Ready to process requests");
@@ -4684,7 +4756,7 @@ static int event_new_fd(rad_listen_t *this)
 			/*
 			 *	EOL all requests using this socket.
 			 */
-			rbtree_walk(pl, RBTREE_DELETE_ORDER, eol_listener, this);
+			fr_packet_hash_walk(pl, this, eol_listener);
 		}
 
 		/*
@@ -4881,20 +4953,139 @@ static void event_signal_handler(UNUSED fr_event_list_t *xel,
  *	Externally-visibly functions.
  */
 int radius_event_init(TALLOC_CTX *ctx) {
-	el = fr_event_list_create(ctx, event_status);
+	el = fr_event_list_create(ctx, event_status, FR_EVENT_TIMER_WHEEL);
 	if (!el) return 0;
 
 	return 1;
 }
 
-static int packet_entry_cmp(void const *one, void const *two)
+#ifdef HAVE_PTHREAD_H
+/***********************************************************************
+ *
+ *	Listeners with their own event loop.
+ *
+ *	Each one is read by one thread, which processes the packets
+ *	itself.  The thread also tracks its own requests, so that it
+ *	can answer retransmissions.  Nothing else touches the event
+ *	loop or the requests, so none of this needs locks.
+ *
+ ***********************************************************************/
+static void worker_request_free(void *ctx)
 {
-	RADIUS_PACKET const * const *a = one;
-	RADIUS_PACKET const * const *b = two;
+	REQUEST *request = talloc_get_type_abort(ctx, REQUEST);
+	rad_listen_t *listener = request->listener;
+
+	if (request->ev) fr_event_delete(listener->el, &request->ev);
+
+	if (request->in_request_hash) {
+		(void) fr_packet_hash_yank(listener->requests, request->packet);
+		request->in_request_hash = false;
+	}
 
-	return fr_packet_cmp(*a, *b);
+	talloc_free(request);
 }
 
+/*
+ *	Remember the reply to an Access-Request for "cleanup_delay"
+ *	seconds, in case the client retransmits the request.
+ */
+static bool worker_request_track(REQUEST *request)
+{
+	struct timeval when;
+	rad_listen_t *listener = request->listener;
+
+	if ((request->packet->code != PW_CODE_ACCESS_REQUEST) ||
+	    !request->root->cleanup_delay) return false;
+
+	if (!fr_packet_hash_insert(listener->requests, &request->packet)) return false;
+	request->in_request_hash = true;
+
+	gettimeofday(&when, NULL);
+	when.tv_sec += request->root->cleanup_delay;
+
+	if (!fr_event_insert(listener->el, worker_request_free, request, &when, &request->ev)) {
+		(void) fr_packet_hash_yank(listener->requests, request->packet);
+		request->in_request_hash = false;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ *	Check for a retransmission of a request we've already
+ *	answered.  If so, send the same reply again.
+ */
+static bool worker_request_dup(rad_listen_t *listener, RADIUS_PACKET *packet)
+{
+	RADIUS_PACKET **packet_p;
+	REQUEST *request;
+	RADCLIENT *client;
+
+	packet_p = fr_packet_hash_find(listener->requests, packet);
+	if (!packet_p) return false;
+
+	request = fr_packet2myptr(REQUEST, packet, packet_p);
+
+	/*
+	 *	A new request re-using the ID.  Forget the old one.
+	 */
+	if ((request->packet->data_len != packet->data_len) ||
+	    (memcmp(request->packet->vector, packet->vector,
+		    sizeof(packet->vector)) != 0)) {
+		worker_request_free(request);
+		return false;
+	}
+
+	client = request->client;
+	FR_STATS_INC(auth, total_dup_requests);
+
+	if (request->reply->code != 0) {
+		listener->send(listener, request);
+	} else {
+		RDEBUG("No reply.  Ignoring retransmit");
+	}
+
+	return true;
+}
+
+static void worker_socket_handler(UNUSED fr_event_list_t *xel, UNUSED int fd, void *ctx)
+{
+	rad_listen_t *listener = talloc_get_type_abort(ctx, rad_listen_t);
+
+	listener->recv(listener);
+}
+
+/** Run an event loop for one listener, in its own thread
+ *
+ * @param ctx the listener.
+ * @return NULL when the event loop exits.
+ */
+void *radius_event_worker(void *ctx)
+{
+	rad_listen_t *listener = talloc_get_type_abort(ctx, rad_listen_t);
+	char buffer[256];
+
+	listener->print(listener, buffer, sizeof(buffer));
+
+	listener->el = fr_event_list_create(NULL, NULL, FR_EVENT_TIMER_WHEEL);
+	listener->requests = fr_packet_hash_create(NULL);
+	if (!listener->el || !listener->requests) {
+		ERROR("Failed creating event loop for %s", buffer);
+		fr_exit(1);
+	}
+
+	if (!fr_event_fd_insert(listener->el, 0, listener->fd, worker_socket_handler, listener)) {
+		ERROR("Failed adding event handler for %s: %s", buffer, fr_strerror());
+		fr_exit(1);
+	}
+
+	fr_event_loop(listener->el);
+
+	return NULL;
+}
+#endif
+
 
 int radius_event_start(CONF_SECTION *cs, bool have_children)
 {
@@ -4910,7 +5101,7 @@ int radius_event_start(CONF_SECTION *cs, bool have_children)
 		 */
 		rad_assert(el);
 
-		pl = rbtree_create(NULL, packet_entry_cmp, NULL, 0);
+		pl = fr_packet_hash_create(NULL);
 		if (!pl) return 0;	/* leak el */
 	}
 
@@ -5124,7 +5315,7 @@ void radius_event_free(void)
 	}
 #endif
 
-	rbtree_walk(pl, RBTREE_DELETE_ORDER,  request_delete_cb, NULL);
+	fr_packet_hash_walk(pl, NULL, request_delete_cb);
 
 	if (spawn_flag) {
 		/*
@@ -5152,15 +5343,15 @@ void radius_event_free(void)
 			}
 #endif
 
-			rbtree_walk(pl, RBTREE_DELETE_ORDER, NULL, request_delete_cb);
-			num = rbtree_num_elements(pl);
+			fr_packet_hash_walk(pl, NULL, request_delete_cb);
+			num = fr_packet_hash_num_elements(pl);
 			if (num > 0) {
 				ERROR("Request list has %d requests still in it.", num);
 			}
 		}
 	}
 
-	rbtree_free(pl);
+	talloc_free(pl);
 	pl = NULL;
 
 #ifdef WITH_PROXY
@@ -43,6 +43,11 @@ typedef struct REQUEST REQUEST;
 #include <freeradius-devel/log.h>
 log_debug_t debug_flag = 0;
 
+/*
+ *	If set, each "decode" is timed over this many loops.
+ */
+static uint32_t decode_loops = 0;
+
 /**********************************************************************
  *	Hacks for xlat
  */
@@ -559,6 +564,65 @@ static void parse_xlat(char const *input, char *output, size_t outlen)
 	talloc_free(fmt);
 }
 
+/*
+ *	Decode a list of attributes.  Returns the length of the last
+ *	attribute decoded, which is negative on error.
+ */
+static ssize_t decode_attrs(uint8_t const *attr, size_t len, VALUE_PAIR **head)
+{
+	ssize_t my_len = 0;
+	VALUE_PAIR *vp, **tail = head;
+
+	while (len > 0) {
+		vp = NULL;
+		my_len = rad_attr2vp(NULL, NULL, NULL, NULL, attr, len, &vp);
+		if (my_len < 0) {
+			pairfree(head);
+			break;
+		}
+
+		if ((size_t) my_len > len) {
+			fprintf(stderr, "Internal sanity check failed at %d\n", __LINE__);
+			exit(1);
+		}
+
+		*tail = vp;
+		while (vp) {
+			tail = &(vp->next);
+			vp = vp->next;
+		}
+
+		attr += my_len;
+		len -= my_len;
+	}
+
+	return my_len;
+}
+
+/*
+ *	Time decoding the attributes "loops" times.
+ */
+static void decode_bench(char const *filename, int lineno, uint8_t const *attr, size_t len)
+{
+	uint32_t i;
+	struct timeval start, end;
+	uint64_t usec;
+	VALUE_PAIR *head;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < decode_loops; i++) {
+		head = NULL;
+		(void) decode_attrs(attr, len, &head);
+		pairfree(&head);
+	}
+	gettimeofday(&end, NULL);
+
+	usec = ((end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+
+	printf("%s[%d]: %zu bytes, %.3f usec/decode, %.0f decodes/s\n", filename, lineno, len,
+	       (double) usec / decode_loops, usec ? ((double) decode_loops * 1000000) / usec : 0);
+}
+
 static void process_file(const char *root_dir, char const *filename)
 {
 	int lineno;
@@ -599,7 +663,6 @@ static void process_file(const char *root_dir, char const *filename)
 	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
 		char *p = strchr(buffer, '\n');
 		VALUE_PAIR *vp, *head = NULL;
-		VALUE_PAIR **tail = &head;
 
 		lineno++;
 
@@ -715,29 +778,9 @@ static void process_file(const char *root_dir, char const *filename)
 				}
 			}
 
-			my_len = 0;
-			while (len > 0) {
-				vp = NULL;
-				my_len = rad_attr2vp(NULL, NULL, NULL, NULL, attr, len, &vp);
-				if (my_len < 0) {
-					pairfree(&head);
-					break;
-				}
-
-				if (my_len > len) {
-					fprintf(stderr, "Internal sanity check failed at %d\n", __LINE__);
-					exit(1);
-				}
+			if (decode_loops) decode_bench(filename, lineno, attr, len);
 
-				*tail = vp;
-				while (vp) {
-					tail = &(vp->next);
-					vp = vp->next;
-				}
-
-				attr += my_len;
-				len -= my_len;
-			}
+			my_len = decode_attrs(attr, len, &head);
 
 			/*
 			 *	Output may be an error, and we ignore
@@ -779,6 +822,34 @@ static void process_file(const char *root_dir, char const *filename)
 			continue;
 		}
 
+		/*
+		 *	Read more definitions, as the server does after
+		 *	dict_init().  The file is relative to this one.
+		 */
+		if (strncmp(p, "dictionary ", 11) == 0) {
+			char *q;
+			int rcode;
+
+			p += 11;
+			while (isspace((int) *p)) p++;
+
+			q = strrchr(directory, '/');
+			if (q) {
+				*q = '\0';
+				rcode = dict_read(directory, p);
+				*q = '/';
+			} else {
+				rcode = dict_read(".", p);
+			}
+
+			if (rcode < 0) {
+				fprintf(stderr, "Failed reading dictionary at line %d of %s: %s\n",
+					lineno, directory, fr_strerror());
+				exit(1);
+			}
+			continue;
+		}
+
 		if (strncmp(p, "$INCLUDE ", 9) == 0) {
 			char *q;
 
@@ -830,13 +901,16 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	while ((c = getopt(argc, argv, "d:D:xM")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "d:D:n:xM")) != EOF) switch (c) {
 		case 'd':
 			radius_dir = optarg;
 			break;
 		case 'D':
 			dict_dir = optarg;
 			break;
+		case 'n':
+			decode_loops = atoi(optarg);
+			break;
 		case 'x':
 			fr_debug_flag++;
 			debug_flag = fr_debug_flag;
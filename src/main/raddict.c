@@ -0,0 +1,108 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file raddict.c
+ * @brief Compile the dictionaries into an image which can be mapped at startup.
+ *
+ * @copyright 2014 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+static void NEVER_RETURNS usage(int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: raddict [options]\n");
+	fprintf(output, "  -D <dictdir>     Set dictionary directory (default " DICTDIR ").\n");
+	fprintf(output, "  -o <file>        Write the compiled dictionary to <file>\n");
+	fprintf(output, "                   (default <dictdir>/" RADIUS_DICTIONARY ".snapshot).\n");
+	fprintf(output, "  -h               Print this help message.\n");
+	fprintf(output, "  -x               Increase debug level.\n");
+
+	exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = DICTDIR;
+	char const	*output = NULL;
+	char		buffer[2048];
+
+#ifndef NDEBUG
+	if (fr_fault_setup(getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("raddict");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	while ((c = getopt(argc, argv, "D:ho:x")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'h':
+			usage(0);
+
+		case 'o':
+			output = optarg;
+			break;
+
+		case 'x':
+			fr_debug_flag++;
+			break;
+
+		default:
+			usage(1);
+	}
+	argc -= optind;
+
+	if (argc != 0) usage(1);
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddict");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!output) {
+		snprintf(buffer, sizeof(buffer), "%s/%s.snapshot", dict_dir, RADIUS_DICTIONARY);
+		output = buffer;
+	}
+
+	if (dict_compile(dict_dir, RADIUS_DICTIONARY, output) < 0) {
+		fr_perror("raddict");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_debug_flag) printf("Wrote %s\n", output);
+
+	dict_free();
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,6 @@
+TARGET		:= raddict
+SOURCES		:= raddict.c
+
+TGT_INSTALLDIR  := ${sbindir}
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
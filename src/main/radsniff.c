@@ -43,11 +43,16 @@ RCSID("$Id$")
 
 static rs_t *conf;
 struct timeval start_pcap = {0, 0};
-static char timestr[50];
+static RS_THREAD_LOCAL char timestr[50];
 
-static rbtree_t *request_tree = NULL;
-static rbtree_t *link_tree = NULL;
-static fr_event_list_t *events;
+/*
+ *	With worker threads (-j) each worker has its own copy of these,
+ *	otherwise they all belong to the capture thread.
+ */
+static RS_THREAD_LOCAL rbtree_t *request_tree = NULL;
+static RS_THREAD_LOCAL rbtree_t *link_tree = NULL;
+static RS_THREAD_LOCAL fr_event_list_t *events;
+static RS_THREAD_LOCAL TALLOC_CTX *packet_ctx;		//!< Where requests and decoded packets are allocated.
 static bool cleanup;
 
 static int self_pipe[2] = {-1, -1};		//!< Signals from sig handlers
@@ -77,6 +82,9 @@ static int rs_useful_codes[] = {
 	PW_CODE_COA_NAK,			//!< RFC3575/RFC5176 - CoA-Nak (not willing to perform)
 };
 
+static double const rs_percentiles[RS_PERCENTILES] = { 50.0, 90.0, 99.0, 99.9 };
+static char const *rs_percentile_names[RS_PERCENTILES] = { "p50", "p90", "p99", "p99.9" };
+
 const FR_NAME_NUMBER rs_events[] = {
 	{ "received",	RS_NORMAL	},
 	{ "norsp",	RS_LOST		},
@@ -192,6 +200,7 @@ static void rs_time_print(char *out, size_t len, struct timeval const *t)
 {
 	size_t ret;
 	struct timeval now;
+	struct tm tm;
 	uint32_t usec;
 
 	if (!t) {
@@ -199,7 +208,7 @@ static void rs_time_print(char *out, size_t len, struct timeval const *t)
 		t = &now;
 	}
 
-	ret = strftime(out, len, "%Y-%m-%d %H:%M:%S", localtime(&t->tv_sec));
+	ret = strftime(out, len, "%Y-%m-%d %H:%M:%S", localtime_r(&t->tv_sec, &tm));
 	if (ret >= len) {
 		return;
 	}
@@ -475,6 +484,11 @@ static void rs_packet_print_fancy(uint64_t count, rs_status_t status, fr_pcap_t
 
 	*--p = '\0';
 
+	/*
+	 *	Workers share fr_log_fp, hold the lock so the body
+	 *	stays with its packet.
+	 */
+	flockfile(fr_log_fp);
 	RIDEBUG("%s", buffer);
 
 	if (body) {
@@ -497,6 +511,7 @@ static void rs_packet_print_fancy(uint64_t count, rs_status_t status, fr_pcap_t
 			INFO("\tAuthenticator-Field = 0x%s", vector);
 		}
 	}
+	funlockfile(fr_log_fp);
 }
 
 static void rs_stats_print(rs_latency_t *stats, PW_CODE code)
@@ -529,6 +544,9 @@ static void rs_stats_print(rs_latency_t *stats, PW_CODE code)
 		INFO("\tLow       : %.3lfms", stats->interval.latency_low);
 		INFO("\tAverage   : %.3lfms", stats->interval.latency_average);
 		INFO("\tMA        : %.3lfms", stats->latency_smoothed);
+		for (i = 0; i < RS_PERCENTILES; i++) {
+			INFO("\t%-10s: %.3lfms", rs_percentile_names[i], stats->interval.latency_pct[i]);
+		}
 	}
 
 	if (have_rt || stats->interval.lost || stats->interval.reused) {
@@ -597,6 +615,8 @@ static int rs_check_pcap_drop(fr_pcap_t *in, int interval) {
  */
 static void rs_stats_process_latency(rs_latency_t *stats)
 {
+	int i;
+
 	/*
 	 *	If we didn't link any packets during this interval, we don't have a value to return.
 	 *	returning 0 is misleading as it would be like saying the latency had dropped to 0.
@@ -611,6 +631,9 @@ static void rs_stats_process_latency(rs_latency_t *stats)
 		stats->interval.latency_average = unk;
 		stats->interval.latency_high = unk;
 		stats->interval.latency_low = unk;
+		for (i = 0; i < RS_PERCENTILES; i++) {
+			stats->interval.latency_pct[i] = unk;
+		}
 
 		/*
 		 *	We've not yet been able to determine latency, so latency_smoothed is also NaN
@@ -625,6 +648,11 @@ static void rs_stats_process_latency(rs_latency_t *stats)
 		stats->interval.latency_average = (stats->interval.latency_total / stats->interval.linked_total);
 	}
 
+	if (stats->latency_histogram) for (i = 0; i < RS_PERCENTILES; i++) {
+		stats->interval.latency_pct[i] = fr_histogram_percentile(stats->latency_histogram,
+									 rs_percentiles[i]) / 1000.0;
+	}
+
 	if (isnan(stats->latency_smoothed)) {
 		stats->latency_smoothed = 0;
 	}
@@ -650,6 +678,57 @@ static void rs_stats_process_counters(rs_latency_t *stats)
 	}
 }
 
+#ifdef WITH_RS_WORKERS
+/** Add a worker's stats for the interval to the totals, and reset them
+ *
+ * Must be called with the worker's stats_mutex held.
+ *
+ * @param stats to add to.
+ * @param from worker stats to add.
+ */
+static void rs_stats_merge(rs_stats_t *stats, rs_stats_t *from)
+{
+	size_t i;
+	int j;
+
+	for (i = 0; i < (sizeof(rs_useful_codes) / sizeof(*rs_useful_codes)); i++) {
+		rs_latency_t *dst = &stats->exchange[rs_useful_codes[i]];
+		rs_latency_t *src = &from->exchange[rs_useful_codes[i]];
+
+		dst->interval.received_total += src->interval.received_total;
+		dst->interval.linked_total += src->interval.linked_total;
+		dst->interval.unlinked_total += src->interval.unlinked_total;
+		dst->interval.reused_total += src->interval.reused_total;
+		dst->interval.lost_total += src->interval.lost_total;
+		for (j = 0; j <= RS_RETRANSMIT_MAX; j++) {
+			dst->interval.rt_total[j] += src->interval.rt_total[j];
+		}
+
+		dst->interval.latency_total += src->interval.latency_total;
+		if (src->interval.latency_high > dst->interval.latency_high) {
+			dst->interval.latency_high = src->interval.latency_high;
+		}
+		if (src->interval.latency_low &&
+		    (!dst->interval.latency_low || (src->interval.latency_low < dst->interval.latency_low))) {
+			dst->interval.latency_low = src->interval.latency_low;
+		}
+
+		if (src->latency_histogram) {
+			if (!dst->latency_histogram) dst->latency_histogram = talloc_zero(conf, fr_histogram_t);
+			if (dst->latency_histogram) fr_histogram_merge(dst->latency_histogram, src->latency_histogram);
+			memset(src->latency_histogram, 0, sizeof(fr_histogram_t));
+		}
+
+		memset(&src->interval, 0, sizeof(src->interval));
+	}
+
+	/*
+	 *	If a worker ran out of memory, mute the stats for all of them.
+	 */
+	if (timercmp(&from->quiet, &stats->quiet, >)) stats->quiet = from->quiet;
+}
+#endif
+
 /** Process stats for a single interval
  *
  */
@@ -661,6 +740,7 @@ static void rs_stats_process(void *ctx)
 	rs_update_t		*this = ctx;
 	rs_stats_t		*stats = this->stats;
 	struct timeval		now;
+	bool			dropped = false;	/* Whether a worker's queue overflowed */
 
 	gettimeofday(&now, NULL);
 
@@ -668,6 +748,33 @@ static void rs_stats_process(void *ctx)
 
 	INFO("######### Stats Iteration %i #########", stats->intervals);
 
+#ifdef WITH_RS_WORKERS
+	/*
+	 *	Collect the workers' stats, so the rest of this function
+	 *	sees the totals for the interval.
+	 */
+	if (conf->workers) {
+		for (i = 0; i < (size_t) conf->workers; i++) {
+			rs_worker_t *worker = &conf->worker[i];
+			uint64_t drops;
+
+			pthread_mutex_lock(&worker->stats_mutex);
+			rs_stats_merge(stats, &worker->stats);
+			pthread_mutex_unlock(&worker->stats_mutex);
+
+			pthread_mutex_lock(&worker->mutex);
+			drops = worker->dropped;
+			worker->dropped = 0;
+			pthread_mutex_unlock(&worker->mutex);
+
+			if (drops > 0) {
+				ERROR("Worker %i dropped %" PRIu64 " packets: Queue full", worker->id, drops);
+				dropped = true;
+			}
+		}
+	}
+#endif
+
 	/*
 	 *	Verify that none of the pcap handles have dropped packets.
 	 */
@@ -683,6 +790,13 @@ static void rs_stats_process(void *ctx)
 		}
 	}
 
+	if (dropped) {
+		ERROR("Muting stats for the next %i milliseconds", conf->stats.timeout);
+
+		rs_tv_add_ms(&now, conf->stats.timeout, &stats->quiet);
+		goto clear;
+	}
+
 	if ((stats->quiet.tv_sec + (stats->quiet.tv_usec / 1000000.0)) -
 	    (now.tv_sec + (now.tv_usec / 1000000.0)) > 0) {
 		INFO("Stats muted because of warmup, or previous error");
@@ -719,6 +833,9 @@ static void rs_stats_process(void *ctx)
 	for (i = 0; i < rs_codes_len; i++) {
 		memset(&stats->exchange[rs_useful_codes[i]].interval, 0,
 		       sizeof(stats->exchange[rs_useful_codes[i]].interval));
+		if (stats->exchange[rs_useful_codes[i]].latency_histogram) {
+			memset(stats->exchange[rs_useful_codes[i]].latency_histogram, 0, sizeof(fr_histogram_t));
+		}
 	}
 
 	{
@@ -752,6 +869,13 @@ static void rs_stats_update_latency(rs_latency_t *stats, struct timeval *latency
 	}
 	stats->interval.latency_total += lint;
 
+	if (!stats->latency_histogram) {
+		stats->latency_histogram = talloc_zero(packet_ctx, fr_histogram_t);
+		if (!stats->latency_histogram) return;
+	}
+	fr_histogram_add(stats->latency_histogram,
+			 ((uint64_t) latency->tv_sec * 1000000) + latency->tv_usec);
+
 }
 
 /** Copy a subset of attributes from one list into the other
@@ -1107,7 +1231,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	current = rad_alloc(conf, false);
+	current = rad_alloc(packet_ctx, false);
 	if (!current) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1188,9 +1312,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			int ret;
 			FILE *log_fp = fr_log_fp;
 
-			fr_log_fp = NULL;
+			/* fr_log_fp is shared with the other threads, so workers leave it alone */
+			if (!conf->workers) fr_log_fp = NULL;
 			ret = rad_decode(current, original ? original->expect : NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
+			if (!conf->workers) fr_log_fp = log_fp;
 			if (ret != 0) {
 				rad_free(&current);
 				REDEBUG("Failed decoding");
@@ -1295,9 +1420,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			int ret;
 			FILE *log_fp = fr_log_fp;
 
-			fr_log_fp = NULL;
+			/* fr_log_fp is shared with the other threads, so workers leave it alone */
+			if (!conf->workers) fr_log_fp = NULL;
 			ret = rad_decode(current, NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
+			if (!conf->workers) fr_log_fp = log_fp;
 
 			if (ret != 0) {
 				rad_free(&current);
@@ -1410,7 +1536,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = talloc_zero(conf, rs_request_t);
+			original = talloc_zero(packet_ctx, rs_request_t);
 			talloc_set_destructor(original, _request_free);
 
 			original->id = count;
@@ -1507,7 +1633,9 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 		/*
 		 *	Were filtering on response, now print out the full data from the request
+		 *	and keep it next to the response.
 		 */
+		flockfile(fr_log_fp);
 		if (conf->filter_response && RIDEBUG_ENABLED() && (conf->event_flags & RS_NORMAL)) {
 			rs_time_print(timestr, sizeof(timestr), &original->packet->timestamp);
 			rs_tv_sub(&original->packet->timestamp, &start_pcap, &elapsed);
@@ -1519,6 +1647,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		if (conf->event_flags & status) {
 			conf->logger(count, status, event->in, current, &elapsed, &latency, response, true);
 		}
+		funlockfile(fr_log_fp);
 	/*
 	 *	It's the original request
 	 *
@@ -1539,6 +1668,12 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		rad_free(&current);
 	}
 
+	/*
+	 *	Workers can't stop the event loop, the capture thread
+	 *	enforces the limit for them.
+	 */
+	if (conf->workers) return;
+
 	captured++;
 	/*
 	 *	We've hit our capture limit, break out of the event loop
@@ -1549,6 +1684,111 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	}
 }
 
+#ifdef WITH_RS_WORKERS
+/** Pick the worker for a packet
+ *
+ * The hash covers the addresses, ports and RADIUS ID, and is the same whichever
+ * direction the packet is travelling in, so a request and its response always go
+ * to the same worker.  Packets we can't parse go to the first worker, which will
+ * complain about them.
+ */
+static rs_worker_t *rs_worker_select(fr_pcap_t *in, struct pcap_pkthdr const *header, uint8_t const *data)
+{
+	uint8_t const		*p = data, *end = data + header->caplen;
+	udp_header_t const	*udp;
+	uint32_t		src, dst;
+	ssize_t			len;
+
+	len = fr_link_layer_offset(data, header->caplen, in->link_type);
+	if ((len < 0) || ((p + len) >= end)) return &conf->worker[0];
+	p += len;
+
+	switch ((p[0] & 0xf0) >> 4) {
+	case 4:
+	{
+		ip_header_t const *ip = (ip_header_t const *) p;
+
+		if ((p + sizeof(*ip)) > end) return &conf->worker[0];
+
+		src = fr_hash(&ip->ip_src, sizeof(ip->ip_src));
+		dst = fr_hash(&ip->ip_dst, sizeof(ip->ip_dst));
+		p += (0x0f & ip->ip_vhl) * 4;
+	}
+		break;
+
+	case 6:
+	{
+		ip_header6_t const *ip6 = (ip_header6_t const *) p;
+
+		if ((p + sizeof(*ip6)) > end) return &conf->worker[0];
+
+		src = fr_hash(&ip6->ip_src, sizeof(ip6->ip_src));
+		dst = fr_hash(&ip6->ip_dst, sizeof(ip6->ip_dst));
+		p += sizeof(*ip6);
+	}
+		break;
+
+	default:
+		return &conf->worker[0];
+	}
+
+	/* UDP header, plus the RADIUS code and ID */
+	if ((p + sizeof(udp_header_t) + 2) > end) return &conf->worker[0];
+	udp = (udp_header_t const *) p;
+
+	src = fr_hash_update(&udp->src, sizeof(udp->src), src);
+	dst = fr_hash_update(&udp->dst, sizeof(udp->dst), dst);
+	p += sizeof(udp_header_t);
+
+	return &conf->worker[fr_hash_update(p + 1, 1, src ^ dst) % conf->workers];
+}
+
+/** Copy a packet out of the capture buffer, and queue it for a worker
+ *
+ */
+static void rs_worker_enqueue(uint64_t count, rs_event_t *event, struct pcap_pkthdr const *header,
+			      uint8_t const *data)
+{
+	rs_worker_t	*worker;
+	rs_queued_t	*queued;
+
+	/*
+	 *	The workers only read this, so it must be set before
+	 *	they see the first packet.
+	 */
+	if (!start_pcap.tv_sec) {
+		start_pcap = header->ts;
+	}
+
+	worker = rs_worker_select(event->in, header, data);
+
+	queued = malloc(sizeof(*queued) + header->caplen);
+	if (!queued) {
+		pthread_mutex_lock(&worker->mutex);
+		worker->dropped++;
+		pthread_mutex_unlock(&worker->mutex);
+		return;
+	}
+	queued->count = count;
+	queued->in = event->in;
+	queued->header = *header;
+	queued->data = (uint8_t *) (queued + 1);
+	memcpy(queued->data, data, header->caplen);
+
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->num == RS_WORKER_QUEUE_SIZE) {
+		worker->dropped++;
+		pthread_mutex_unlock(&worker->mutex);
+		free(queued);
+		return;
+	}
+
+	worker->queue[(worker->head + worker->num) % RS_WORKER_QUEUE_SIZE] = queued;
+	if (worker->num++ == 0) pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+}
+#endif
+
 static void rs_got_packet(UNUSED fr_event_list_t *el, int fd, void *ctx)
 {
 	static uint64_t	count = 0;	/* Packets seen */
@@ -1614,6 +1854,18 @@ static void rs_got_packet(UNUSED fr_event_list_t *el, int fd, void *ctx)
 		}
 
 		count++;
+#ifdef WITH_RS_WORKERS
+		if (conf->workers) {
+			rs_worker_enqueue(count, event, header, data);
+
+			if ((conf->limit > 0) && (count >= conf->limit)) {
+				INFO("Captured %" PRIu64 " packets, exiting...", count);
+				fr_event_loop_exit(events, 1);
+				return;
+			}
+			continue;
+		}
+#endif
 		rs_packet_process(count, event, header, data);
 	}
 }
@@ -1850,6 +2102,168 @@ static void rs_signal_action(UNUSED fr_event_list_t *list, int fd, UNUSED void *
 	}
 }
 
+#ifdef WITH_RS_WORKERS
+/** Decode and correlate the packets queued for one worker
+ *
+ * Runs the worker's timers between batches of packets, and at least every
+ * RS_WORKER_WAKEUP milliseconds when there's nothing to do, so requests
+ * without responses are still counted as lost.
+ */
+static void *rs_worker_thread(void *arg)
+{
+	rs_worker_t	*worker = arg;
+	rs_queued_t	*batch[RS_FORCE_YIELD];
+	rs_event_t	event;
+
+	packet_ctx = worker->ctx;
+	events = worker->events;
+	request_tree = worker->request_tree;
+	link_tree = worker->link_tree;
+
+	memset(&event, 0, sizeof(event));
+	event.list = events;
+	event.stats = &worker->stats;
+
+	for (;;) {
+		struct timeval	now, when;
+		int		i, num = 0;
+
+		pthread_mutex_lock(&worker->mutex);
+		if (!worker->num && !worker->exit) {
+			struct timespec wait;
+
+			gettimeofday(&now, NULL);
+			rs_tv_add_ms(&now, RS_WORKER_WAKEUP, &when);
+			wait.tv_sec = when.tv_sec;
+			wait.tv_nsec = when.tv_usec * 1000;
+
+			pthread_cond_timedwait(&worker->cond, &worker->mutex, &wait);
+		}
+
+		if (worker->exit) {
+			pthread_mutex_unlock(&worker->mutex);
+			break;
+		}
+
+		while (worker->num && (num < RS_FORCE_YIELD)) {
+			batch[num++] = worker->queue[worker->head];
+			worker->head = (worker->head + 1) % RS_WORKER_QUEUE_SIZE;
+			worker->num--;
+		}
+		pthread_mutex_unlock(&worker->mutex);
+
+		pthread_mutex_lock(&worker->stats_mutex);
+		gettimeofday(&now, NULL);
+		do {
+			when = now;
+		} while (fr_event_run(events, &when) == 1);
+
+		for (i = 0; i < num; i++) {
+			event.in = batch[i]->in;
+			rs_packet_process(batch[i]->count, &event, &batch[i]->header, batch[i]->data);
+			free(batch[i]);
+		}
+		pthread_mutex_unlock(&worker->stats_mutex);
+	}
+
+	/*
+	 *	The request destructors use our trees and event list,
+	 *	so the requests have to be freed by this thread.
+	 */
+	talloc_free(worker->ctx);
+	worker->ctx = NULL;
+
+	return NULL;
+}
+
+/** Create the worker threads
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int rs_workers_start(void)
+{
+	int i;
+
+	conf->worker = talloc_zero_array(conf, rs_worker_t, conf->workers);
+	if (!conf->worker) {
+		ERROR("Failed allocating memory for workers");
+		return -1;
+	}
+
+	for (i = 0; i < conf->workers; i++) {
+		rs_worker_t *worker = &conf->worker[i];
+		int ret;
+
+		worker->id = i;
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_mutex_init(&worker->stats_mutex, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+
+		worker->ctx = talloc_init("worker %i", i);
+		if (!worker->ctx) {
+		oom:
+			ERROR("Failed allocating memory for worker %i", i);
+			return -1;
+		}
+
+		worker->events = fr_event_list_create(worker->ctx, NULL, FR_EVENT_TIMER_HEAP);
+		if (!worker->events) goto oom;
+
+		worker->request_tree = rbtree_create(worker->ctx, (rbcmp) rs_packet_cmp, _unmark_request, 0);
+		if (!worker->request_tree) goto oom;
+
+		if (conf->link_da_num > 0) {
+			worker->link_tree = rbtree_create(worker->ctx, (rbcmp) rs_rtx_cmp, _unmark_link, 0);
+			if (!worker->link_tree) goto oom;
+		}
+
+		ret = pthread_create(&worker->thread, NULL, rs_worker_thread, worker);
+		if (ret != 0) {
+			ERROR("Failed creating worker %i: %s", i, fr_syserror(ret));
+			return -1;
+		}
+		worker->running = true;
+	}
+
+	DEBUG("Started %i workers", conf->workers);
+
+	return 0;
+}
+
+/** Tell the worker threads to exit, and wait for them
+ *
+ * Any packets still in the queues are discarded.
+ */
+static void rs_workers_stop(void)
+{
+	int i;
+
+	if (!conf->worker) return;
+
+	for (i = 0; i < conf->workers; i++) {
+		rs_worker_t *worker = &conf->worker[i];
+
+		if (!worker->running) {
+			talloc_free(worker->ctx);
+			continue;
+		}
+
+		pthread_mutex_lock(&worker->mutex);
+		worker->exit = true;
+		pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->mutex);
+
+		pthread_join(worker->thread, NULL);
+
+		while (worker->num) {
+			free(worker->queue[worker->head]);
+			worker->head = (worker->head + 1) % RS_WORKER_QUEUE_SIZE;
+			worker->num--;
+		}
+	}
+}
+#endif
+
 static void NEVER_RETURNS usage(int status)
 {
 	FILE *output = status ? stderr : stdout;
@@ -1873,6 +2287,12 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -h                    This help message.\n");
 	fprintf(output, "  -i <interface>        Capture packets from interface (defaults to all if supported).\n");
 	fprintf(output, "  -I <file>             Read packets from file (overrides input of -F).\n");
+#ifdef WITH_RS_WORKERS
+	fprintf(output, "  -j <threads>          Decode packets from capture interfaces using <threads> threads.\n");
+	fprintf(output, "                        Retransmissions are only linked by -L if they use the\n");
+	fprintf(output, "                        same addresses, ports and ID.  0 (the default) decodes\n");
+	fprintf(output, "                        in the capture thread.\n");
+#endif
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
@@ -1935,6 +2355,7 @@ int main(int argc, char *argv[])
 	if (!fr_assert(conf)) {
 		exit (1);
 	}
+	packet_ctx = conf;
 
 	/*
 	 *  We don't really want probes taking down machines
@@ -1965,7 +2386,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((opt = getopt(argc, argv, "ab:c:Cd:D:e:Ff:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != EOF) {
+	while ((opt = getopt(argc, argv, "ab:c:Cd:D:e:Ff:hi:I:j:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != EOF) {
 		switch (opt) {
 		case 'a':
 		{
@@ -2049,6 +2470,16 @@ int main(int argc, char *argv[])
 			conf->from_file = true;
 			break;
 
+#ifdef WITH_RS_WORKERS
+		case 'j':
+			conf->workers = atoi(optarg);
+			if ((conf->workers < 0) || (conf->workers > RS_WORKERS_MAX)) {
+				ERROR("Number of threads must be between 0 and %i", RS_WORKERS_MAX);
+				usage(64);
+			}
+			break;
+#endif
+
 		case 'l':
 			conf->list_attributes = optarg;
 			break;
@@ -2192,6 +2623,22 @@ int main(int argc, char *argv[])
 		conf->to_stdout = false;
 	}
 
+	/*
+	 *	Packets from files have to be processed in order, and the
+	 *	workers would interleave the packets they write out.
+	 */
+	if (conf->workers) {
+		if (conf->from_file || conf->from_stdin) {
+			ERROR("Threads (-j) can only be used with live capture");
+			usage(64);
+		}
+
+		if (conf->to_file || conf->to_stdout) {
+			ERROR("Threads (-j) can't be used when writing PCAP data (-w, -S)");
+			usage(64);
+		}
+	}
+
 	if (conf->to_stdout) {
 		out = fr_pcap_init(conf, "stdout", PCAP_STDIO_OUT);
 		if (!out) {
@@ -2522,7 +2969,7 @@ int main(int argc, char *argv[])
 		memset(&stats, 0, sizeof(stats));
 		memset(&update, 0, sizeof(update));
 
-		events = fr_event_list_create(conf, _rs_event_status);
+		events = fr_event_list_create(conf, _rs_event_status, FR_EVENT_TIMER_HEAP);
 		if (!events) {
 			ERROR();
 			goto finish;
@@ -2596,6 +3043,15 @@ int main(int argc, char *argv[])
 		rs_daemonize(conf->pidfile);
 	}
 
+#ifdef WITH_RS_WORKERS
+	/*
+	 *	After daemonizing, as threads don't survive fork()
+	 */
+	if (conf->workers && (rs_workers_start() < 0)) {
+		goto finish;
+	}
+#endif
+
 	/*
 	 *	Setup signal handlers so we always exit gracefully, ensuring output buffers are always
 	 *	flushed.
@@ -2615,6 +3071,10 @@ int main(int argc, char *argv[])
 
 	cleanup = true;
 
+#ifdef WITH_RS_WORKERS
+	rs_workers_stop();
+#endif
+
 	/*
 	 *	Free all the things! This also closes all the sockets and file descriptors
 	 */
@@ -30,11 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/state.h>
 #include <freeradius-devel/rad_assert.h>
 
-static rbtree_t *state_tree;
-
 #ifdef HAVE_PTHREAD_H
-static pthread_mutex_t state_mutex;
-
 #define PTHREAD_MUTEX_LOCK pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
 
@@ -47,9 +43,13 @@ static pthread_mutex_t state_mutex;
 
 #endif
 
+typedef struct state_shard_t state_shard_t;
+
 typedef struct state_entry_t {
 	uint8_t		state[AUTH_VECTOR_LEN];
 
+	state_shard_t	*shard;
+
 	time_t		cleanup;
 	struct state_entry_t *prev;
 	struct state_entry_t *next;
@@ -62,8 +62,26 @@ typedef struct state_entry_t {
 	void 		(*free_opaque)(void *opaque);
 } state_entry_t;
 
-static state_entry_t *state_head = NULL;
-static state_entry_t *state_tail = NULL;
+/*
+ *	The entries are spread over a number of shards, by a hash of
+ *	the State attribute.  Each shard has its own lock, tree, and
+ *	list of entries ordered by cleanup time.  So requests for
+ *	different sessions don't wait for each other.
+ */
+struct state_shard_t {
+	rbtree_t	*tree;
+
+	state_entry_t	*head;
+	state_entry_t	*tail;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex;
+#endif
+};
+
+static state_shard_t state_shards[FR_STATE_SHARDS];
+
+static bool state_initialized = false;
 
 /*
  *	rbtree callback.
@@ -76,39 +94,72 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+static state_shard_t *state_shard(uint8_t const *state)
+{
+	return &state_shards[fr_hash(state, AUTH_VECTOR_LEN) & (FR_STATE_SHARDS - 1)];
+}
+
+/*
+ *	Lock two shards.  Shards are always locked in the order in
+ *	which they appear in the array, so that two threads can't
+ *	each hold the shard the other one wants.
+ */
+static void state_shard_lock_pair(state_shard_t *a, state_shard_t *b)
+{
+	if (!a || (a == b)) {
+		PTHREAD_MUTEX_LOCK(&b->mutex);
+		return;
+	}
+
+	if (a < b) {
+		PTHREAD_MUTEX_LOCK(&a->mutex);
+		PTHREAD_MUTEX_LOCK(&b->mutex);
+	} else {
+		PTHREAD_MUTEX_LOCK(&b->mutex);
+		PTHREAD_MUTEX_LOCK(&a->mutex);
+	}
+}
+
+static void state_shard_unlock_pair(state_shard_t *a, state_shard_t *b)
+{
+	if (b) PTHREAD_MUTEX_UNLOCK(&b->mutex);
+	if (a && (a != b)) PTHREAD_MUTEX_UNLOCK(&a->mutex);
+}
+
 /*
  *	When an entry is free'd, it's removed from the linked list of
  *	cleanup times.
  *
- *	Note that
+ *	Called with the shard mutex held.
  */
 static void state_entry_free(state_entry_t *entry)
 {
 	state_entry_t *prev, *next;
+	state_shard_t *shard = entry->shard;
 
 	/*
 	 *	If we're deleting the whole tree, don't bother doing
 	 *	all of the fixups.
 	 */
-	if (!state_tree) return;
+	if (!shard->tree) return;
 
 	prev = entry->prev;
 	next = entry->next;
 
 	if (prev) {
-		rad_assert(state_tail != entry);
+		rad_assert(shard->tail != entry);
 		prev->next = next;
-	} else if (state_head) {
-		rad_assert(state_head == entry);
-		state_head = next;
+	} else if (shard->head) {
+		rad_assert(shard->head == entry);
+		shard->head = next;
 	}
 
 	if (next) {
-		rad_assert(state_tail != entry);
+		rad_assert(shard->tail != entry);
 		next->prev = prev;
-	} else if (state_tail) {
-		rad_assert(state_tail == entry);
-		state_tail = prev;
+	} else if (shard->tail) {
+		rad_assert(shard->tail == entry);
+		shard->tail = prev;
 	}
 
 	if (entry->opaque) {
@@ -118,58 +169,239 @@ static void state_entry_free(state_entry_t *entry)
 #ifdef WITH_VERIFY_PTR
 	(void) talloc_get_type_abort(entry, state_entry_t);
 #endif
-	rbtree_deletebydata(state_tree, entry);
+	rbtree_deletebydata(shard->tree, entry);
 	talloc_free(entry);
 }
 
 bool fr_state_init(void)
 {
+	int i;
+
+	if (state_initialized) return true;
+
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		state_shard_t *shard = &state_shards[i];
+
+		memset(shard, 0, sizeof(*shard));
+
 #ifdef HAVE_PTHREAD_H
-	if (pthread_mutex_init(&state_mutex, NULL) != 0) {
-		return false;
-	}
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			return false;
+		}
 #endif
 
-	state_tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
-	if (!state_tree) {
-		return false;
+		shard->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
+		if (!shard->tree) {
+			return false;
+		}
 	}
 
+	state_initialized = true;
+
 	return true;
 }
 
 void fr_state_delete(void)
 {
+	int i;
 	rbtree_t *my_tree;
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
+	if (!state_initialized) return;
 
-	/*
-	 *	Tell the talloc callback to NOT delete the entry from
-	 *	the tree.  We're deleting the entire tree.
-	 */
-	my_tree = state_tree;
-	state_tree = NULL;
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		state_shard_t *shard = &state_shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+		/*
+		 *	Tell the talloc callback to NOT delete the entry from
+		 *	the tree.  We're deleting the entire tree.
+		 */
+		my_tree = shard->tree;
+		shard->tree = NULL;
+		shard->head = shard->tail = NULL;
 
-	rbtree_free(my_tree);
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
+		rbtree_free(my_tree);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&shard->mutex);
+#endif
+	}
+
+	state_initialized = false;
+}
+
+/** Get the number of entries in each shard of the state table
+ *
+ * @param[out] entries array of FR_STATE_SHARDS counters.
+ */
+void fr_state_shard_entries(uint32_t entries[FR_STATE_SHARDS])
+{
+	int i;
+
+	for (i = 0; i < FR_STATE_SHARDS; i++) {
+		state_shard_t *shard = &state_shards[i];
+
+		if (!state_initialized) {
+			entries[i] = 0;
+			continue;
+		}
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		entries[i] = rbtree_num_elements(shard->tree);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
 }
 
 /*
- *	Create a new entry.  Called with the mutex held.
+ *	Find the entry, based on the State attribute.  Called with the
+ *	shard mutex held.
+ */
+static state_entry_t *state_entry_find(state_shard_t *shard, uint8_t const *state)
+{
+	state_entry_t *entry, my_entry;
+
+	memcpy(my_entry.state, state, sizeof(my_entry.state));
+
+	entry = rbtree_finddata(shard->tree, &my_entry);
+
+#ifdef WITH_VERIFY_PTR
+	if (entry)  (void) talloc_get_type_abort(entry, state_entry_t);
+#endif
+
+	return entry;
+}
+
+/*
+ *	Get the State attribute from a packet, if it's one of ours.
+ */
+static uint8_t const *state_from_packet(RADIUS_PACKET *packet)
+{
+	VALUE_PAIR *vp;
+
+	if (!packet) return NULL;
+
+	vp = pairfind(packet->vps, PW_STATE, 0, TAG_ANY);
+	if (!vp) return NULL;
+
+	if (vp->length != AUTH_VECTOR_LEN) return NULL;
+
+	return vp->vp_octets;
+}
+
+/*
+ *	Find the entry, and lock the shard it lives in.  If there's
+ *	no entry, nothing is locked.
+ */
+static state_entry_t *fr_state_find(RADIUS_PACKET *packet)
+{
+	uint8_t const *state;
+	state_shard_t *shard;
+	state_entry_t *entry;
+
+	state = state_from_packet(packet);
+	if (!state) return NULL;
+
+	shard = state_shard(state);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, state);
+	if (!entry) PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	return entry;
+}
+
+/*
+ *	Create a new entry, based on the entry for the original
+ *	packet, if there is one.
+ *
+ *	On return, the shards of the old and the new entry are both
+ *	locked, and must be unlocked by the caller, even if we failed
+ *	to create a new entry.
  */
-static state_entry_t *fr_state_create(RADIUS_PACKET *packet, state_entry_t *old)
+static state_entry_t *fr_state_create(RADIUS_PACKET *packet, RADIUS_PACKET *original,
+				      state_shard_t **p_old_shard, state_shard_t **p_shard,
+				      state_entry_t **p_old)
 {
 	size_t i;
 	uint32_t x;
 	time_t now = time(NULL);
 	VALUE_PAIR *vp;
-	state_entry_t *entry, *next;
+	uint8_t const *old_state;
+	uint8_t state[AUTH_VECTOR_LEN];
+	state_shard_t *old_shard = NULL, *shard;
+	state_entry_t *entry, *next, *old = NULL;
+	int tries = 0;
+
+	old_state = state_from_packet(original);
+	if (old_state) {
+		old_shard = state_shard(old_state);
+
+		PTHREAD_MUTEX_LOCK(&old_shard->mutex);
+		old = state_entry_find(old_shard, old_state);
+	}
+
+	/*
+	 *	Hacks for EAP, until we convert EAP to using the state API.
+	 *
+	 *	The EAP module creates it's own State attribute, so we
+	 *	want to use that one in preference to one we create.
+	 */
+	vp = pairfind(packet->vps, PW_STATE, 0, TAG_ANY);
+	if (vp) {
+		rad_assert(vp->length == sizeof(state));
+		memcpy(state, vp->vp_octets, sizeof(state));
+
+	} else if (old) {
+		/*
+		 *	If possible, base the new one off of the old one.
+		 */
+		memcpy(state, old->state, sizeof(state));
+
+		state[1] = state[0] ^ (old->tries + 1);
+		state[3] = state[2] ^ (RADIUSD_VERSION / 10000);
+
+	} else {
+		/*
+		 *	16 octets of randomness should be enough to
+		 *	have a globally unique state.
+		 */
+		for (i = 0; i < sizeof(state) / sizeof(x); i++) {
+			x = fr_rand();
+			memcpy(state + (i * 4), &x, sizeof(x));
+		}
+	}
+
+	if (old) tries = old->tries + 1;
+
+	/*
+	 *	The new entry may live in a different shard.  If it
+	 *	has to be locked before the old one, let go of the old
+	 *	one, and look for the old entry again once we hold
+	 *	both locks.
+	 */
+	shard = state_shard(state);
+	if (!old_shard) {
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	} else if (shard > old_shard) {
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	} else if (shard < old_shard) {
+		PTHREAD_MUTEX_UNLOCK(&old_shard->mutex);
+		state_shard_lock_pair(old_shard, shard);
+		old = state_entry_find(old_shard, old_state);
+	}
+
+	*p_old_shard = old_shard;
+	*p_shard = shard;
+	*p_old = old;
 
 	/*
 	 *	Clean up old entries.
 	 */
-	for (entry = state_head; entry != NULL; entry = next) {
+	for (entry = shard->head; entry != NULL; entry = next) {
 		next = entry->next;
 
 		if (entry == old) continue;
@@ -196,18 +428,24 @@ static state_entry_t *fr_state_create(RADIUS_PACKET *packet, state_entry_t *old)
 
 	/*
 	 *	Limit the size of the cache based on how many requests
-	 *	we can handle at the same time.
+	 *	we can handle at the same time.  Each shard gets its
+	 *	share of the limit.
 	 */
-	if (rbtree_num_elements(state_tree) >= main_config.max_requests * 2) {
+	if (rbtree_num_elements(shard->tree) >=
+	    ((main_config.max_requests * 2) + FR_STATE_SHARDS - 1) / FR_STATE_SHARDS) {
 		return NULL;
 	}
 
 	/*
 	 *	Allocate a new one.
 	 */
-	entry = talloc_zero(state_tree, state_entry_t);
+	entry = talloc_zero(shard->tree, state_entry_t);
 	if (!entry) return NULL;
 
+	memcpy(entry->state, state, sizeof(entry->state));
+	entry->shard = shard;
+	entry->tries = tries;
+
 	/*
 	 *	Limit the lifetime of this entry based on how long the
 	 *	server takes to process a request.  Doing it this way
@@ -216,63 +454,29 @@ static state_entry_t *fr_state_create(RADIUS_PACKET *packet, state_entry_t *old)
 	 */
 	entry->cleanup = now + main_config.max_request_time * 10;
 
-	/*
-	 *	Hacks for EAP, until we convert EAP to using the state API.
-	 *
-	 *	The EAP module creates it's own State attribute, so we
-	 *	want to use that one in preference to one we create.
-	 */
-	vp = pairfind(packet->vps, PW_STATE, 0, TAG_ANY);
-
-	/*
-	 *	If possible, base the new one off of the old one.
-	 */
 	if (old) {
-		entry->tries = old->tries + 1;
-
 		rad_assert(old->vps == NULL);
 
-		/*
-		 *	Track State
-		 */
-		if (!vp) {
-			memcpy(entry->state, old->state, sizeof(entry->state));
-
-			entry->state[1] = entry->state[0] ^ entry->tries;
-			entry->state[3] = entry->state[2] ^ (RADIUSD_VERSION / 10000);
-		}
-
 		/*
 		 *	The old one isn't used any more, so we can free it.
 		 */
-		if (!old->opaque) state_entry_free(old);
-
-	} else if (!vp) {
-		/*
-		 *	16 octets of randomness should be enough to
-		 *	have a globally unique state.
-		 */
-		for (i = 0; i < sizeof(entry->state) / sizeof(x); i++) {
-			x = fr_rand();
-			memcpy(entry->state + (i * 4), &x, sizeof(x));
+		if (!old->opaque) {
+			state_entry_free(old);
+			*p_old = NULL;
 		}
 	}
 
 	/*
-	 *	If EAP created a State, use that.  Otherwise, use the
+	 *	If EAP created a State, use that.  Otherwise, add the
 	 *	one we created above.
 	 */
-	if (vp) {
-		rad_assert(vp->length == sizeof(entry->state));
-		memcpy(entry->state, vp->vp_octets, sizeof(entry->state));
-
-	} else {
+	if (!vp) {
 		vp = paircreate(packet, PW_STATE, 0);
 		pairmemcpy(vp, entry->state, sizeof(entry->state));
 		pairadd(&packet->vps, vp);
 	}
 
-	if (!rbtree_insert(state_tree, entry)) {
+	if (!rbtree_insert(shard->tree, entry)) {
 		talloc_free(entry);
 		return NULL;
 	}
@@ -281,47 +485,22 @@ static state_entry_t *fr_state_create(RADIUS_PACKET *packet, state_entry_t *old)
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	if (!state_head) {
+	if (!shard->head) {
 		entry->prev = entry->next = NULL;
-		state_head = state_tail = entry;
+		shard->head = shard->tail = entry;
 	} else {
-		rad_assert(state_tail != NULL);
+		rad_assert(shard->tail != NULL);
 
-		entry->prev = state_tail;
-		state_tail->next = entry;
+		entry->prev = shard->tail;
+		shard->tail->next = entry;
 
 		entry->next = NULL;
-		state_tail = entry;
+		shard->tail = entry;
 	}
 
 	return entry;
 }
 
-
-/*
- *	Find the entry, based on the State attribute.
- */
-static state_entry_t *fr_state_find(RADIUS_PACKET *packet)
-{
-	VALUE_PAIR *vp;
-	state_entry_t *entry, my_entry;
-
-	vp = pairfind(packet->vps, PW_STATE, 0, TAG_ANY);
-	if (!vp) return NULL;
-
-	if (vp->length != sizeof(my_entry.state)) return NULL;
-
-	memcpy(my_entry.state, vp->vp_octets, sizeof(my_entry.state));
-
-	entry = rbtree_finddata(state_tree, &my_entry);
-
-#ifdef WITH_VERIFY_PTR
-	if (entry)  (void) talloc_get_type_abort(entry, state_entry_t);
-#endif
-
-	return entry;
-}
-
 /*
  *	Called when sending Access-Reject, so that all State is
  *	discarded.
@@ -329,19 +508,17 @@ static state_entry_t *fr_state_find(RADIUS_PACKET *packet)
 void fr_state_discard(REQUEST *request, RADIUS_PACKET *original)
 {
 	state_entry_t *entry;
+	state_shard_t *shard;
 
 	pairfree(&request->state);
 	request->state = NULL;
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
 	entry = fr_state_find(original);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state_mutex);
-		return;
-	}
+	if (!entry) return;
 
+	shard = entry->shard;
 	state_entry_free(entry);
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 	return;
 }
 
@@ -362,7 +539,6 @@ void fr_state_get_vps(REQUEST *request, RADIUS_PACKET *packet)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
 	entry = fr_state_find(packet);
 
 	/*
@@ -371,6 +547,8 @@ void fr_state_get_vps(REQUEST *request, RADIUS_PACKET *packet)
 	 */
 	if (entry) {
 		pairfilter(request, &request->state, &entry->vps, 0, 0, TAG_ANY);
+		PTHREAD_MUTEX_UNLOCK(&entry->shard->mutex);
+
 		RDEBUG2("session-state: Found cached attributes");
 		rdebug_pair_list(L_DBG_LVL_1, request, request->state, NULL);
 
@@ -378,8 +556,6 @@ void fr_state_get_vps(REQUEST *request, RADIUS_PACKET *packet)
 		RDEBUG2("session-state: No cached attributes");
 	}
 
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
-
 	VERIFY_REQUEST(request);
 	return;
 }
@@ -393,6 +569,7 @@ void fr_state_get_vps(REQUEST *request, RADIUS_PACKET *packet)
 bool fr_state_put_vps(REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *packet)
 {
 	state_entry_t *entry, *old;
+	state_shard_t *old_shard, *shard;
 
 	if (!request->state) {
 		RDEBUG3("session-state: Nothing to cache");
@@ -402,17 +579,9 @@ bool fr_state_put_vps(REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *
 	RDEBUG2("session-state: Saving cached attributes");
 	rdebug_pair_list(L_DBG_LVL_1, request, request->state, NULL);
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
-
-	if (original) {
-		old = fr_state_find(original);
-	} else {
-		old = NULL;
-	}
-
-	entry = fr_state_create(packet, old);
+	entry = fr_state_create(packet, original, &old_shard, &shard, &old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state_mutex);
+		state_shard_unlock_pair(old_shard, shard);
 		return false;
 	}
 
@@ -421,7 +590,7 @@ bool fr_state_put_vps(REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *
 	 *	isn't thread-safe.
 	 */
 	pairfilter(entry, &entry->vps, &request->state, 0, 0, TAG_ANY);
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
+	state_shard_unlock_pair(old_shard, shard);
 
 	rad_assert(request->state == NULL);
 	VERIFY_REQUEST(request);
@@ -437,15 +606,11 @@ void *fr_state_find_data(UNUSED REQUEST *request, RADIUS_PACKET *packet)
 	void *data;
 	state_entry_t *entry;
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
 	entry = fr_state_find(packet);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state_mutex);
-		return NULL;
-	}
+	if (!entry) return NULL;
 
 	data = entry->opaque;
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
+	PTHREAD_MUTEX_UNLOCK(&entry->shard->mutex);
 
 	return data;
 }
@@ -460,16 +625,12 @@ void *fr_state_get_data(UNUSED REQUEST *request, RADIUS_PACKET *packet)
 	void *data;
 	state_entry_t *entry;
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
 	entry = fr_state_find(packet);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state_mutex);
-		return NULL;
-	}
+	if (!entry) return NULL;
 
 	data = entry->opaque;
 	entry->opaque = NULL;
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
+	PTHREAD_MUTEX_UNLOCK(&entry->shard->mutex);
 
 	return data;
 }
@@ -483,18 +644,11 @@ bool fr_state_put_data(UNUSED REQUEST *request, RADIUS_PACKET *original, RADIUS_
 		       void *data, void (*free_data)(void *))
 {
 	state_entry_t *entry, *old;
+	state_shard_t *old_shard, *shard;
 
-	PTHREAD_MUTEX_LOCK(&state_mutex);
-
-	if (original) {
-		old = fr_state_find(original);
-	} else {
-		old = NULL;
-	}
-
-	entry = fr_state_create(packet, old);
+	entry = fr_state_create(packet, original, &old_shard, &shard, &old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state_mutex);
+		state_shard_unlock_pair(old_shard, shard);
 		return false;
 	}
 
@@ -509,6 +663,6 @@ bool fr_state_put_data(UNUSED REQUEST *request, RADIUS_PACKET *original, RADIUS_
 	entry->opaque = data;
 	entry->free_opaque = free_data;
 
-	PTHREAD_MUTEX_UNLOCK(&state_mutex);
+	state_shard_unlock_pair(old_shard, shard);
 	return true;
 }
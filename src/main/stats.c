@@ -24,6 +24,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modcall.h>
 #include <freeradius-devel/rad_assert.h>
 
 #ifdef WITH_STATS
@@ -37,29 +38,49 @@ RCSID("$Id$")
 static struct timeval	start_time;
 static struct timeval	hup_time;
 
-#define FR_STATS_INIT { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 	\
-				 { 0, 0, 0, 0, 0, 0, 0, 0 }}
+#define FR_STATS_INIT(_h) { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 	\
+				 { 0, 0, 0, 0, 0, 0, 0, 0 }, &_h }
 
-fr_stats_t radius_auth_stats = FR_STATS_INIT;
+/*
+ *	The global statistics always have a histogram.  Clients,
+ *	sockets, and home servers get one when their first response
+ *	is counted.
+ */
+static fr_histogram_t radius_auth_latency;
+fr_stats_t radius_auth_stats = FR_STATS_INIT(radius_auth_latency);
 #ifdef WITH_ACCOUNTING
-fr_stats_t radius_acct_stats = FR_STATS_INIT;
+static fr_histogram_t radius_acct_latency;
+fr_stats_t radius_acct_stats = FR_STATS_INIT(radius_acct_latency);
 #endif
 #ifdef WITH_COA
-fr_stats_t radius_coa_stats = FR_STATS_INIT;
-fr_stats_t radius_dsc_stats = FR_STATS_INIT;
+static fr_histogram_t radius_coa_latency;
+static fr_histogram_t radius_dsc_latency;
+fr_stats_t radius_coa_stats = FR_STATS_INIT(radius_coa_latency);
+fr_stats_t radius_dsc_stats = FR_STATS_INIT(radius_dsc_latency);
 #endif
 
 #ifdef WITH_PROXY
-fr_stats_t proxy_auth_stats = FR_STATS_INIT;
+static fr_histogram_t proxy_auth_latency;
+fr_stats_t proxy_auth_stats = FR_STATS_INIT(proxy_auth_latency);
 #ifdef WITH_ACCOUNTING
-fr_stats_t proxy_acct_stats = FR_STATS_INIT;
+static fr_histogram_t proxy_acct_latency;
+fr_stats_t proxy_acct_stats = FR_STATS_INIT(proxy_acct_latency);
 #endif
 #ifdef WITH_COA
-fr_stats_t proxy_coa_stats = FR_STATS_INIT;
-fr_stats_t proxy_dsc_stats = FR_STATS_INIT;
+static fr_histogram_t proxy_coa_latency;
+static fr_histogram_t proxy_dsc_latency;
+fr_stats_t proxy_coa_stats = FR_STATS_INIT(proxy_coa_latency);
+fr_stats_t proxy_dsc_stats = FR_STATS_INIT(proxy_dsc_latency);
 #endif
 #endif
 
+double const fr_stats_percentile[FR_STATS_PERCENTILES] = {
+	50.0, 90.0, 99.0, 99.9
+};
+
+char const *fr_stats_percentile_names[FR_STATS_PERCENTILES] = {
+	"p50", "p90", "p99", "p99.9"
+};
 
 static void tv_sub(struct timeval *end, struct timeval *start,
 		   struct timeval *elapsed)
@@ -80,8 +101,16 @@ static void tv_sub(struct timeval *end, struct timeval *start,
 	}
 }
 
-static void stats_time(fr_stats_t *stats, struct timeval *start,
-		       struct timeval *end)
+/*
+ *	Count a response time in "stats".  "ctx" owns "stats", and is
+ *	used to allocate its histogram.
+ *
+ *	This is only called from request_done(), which runs in the
+ *	main thread.  So each histogram has one writer, and needs no
+ *	locks.  Readers see counts which are at most a little stale.
+ */
+static void stats_time(TALLOC_CTX *ctx, fr_stats_t *stats,
+		       struct timeval *start, struct timeval *end)
 {
 	struct timeval diff;
 	uint32_t delay;
@@ -91,6 +120,12 @@ static void stats_time(fr_stats_t *stats, struct timeval *start,
 
 	tv_sub(end, start, &diff);
 
+	if (!stats->latency) stats->latency = talloc_zero(ctx, fr_histogram_t);
+	if (stats->latency) {
+		fr_histogram_add(stats->latency,
+				 ((uint64_t) diff.tv_sec * USEC) + diff.tv_usec);
+	}
+
 	if (diff.tv_sec >= 10) {
 		stats->elapsed[7]++;
 	} else {
@@ -173,13 +208,13 @@ void request_stats_final(REQUEST *request)
 		/*
 		 *	FIXME: Do the time calculations once...
 		 */
-		stats_time(&radius_auth_stats,
+		stats_time(NULL, &radius_auth_stats,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
-		stats_time(&request->client->auth,
+		stats_time(request->client, &request->client->auth,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
-		stats_time(&request->listener->stats,
+		stats_time(request->listener, &request->listener->stats,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
 		break;
@@ -195,10 +230,10 @@ void request_stats_final(REQUEST *request)
 #ifdef WITH_ACCOUNTING
 	case PW_CODE_ACCOUNTING_RESPONSE:
 		INC_ACCT(total_responses);
-		stats_time(&radius_acct_stats,
+		stats_time(NULL, &radius_acct_stats,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
-		stats_time(&request->client->acct,
+		stats_time(request->client, &request->client->acct,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
 		break;
@@ -209,7 +244,7 @@ void request_stats_final(REQUEST *request)
 		INC_COA(total_access_accepts);
 	  coa_stats:
 		INC_COA(total_responses);
-		stats_time(&request->client->coa,
+		stats_time(request->client, &request->client->coa,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
 		break;
@@ -222,7 +257,7 @@ void request_stats_final(REQUEST *request)
 		INC_DSC(total_access_accepts);
 	  dsc_stats:
 		INC_DSC(total_responses);
-		stats_time(&request->client->dsc,
+		stats_time(request->client, &request->client->dsc,
 			   &request->packet->timestamp,
 			   &request->reply->timestamp);
 		break;
@@ -288,10 +323,10 @@ void request_stats_final(REQUEST *request)
 		INC(total_access_accepts);
 	proxy_stats:
 		INC(total_responses);
-		stats_time(&proxy_auth_stats,
+		stats_time(NULL, &proxy_auth_stats,
 			   &request->proxy->timestamp,
 			   &request->proxy_reply->timestamp);
-		stats_time(&request->home_server->stats,
+		stats_time(request->home_server, &request->home_server->stats,
 			   &request->proxy->timestamp,
 			   &request->proxy_reply->timestamp);
 		break;
@@ -309,10 +344,10 @@ void request_stats_final(REQUEST *request)
 		proxy_acct_stats.total_responses++;
 		request->proxy_listener->stats.total_responses++;
 		request->home_server->stats.total_responses++;
-		stats_time(&proxy_acct_stats,
+		stats_time(NULL, &proxy_acct_stats,
 			   &request->proxy->timestamp,
 			   &request->proxy_reply->timestamp);
-		stats_time(&request->home_server->stats,
+		stats_time(request->home_server, &request->home_server->stats,
 			   &request->proxy->timestamp,
 			   &request->proxy_reply->timestamp);
 		break;
@@ -447,6 +482,96 @@ static void request_stats_addvp(REQUEST *request,
 	}
 }
 
+/*
+ *	Add the latency percentiles, in microseconds, as the
+ *	attributes "attribute" through "attribute + 3".
+ */
+static void request_stats_addlatency(REQUEST *request, int attribute,
+				     fr_stats_t *stats)
+{
+	int i;
+	VALUE_PAIR *vp;
+
+	if (!stats->latency || (fr_histogram_count(stats->latency) == 0)) return;
+
+	for (i = 0; i < FR_STATS_PERCENTILES; i++) {
+		vp = radius_paircreate(request->reply, &request->reply->vps,
+				       attribute + i, VENDORPEC_FREERADIUS);
+		if (!vp) continue;
+
+		vp->vp_integer = fr_histogram_percentile(stats->latency,
+							 fr_stats_percentile[i]);
+	}
+}
+
+/*
+ *	A reply is limited to 4096 bytes, and the other statistics
+ *	need some of that.  Stop adding module counters when they
+ *	would take more than this.
+ */
+#define MODULE_STATS_MAX (3072)
+
+typedef struct stats_modules_ctx_t {
+	REQUEST		*request;
+	char const	*prefix;
+	size_t		prefix_len;
+	size_t		used;
+} stats_modules_ctx_t;
+
+static int request_stats_addmodule(void *ctx, modcall_stats_t const *stats)
+{
+	stats_modules_ctx_t *my_ctx = ctx;
+	REQUEST *request = my_ctx->request;
+	size_t len;
+	int i;
+	VALUE_PAIR *vp;
+
+	if (stats->calls == 0) return 0;
+
+	if (my_ctx->prefix &&
+	    (strncmp(stats->name, my_ctx->prefix, my_ctx->prefix_len) != 0)) return 0;
+
+	/*
+	 *	Each attribute is a Vendor-Specific, with 8 bytes of
+	 *	headers.
+	 */
+	len = (8 + strlen(stats->name)) + (8 + 4) + (8 + 8) + (8 + 4);
+	for (i = 0; i < RLM_MODULE_NUMCODES; i++) {
+		if (stats->rcode[i]) len += 8 + 4;
+	}
+	if ((my_ctx->used + len) > MODULE_STATS_MAX) return 1;
+	my_ctx->used += len;
+
+	vp = radius_paircreate(request->reply, &request->reply->vps,
+			       202, VENDORPEC_FREERADIUS);
+	if (!vp) return 1;
+	pairstrcpy(vp, stats->name);
+
+	vp = radius_paircreate(request->reply, &request->reply->vps,
+			       203, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = stats->calls;
+
+	vp = radius_paircreate(request->reply, &request->reply->vps,
+			       204, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer64 = stats->usec;
+
+	vp = radius_paircreate(request->reply, &request->reply->vps,
+			       205, VENDORPEC_FREERADIUS);
+	if (vp) vp->vp_integer = stats->max_usec;
+
+	/*
+	 *	Only the rcodes which were returned.
+	 */
+	for (i = 0; i < RLM_MODULE_NUMCODES; i++) {
+		if (!stats->rcode[i]) continue;
+
+		vp = radius_paircreate(request->reply, &request->reply->vps,
+				       206 + i, VENDORPEC_FREERADIUS);
+		if (vp) vp->vp_integer = stats->rcode[i];
+	}
+
+	return 0;
+}
 
 void request_stats_reply(REQUEST *request)
 {
@@ -467,6 +592,7 @@ void request_stats_reply(REQUEST *request)
 	if (((flag->vp_integer & 0x01) != 0) &&
 	    ((flag->vp_integer & 0xc0) == 0)) {
 		request_stats_addvp(request, authvp, &radius_auth_stats);
+		request_stats_addlatency(request, 186, &radius_auth_stats);
 	}
 
 #ifdef WITH_ACCOUNTING
@@ -476,6 +602,7 @@ void request_stats_reply(REQUEST *request)
 	if (((flag->vp_integer & 0x02) != 0) &&
 	    ((flag->vp_integer & 0xc0) == 0)) {
 		request_stats_addvp(request, acctvp, &radius_acct_stats);
+		request_stats_addlatency(request, 190, &radius_acct_stats);
 	}
 #endif
 
@@ -486,6 +613,7 @@ void request_stats_reply(REQUEST *request)
 	if (((flag->vp_integer & 0x04) != 0) &&
 	    ((flag->vp_integer & 0x20) == 0)) {
 		request_stats_addvp(request, proxy_authvp, &proxy_auth_stats);
+		request_stats_addlatency(request, 194, &proxy_auth_stats);
 	}
 
 #ifdef WITH_ACCOUNTING
@@ -495,6 +623,7 @@ void request_stats_reply(REQUEST *request)
 	if (((flag->vp_integer & 0x08) != 0) &&
 	    ((flag->vp_integer & 0x20) == 0)) {
 		request_stats_addvp(request, proxy_acctvp, &proxy_acct_stats);
+		request_stats_addlatency(request, 198, &proxy_acct_stats);
 	}
 #endif
 #endif
@@ -533,6 +662,25 @@ void request_stats_reply(REQUEST *request)
 #endif
 	}
 
+	/*
+	 *	Module, policy and section counters, optionally only
+	 *	those whose names start with FreeRADIUS-Stats-Module-Name.
+	 */
+	if ((flag->vp_integer & 0x100) != 0) {
+		stats_modules_ctx_t my_ctx;
+
+		memset(&my_ctx, 0, sizeof(my_ctx));
+		my_ctx.request = request;
+
+		vp = pairfind(request->packet->vps, 202, VENDORPEC_FREERADIUS, TAG_ANY);
+		if (vp) {
+			my_ctx.prefix = vp->vp_strvalue;
+			my_ctx.prefix_len = vp->length;
+		}
+
+		modcall_stats_walk(request_stats_addmodule, &my_ctx);
+	}
+
 	/*
 	 *	For a particular client.
 	 */
@@ -624,11 +772,15 @@ void request_stats_reply(REQUEST *request)
 			if ((flag->vp_integer & 0x01) != 0) {
 				request_stats_addvp(request, client_authvp,
 						    &client->auth);
+				request_stats_addlatency(request, 186,
+							 &client->auth);
 			}
 #ifdef WITH_ACCOUNTING
 			if ((flag->vp_integer & 0x01) != 0) {
 				request_stats_addvp(request, client_acctvp,
 						    &client->acct);
+				request_stats_addlatency(request, 190,
+							 &client->acct);
 			}
 #endif
 		} /* else client wasn't found, don't echo it back */
@@ -673,6 +825,7 @@ void request_stats_reply(REQUEST *request)
 		    ((request->listener->type == RAD_LISTEN_AUTH) ||
 		     (request->listener->type == RAD_LISTEN_NONE))) {
 			request_stats_addvp(request, authvp, &this->stats);
+			request_stats_addlatency(request, 186, &this->stats);
 		}
 
 #ifdef WITH_ACCOUNTING
@@ -680,6 +833,7 @@ void request_stats_reply(REQUEST *request)
 		    ((request->listener->type == RAD_LISTEN_ACCT) ||
 		     (request->listener->type == RAD_LISTEN_NONE))) {
 			request_stats_addvp(request, acctvp, &this->stats);
+			request_stats_addlatency(request, 190, &this->stats);
 		}
 #endif
 	}
@@ -777,6 +931,7 @@ void request_stats_reply(REQUEST *request)
 		    (home->type == HOME_TYPE_AUTH)) {
 			request_stats_addvp(request, proxy_authvp,
 					    &home->stats);
+			request_stats_addlatency(request, 194, &home->stats);
 		}
 
 #ifdef WITH_ACCOUNTING
@@ -784,6 +939,7 @@ void request_stats_reply(REQUEST *request)
 		    (home->type == HOME_TYPE_ACCT)) {
 			request_stats_addvp(request, proxy_acctvp,
 					    &home->stats);
+			request_stats_addlatency(request, 198, &home->stats);
 		}
 #endif
 	}
@@ -857,4 +1013,34 @@ void radius_stats_ema(fr_stats_ema_t *ema,
 #endif
 }
 
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ *	Record how many packets one recvmmsg() or sendmmsg() moved,
+ *	out of a batch of "size".  Replies may be sent by any child
+ *	thread, so the counters are updated under a lock.
+ */
+void radius_stats_batch(fr_stats_batch_t *stats, uint32_t packets, uint32_t size)
+{
+	uint32_t i;
+
+	if ((packets == 0) || (size == 0)) return;
+
+	if (packets > size) packets = size;
+
+	i = ((packets * 8) - 1) / size;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&batch_mutex);
+#endif
+	stats->calls++;
+	stats->packets += packets;
+	stats->fill[i]++;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&batch_mutex);
+#endif
+}
+
 #endif /* WITH_STATS */
@@ -57,6 +57,10 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <sys/wait.h>
 #endif
 
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+#endif
+
 #ifdef HAVE_PTHREAD_H
 
 #ifdef HAVE_OPENSSL_CRYPTO_H
@@ -79,6 +83,25 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #define NUM_FIFOS	       RAD_LISTEN_MAX
 
+#define USEC			(1000000)
+
+/*
+ *	With lock-free queues, the queues and their counters don't
+ *	need the mutex.  It's then only used for the thread
+ *	accounting, and for the "auto_limit_acct" statistics.
+ */
+#ifdef HAVE_STDATOMIC_H
+#define QUEUE_MUTEX_LOCK(_x)
+#define QUEUE_MUTEX_UNLOCK(_x)
+#define STATS_MUTEX_LOCK pthread_mutex_lock
+#define STATS_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#define QUEUE_MUTEX_LOCK pthread_mutex_lock
+#define QUEUE_MUTEX_UNLOCK pthread_mutex_unlock
+#define STATS_MUTEX_LOCK(_x)
+#define STATS_MUTEX_UNLOCK(_x)
+#endif
+
 /*
  *  A data structure which contains the information about
  *  the current thread.
@@ -123,7 +146,11 @@ typedef struct THREAD_POOL {
 	THREAD_HANDLE	*head;
 	THREAD_HANDLE	*tail;
 
+#ifdef HAVE_STDATOMIC_H
+	atomic_uint_fast32_t active_threads;
+#else
 	uint32_t	active_threads;	/* protected by queue_mutex */
+#endif
 	uint32_t	total_threads;
 
 	uint32_t	exited_threads;
@@ -168,14 +195,51 @@ typedef struct THREAD_POOL {
 	pthread_mutex_t	queue_mutex;
 
 	uint32_t	max_queue_size;
+#ifdef HAVE_STDATOMIC_H
+	atomic_uint_fast32_t num_queued;
+	fr_atomic_queue_t *fifo[NUM_FIFOS];
+#else
 	uint32_t	num_queued;
 	fr_fifo_t	*fifo[NUM_FIFOS];
+#endif
 #endif	/* WITH_GCD */
 } THREAD_POOL;
 
 static THREAD_POOL thread_pool;
 static bool pool_initialized = false;
 
+#ifndef WITH_GCD
+/*
+ *	A small, fixed size pool of threads which handles only the
+ *	requests carrying a TLS based EAP method.  The handshakes do
+ *	expensive public key operations, and a burst of them would
+ *	otherwise occupy every thread in the main pool, starving the
+ *	cheap PAP and accounting traffic.
+ *
+ *	The threads aren't managed like the main pool.  They're all
+ *	started at init, and stopped at exit.
+ */
+typedef struct CRYPTO_POOL {
+	uint32_t	num_threads;
+	pthread_t	*threads;
+
+	sem_t		semaphore;
+	pthread_mutex_t	mutex;		//!< Protects everything below.
+	fr_fifo_t	*fifo;
+	uint32_t	max_queue_size;
+	uint32_t	num_queued;
+
+	uint32_t	max_queued;
+	uint64_t	requests;
+	uint64_t	dropped;
+	uint64_t	wait_usec;
+	uint64_t	max_wait_usec;
+	uint64_t	run_usec;
+} CRYPTO_POOL;
+
+static CRYPTO_POOL crypto_pool;
+#endif
+
 #ifndef WITH_GCD
 static time_t last_cleaned = 0;
 
@@ -194,6 +258,8 @@ static const CONF_PARSER thread_config[] = {
 	{ "max_requests_per_server", FR_CONF_POINTER(PW_TYPE_INTEGER, &thread_pool.max_requests_per_thread), "0" },
 	{ "cleanup_delay", FR_CONF_POINTER(PW_TYPE_INTEGER, &thread_pool.cleanup_delay), "5" },
 	{ "max_queue_size", FR_CONF_POINTER(PW_TYPE_INTEGER, &thread_pool.max_queue_size), "65536" },
+	{ "crypto_servers", FR_CONF_POINTER(PW_TYPE_INTEGER, &crypto_pool.num_threads), "0" },
+	{ "crypto_max_queue_size", FR_CONF_POINTER(PW_TYPE_INTEGER, &crypto_pool.max_queue_size), "1024" },
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
 	{ "auto_limit_acct", FR_CONF_POINTER(PW_TYPE_BOOLEAN, &thread_pool.auto_limit_acct), NULL },
@@ -300,6 +366,131 @@ static void reap_children(void)
 #endif /* WNOHANG */
 
 #ifndef WITH_GCD
+/*
+ *	Wrappers around the per-priority queues, so that the rest of
+ *	the code doesn't care which kind they are.
+ */
+#ifdef HAVE_STDATOMIC_H
+static bool queue_push(RAD_LISTEN_TYPE i, REQUEST *request)
+{
+	return fr_atomic_queue_push(thread_pool.fifo[i], request);
+}
+
+static REQUEST *queue_pop(RAD_LISTEN_TYPE i)
+{
+	void *data;
+
+	if (!fr_atomic_queue_pop(thread_pool.fifo[i], &data)) return NULL;
+
+	return data;
+}
+
+static int queue_num_elements(RAD_LISTEN_TYPE i)
+{
+	return fr_atomic_queue_num_elements(thread_pool.fifo[i]);
+}
+#else
+static bool queue_push(RAD_LISTEN_TYPE i, REQUEST *request)
+{
+	return fr_fifo_push(thread_pool.fifo[i], request);
+}
+
+static REQUEST *queue_pop(RAD_LISTEN_TYPE i)
+{
+	return fr_fifo_pop(thread_pool.fifo[i]);
+}
+
+static int queue_num_elements(RAD_LISTEN_TYPE i)
+{
+	return fr_fifo_num_elements(thread_pool.fifo[i]);
+}
+#endif
+
+/*
+ *	Whether the request is part of a TLS based EAP session, and
+ *	should be run by the crypto pool.
+ *
+ *	Packets are decoded by the thread which runs them, so we look
+ *	at the raw packet.  rad_packet_ok() has already checked that
+ *	the attributes are well formed.  Only the EAP header of the
+ *	first EAP-Message matters.  If the session later turns out to
+ *	be something else, it just ends up on the other pool.
+ */
+static bool request_is_crypto(REQUEST *request)
+{
+	uint8_t const *attr, *end;
+
+	if (!request->packet->data || (request->packet->code != PW_CODE_ACCESS_REQUEST)) return false;
+
+	attr = request->packet->data + 20; /* RADIUS_HDR_LEN */
+	end = request->packet->data + request->packet->data_len;
+
+	while ((attr + 2) <= end) {
+		if (attr[1] < 2) return false;
+
+		if (attr[0] != PW_EAP_MESSAGE) {
+			attr += attr[1];
+			continue;
+		}
+
+		/*
+		 *	Only EAP-Response packets carry a method.
+		 */
+		if ((attr[1] < 7) || (attr[2] != 2)) return false;
+
+		switch (attr[6]) {
+		case 13:	/* EAP-TLS */
+		case 21:	/* EAP-TTLS */
+		case 25:	/* PEAP */
+		case 43:	/* EAP-FAST */
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/*
+ *	Add a request to the queue of the crypto pool.
+ *
+ *	Like request_enqueue(), this is called only from the main
+ *	thread.
+ */
+static int crypto_enqueue(REQUEST *request)
+{
+	pthread_mutex_lock(&crypto_pool.mutex);
+
+	if (crypto_pool.num_queued >= crypto_pool.max_queue_size) {
+		crypto_pool.dropped++;
+		pthread_mutex_unlock(&crypto_pool.mutex);
+
+		RATE_LIMIT(ERROR("The crypto pool is full.  There are %d TLS requests in the queue, "
+				 "waiting to be processed.  Ignoring the new request.", (int) crypto_pool.max_queue_size));
+		return 0;
+	}
+
+	request->component = "<core>";
+	request->module = "<crypto queue>";
+	request->child_state = REQUEST_QUEUED;
+
+	if (!fr_fifo_push(crypto_pool.fifo, request)) {
+		pthread_mutex_unlock(&crypto_pool.mutex);
+		ERROR("!!! ERROR !!! Failed inserting request %d into the crypto queue", request->number);
+		return 0;
+	}
+
+	crypto_pool.num_queued++;
+	if (crypto_pool.num_queued > crypto_pool.max_queued) crypto_pool.max_queued = crypto_pool.num_queued;
+	pthread_mutex_unlock(&crypto_pool.mutex);
+
+	sem_post(&crypto_pool.semaphore);
+
+	return 1;
+}
+
 /*
  *	Add a request to the list of waiting requests.
  *	This function gets called ONLY from the main handler thread...
@@ -308,6 +499,13 @@ static void reap_children(void)
  */
 int request_enqueue(REQUEST *request)
 {
+	/*
+	 *	TLS handshakes go to their own pool.
+	 */
+	if (crypto_pool.num_threads && request_is_crypto(request)) {
+		return crypto_enqueue(request);
+	}
+
 	/*
 	 *	If we haven't checked the number of child threads
 	 *	in a while, OR if the thread pool appears to be full,
@@ -320,7 +518,7 @@ int request_enqueue(REQUEST *request)
 	}
 
 
-	pthread_mutex_lock(&thread_pool.queue_mutex);
+	QUEUE_MUTEX_LOCK(&thread_pool.queue_mutex);
 
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
@@ -380,7 +578,7 @@ int request_enqueue(REQUEST *request)
 			 *	roll, we throw the packet away.
 			 */
 			if (thread_pool.num_queued > keep) {
-				pthread_mutex_unlock(&thread_pool.queue_mutex);
+				QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 				return 0;
 			}
 		}
@@ -404,31 +602,40 @@ int request_enqueue(REQUEST *request)
 	thread_pool.request_count++;
 
 	if (thread_pool.num_queued >= thread_pool.max_queue_size) {
-		pthread_mutex_unlock(&thread_pool.queue_mutex);
+		QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 
 		/*
 		 *	Mark the request as done.
 		 */
 		RATE_LIMIT(ERROR("Something is blocking the server.  There are %d packets in the queue, "
-				 "waiting to be processed.  Ignoring the new request.", thread_pool.num_queued));
+				 "waiting to be processed.  Ignoring the new request.", (int) thread_pool.num_queued));
 		return 0;
 	}
 	request->component = "<core>";
 	request->module = "<queue>";
 	request->child_state = REQUEST_QUEUED;
 
+	/*
+	 *	Count the request before pushing it.  Once it's in
+	 *	the queue, a thread may pop it, and decrement the
+	 *	counter, before we get another chance.
+	 *
+	 *	Only this thread adds requests, so the check against
+	 *	"max_queue_size" above still holds.
+	 */
+	thread_pool.num_queued++;
+
 	/*
 	 *	Push the request onto the appropriate fifo for that
 	 */
-	if (!fr_fifo_push(thread_pool.fifo[request->priority], request)) {
-		pthread_mutex_unlock(&thread_pool.queue_mutex);
+	if (!queue_push(request->priority, request)) {
+		thread_pool.num_queued--;
+		QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 		ERROR("!!! ERROR !!! Failed inserting request %d into the queue", request->number);
 		return 0;
 	}
 
-	thread_pool.num_queued++;
-
-	pthread_mutex_unlock(&thread_pool.queue_mutex);
+	QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 
 	/*
 	 *	There's one more request in the queue.
@@ -451,13 +658,20 @@ static int request_dequeue(REQUEST **prequest)
 {
 	time_t blocked;
 	static time_t last_complained = 0;
-	static time_t total_blocked = 0;
+#ifdef HAVE_STDATOMIC_H
+	/*
+	 *	Reset without the mutex, below, so it has to be atomic.
+	 */
+	static atomic_int total_blocked = 0;
+#else
+	static int total_blocked = 0;
+#endif
 	int num_blocked;
 	RAD_LISTEN_TYPE i, start;
 	REQUEST *request;
 	reap_children();
 
-	pthread_mutex_lock(&thread_pool.queue_mutex);
+	QUEUE_MUTEX_LOCK(&thread_pool.queue_mutex);
 
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
@@ -470,15 +684,18 @@ static int request_dequeue(REQUEST **prequest)
 		 *	Calculate the instantaneous departure rate
 		 *	from the queue.
 		 */
+		STATS_MUTEX_LOCK(&thread_pool.queue_mutex);
 		thread_pool.pps_out.pps  = rad_pps(&thread_pool.pps_out.pps_old,
 						   &thread_pool.pps_out.pps_now,
 						   &thread_pool.pps_out.time_old,
 						   &now);
 		thread_pool.pps_out.pps_now++;
+		STATS_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 	}
 #endif
 #endif
 
+#ifndef HAVE_STDATOMIC_H
 	/*
 	 *	Clear old requests from all queues.
 	 *
@@ -486,6 +703,9 @@ static int request_dequeue(REQUEST **prequest)
 	 *	amortize the work across the child threads.  Since we
 	 *	do N checks for one request de-queued, the old
 	 *	requests will be quickly cleared.
+	 *
+	 *	The lock-free queues can't be peeked at.  Old
+	 *	requests are instead cleared as they're popped, below.
 	 */
 	for (i = 0; i < RAD_LISTEN_MAX; i++) {
 		request = fr_fifo_peek(thread_pool.fifo[i]);
@@ -506,14 +726,16 @@ static int request_dequeue(REQUEST **prequest)
 		request->child_state = REQUEST_DONE;
 		thread_pool.num_queued--;
 	}
+#endif
 
 	start = 0;
  retry:
 	/*
 	 *	Pop results from the top of the queue
 	 */
+	request = NULL;
 	for (i = start; i < RAD_LISTEN_MAX; i++) {
-		request = fr_fifo_pop(thread_pool.fifo[i]);
+		request = queue_pop(i);
 		if (request) {
 			VERIFY_REQUEST(request);
 			start = i;
@@ -522,7 +744,19 @@ static int request_dequeue(REQUEST **prequest)
 	}
 
 	if (!request) {
-		pthread_mutex_unlock(&thread_pool.queue_mutex);
+#ifdef HAVE_STDATOMIC_H
+		/*
+		 *	Another thread may have taken "our" request
+		 *	from a queue after we looked at it, leaving its
+		 *	own request in a queue which we already passed.
+		 *	Look again, until the queues are really empty.
+		 */
+		if (thread_pool.num_queued > 0) {
+			start = 0;
+			goto retry;
+		}
+#endif
+		QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 		*prequest = NULL;
 		return 0;
 	}
@@ -559,6 +793,7 @@ static int request_dequeue(REQUEST **prequest)
 
 	blocked = time(NULL);
 	if (!request->proxy && (blocked - request->timestamp) > 5) {
+		STATS_MUTEX_LOCK(&thread_pool.queue_mutex);
 		total_blocked++;
 		if (last_complained < blocked) {
 			last_complained = blocked;
@@ -567,12 +802,13 @@ static int request_dequeue(REQUEST **prequest)
 		} else {
 			blocked = 0;
 		}
+		STATS_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 	} else {
-		total_blocked = 0;
+		if (total_blocked) total_blocked = 0;
 		blocked = 0;
 	}
 
-	pthread_mutex_unlock(&thread_pool.queue_mutex);
+	QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 
 	if (blocked) {
 		ERROR("%d requests have been waiting in the processing queue for %d seconds.  Check that all databases are running properly!",
@@ -591,6 +827,9 @@ static int request_dequeue(REQUEST **prequest)
 static void *request_handler_thread(void *arg)
 {
 	THREAD_HANDLE *self = (THREAD_HANDLE *) arg;
+#ifdef WITH_RADIUS_BATCH
+	rad_listen_t *listener;
+#endif
 
 	/*
 	 *	Loop forever, until told to exit.
@@ -671,16 +910,25 @@ static void *request_handler_thread(void *arg)
 		}
 #endif
 
+#ifdef WITH_RADIUS_BATCH
+		listener = self->request->listener;
+		listen_batch_hold(listener);
+#endif
+
 		self->request->process(self->request, FR_ACTION_RUN);
 		self->request = NULL;
 
+#ifdef WITH_RADIUS_BATCH
+		listen_batch_release(listener);
+#endif
+
 		/*
 		 *	Update the active threads.
 		 */
-		pthread_mutex_lock(&thread_pool.queue_mutex);
+		QUEUE_MUTEX_LOCK(&thread_pool.queue_mutex);
 		rad_assert(thread_pool.active_threads > 0);
 		thread_pool.active_threads--;
-		pthread_mutex_unlock(&thread_pool.queue_mutex);
+		QUEUE_MUTEX_UNLOCK(&thread_pool.queue_mutex);
 
 		/*
 		 *	If the thread has handled too many requests, then make it
@@ -719,6 +967,100 @@ static void *request_handler_thread(void *arg)
 	return NULL;
 }
 
+/*
+ *	The thread handler for the crypto pool.
+ *
+ *	This is a simpler version of request_handler_thread().  The
+ *	threads never exit until the server does.
+ */
+static void *crypto_handler_thread(UNUSED void *arg)
+{
+	REQUEST *request;
+	struct timeval start, end;
+	uint64_t wait_usec, run_usec;
+#ifdef WITH_RADIUS_BATCH
+	rad_listen_t *listener;
+#endif
+
+	while (true) {
+		if (sem_wait(&crypto_pool.semaphore) != 0) {
+			if (errno == EINTR) continue;
+
+			ERROR("Crypto thread failed waiting for semaphore: %s: Exiting\n",
+			      fr_syserror(errno));
+			break;
+		}
+
+#ifdef HAVE_OPENSSL_ERR_H
+		ERR_clear_error();
+#endif
+
+		if (thread_pool.stop_flag) break;
+
+		pthread_mutex_lock(&crypto_pool.mutex);
+		request = fr_fifo_pop(crypto_pool.fifo);
+		if (request) crypto_pool.num_queued--;
+		pthread_mutex_unlock(&crypto_pool.mutex);
+
+		if (!request) continue;
+
+		VERIFY_REQUEST(request);
+
+		/*
+		 *	Sat in the queue for too long.  See
+		 *	request_dequeue().
+		 */
+		if (request->master_state == REQUEST_STOP_PROCESSING) {
+			request->module = "<done>";
+			request->child_state = REQUEST_DONE;
+			continue;
+		}
+
+		request->component = "<core>";
+		request->module = "";
+		request->child_state = REQUEST_RUNNING;
+		request->child_pid = pthread_self();
+
+		gettimeofday(&start, NULL);
+		wait_usec = (start.tv_sec - request->packet->timestamp.tv_sec) * USEC;
+		wait_usec += start.tv_usec;
+		wait_usec -= request->packet->timestamp.tv_usec;
+
+#ifdef WITH_RADIUS_BATCH
+		listener = request->listener;
+		listen_batch_hold(listener);
+#endif
+
+		/*
+		 *	The request may be freed by the main thread as
+		 *	soon as this returns.  Don't touch it afterwards.
+		 */
+		request->process(request, FR_ACTION_RUN);
+
+#ifdef WITH_RADIUS_BATCH
+		listen_batch_release(listener);
+#endif
+
+		gettimeofday(&end, NULL);
+		run_usec = (end.tv_sec - start.tv_sec) * USEC;
+		run_usec += end.tv_usec;
+		run_usec -= start.tv_usec;
+
+		pthread_mutex_lock(&crypto_pool.mutex);
+		crypto_pool.requests++;
+		crypto_pool.wait_usec += wait_usec;
+		if (wait_usec > crypto_pool.max_wait_usec) crypto_pool.max_wait_usec = wait_usec;
+		crypto_pool.run_usec += run_usec;
+		pthread_mutex_unlock(&crypto_pool.mutex);
+	}
+
+#ifdef HAVE_OPENSSL_ERR_H
+	ERR_remove_state(0);
+#endif
+
+	return NULL;
+}
+
 /*
  *	Take a THREAD_HANDLE, delete it from the thread pool and
  *	free its resources.
@@ -990,12 +1332,41 @@ int thread_pool_init(UNUSED CONF_SECTION *cs, bool *spawn_flag)
 	 *	Allocate multiple fifos.
 	 */
 	for (i = 0; i < RAD_LISTEN_MAX; i++) {
+#ifdef HAVE_STDATOMIC_H
+		thread_pool.fifo[i] = fr_atomic_queue_create(NULL, thread_pool.max_queue_size);
+#else
 		thread_pool.fifo[i] = fr_fifo_create(thread_pool.max_queue_size, NULL);
+#endif
 		if (!thread_pool.fifo[i]) {
 			ERROR("FATAL: Failed to set up request fifo");
 			return -1;
 		}
 	}
+
+	if (crypto_pool.num_threads > 0) {
+		if (crypto_pool.max_queue_size < 2) crypto_pool.max_queue_size = 2;
+
+		memset(&crypto_pool.semaphore, 0, sizeof(crypto_pool.semaphore));
+		rcode = sem_init(&crypto_pool.semaphore, 0, SEMAPHORE_LOCKED);
+		if (rcode != 0) {
+			ERROR("FATAL: Failed to initialize crypto semaphore: %s",
+			       fr_syserror(errno));
+			return -1;
+		}
+
+		rcode = pthread_mutex_init(&crypto_pool.mutex, NULL);
+		if (rcode != 0) {
+			ERROR("FATAL: Failed to initialize crypto mutex: %s",
+			       fr_syserror(errno));
+			return -1;
+		}
+
+		crypto_pool.fifo = fr_fifo_create(crypto_pool.max_queue_size, NULL);
+		if (!crypto_pool.fifo) {
+			ERROR("FATAL: Failed to set up crypto fifo");
+			return -1;
+		}
+	}
 #endif
 
 #ifdef HAVE_OPENSSL_CRYPTO_H
@@ -1021,6 +1392,21 @@ int thread_pool_init(UNUSED CONF_SECTION *cs, bool *spawn_flag)
 			return -1;
 		}
 	}
+
+	if (crypto_pool.num_threads > 0) {
+		crypto_pool.threads = rad_malloc(sizeof(crypto_pool.threads[0]) * crypto_pool.num_threads);
+
+		for (i = 0; i < crypto_pool.num_threads; i++) {
+			rcode = pthread_create(&crypto_pool.threads[i], 0, crypto_handler_thread, NULL);
+			if (rcode != 0) {
+				ERROR("Crypto thread create failed: %s", fr_syserror(rcode));
+				crypto_pool.num_threads = i;
+				return -1;
+			}
+		}
+
+		DEBUG2("Crypto pool initialized with %d threads", crypto_pool.num_threads);
+	}
 #else
 	thread_pool.queue = dispatch_queue_create("org.freeradius.threads", NULL);
 	if (!thread_pool.queue) {
@@ -1070,6 +1456,17 @@ void thread_pool_stop(void)
 		pthread_join(handle->pthread_id, NULL);
 		delete_thread(handle);
 	}
+
+	for (i = 0; i < (int) crypto_pool.num_threads; i++) {
+		sem_post(&crypto_pool.semaphore);
+	}
+
+	for (i = 0; i < (int) crypto_pool.num_threads; i++) {
+		pthread_join(crypto_pool.threads[i], NULL);
+	}
+	free(crypto_pool.threads);
+	crypto_pool.threads = NULL;
+	crypto_pool.num_threads = 0;
 #endif
 }
 
@@ -1346,7 +1743,7 @@ void thread_pool_queue_stats(int array[RAD_LISTEN_MAX], int pps[2])
 		struct timeval now;
 
 		for (i = 0; i < RAD_LISTEN_MAX; i++) {
-			array[i] = fr_fifo_num_elements(thread_pool.fifo[i]);
+			array[i] = queue_num_elements(i);
 		}
 
 		gettimeofday(&now, NULL);
@@ -1370,6 +1767,49 @@ void thread_pool_queue_stats(int array[RAD_LISTEN_MAX], int pps[2])
 		pps[0] = pps[1] = 0;
 	}
 }
+
+/** Get the statistics of the crypto pool
+ *
+ * @param[out] stats Where to write the statistics.  All zero if
+ *	the crypto pool isn't in use.
+ */
+void thread_pool_crypto_stats(thread_crypto_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+#ifndef WITH_GCD
+	if (!pool_initialized || !crypto_pool.num_threads) return;
+
+	pthread_mutex_lock(&crypto_pool.mutex);
+	stats->threads = crypto_pool.num_threads;
+	stats->max_queue_size = crypto_pool.max_queue_size;
+	stats->queued = crypto_pool.num_queued;
+	stats->max_queued = crypto_pool.max_queued;
+	stats->requests = crypto_pool.requests;
+	stats->dropped = crypto_pool.dropped;
+	stats->wait_usec = crypto_pool.wait_usec;
+	stats->max_wait_usec = crypto_pool.max_wait_usec;
+	stats->run_usec = crypto_pool.run_usec;
+	pthread_mutex_unlock(&crypto_pool.mutex);
+#endif
+}
+
+/*
+ *	Whether requests are being processed by a pool of threads,
+ *	i.e. other requests may be running at the same time.
+ */
+bool thread_pool_active(void)
+{
+	return pool_initialized;
+}
+
+/*
+ *	The most requests which can be processed at the same time.
+ */
+uint32_t thread_pool_max_threads(void)
+{
+	return thread_pool.max_threads;
+}
 #endif /* HAVE_PTHREAD_H */
 
 static void time_free(void *data)
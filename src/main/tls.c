@@ -49,6 +49,7 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #ifdef HAVE_OPENSSL_OCSP_H
 #include <openssl/ocsp.h>
+#include <freeradius-devel/heap.h>
 #endif
 
 #ifdef ENABLE_OPENSSL_VERSION_CHECK
@@ -899,6 +900,10 @@ static CONF_PARSER cache_config[] = {
 	{ "max_entries", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, session_cache_size), "255" },
 	{ "name", FR_CONF_OFFSET(PW_TYPE_STRING, fr_tls_server_conf_t, session_id_name), NULL },
 	{ "persist_dir", FR_CONF_OFFSET(PW_TYPE_STRING, fr_tls_server_conf_t, session_cache_path), NULL },
+	{ "driver", FR_CONF_OFFSET(PW_TYPE_STRING, fr_tls_server_conf_t, session_cache_driver_name), NULL },
+	{ "virtual_server", FR_CONF_OFFSET(PW_TYPE_STRING, fr_tls_server_conf_t, session_cache_server), NULL },
+	{ "filename", FR_CONF_OFFSET(PW_TYPE_STRING, fr_tls_server_conf_t, session_cache_file), NULL },
+	{ "slot_size", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, session_cache_slot_size), "4096" },
 	{ NULL, -1, 0, NULL, NULL }	   /* end the list */
 };
 
@@ -909,13 +914,24 @@ static CONF_PARSER verify_config[] = {
 };
 
 #ifdef HAVE_OPENSSL_OCSP_H
+static CONF_PARSER ocsp_cache_config[] = {
+	{ "enable", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, fr_tls_server_conf_t, ocsp_cache_enable), "no" },
+	{ "lifetime", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, ocsp_cache_lifetime), "300" },
+	{ "max_entries", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, ocsp_cache_size), "1024" },
+	{ "refresh", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, fr_tls_server_conf_t, ocsp_cache_refresh), "no" },
+	{ "refresh_margin", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, ocsp_cache_refresh_margin), "60" },
+	{ NULL, -1, 0, NULL, NULL }	   /* end the list */
+};
+
 static CONF_PARSER ocsp_config[] = {
 	{ "enable", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, fr_tls_server_conf_t, ocsp_enable), "no" },
 	{ "override_cert_url", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, fr_tls_server_conf_t, ocsp_override_url), "no" },
 	{ "url", FR_CONF_OFFSET(PW_TYPE_STRING, fr_tls_server_conf_t, ocsp_url), NULL },
 	{ "use_nonce", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, fr_tls_server_conf_t, ocsp_use_nonce), "yes" },
-	{ "timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, ocsp_timeout), "yes" },
+	{ "timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, fr_tls_server_conf_t, ocsp_timeout), "0" },
 	{ "softfail", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, fr_tls_server_conf_t, ocsp_softfail), "no" },
+
+	{ "cache", FR_CONF_POINTER(PW_TYPE_SUBSECTION, NULL), (void const *) ocsp_cache_config },
 	{ NULL, -1, 0, NULL, NULL }	   /* end the list */
 };
 #endif
@@ -1220,7 +1236,19 @@ static SSL_SESSION *cbtls_get_session(SSL *ssl,
 
 	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
 	talloc_ctx = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TALLOC);
-	if (conf && conf->session_cache_path) {
+	if (conf && conf->session_cache_driver) {
+		VALUE_PAIR *vps;
+
+		sess = tls_cache_fetch(conf, SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST), talloc_ctx, &vps,
+				       data, inlen);
+		if (sess) {
+			SSL_SESSION_set_ex_data(sess, fr_tls_ex_index_vps, vps);
+			DEBUG2("SSL: Successfully restored session %s", buffer);
+		} else {
+			DEBUG2("SSL: Session %s not found in the cache", buffer);
+		}
+
+	} else if (conf && conf->session_cache_path) {
 		int rv, fd, todo;
 		size_t len;
 		char filename[256];
@@ -1334,16 +1362,54 @@ static int ocsp_parse_cert_url(X509 *cert, char **phost, char **pport,
 	return 0;
 }
 
+/*
+ *	Convert an ASN.1 GeneralizedTime (YYYYMMDDHHMMSS[.fff]Z) to
+ *	a time_t.  The times in OCSP responses are always UTC, so
+ *	the date is converted directly, without using the local
+ *	timezone.
+ */
+static int ocsp_asn1_time(time_t *out, ASN1_GENERALIZEDTIME *when)
+{
+	int year, mon, day, hour, min, sec;
+	long era, yoe, doy, doe;
+
+	if (!when || !when->data || (when->length < 14)) return -1;
+
+	if (sscanf((char const *) when->data, "%4d%2d%2d%2d%2d%2d",
+		   &year, &mon, &day, &hour, &min, &sec) != 6) return -1;
+
+	if ((year < 1970) || (mon < 1) || (mon > 12) || (day < 1) || (day > 31)) return -1;
+
+	/*
+	 *	Days since the epoch, counting years from March so that
+	 *	the leap day is the last day of the year.
+	 */
+	if (mon <= 2) year--;
+	era = year / 400;
+	yoe = year - (era * 400);
+	doy = ((153 * (mon > 2 ? mon - 3 : mon + 9)) + 2) / 5 + day - 1;
+	doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+
+	*out = (time_t) ((era * 146097) + doe - 719468) * 86400 + (hour * 3600) + (min * 60) + sec;
+
+	return 0;
+}
+
 /*
  * This function sends a OCSP request to a defined OCSP responder
  * and checks the OCSP response for correctness.
+ *
+ * Returns 1 if the certificate is good, 0 if it has been revoked (or
+ * the response was bad), and 2 if the responder couldn't be queried.
+ * If the response can be cached, expires is set to when it should
+ * be discarded, otherwise it's set to 0.
  */
 
 /* Maximum leeway in validity period: default 5 minutes */
 #define MAX_VALIDITY_PERIOD     (5 * 60)
 
-static int ocsp_check(X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
-		      fr_tls_server_conf_t *conf)
+static int ocsp_query(X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
+		      fr_tls_server_conf_t *conf, time_t *expires)
 {
 	OCSP_CERTID *certid;
 	OCSP_REQUEST *req;
@@ -1367,6 +1433,8 @@ static int ocsp_check(X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
 	struct timeval when;
 #endif
 
+	*expires = 0;
+
 	/*
 	 * Create OCSP Request
 	 */
@@ -1552,6 +1620,14 @@ static int ocsp_check(X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
 		break;
 	}
 
+	/*
+	 *	The responder has given a definite answer, which is
+	 *	valid until it says it'll have newer information.
+	 */
+	if (conf->ocsp_cache && (!nextupd || (ocsp_asn1_time(expires, nextupd) < 0))) {
+		if (conf->ocsp_cache_lifetime) *expires = time(NULL) + conf->ocsp_cache_lifetime;
+	}
+
 ocsp_end:
 	/* Free OCSP Stuff */
 	OCSP_REQUEST_free(req);
@@ -1564,6 +1640,385 @@ ocsp_end:
 	OCSP_BASICRESP_free(bresp);
 
  ocsp_skip:
+	return ocsp_ok;
+}
+
+/*
+ *	Cache of OCSP responses, keyed by the DER encoded certificate
+ *	ID, which identifies the issuer and serial number of the
+ *	certificate.
+ */
+#define OCSP_CACHE_KEY_MAX	(256)
+
+typedef struct tls_ocsp_entry {
+	uint8_t			key[OCSP_CACHE_KEY_MAX];
+	size_t			key_len;
+
+	int			ocsp_ok;	//!< Result of the query, as returned by ocsp_query().
+	time_t			expires;	//!< When the response should be discarded.
+	int			heap_id;	//!< Position of the entry in the expiry heap.
+	bool			refreshing;	//!< A background query is in progress.
+} tls_ocsp_entry_t;
+
+struct tls_ocsp_cache {
+	fr_tls_server_conf_t	*conf;
+	rbtree_t		*tree;		//!< Entries by key.
+	fr_heap_t		*heap;		//!< Entries by expiry time.
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;		//!< Signalled when a refresh finishes.
+	int			num_refreshing;
+#endif
+};
+
+#ifdef HAVE_PTHREAD_H
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+static int ocsp_entry_cmp(void const *one, void const *two)
+{
+	tls_ocsp_entry_t const *a = one;
+	tls_ocsp_entry_t const *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int ocsp_heap_cmp(void const *one, void const *two)
+{
+	tls_ocsp_entry_t const *a = one;
+	tls_ocsp_entry_t const *b = two;
+
+	if (a->expires < b->expires) return -1;
+	if (a->expires > b->expires) return +1;
+
+	return 0;
+}
+
+/*
+ *	Get the cache key for a certificate.  Returns the length of
+ *	the key, or 0 if it can't be cached.
+ */
+static size_t ocsp_cache_key(uint8_t *out, size_t outlen, X509 *issuer_cert, X509 *client_cert)
+{
+	OCSP_CERTID *certid;
+	unsigned char *p = out;
+	int len;
+
+	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
+	if (!certid) return 0;
+
+	len = i2d_OCSP_CERTID(certid, NULL);
+	if ((len <= 0) || ((size_t) len > outlen)) {
+		OCSP_CERTID_free(certid);
+		return 0;
+	}
+
+	len = i2d_OCSP_CERTID(certid, &p);
+	OCSP_CERTID_free(certid);
+
+	return (len > 0) ? len : 0;
+}
+
+static void ocsp_cache_delete(tls_ocsp_cache_t *cache, tls_ocsp_entry_t *entry)
+{
+	fr_heap_extract(cache->heap, entry);
+	rbtree_deletebydata(cache->tree, entry);
+	talloc_free(entry);
+}
+
+/*
+ *	Add (or update) the response for a certificate.
+ */
+static void ocsp_cache_add(tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+			   int ocsp_ok, time_t expires)
+{
+	tls_ocsp_entry_t *entry, my_entry;
+
+	rad_assert(key_len <= sizeof(my_entry.key));
+
+	memcpy(my_entry.key, key, key_len);
+	my_entry.key_len = key_len;
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	entry = rbtree_finddata(cache->tree, &my_entry);
+	if (entry) {
+		fr_heap_extract(cache->heap, entry);
+	} else {
+		/*
+		 *	Make room by discarding the response which
+		 *	expires first.
+		 */
+		if (rbtree_num_elements(cache->tree) >= cache->conf->ocsp_cache_size) {
+			tls_ocsp_entry_t *old;
+
+			old = fr_heap_peek(cache->heap);
+			if (old) ocsp_cache_delete(cache, old);
+		}
+
+		entry = talloc_zero(cache, tls_ocsp_entry_t);
+		if (!entry) {
+			PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+			return;
+		}
+		memcpy(entry->key, key, key_len);
+		entry->key_len = key_len;
+
+		if (!rbtree_insert(cache->tree, entry)) {
+			talloc_free(entry);
+			PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+			return;
+		}
+	}
+
+	entry->ocsp_ok = ocsp_ok;
+	entry->expires = expires;
+	entry->refreshing = false;
+	fr_heap_insert(cache->heap, entry);
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	DEBUG2("[ocsp] --> Caching response for %d seconds", (int) (expires - time(NULL)));
+}
+
+#ifdef HAVE_PTHREAD_H
+typedef struct ocsp_refresh {
+	tls_ocsp_cache_t	*cache;
+	X509			*issuer_cert;
+	X509			*client_cert;
+	uint8_t			key[OCSP_CACHE_KEY_MAX];
+	size_t			key_len;
+} ocsp_refresh_t;
+
+/*
+ *	Query the responder for a cached certificate, so that the
+ *	entry is replaced before it expires.  The request which
+ *	triggered the refresh uses the cached response, and doesn't
+ *	wait for this.
+ */
+static void *ocsp_refresh_thread(void *arg)
+{
+	ocsp_refresh_t *refresh = arg;
+	tls_ocsp_cache_t *cache = refresh->cache;
+	fr_tls_server_conf_t *conf = cache->conf;
+	tls_ocsp_entry_t *entry, my_entry;
+	time_t expires;
+	int ocsp_ok;
+
+	DEBUG2("[ocsp] --> Refreshing cached response");
+
+	ocsp_ok = ocsp_query(conf->ocsp_store, refresh->issuer_cert, refresh->client_cert, conf, &expires);
+	if (expires) {
+		ocsp_cache_add(cache, refresh->key, refresh->key_len, ocsp_ok, expires);
+	} else {
+		/*
+		 *	Keep using the old response until it expires,
+		 *	and let the next request retry the refresh.
+		 */
+		memcpy(my_entry.key, refresh->key, refresh->key_len);
+		my_entry.key_len = refresh->key_len;
+
+		pthread_mutex_lock(&cache->mutex);
+		entry = rbtree_finddata(cache->tree, &my_entry);
+		if (entry) entry->refreshing = false;
+		pthread_mutex_unlock(&cache->mutex);
+	}
+
+	X509_free(refresh->issuer_cert);
+	X509_free(refresh->client_cert);
+	talloc_free(refresh);
+
+	pthread_mutex_lock(&cache->mutex);
+	cache->num_refreshing--;
+	pthread_cond_broadcast(&cache->cond);
+	pthread_mutex_unlock(&cache->mutex);
+
+	return NULL;
+}
+
+/*
+ *	Start a background refresh of a cache entry.  Called with
+ *	the cache locked.
+ */
+static void ocsp_cache_refresh(tls_ocsp_cache_t *cache, tls_ocsp_entry_t *entry,
+			       X509 *issuer_cert, X509 *client_cert)
+{
+	ocsp_refresh_t *refresh;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rcode;
+
+	refresh = talloc_zero(NULL, ocsp_refresh_t);
+	if (!refresh) return;
+
+	refresh->cache = cache;
+	refresh->issuer_cert = X509_dup(issuer_cert);
+	refresh->client_cert = X509_dup(client_cert);
+	memcpy(refresh->key, entry->key, entry->key_len);
+	refresh->key_len = entry->key_len;
+
+	if (!refresh->issuer_cert || !refresh->client_cert) goto error;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rcode = pthread_create(&thread, &attr, ocsp_refresh_thread, refresh);
+	pthread_attr_destroy(&attr);
+	if (rcode != 0) {
+		ERROR("Failed creating OCSP refresh thread: %s", fr_syserror(rcode));
+	error:
+		if (refresh->issuer_cert) X509_free(refresh->issuer_cert);
+		if (refresh->client_cert) X509_free(refresh->client_cert);
+		talloc_free(refresh);
+		return;
+	}
+
+	entry->refreshing = true;
+	cache->num_refreshing++;
+}
+#endif
+
+/*
+ *	Look up the cached response for a certificate.  Returns the
+ *	cached result, or -1 if there's no valid cached response.
+ */
+static int ocsp_cache_find(tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+			   UNUSED X509 *issuer_cert, UNUSED X509 *client_cert)
+{
+	tls_ocsp_entry_t *entry, my_entry;
+	time_t now, expires;
+	int ocsp_ok;
+
+	memcpy(my_entry.key, key, key_len);
+	my_entry.key_len = key_len;
+
+	now = time(NULL);
+
+	PTHREAD_MUTEX_LOCK(&cache->mutex);
+	entry = rbtree_finddata(cache->tree, &my_entry);
+	if (!entry) {
+		PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+		DEBUG2("[ocsp] --> No cached response");
+		return -1;
+	}
+
+	if (entry->expires <= now) {
+		ocsp_cache_delete(cache, entry);
+		PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+		DEBUG2("[ocsp] --> Cached response has expired");
+		return -1;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	if (cache->conf->ocsp_cache_refresh && !entry->refreshing &&
+	    ((entry->expires - now) <= (time_t) cache->conf->ocsp_cache_refresh_margin)) {
+		ocsp_cache_refresh(cache, entry, issuer_cert, client_cert);
+	}
+#endif
+
+	ocsp_ok = entry->ocsp_ok;
+	expires = entry->expires;
+	PTHREAD_MUTEX_UNLOCK(&cache->mutex);
+
+	DEBUG2("[ocsp] --> Using cached response, valid for %d seconds", (int) (expires - now));
+
+	return ocsp_ok;
+}
+
+static int _ocsp_cache_free(tls_ocsp_cache_t *cache)
+{
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	Refresh threads use the configuration, so wait for
+	 *	them to finish before it's freed.
+	 */
+	pthread_mutex_lock(&cache->mutex);
+	while (cache->num_refreshing > 0) pthread_cond_wait(&cache->cond, &cache->mutex);
+	pthread_mutex_unlock(&cache->mutex);
+#endif
+
+	if (cache->heap) fr_heap_delete(cache->heap);
+	if (cache->tree) rbtree_free(cache->tree);
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&cache->mutex);
+	pthread_cond_destroy(&cache->cond);
+#endif
+
+	return 0;
+}
+
+static tls_ocsp_cache_t *ocsp_cache_alloc(fr_tls_server_conf_t *conf)
+{
+	tls_ocsp_cache_t *cache;
+
+	if (conf->ocsp_cache_size == 0) {
+		ERROR("OCSP cache max_entries must be greater than zero");
+		return NULL;
+	}
+
+#ifndef HAVE_PTHREAD_H
+	if (conf->ocsp_cache_refresh) {
+		WARN("OCSP cache refresh requires thread support, disabling it");
+		conf->ocsp_cache_refresh = false;
+	}
+#endif
+
+	cache = talloc_zero(conf, tls_ocsp_cache_t);
+	if (!cache) return NULL;
+
+	cache->conf = conf;
+
+	cache->tree = rbtree_create(NULL, ocsp_entry_cmp, NULL, 0);
+	if (!cache->tree) {
+		ERROR("Failed creating OCSP cache");
+	error:
+		talloc_free(cache);
+		return NULL;
+	}
+
+	cache->heap = fr_heap_create(ocsp_heap_cmp, offsetof(tls_ocsp_entry_t, heap_id));
+	if (!cache->heap) {
+		ERROR("Failed creating OCSP cache heap");
+		goto error;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_init(&cache->mutex, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+#endif
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	return cache;
+}
+
+/*
+ *	Check the status of a certificate, using the cached response
+ *	if there is one.
+ */
+static int ocsp_check(X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
+		      fr_tls_server_conf_t *conf)
+{
+	uint8_t key[OCSP_CACHE_KEY_MAX];
+	size_t key_len = 0;
+	time_t expires;
+	int ocsp_ok = -1;
+
+	if (conf->ocsp_cache) {
+		key_len = ocsp_cache_key(key, sizeof(key), issuer_cert, client_cert);
+		if (key_len) ocsp_ok = ocsp_cache_find(conf->ocsp_cache, key, key_len, issuer_cert, client_cert);
+	}
+
+	if (ocsp_ok < 0) {
+		ocsp_ok = ocsp_query(store, issuer_cert, client_cert, conf, &expires);
+		if (key_len && expires) ocsp_cache_add(conf->ocsp_cache, key, key_len, ocsp_ok, expires);
+	}
+
 	switch (ocsp_ok) {
 	case 1:
 		DEBUG2("[ocsp] --> Certificate is valid!");
@@ -1944,6 +2399,7 @@ int cbtls_verify(int ok, X509_STORE_CTX *ctx)
 				RERROR("Couldn't get issuer_cert for %s", common_name);
 			} else {
 				my_ok = ocsp_check(ocsp_store, issuer_cert, client_cert, conf);
+				X509_free(issuer_cert);
 			}
 		}
 #endif
@@ -2564,9 +3020,16 @@ post_ca:
 		}
 
 		/*
-		 *	Cache it, and DON'T auto-clear it.
+		 *	Cache it, and DON'T auto-clear it.  If the
+		 *	cache driver holds every session, there's no
+		 *	point in OpenSSL keeping another copy.
 		 */
-		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_AUTO_CLEAR);
+		if (conf->session_cache_driver && conf->session_cache_driver->authoritative) {
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_AUTO_CLEAR |
+						       SSL_SESS_CACHE_NO_INTERNAL);
+		} else {
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_AUTO_CLEAR);
+		}
 
 		SSL_CTX_set_session_id_context(ctx,
 					       (unsigned char *) conf->session_context_id,
@@ -2602,6 +3065,10 @@ static int _tls_server_conf_free(fr_tls_server_conf_t *conf)
 	if (conf->ctx) SSL_CTX_free(conf->ctx);
 
 #ifdef HAVE_OPENSSL_OCSP_H
+	/*
+	 *	Before the store, which background refreshes use.
+	 */
+	TALLOC_FREE(conf->ocsp_cache);
 	if (conf->ocsp_store) X509_STORE_free(conf->ocsp_store);
 	conf->ocsp_store = NULL;
 #endif
@@ -2665,6 +3132,15 @@ fr_tls_server_conf_t *tls_server_conf_parse(CONF_SECTION *cs)
 		goto error;
 	}
 
+	/*
+	 *	Before the context, which needs to know whether the
+	 *	driver replaces OpenSSL's session cache.
+	 */
+	if (conf->session_cache_enable && conf->session_cache_driver_name &&
+	    (tls_cache_instantiate(conf) < 0)) {
+		goto error;
+	}
+
 	/*
 	 *	Initialize TLS
 	 */
@@ -2680,6 +3156,11 @@ fr_tls_server_conf_t *tls_server_conf_parse(CONF_SECTION *cs)
 	if (conf->ocsp_enable) {
 		conf->ocsp_store = init_revocation_store(conf);
 		if (conf->ocsp_store == NULL) goto error;
+
+		if (conf->ocsp_cache_enable) {
+			conf->ocsp_cache = ocsp_cache_alloc(conf);
+			if (!conf->ocsp_cache) goto error;
+		}
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 	{
@@ -2775,6 +3256,8 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 
 	talloc_ctx = SSL_get_ex_data(ssn->ssl, FR_TLS_EX_INDEX_TALLOC);
 
+	if (conf->session_cache_enable) tls_cache_count(SSL_session_reused(ssn->ssl));
+
 	/*
 	 *	If there's no session resumption, delete the entry
 	 *	from the cache.  This means either it's disabled
@@ -2789,6 +3272,7 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 	     (vp->vp_integer == 0))) {
 		SSL_CTX_remove_session(ssn->ctx,
 				       ssn->ssl->session);
+		tls_cache_delete(conf, request, SSL_get_session(ssn->ssl));
 		ssn->allow_session_resumption = 0;
 
 		/*
@@ -2843,7 +3327,10 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 			RDEBUG2("Saving session %s vps %p in the cache", buffer, vps);
 			SSL_SESSION_set_ex_data(ssn->ssl->session,
 						fr_tls_ex_index_vps, vps);
-			if (conf->session_cache_path) {
+			if (conf->session_cache_driver) {
+				tls_cache_store(conf, request, SSL_get_session(ssn->ssl), vps);
+
+			} else if (conf->session_cache_path) {
 				/* write the VPs to the cache file */
 				char filename[256], buf[1024];
 				FILE *vp_file;
@@ -2943,10 +3430,18 @@ int tls_success(tls_session_t *ssn, REQUEST *request)
 
 void tls_fail(tls_session_t *ssn)
 {
+	fr_tls_server_conf_t *conf;
+
 	/*
 	 *	Force the session to NOT be cached.
 	 */
 	SSL_CTX_remove_session(ssn->ctx, ssn->ssl->session);
+
+	conf = (fr_tls_server_conf_t *)SSL_get_ex_data(ssn->ssl, FR_TLS_EX_INDEX_CONF);
+	if (conf) {
+		tls_cache_delete(conf, SSL_get_ex_data(ssn->ssl, FR_TLS_EX_INDEX_REQUEST),
+				 SSL_get_session(ssn->ssl));
+	}
 }
 
 fr_tls_status_t tls_application_data(tls_session_t *ssn,
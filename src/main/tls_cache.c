@@ -0,0 +1,1046 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Session resumption cache drivers for TLS.
+ * @file main/tls_cache.c
+ *
+ * OpenSSL's own session cache is private to one SSL_CTX, in one
+ * process.  The drivers here let sessions be kept in a table shared
+ * by all threads, in a file shared by all processes on a host, or
+ * by a virtual server (and so by anything rlm_cache can talk to),
+ * so a client can resume its session on whichever server it reaches.
+ *
+ * @copyright 2015 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef WITH_TLS
+
+#ifdef HAVE_PTHREAD_H
+#  define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#  define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+#else
+#  define PTHREAD_MUTEX_LOCK(_x)
+#  define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+/*
+ *	Must be a power of 2.
+ */
+#define TLS_CACHE_SHARDS	(16)
+
+static tls_cache_stats_t tls_cache_counters;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t tls_cache_counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#define TLS_CACHE_COUNT(_x) do { \
+	PTHREAD_MUTEX_LOCK(&tls_cache_counters_mutex); \
+	tls_cache_counters._x++; \
+	PTHREAD_MUTEX_UNLOCK(&tls_cache_counters_mutex); \
+} while (0)
+
+/*
+ *	In-memory cache.
+ *
+ *	Sessions are spread over a number of shards by a hash of the
+ *	session ID, so handshakes for different sessions don't wait
+ *	for each other the way they do on OpenSSL's single cache lock.
+ *	Every entry has the same lifetime, so each shard keeps its
+ *	entries in insertion order, and expires them from the head.
+ */
+typedef struct tls_cache_mem_entry_t {
+	uint8_t		id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	size_t		id_len;
+	time_t		expires;
+
+	struct tls_cache_mem_entry_t *prev;
+	struct tls_cache_mem_entry_t *next;
+
+	uint8_t		*data;
+	size_t		data_len;
+} tls_cache_mem_entry_t;
+
+typedef struct tls_cache_mem_shard_t {
+	rbtree_t		*tree;
+	tls_cache_mem_entry_t	*head;
+	tls_cache_mem_entry_t	*tail;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t		mutex;
+#endif
+} tls_cache_mem_shard_t;
+
+typedef struct tls_cache_mem_t {
+	uint32_t		max_entries;	//!< Per shard, 0 for no limit.
+	tls_cache_mem_shard_t	shards[TLS_CACHE_SHARDS];
+} tls_cache_mem_t;
+
+static int mem_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_mem_entry_t const *a = one;
+	tls_cache_mem_entry_t const *b = two;
+
+	if (a->id_len != b->id_len) return (int) a->id_len - (int) b->id_len;
+
+	return memcmp(a->id, b->id, a->id_len);
+}
+
+static void mem_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static tls_cache_mem_shard_t *mem_shard(tls_cache_mem_t *inst, uint8_t const *id, size_t id_len)
+{
+	return &inst->shards[fr_hash(id, id_len) & (TLS_CACHE_SHARDS - 1)];
+}
+
+/*
+ *	Called with the shard mutex held.
+ */
+static tls_cache_mem_entry_t *mem_entry_find(tls_cache_mem_shard_t *shard, uint8_t const *id, size_t id_len)
+{
+	tls_cache_mem_entry_t my_entry;
+
+	if (id_len > sizeof(my_entry.id)) return NULL;
+
+	memcpy(my_entry.id, id, id_len);
+	my_entry.id_len = id_len;
+
+	return rbtree_finddata(shard->tree, &my_entry);
+}
+
+/*
+ *	Called with the shard mutex held.
+ */
+static void mem_entry_delete(tls_cache_mem_shard_t *shard, tls_cache_mem_entry_t *entry)
+{
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		shard->head = entry->next;
+	}
+
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		shard->tail = entry->prev;
+	}
+
+	rbtree_deletebydata(shard->tree, entry);
+}
+
+static int _mem_cache_free(tls_cache_mem_t *inst)
+{
+	int i;
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) {
+		tls_cache_mem_shard_t *shard = &inst->shards[i];
+
+		if (!shard->tree) continue;
+
+		rbtree_free(shard->tree);
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_destroy(&shard->mutex);
+#endif
+	}
+
+	return 0;
+}
+
+static int mem_instantiate(fr_tls_server_conf_t *conf, void **instance)
+{
+	int i;
+	tls_cache_mem_t *inst;
+
+	*instance = inst = talloc_zero(conf, tls_cache_mem_t);
+	if (!inst) return -1;
+
+	talloc_set_destructor(inst, _mem_cache_free);
+
+	if (conf->session_cache_size) {
+		inst->max_entries = (conf->session_cache_size + TLS_CACHE_SHARDS - 1) / TLS_CACHE_SHARDS;
+	}
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) {
+		tls_cache_mem_shard_t *shard = &inst->shards[i];
+
+#ifdef HAVE_PTHREAD_H
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			ERROR("tls: Failed initializing session cache mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+#endif
+
+		shard->tree = rbtree_create(NULL, mem_entry_cmp, mem_entry_free, 0);
+		if (!shard->tree) {
+#ifdef HAVE_PTHREAD_H
+			pthread_mutex_destroy(&shard->mutex);
+#endif
+			ERROR("tls: Failed creating session cache");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int mem_store(void *instance, UNUSED REQUEST *request, uint8_t const *id, size_t id_len,
+		     uint8_t const *data, size_t data_len, time_t expires)
+{
+	tls_cache_mem_t *inst = instance;
+	tls_cache_mem_shard_t *shard;
+	tls_cache_mem_entry_t *entry;
+	time_t now;
+
+	if (id_len > sizeof(entry->id)) return -1;
+
+	/*
+	 *	Build the entry outside of the lock.  It isn't parented
+	 *	to anything shared, so there's no need to serialise the
+	 *	allocation with other threads.
+	 */
+	entry = talloc_zero(NULL, tls_cache_mem_entry_t);
+	if (!entry) return -1;
+
+	memcpy(entry->id, id, id_len);
+	entry->id_len = id_len;
+	entry->expires = expires;
+	entry->data = talloc_memdup(entry, data, data_len);
+	entry->data_len = data_len;
+
+	now = time(NULL);
+	shard = mem_shard(inst, id, id_len);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	{
+		tls_cache_mem_entry_t *old;
+
+		old = rbtree_finddata(shard->tree, entry);
+		if (old) mem_entry_delete(shard, old);
+	}
+
+	while (shard->head &&
+	       ((shard->head->expires <= now) ||
+		(inst->max_entries && (rbtree_num_elements(shard->tree) >= inst->max_entries)))) {
+		mem_entry_delete(shard, shard->head);
+	}
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+		talloc_free(entry);
+		return -1;
+	}
+
+	entry->prev = shard->tail;
+	if (shard->tail) {
+		shard->tail->next = entry;
+	} else {
+		shard->head = entry;
+	}
+	shard->tail = entry;
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	return 0;
+}
+
+static ssize_t mem_fetch(void *instance, UNUSED REQUEST *request, TALLOC_CTX *ctx, uint8_t **data,
+			 uint8_t const *id, size_t id_len)
+{
+	tls_cache_mem_t *inst = instance;
+	tls_cache_mem_shard_t *shard;
+	tls_cache_mem_entry_t *entry;
+	ssize_t len = 0;
+
+	shard = mem_shard(inst, id, id_len);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = mem_entry_find(shard, id, id_len);
+	if (entry && (entry->expires <= time(NULL))) {
+		mem_entry_delete(shard, entry);
+		entry = NULL;
+	}
+
+	if (entry) {
+		*data = talloc_memdup(ctx, entry->data, entry->data_len);
+		len = entry->data_len;
+	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	return len;
+}
+
+static int mem_delete(void *instance, UNUSED REQUEST *request, uint8_t const *id, size_t id_len)
+{
+	tls_cache_mem_t *inst = instance;
+	tls_cache_mem_shard_t *shard;
+	tls_cache_mem_entry_t *entry;
+
+	shard = mem_shard(inst, id, id_len);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = mem_entry_find(shard, id, id_len);
+	if (entry) mem_entry_delete(shard, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	return 0;
+}
+
+static tls_cache_driver_t tls_cache_mem = {
+	.name		= "memory",
+	.authoritative	= true,
+	.instantiate	= mem_instantiate,
+	.store		= mem_store,
+	.fetch		= mem_fetch,
+	.delete		= mem_delete
+};
+
+#if defined(HAVE_SYS_MMAN_H) && defined(F_SETLKW)
+/*
+ *	File-backed cache.
+ *
+ *	The file is a fixed-size, set-associative table mapped by
+ *	every server process on the host.  A session ID hashes to one
+ *	bucket of TLS_CACHE_MMAP_WAYS slots.  A bucket is locked with
+ *	a byte-range lock on the file, which keeps other processes
+ *	out, and a mutex, which keeps other threads out (byte-range
+ *	locks are per-process).  Sessions which don't fit in a slot
+ *	are not cached.
+ */
+#define TLS_CACHE_MMAP_MAGIC	(0x46525453)
+#define TLS_CACHE_MMAP_VERSION	(1)
+#define TLS_CACHE_MMAP_WAYS	(8)
+
+typedef struct tls_cache_mmap_header_t {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	buckets;
+	uint32_t	slot_size;
+} tls_cache_mmap_header_t;
+
+typedef struct tls_cache_mmap_slot_t {
+	int64_t		expires;		//!< 0 if the slot is empty.
+	uint32_t	id_len;
+	uint32_t	data_len;
+	uint8_t		id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+} tls_cache_mmap_slot_t;
+
+typedef struct tls_cache_mmap_t {
+	char const	*filename;
+	int		fd;
+	uint8_t		*map;
+	size_t		map_len;
+	uint32_t	buckets;
+	uint32_t	slot_size;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex[TLS_CACHE_SHARDS];
+#endif
+} tls_cache_mmap_t;
+
+static uint32_t mmap_bucket(tls_cache_mmap_t *inst, uint8_t const *id, size_t id_len)
+{
+	return fr_hash(id, id_len) % inst->buckets;
+}
+
+static tls_cache_mmap_slot_t *mmap_slot(tls_cache_mmap_t *inst, uint32_t bucket, int way)
+{
+	return (tls_cache_mmap_slot_t *) (inst->map + sizeof(tls_cache_mmap_header_t) +
+					  (((size_t) bucket * TLS_CACHE_MMAP_WAYS) + way) * inst->slot_size);
+}
+
+static int mmap_lock(tls_cache_mmap_t *inst, uint32_t bucket, short type)
+{
+	struct flock fl;
+
+	if (type != F_UNLCK) PTHREAD_MUTEX_LOCK(&inst->mutex[bucket & (TLS_CACHE_SHARDS - 1)]);
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = sizeof(tls_cache_mmap_header_t) + ((off_t) bucket * TLS_CACHE_MMAP_WAYS * inst->slot_size);
+	fl.l_len = TLS_CACHE_MMAP_WAYS * inst->slot_size;
+
+	while (fcntl(inst->fd, F_SETLKW, &fl) < 0) {
+		if (errno == EINTR) continue;
+
+		ERROR("tls: Failed locking session cache file %s: %s", inst->filename, fr_syserror(errno));
+		if (type != F_UNLCK) PTHREAD_MUTEX_UNLOCK(&inst->mutex[bucket & (TLS_CACHE_SHARDS - 1)]);
+		return -1;
+	}
+
+	if (type == F_UNLCK) PTHREAD_MUTEX_UNLOCK(&inst->mutex[bucket & (TLS_CACHE_SHARDS - 1)]);
+
+	return 0;
+}
+
+/*
+ *	Called with the bucket locked.
+ */
+static tls_cache_mmap_slot_t *mmap_slot_find(tls_cache_mmap_t *inst, uint32_t bucket,
+					     uint8_t const *id, size_t id_len)
+{
+	int i;
+
+	for (i = 0; i < TLS_CACHE_MMAP_WAYS; i++) {
+		tls_cache_mmap_slot_t *slot = mmap_slot(inst, bucket, i);
+
+		if (!slot->expires || (slot->id_len != id_len)) continue;
+
+		if (memcmp(slot->id, id, id_len) == 0) return slot;
+	}
+
+	return NULL;
+}
+
+static int _mmap_cache_free(tls_cache_mmap_t *inst)
+{
+#ifdef HAVE_PTHREAD_H
+	int i;
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) pthread_mutex_destroy(&inst->mutex[i]);
+#endif
+
+	if (inst->map) munmap(inst->map, inst->map_len);
+	if (inst->fd >= 0) close(inst->fd);
+
+	return 0;
+}
+
+static int mmap_instantiate(fr_tls_server_conf_t *conf, void **instance)
+{
+	tls_cache_mmap_t *inst;
+	tls_cache_mmap_header_t *header;
+	struct flock fl;
+	struct stat st;
+	int i;
+
+	if (!conf->session_cache_file) {
+		ERROR("tls: Session cache driver \"mmap\" requires a \"filename\"");
+		return -1;
+	}
+
+	if (conf->session_cache_slot_size < (sizeof(tls_cache_mmap_slot_t) + 256)) {
+		ERROR("tls: Session cache \"slot_size\" must be at least %zu",
+		      sizeof(tls_cache_mmap_slot_t) + 256);
+		return -1;
+	}
+
+	*instance = inst = talloc_zero(conf, tls_cache_mmap_t);
+	if (!inst) return -1;
+
+	inst->fd = -1;
+	talloc_set_destructor(inst, _mmap_cache_free);
+
+#ifdef HAVE_PTHREAD_H
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) pthread_mutex_init(&inst->mutex[i], NULL);
+#endif
+
+	inst->filename = conf->session_cache_file;
+	inst->slot_size = (conf->session_cache_slot_size + 7) & ~7;
+	inst->buckets = (conf->session_cache_size + TLS_CACHE_MMAP_WAYS - 1) / TLS_CACHE_MMAP_WAYS;
+	if (!inst->buckets) inst->buckets = 1;
+	inst->map_len = sizeof(*header) + ((size_t) inst->buckets * TLS_CACHE_MMAP_WAYS * inst->slot_size);
+
+	inst->fd = open(inst->filename, O_RDWR | O_CREAT, 0600);
+	if (inst->fd < 0) {
+		ERROR("tls: Failed opening session cache file %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Lock the whole file while we check (or write) the
+	 *	header, in case another server is starting too.
+	 */
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	if (fcntl(inst->fd, F_SETLKW, &fl) < 0) {
+		ERROR("tls: Failed locking session cache file %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(inst->fd, &st) < 0) {
+		ERROR("tls: Failed reading session cache file %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if ((st.st_size == 0) && (ftruncate(inst->fd, inst->map_len) < 0)) {
+		ERROR("tls: Failed sizing session cache file %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if ((st.st_size != 0) && ((size_t) st.st_size != inst->map_len)) {
+	mismatch:
+		ERROR("tls: Session cache file %s was created with a different \"max_entries\" or \"slot_size\".  "
+		      "Remove it, or change the configuration back", inst->filename);
+		return -1;
+	}
+
+	inst->map = mmap(NULL, inst->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, inst->fd, 0);
+	if (inst->map == MAP_FAILED) {
+		inst->map = NULL;
+		ERROR("tls: Failed mapping session cache file %s: %s", inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	header = (tls_cache_mmap_header_t *) inst->map;
+	if (st.st_size == 0) {
+		header->magic = TLS_CACHE_MMAP_MAGIC;
+		header->version = TLS_CACHE_MMAP_VERSION;
+		header->buckets = inst->buckets;
+		header->slot_size = inst->slot_size;
+
+	} else if ((header->magic != TLS_CACHE_MMAP_MAGIC) || (header->version != TLS_CACHE_MMAP_VERSION) ||
+		   (header->buckets != inst->buckets) || (header->slot_size != inst->slot_size)) {
+		goto mismatch;
+	}
+
+	fl.l_type = F_UNLCK;
+	(void) fcntl(inst->fd, F_SETLK, &fl);
+
+	return 0;
+}
+
+static int mmap_store(void *instance, REQUEST *request, uint8_t const *id, size_t id_len,
+		      uint8_t const *data, size_t data_len, time_t expires)
+{
+	tls_cache_mmap_t *inst = instance;
+	tls_cache_mmap_slot_t *slot;
+	uint32_t bucket;
+	int i;
+
+	if (id_len > sizeof(slot->id)) return -1;
+
+	if (data_len > (inst->slot_size - sizeof(*slot))) {
+		if (request) RWDEBUG("Session is %zu bytes, too large for a %u byte cache slot.  Not caching it",
+				     data_len, inst->slot_size);
+		return -1;
+	}
+
+	bucket = mmap_bucket(inst, id, id_len);
+	if (mmap_lock(inst, bucket, F_WRLCK) < 0) return -1;
+
+	/*
+	 *	Replace the same session, or use an empty slot, or
+	 *	evict whichever session expires first.
+	 */
+	slot = mmap_slot_find(inst, bucket, id, id_len);
+	if (!slot) {
+		time_t now = time(NULL);
+
+		for (i = 0; i < TLS_CACHE_MMAP_WAYS; i++) {
+			tls_cache_mmap_slot_t *this = mmap_slot(inst, bucket, i);
+
+			if (this->expires <= now) {
+				slot = this;
+				break;
+			}
+
+			if (!slot || (this->expires < slot->expires)) slot = this;
+		}
+	}
+
+	slot->expires = 0;
+	memcpy(slot->id, id, id_len);
+	slot->id_len = id_len;
+	memcpy(((uint8_t *) slot) + sizeof(*slot), data, data_len);
+	slot->data_len = data_len;
+	slot->expires = expires;
+
+	mmap_lock(inst, bucket, F_UNLCK);
+
+	return 0;
+}
+
+static ssize_t mmap_fetch(void *instance, UNUSED REQUEST *request, TALLOC_CTX *ctx, uint8_t **data,
+			  uint8_t const *id, size_t id_len)
+{
+	tls_cache_mmap_t *inst = instance;
+	tls_cache_mmap_slot_t *slot;
+	uint32_t bucket;
+	ssize_t len = 0;
+
+	bucket = mmap_bucket(inst, id, id_len);
+	if (mmap_lock(inst, bucket, F_RDLCK) < 0) return -1;
+
+	slot = mmap_slot_find(inst, bucket, id, id_len);
+	if (slot && (slot->expires > time(NULL)) && (slot->data_len <= (inst->slot_size - sizeof(*slot)))) {
+		*data = talloc_memdup(ctx, ((uint8_t *) slot) + sizeof(*slot), slot->data_len);
+		len = slot->data_len;
+	}
+
+	mmap_lock(inst, bucket, F_UNLCK);
+
+	return len;
+}
+
+static int mmap_delete(void *instance, UNUSED REQUEST *request, uint8_t const *id, size_t id_len)
+{
+	tls_cache_mmap_t *inst = instance;
+	tls_cache_mmap_slot_t *slot;
+	uint32_t bucket;
+
+	bucket = mmap_bucket(inst, id, id_len);
+	if (mmap_lock(inst, bucket, F_WRLCK) < 0) return -1;
+
+	slot = mmap_slot_find(inst, bucket, id, id_len);
+	if (slot) slot->expires = 0;
+
+	mmap_lock(inst, bucket, F_UNLCK);
+
+	return 0;
+}
+
+static tls_cache_driver_t tls_cache_mmap = {
+	.name		= "mmap",
+	.authoritative	= true,
+	.instantiate	= mmap_instantiate,
+	.store		= mmap_store,
+	.fetch		= mmap_fetch,
+	.delete		= mmap_delete
+};
+#endif	/* HAVE_SYS_MMAN_H */
+
+/*
+ *	Virtual server cache.
+ *
+ *	Sessions are handed to the "Autz-Type TLS-Cache-*" sections of
+ *	a virtual server, as TLS-Session-Id and TLS-Session-Data, so
+ *	that an rlm_cache instance (or anything else) can keep them
+ *	where every server in the farm can see them.  OpenSSL's cache
+ *	is kept in front of it.
+ */
+typedef struct tls_cache_vs_t {
+	char const	*server;
+} tls_cache_vs_t;
+
+static int vs_instantiate(fr_tls_server_conf_t *conf, void **instance)
+{
+	tls_cache_vs_t *inst;
+
+	if (!conf->session_cache_server) {
+		ERROR("tls: Session cache driver \"virtual_server\" requires a \"virtual_server\"");
+		return -1;
+	}
+
+	*instance = inst = talloc_zero(conf, tls_cache_vs_t);
+	if (!inst) return -1;
+
+	inst->server = conf->session_cache_server;
+
+	return 0;
+}
+
+/** Run one of the TLS-Cache-* sections of the cache virtual server
+ *
+ * @param[in] inst of the driver.
+ * @param[in] request the handshake is being done for.
+ * @param[in] section name of the Autz-Type section to run.
+ * @param[in] id of the session.
+ * @param[in] id_len length of the session ID.
+ * @param[in] data to pass as TLS-Session-Data, may be NULL.
+ * @param[in] data_len length of data.
+ * @return the fake request the section was run for, or NULL if the section couldn't be run.
+ */
+static REQUEST *vs_call(tls_cache_vs_t *inst, REQUEST *request, char const *section,
+			uint8_t const *id, size_t id_len, uint8_t const *data, size_t data_len)
+{
+	DICT_VALUE *dval;
+	REQUEST *fake;
+	VALUE_PAIR *vp;
+	rlm_rcode_t rcode;
+
+	if (!request) return NULL;
+
+	/*
+	 *	The Autz-Type values are only defined once the virtual
+	 *	servers have been loaded, so look them up here.
+	 */
+	dval = dict_valbyname(PW_AUTZ_TYPE, 0, section);
+	if (!dval) {
+		RWDEBUG("No \"Autz-Type %s\" section in server %s", section, inst->server);
+		return NULL;
+	}
+
+	fake = request_alloc_fake(request);
+	if (!fake) return NULL;
+
+	fake->server = inst->server;
+
+	vp = pairmake(fake->packet, &fake->packet->vps, "TLS-Session-Id", NULL, T_OP_SET);
+	if (!vp) {
+	error:
+		talloc_free(fake);
+		return NULL;
+	}
+	pairmemcpy(vp, id, id_len);
+
+	if (data) {
+		vp = pairmake(fake->packet, &fake->packet->vps, "TLS-Session-Data", NULL, T_OP_SET);
+		if (!vp) goto error;
+		pairmemcpy(vp, data, data_len);
+	}
+
+	RDEBUG2("Running \"Autz-Type %s\" in server %s", section, inst->server);
+	rcode = process_authorize(dval->value, fake);
+	switch (rcode) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_NOOP:
+	case RLM_MODULE_NOTFOUND:
+		break;
+
+	default:
+		RWDEBUG("\"Autz-Type %s\" returned %s", section, fr_int2str(modreturn_table, rcode, "<INVALID>"));
+		goto error;
+	}
+
+	return fake;
+}
+
+static int vs_store(void *instance, REQUEST *request, uint8_t const *id, size_t id_len,
+		    uint8_t const *data, size_t data_len, UNUSED time_t expires)
+{
+	REQUEST *fake;
+
+	fake = vs_call(instance, request, "TLS-Cache-Store", id, id_len, data, data_len);
+	if (!fake) return -1;
+
+	talloc_free(fake);
+
+	return 0;
+}
+
+static ssize_t vs_fetch(void *instance, REQUEST *request, TALLOC_CTX *ctx, uint8_t **data,
+			uint8_t const *id, size_t id_len)
+{
+	REQUEST *fake;
+	VALUE_PAIR *vp;
+	ssize_t len = 0;
+
+	fake = vs_call(instance, request, "TLS-Cache-Load", id, id_len, NULL, 0);
+	if (!fake) return -1;
+
+	vp = pairfind(fake->reply->vps, PW_TLS_SESSION_DATA, 0, TAG_ANY);
+	if (vp) {
+		*data = talloc_memdup(ctx, vp->vp_octets, vp->length);
+		len = vp->length;
+	}
+
+	talloc_free(fake);
+
+	return len;
+}
+
+static int vs_delete(void *instance, REQUEST *request, uint8_t const *id, size_t id_len)
+{
+	REQUEST *fake;
+
+	fake = vs_call(instance, request, "TLS-Cache-Clear", id, id_len, NULL, 0);
+	if (!fake) return -1;
+
+	talloc_free(fake);
+
+	return 0;
+}
+
+static tls_cache_driver_t tls_cache_vs = {
+	.name		= "virtual_server",
+	.authoritative	= false,
+	.instantiate	= vs_instantiate,
+	.store		= vs_store,
+	.fetch		= vs_fetch,
+	.delete		= vs_delete
+};
+
+static tls_cache_driver_t const *tls_cache_drivers[] = {
+	&tls_cache_mem,
+#if defined(HAVE_SYS_MMAN_H) && defined(F_SETLKW)
+	&tls_cache_mmap,
+#endif
+	&tls_cache_vs,
+	NULL
+};
+
+/*
+ *	The blob handed to drivers is the length of the ASN.1 session
+ *	(4 octets, network order), the session, then the cached
+ *	attributes as text.
+ */
+static uint8_t *tls_cache_encode(TALLOC_CTX *ctx, size_t *out_len, SSL_SESSION *sess, VALUE_PAIR *vps)
+{
+	int asn1_len;
+	uint8_t *data, *p;
+	char *text;
+	size_t text_len;
+	vp_cursor_t cursor;
+	VALUE_PAIR *vp;
+
+	asn1_len = i2d_SSL_SESSION(sess, NULL);
+	if (asn1_len < 1) return NULL;
+
+	text = talloc_strdup(ctx, "");
+	for (vp = fr_cursor_init(&cursor, &vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		char buffer[1024];
+
+		vp_prints(buffer, sizeof(buffer), vp);
+		text = talloc_asprintf_append_buffer(text, "%s%s", text[0] ? ", " : "", buffer);
+	}
+	text_len = strlen(text);
+
+	data = talloc_array(ctx, uint8_t, 4 + asn1_len + text_len);
+	data[0] = (asn1_len >> 24) & 0xff;
+	data[1] = (asn1_len >> 16) & 0xff;
+	data[2] = (asn1_len >> 8) & 0xff;
+	data[3] = asn1_len & 0xff;
+
+	/* openssl mutates &p */
+	p = data + 4;
+	if (i2d_SSL_SESSION(sess, &p) != asn1_len) {
+		talloc_free(text);
+		talloc_free(data);
+		return NULL;
+	}
+	memcpy(p, text, text_len);
+	talloc_free(text);
+
+	*out_len = 4 + asn1_len + text_len;
+
+	return data;
+}
+
+static SSL_SESSION *tls_cache_decode(TALLOC_CTX *ctx, VALUE_PAIR **vps, uint8_t const *data, size_t data_len)
+{
+	size_t asn1_len;
+	unsigned char const *p;
+	SSL_SESSION *sess;
+
+	*vps = NULL;
+
+	if (data_len < 4) return NULL;
+
+	asn1_len = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	if (asn1_len > (data_len - 4)) return NULL;
+
+	/* openssl mutates &p */
+	p = data + 4;
+	sess = d2i_SSL_SESSION(NULL, &p, asn1_len);
+	if (!sess) return NULL;
+
+	if (data_len > (4 + asn1_len)) {
+		char *text;
+
+		text = talloc_strndup(NULL, (char const *) data + 4 + asn1_len, data_len - 4 - asn1_len);
+		if (userparse(ctx, text, vps) == T_INVALID) {
+			talloc_free(text);
+			pairfree(vps);
+			SSL_SESSION_free(sess);
+			return NULL;
+		}
+		talloc_free(text);
+	}
+
+	return sess;
+}
+
+/** Find and instantiate the session cache driver named in the configuration
+ *
+ * @param[in] conf to instantiate the driver for.
+ * @return 0 on success, -1 on error.
+ */
+int tls_cache_instantiate(fr_tls_server_conf_t *conf)
+{
+	int i;
+
+	for (i = 0; tls_cache_drivers[i]; i++) {
+		if (strcmp(tls_cache_drivers[i]->name, conf->session_cache_driver_name) == 0) break;
+	}
+
+	if (!tls_cache_drivers[i]) {
+		ERROR("tls: Unknown session cache driver \"%s\"", conf->session_cache_driver_name);
+		return -1;
+	}
+
+	if (conf->session_cache_path) {
+		ERROR("tls: \"persist_dir\" cannot be used with a session cache driver");
+		return -1;
+	}
+
+	/*
+	 *	Sessions can only be resumed by a context with the same
+	 *	ID, and the default one is different in every process.
+	 */
+	if ((tls_cache_drivers[i] != &tls_cache_mem) && !conf->session_id_name) {
+		WARN("tls: Session cache \"name\" is not set.  "
+		     "Sessions cached by other servers will not be resumed");
+	}
+
+	if (tls_cache_drivers[i]->instantiate(conf, &conf->session_cache) < 0) {
+		TALLOC_FREE(conf->session_cache);
+		return -1;
+	}
+	conf->session_cache_driver = tls_cache_drivers[i];
+
+	return 0;
+}
+
+/** Write a session, and the attributes cached with it, to the cache driver
+ *
+ * @param[in] conf the session was created with.
+ * @param[in] request the handshake was done for.
+ * @param[in] sess to store.
+ * @param[in] vps to restore when the session is resumed.
+ * @return 0 on success, -1 on error.
+ */
+int tls_cache_store(fr_tls_server_conf_t *conf, REQUEST *request, SSL_SESSION *sess, VALUE_PAIR *vps)
+{
+	uint8_t *data;
+	size_t data_len;
+	uint8_t const *id;
+	unsigned int id_len;
+	int ret;
+
+	if (!conf->session_cache_driver) return 0;
+
+	id = SSL_SESSION_get_id(sess, &id_len);
+
+	data = tls_cache_encode(NULL, &data_len, sess, vps);
+	if (!data) {
+		ERROR("tls: Failed serialising session: %s", ERR_error_string(ERR_get_error(), NULL));
+		TLS_CACHE_COUNT(failures);
+		return -1;
+	}
+
+	ret = conf->session_cache_driver->store(conf->session_cache, request, id, id_len, data, data_len,
+						time(NULL) + (conf->session_timeout * 3600));
+	talloc_free(data);
+
+	if (ret < 0) {
+		TLS_CACHE_COUNT(failures);
+		return -1;
+	}
+	TLS_CACHE_COUNT(stores);
+
+	return 0;
+}
+
+/** Read a session, and the attributes cached with it, from the cache driver
+ *
+ * @param[in] conf of the context doing the handshake.
+ * @param[in] request the handshake is being done for, may be NULL.
+ * @param[in] ctx to allocate the attributes in.
+ * @param[out] vps the attributes cached with the session.
+ * @param[in] id of the session.
+ * @param[in] id_len length of the session ID.
+ * @return the session, or NULL if it wasn't found.
+ */
+SSL_SESSION *tls_cache_fetch(fr_tls_server_conf_t *conf, REQUEST *request, TALLOC_CTX *ctx, VALUE_PAIR **vps,
+			     uint8_t const *id, size_t id_len)
+{
+	uint8_t *data = NULL;
+	ssize_t data_len;
+	SSL_SESSION *sess;
+
+	*vps = NULL;
+
+	if (!conf->session_cache_driver) return NULL;
+
+	TLS_CACHE_COUNT(lookups);
+
+	data_len = conf->session_cache_driver->fetch(conf->session_cache, request, NULL, &data, id, id_len);
+	if (data_len < 0) TLS_CACHE_COUNT(failures);
+	if (data_len <= 0) return NULL;
+
+	sess = tls_cache_decode(ctx, vps, data, data_len);
+	talloc_free(data);
+	if (!sess) {
+		ERROR("tls: Failed loading cached session: %s", ERR_error_string(ERR_get_error(), NULL));
+		TLS_CACHE_COUNT(failures);
+		return NULL;
+	}
+	TLS_CACHE_COUNT(hits);
+
+	return sess;
+}
+
+/** Remove a session from the cache driver
+ *
+ * @param[in] conf the session was created with.
+ * @param[in] request the session was being used for, may be NULL.
+ * @param[in] sess to remove.
+ */
+void tls_cache_delete(fr_tls_server_conf_t *conf, REQUEST *request, SSL_SESSION *sess)
+{
+	uint8_t const *id;
+	unsigned int id_len;
+
+	if (!conf->session_cache_driver || !sess) return;
+
+	id = SSL_SESSION_get_id(sess, &id_len);
+
+	if (conf->session_cache_driver->delete(conf->session_cache, request, id, id_len) < 0) {
+		TLS_CACHE_COUNT(failures);
+	}
+}
+
+/** Count a completed handshake
+ *
+ * @param[in] resumed whether the handshake resumed a cached session.
+ */
+void tls_cache_count(bool resumed)
+{
+	if (resumed) {
+		TLS_CACHE_COUNT(resumed);
+	} else {
+		TLS_CACHE_COUNT(full);
+	}
+}
+
+/** Get a copy of the session resumption counters
+ *
+ * @param[out] stats where to write the counters.
+ */
+void tls_cache_stats(tls_cache_stats_t *stats)
+{
+	PTHREAD_MUTEX_LOCK(&tls_cache_counters_mutex);
+	*stats = tls_cache_counters;
+	PTHREAD_MUTEX_UNLOCK(&tls_cache_counters_mutex);
+}
+#endif	/* WITH_TLS */
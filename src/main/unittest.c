@@ -63,6 +63,18 @@ void listen_free(UNUSED rad_listen_t **head)
 	/* do nothing */
 }
 
+#ifdef WITH_RADIUS_BATCH
+void listen_batch_hold(UNUSED rad_listen_t *listener)
+{
+	/* do nothing */
+}
+
+void listen_batch_release(UNUSED rad_listen_t *listener)
+{
+	/* do nothing */
+}
+#endif
+
 
 static rad_listen_t *listen_alloc(void *ctx)
 {
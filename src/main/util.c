@@ -30,6 +30,30 @@ RCSID("$Id$")
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef HAVE_PTHREAD_H
+#define PTHREAD_MUTEX_LOCK pthread_mutex_lock
+#define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
+
+static pthread_mutex_t request_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+/*
+ *	This is easier than ifdef's throughout the code.
+ */
+#define PTHREAD_MUTEX_LOCK(_x)
+#define PTHREAD_MUTEX_UNLOCK(_x)
+#endif
+
+/*
+ *	Size of the arena for new requests.  It follows what recent
+ *	requests used, so that most of them fit into one allocation.
+ */
+#define REQUEST_ARENA_MIN	(2048)
+#define REQUEST_ARENA_MAX	(65536)
+#define REQUEST_ARENA_HDR	(96)	/* talloc overhead per object, roughly */
+#define REQUEST_ARENA_SAMPLE	(64)	/* sample one request in this many */
+
+static size_t request_arena_size = 2 * REQUEST_ARENA_MIN;
+
 /*
  *	The signal() function in Solaris 2.5.1 sets SA_NODEFER in
  *	sa_flags, which causes grief if signal() is called in the
@@ -316,6 +340,28 @@ void NEVER_RETURNS rad_assert_fail(char const *file, unsigned int line, char con
 	fr_exit_now(1);
 }
 
+/*
+ *	Update the arena size from what a request actually used.
+ */
+static void request_arena_sample(TALLOC_CTX *arena)
+{
+	size_t used;
+
+	/*
+	 *	The totals include the pool itself, which is as large as
+	 *	the arena we gave it.  Count only what was allocated from it.
+	 */
+	used = talloc_total_size(arena) - talloc_get_size(arena);
+	used += (talloc_total_blocks(arena) - 1) * REQUEST_ARENA_HDR;
+	used += used / 4;
+
+	PTHREAD_MUTEX_LOCK(&request_arena_mutex);
+	request_arena_size = ((request_arena_size * 7) + used) / 8;
+	if (request_arena_size < REQUEST_ARENA_MIN) request_arena_size = REQUEST_ARENA_MIN;
+	if (request_arena_size > REQUEST_ARENA_MAX) request_arena_size = REQUEST_ARENA_MAX;
+	PTHREAD_MUTEX_UNLOCK(&request_arena_mutex);
+}
+
 /*
  *	Free a REQUEST struct.
  */
@@ -345,9 +391,37 @@ static int _request_free(REQUEST *request)
 	request->home_server = NULL;
 #endif
 
+	if (request->arena && ((request->number % REQUEST_ARENA_SAMPLE) == 0)) {
+		request_arena_sample(request->arena);
+	}
+
 	return 0;
 }
 
+/** Allocate a memory pool for the packets of a request
+ *
+ * The packets, and the attributes decoded into them, are then allocated from
+ * the pool instead of individually, and are all freed with the request.
+ *
+ * @param request to allocate the pool for.
+ * @return the pool, or the request if the pool couldn't be allocated.
+ */
+TALLOC_CTX *request_arena_alloc(REQUEST *request)
+{
+	size_t size;
+
+	if (request->arena) return request->arena;
+
+	PTHREAD_MUTEX_LOCK(&request_arena_mutex);
+	size = request_arena_size;
+	PTHREAD_MUTEX_UNLOCK(&request_arena_mutex);
+
+	request->arena = talloc_pool(request, size);
+	if (!request->arena) return request;
+
+	return request->arena;
+}
+
 /*
  *	Create a new REQUEST data structure.
  */
@@ -952,7 +1026,7 @@ static void verify_packet(char const *file, int line, REQUEST *request, RADIUS_P
 	}
 
 	parent = talloc_parent(packet);
-	if (parent != request) {
+	if ((parent != request) && (!request->arena || (parent != request->arena))) {
 		ERROR("CONSISTENCY CHECK FAILED %s[%i]: Expected RADIUS_PACKET %s to be parented by %p (%s), "
 		      "but parented by %p (%s)", file, line, type, request, talloc_get_name(request),
 		      parent, parent ? talloc_get_name(parent) : "NULL");
@@ -1058,3 +1132,165 @@ bool fr_getgid(char const *name, gid_t *gid)
 }
 #endif	/* HAVE_GETGRNAM_R */
 #endif	/* HAVE_GRP_H */
+
+#ifdef TESTING
+/*
+ *  Compare handling the packets of a request with, and without, the
+ *  per-request arena.
+ *
+ *  cc -DTESTING -I ../include -c util.c -o util_mine.o
+ *  cc util_mine.o -lfreeradius-server -lfreeradius-radius -ltalloc -lpthread -o util
+ *
+ *  ./util <dict_dir>
+ *
+ *  Each loop decodes an Accounting-Request, adds attributes to it and
+ *  to the reply, encodes the reply, and frees the request.
+ */
+#include <sys/wait.h>
+
+struct main_config_t main_config;
+log_debug_t debug_flag = 0;
+
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+
+#define ARENA_LOOPS (100000)
+
+static char const *arena_test_attrs =
+	"User-Name = \"bob@example.com\", "
+	"NAS-IP-Address = 192.0.2.1, "
+	"NAS-Port = 1234, "
+	"Service-Type = Framed-User, "
+	"Framed-Protocol = PPP, "
+	"Framed-IP-Address = 198.51.100.20, "
+	"Class = 0x0102030405060708, "
+	"Called-Station-Id = \"00-11-22-33-44-55:example\", "
+	"Calling-Station-Id = \"66-77-88-99-aa-bb\", "
+	"NAS-Identifier = \"nas01.example.com\", "
+	"Acct-Status-Type = Interim-Update, "
+	"Acct-Delay-Time = 0, "
+	"Acct-Input-Octets = 123456789, "
+	"Acct-Output-Octets = 987654321, "
+	"Acct-Session-Id = \"0123456789abcdef\", "
+	"Acct-Authentic = RADIUS, "
+	"Acct-Session-Time = 3600, "
+	"Acct-Input-Packets = 123456, "
+	"Acct-Output-Packets = 654321, "
+	"Acct-Terminate-Cause = User-Request, "
+	"Acct-Multi-Session-Id = \"fedcba9876543210\", "
+	"Acct-Link-Count = 1, "
+	"Acct-Input-Gigawords = 0, "
+	"Acct-Output-Gigawords = 1, "
+	"Event-Timestamp = 1400000000, "
+	"NAS-Port-Type = Wireless-802.11, "
+	"Connect-Info = \"CONNECT 54Mbps 802.11g\", "
+	"NAS-Port-Id = \"wlan0\", "
+	"Framed-MTU = 1400, "
+	"Acct-Interim-Interval = 600, "
+	"Chargeable-User-Identity = \"cui-0123456789\"";
+
+static uint64_t arena_test_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+/*
+ *	Do what request_setup() and the reply path do with the packets.
+ */
+static REQUEST *arena_test_request(RADIUS_PACKET *raw, bool use_arena)
+{
+	REQUEST *request;
+	TALLOC_CTX *ctx;
+
+	request = request_alloc(NULL);
+	ctx = use_arena ? request_arena_alloc(request) : request;
+
+	request->packet = rad_alloc(ctx, false);
+	request->packet->code = raw->code;
+	request->packet->id = raw->id;
+	request->packet->data = talloc_memdup(request->packet, raw->data, raw->data_len);
+	request->packet->data_len = raw->data_len;
+	if (rad_decode(request->packet, NULL, "testing123") < 0) {
+		fr_perror("util");
+		exit(1);
+	}
+
+	request->reply = rad_alloc_reply(ctx, request->packet);
+	request->reply->code = PW_CODE_ACCOUNTING_RESPONSE;
+	pairmake_packet("Acct-Unique-Session-Id", "0123456789abcdef0123456789abcdef", T_OP_EQ);
+	pairmake_reply("Reply-Message", "accounted", T_OP_EQ);
+	if (rad_encode(request->reply, request->packet, "testing123") < 0) {
+		fr_perror("util");
+		exit(1);
+	}
+
+	return request;
+}
+
+int main(int argc, char **argv)
+{
+	int i, pass, num = 0;
+	RADIUS_PACKET *raw;
+	VALUE_PAIR *vp;
+	vp_cursor_t cursor;
+	REQUEST *request;
+	struct timeval start;
+	uint64_t usec;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <dict_dir>\n", argv[0]);
+		exit(1);
+	}
+
+	if (dict_init(argv[1], RADIUS_DICTIONARY) < 0) {
+		fr_perror("util");
+		exit(1);
+	}
+
+	raw = rad_alloc(NULL, true);
+	raw->code = PW_CODE_ACCOUNTING_REQUEST;
+	if ((userparse(raw, arena_test_attrs, &raw->vps) == T_INVALID) ||
+	    (rad_encode(raw, NULL, "testing123") < 0)) {
+		fr_perror("util");
+		exit(1);
+	}
+
+	for (vp = fr_cursor_init(&cursor, &raw->vps); vp; vp = fr_cursor_next(&cursor)) num++;
+
+	request = arena_test_request(raw, false);
+	printf("%d attributes, %zu byte packet: %zu talloc objects, %zu bytes per request\n",
+	       num, raw->data_len, talloc_total_blocks(request) - 1, talloc_total_size(request));
+	talloc_free(request);
+
+	for (pass = 0; pass < 2; pass++) {
+		bool use_arena = (pass == 1);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < ARENA_LOOPS; i++) {
+			request = arena_test_request(raw, use_arena);
+			request->number = i;
+			talloc_free(request);
+		}
+		usec = arena_test_usec(&start);
+
+		printf("%-8s %7.3f usec/request", use_arena ? "arena" : "no arena", (double) usec / ARENA_LOOPS);
+		if (use_arena) printf(", arena settled at %zu bytes", request_arena_size);
+		printf("\n");
+	}
+
+	talloc_free(raw);
+
+	return 0;
+}
+#endif
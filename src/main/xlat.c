@@ -2365,6 +2365,89 @@ xlat_exp_t *xlat_from_tmpl_attr(TALLOC_CTX *ctx, value_pair_tmpl_t *vpt)
 	return node;
 }
 
+/** A format string which has been tokenized once, with the escape function it's expanded with
+ *
+ */
+struct xlat_compiled_t {
+	char const		*fmt;		//!< The original format string.
+	xlat_exp_t		*head;		//!< The tokenized format string, or NULL if it's
+						//!< tokenized on every expansion.
+	RADIUS_ESCAPE_STRING	escape;		//!< Function to escape expanded values.
+	void			*escape_ctx;	//!< Passed to the escape function.
+};
+
+/** Tokenize a format string once, so that it doesn't need to be tokenized on every expansion
+ *
+ * If the string can't be tokenized yet, e.g. because it refers to an xlat which will be
+ * registered by a module which hasn't been instantiated yet, the string is tokenized when
+ * it's expanded, just as radius_axlat() does.
+ *
+ * @param[in] ctx to allocate the compiled xlat in.
+ * @param[in] fmt the format string.
+ * @param[in] escape function to escape expanded values e.g. SQL quoting.
+ * @param[in] escape_ctx pointer to pass to escape function.
+ * @return a new xlat_compiled_t, or NULL if fmt was NULL, or on error.
+ */
+xlat_compiled_t *xlat_compile(TALLOC_CTX *ctx, char const *fmt, RADIUS_ESCAPE_STRING escape, void *escape_ctx)
+{
+	ssize_t slen;
+	char *tokens;
+	char const *error = NULL;
+	xlat_compiled_t *xc;
+
+	if (!fmt) return NULL;
+
+	xc = talloc_zero(ctx, xlat_compiled_t);
+	if (!xc) return NULL;
+
+	xc->fmt = talloc_typed_strdup(xc, fmt);
+	xc->escape = escape;
+	xc->escape_ctx = escape_ctx;
+
+	/*
+	 *	The tokenizer mangles the string in place, and the
+	 *	nodes point into it, so it has to stay around.
+	 */
+	tokens = talloc_typed_strdup(xc, fmt);
+	if (!xc->fmt || !tokens) {
+		talloc_free(xc);
+		return NULL;
+	}
+
+	slen = xlat_tokenize(xc, tokens, &xc->head, &error);
+	if (slen <= 0) {
+		if (slen < 0) DEBUG3("Will tokenize \"%s\" when it's used: %s", fmt, error);
+		talloc_free(xc->head);
+		talloc_free(tokens);
+		xc->head = NULL;
+	}
+
+	return xc;
+}
+
+static ssize_t xlat_expand_compiled(char **out, size_t outlen, REQUEST *request, xlat_compiled_t const *xc)
+{
+	ssize_t len;
+
+	if (!xc->head) return xlat_expand(out, outlen, request, xc->fmt, xc->escape, xc->escape_ctx);
+
+	len = xlat_expand_struct(out, outlen, request, xc->head, xc->escape, xc->escape_ctx);
+	if (len < 0) return len;
+
+	RDEBUG2("EXPAND %s", xc->fmt);
+	RDEBUG2("   --> %s", *out);
+
+	return len;
+}
+
+/** Get the original format string of a compiled xlat
+ *
+ */
+char const *xlat_compiled_fmt(xlat_compiled_t const *xc)
+{
+	return xc->fmt;
+}
+
 ssize_t radius_xlat(char *out, size_t outlen, REQUEST *request, char const *fmt, RADIUS_ESCAPE_STRING escape, void *ctx)
 {
 	return xlat_expand(&out, outlen, request, fmt, escape, ctx);
@@ -2379,3 +2462,153 @@ ssize_t radius_axlat_struct(char **out, REQUEST *request, xlat_exp_t const *xlat
 {
 	return xlat_expand_struct(out, 0, request, xlat, escape, ctx);
 }
+
+ssize_t radius_xlat_compiled(char *out, size_t outlen, REQUEST *request, xlat_compiled_t const *xc)
+{
+	return xlat_expand_compiled(&out, outlen, request, xc);
+}
+
+ssize_t radius_axlat_compiled(char **out, REQUEST *request, xlat_compiled_t const *xc)
+{
+	return xlat_expand_compiled(out, 0, request, xc);
+}
+
+#ifdef TESTING
+/*
+ *  Compare the cost of tokenizing on every expansion, with the cost of
+ *  expanding a compiled xlat.
+ *
+ *  cc -DTESTING -I ../include -c xlat.c -o xlat_mine.o
+ *  cc xlat_mine.o -lfreeradius-server -lfreeradius-radius -ltalloc -lpthread -o xlat
+ *
+ *  ./xlat <dict_dir>
+ */
+#include <sys/wait.h>
+
+struct main_config_t main_config;
+int debug_flag = 0;
+
+pid_t rad_fork(void)
+{
+	return fork();
+}
+
+pid_t rad_waitpid(pid_t pid, int *status)
+{
+	return waitpid(pid, status, 0);
+}
+
+#define XLAT_LOOPS (100000)
+
+static size_t xlat_test_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *in, UNUSED void *arg)
+{
+	strlcpy(out, in, outlen);
+
+	return strlen(out);
+}
+
+static ssize_t xlat_test(UNUSED void *instance, UNUSED REQUEST *request,
+			 UNUSED char const *fmt, char *out, size_t outlen)
+{
+	return strlcpy(out, "test", outlen);
+}
+
+static char const *xlat_test_fmt[] = {
+	"%{User-Name}",
+	"%{test:%{User-Name}}",
+	"/var/log/radius/%{Client-IP-Address}/detail-%Y%m%d",
+	"SELECT id, username, attribute, value, op FROM radcheck WHERE username = '%{User-Name}' ORDER BY id",
+	"INSERT INTO radacct (acctsessionid, username, nasipaddress, acctstarttime, acctinputoctets) "
+	"VALUES ('%{Acct-Session-Id}', '%{User-Name}', '%{NAS-IP-Address}', "
+	"%{%{integer:Event-Timestamp}:-date('now')}, "
+	"'%{%{Acct-Input-Gigawords}:-0}' << 32 | '%{%{Acct-Input-Octets}:-0}')",
+	NULL
+};
+
+static uint64_t xlat_test_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+int main(int argc, char **argv)
+{
+	int i, j;
+	REQUEST *request;
+	struct timeval start;
+	uint64_t dynamic, compiled;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <dict_dir>\n", argv[0]);
+		exit(1);
+	}
+
+	if (dict_init(argv[1], RADIUS_DICTIONARY) < 0) {
+		fr_perror("xlat");
+		exit(1);
+	}
+
+	/*
+	 *	Also registers the built-in expansions.
+	 */
+	xlat_register("test", xlat_test, NULL, NULL);
+
+	request = request_alloc(NULL);
+	request->packet = rad_alloc(request, false);
+	request->reply = rad_alloc(request, false);
+
+	pairmake_packet("User-Name", "bob", T_OP_EQ);
+	pairmake_packet("Acct-Session-Id", "0123456789abcdef", T_OP_EQ);
+	pairmake_packet("NAS-IP-Address", "192.0.2.1", T_OP_EQ);
+	pairmake_packet("Acct-Input-Octets", "12345", T_OP_EQ);
+
+	for (i = 0; xlat_test_fmt[i] != NULL; i++) {
+		char *a = NULL, *b = NULL;
+		xlat_compiled_t *xc;
+
+		xc = xlat_compile(request, xlat_test_fmt[i], xlat_test_escape, NULL);
+		if (!xc) {
+			fprintf(stderr, "Failed compiling \"%s\"\n", xlat_test_fmt[i]);
+			exit(1);
+		}
+
+		if ((radius_axlat(&a, request, xlat_test_fmt[i], xlat_test_escape, NULL) < 0) ||
+		    (radius_axlat_compiled(&b, request, xc) < 0) ||
+		    (strcmp(a, b) != 0)) {
+			fprintf(stderr, "Expansions of \"%s\" differ: \"%s\" vs \"%s\"\n",
+				xlat_test_fmt[i], a ? a : "", b ? b : "");
+			exit(1);
+		}
+		talloc_free(a);
+		talloc_free(b);
+
+		gettimeofday(&start, NULL);
+		for (j = 0; j < XLAT_LOOPS; j++) {
+			a = NULL;
+			(void) radius_axlat(&a, request, xlat_test_fmt[i], xlat_test_escape, NULL);
+			talloc_free(a);
+		}
+		dynamic = xlat_test_usec(&start);
+
+		gettimeofday(&start, NULL);
+		for (j = 0; j < XLAT_LOOPS; j++) {
+			b = NULL;
+			(void) radius_axlat_compiled(&b, request, xc);
+			talloc_free(b);
+		}
+		compiled = xlat_test_usec(&start);
+
+		printf("%4zu bytes: %7.3f usec tokenized, %7.3f usec compiled\n", strlen(xlat_test_fmt[i]),
+		       (double) dynamic / XLAT_LOOPS, (double) compiled / XLAT_LOOPS);
+
+		talloc_free(xc);
+	}
+
+	talloc_free(request);
+
+	return 0;
+}
+#endif
@@ -184,4 +184,6 @@ module_t rlm_dhcp = {
 		NULL,		 	/* post-proxy */
 		NULL,			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -143,4 +143,6 @@ module_t rlm_always = {
 		mod_always_return		/* send-coa */
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
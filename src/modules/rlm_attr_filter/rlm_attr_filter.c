@@ -372,5 +372,7 @@ module_t rlm_attr_filter = {
 		mod_send_coa
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
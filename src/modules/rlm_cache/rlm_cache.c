@@ -779,4 +779,6 @@ module_t rlm_cache = {
 		mod_cache_it,	       	/* post-proxy */
 		mod_cache_it,		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
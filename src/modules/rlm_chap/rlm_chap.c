@@ -203,4 +203,6 @@ module_t rlm_chap = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
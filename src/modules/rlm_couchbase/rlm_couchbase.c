@@ -908,4 +908,6 @@ module_t rlm_couchbase = {
 		NULL,                   /* post-proxy */
 		NULL                    /* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
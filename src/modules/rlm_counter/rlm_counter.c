@@ -882,4 +882,6 @@ module_t rlm_counter = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
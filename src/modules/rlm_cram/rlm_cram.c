@@ -204,4 +204,6 @@ module_t rlm_cram = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
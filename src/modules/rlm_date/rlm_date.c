@@ -128,5 +128,7 @@ module_t rlm_date = {
 		NULL,			/* pre-accounting */
 		NULL			/* accounting */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
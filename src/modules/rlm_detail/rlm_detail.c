@@ -538,5 +538,7 @@ module_t rlm_detail = {
 		mod_send_coa
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
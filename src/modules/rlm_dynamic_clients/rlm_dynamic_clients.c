@@ -125,4 +125,6 @@ module_t rlm_dynamic_clients = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -94,10 +94,16 @@ static int _eap_handler_free(eap_handler_t *handler)
 
 	if (handler->certs) pairfree(&handler->certs);
 
+	/*
+	 *	The handler tree only exists when we've been asked to
+	 *	warn about unfinished sessions.  Without it, there's
+	 *	nothing shared to synchronise with.
+	 */
+	if (!inst->handler_tree) return 0;
+
 	PTHREAD_MUTEX_LOCK(&(inst->handler_mutex));
-	if (inst->handler_tree) {
-		rbtree_deletebydata(inst->handler_tree, handler);
-	}
+	rbtree_deletebydata(inst->handler_tree, handler);
+
 	/*
 	 *	Free operations need to be synchronised too.
 	 */
@@ -114,17 +120,23 @@ eap_handler_t *eap_handler_alloc(rlm_eap_t *inst)
 {
 	eap_handler_t	*handler;
 
-	PTHREAD_MUTEX_LOCK(&(inst->handler_mutex));
 	handler = talloc_zero(NULL, eap_handler_t);
+	if (!handler) return NULL;
+
 	if (inst->handler_tree) {
-		if (!rbtree_insert(inst->handler_tree, handler)) {
+		bool inserted;
+
+		PTHREAD_MUTEX_LOCK(&(inst->handler_mutex));
+		inserted = rbtree_insert(inst->handler_tree, handler);
+		PTHREAD_MUTEX_UNLOCK(&(inst->handler_mutex));
+
+		if (!inserted) {
 			ERROR("Failed inserting EAP handler into handler tree");
 			talloc_free(handler);
 			return NULL;
 		}
 	}
 	handler->inst_holder = inst;
-	PTHREAD_MUTEX_UNLOCK(&(inst->handler_mutex));
 
 	/* Doesn't need to be inside the critical region */
 	talloc_set_destructor(handler, _eap_handler_free);
@@ -147,7 +159,7 @@ static int _check_opaque_free(check_handler_t *check)
 		return 0;
 	}
 
-	if (!check->inst->handler_tree) goto done;
+	if (!check->inst->handler_tree) return 0;
 
 	PTHREAD_MUTEX_LOCK(&(check->inst->handler_mutex));
 	if (!rbtree_finddata(check->inst->handler_tree, check->handler)) {
@@ -200,14 +212,29 @@ done:
 
 void eaplist_free(rlm_eap_t *inst)
 {
+	int i;
 	eap_handler_t *node, *next;
 
-	for (node = inst->session_head; node != NULL; node = next) {
-		next = node->next;
-		talloc_free(node);
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		eap_session_shard_t *shard = &inst->sessions[i];
+
+		for (node = shard->head; node != NULL; node = next) {
+			next = node->next;
+			talloc_free(node);
+		}
+
+		shard->head = shard->tail = NULL;
 	}
+}
 
-	inst->session_head = inst->session_tail = NULL;
+/*
+ *	Sessions are spread over the shards by a hash of their
+ *	State.  The State sent to the client and the State it
+ *	returns are identical, so both ends agree on the shard.
+ */
+static eap_session_shard_t *eaplist_shard(rlm_eap_t *inst, uint8_t const *state)
+{
+	return &inst->sessions[fr_hash(state, EAP_STATE_LEN) & (EAP_SESSION_SHARDS - 1)];
 }
 
 /*
@@ -227,15 +254,15 @@ static uint32_t eap_rand(fr_randctx *ctx)
 }
 
 
-static eap_handler_t *eaplist_delete(rlm_eap_t *inst, REQUEST *request,
+static eap_handler_t *eaplist_delete(eap_session_shard_t *shard, REQUEST *request,
 				   eap_handler_t *handler)
 {
 	rbnode_t *node;
 
-	node = rbtree_find(inst->session_tree, handler);
+	node = rbtree_find(shard->tree, handler);
 	if (!node) return NULL;
 
-	handler = rbtree_node2data(inst->session_tree, node);
+	handler = rbtree_node2data(shard->tree, node);
 
 	RDEBUG("Finished EAP session with state "
 	       "0x%02x%02x%02x%02x%02x%02x%02x%02x",
@@ -246,7 +273,7 @@ static eap_handler_t *eaplist_delete(rlm_eap_t *inst, REQUEST *request,
 	/*
 	 *	Delete old handler from the tree.
 	 */
-	rbtree_delete(inst->session_tree, node);
+	rbtree_delete(shard->tree, node);
 
 	/*
 	 *	And unsplice it from the linked list.
@@ -254,12 +281,12 @@ static eap_handler_t *eaplist_delete(rlm_eap_t *inst, REQUEST *request,
 	if (handler->prev) {
 		handler->prev->next = handler->next;
 	} else {
-		inst->session_head = handler->next;
+		shard->head = handler->next;
 	}
 	if (handler->next) {
 		handler->next->prev = handler->prev;
 	} else {
-		inst->session_tail = handler->prev;
+		shard->tail = handler->prev;
 	}
 	handler->prev = handler->next = NULL;
 
@@ -267,7 +294,7 @@ static eap_handler_t *eaplist_delete(rlm_eap_t *inst, REQUEST *request,
 }
 
 
-static void eaplist_expire(rlm_eap_t *inst, REQUEST *request, time_t timestamp)
+static void eaplist_expire(rlm_eap_t *inst, eap_session_shard_t *shard, REQUEST *request, time_t timestamp)
 {
 	int i;
 	eap_handler_t *handler;
@@ -280,7 +307,7 @@ static void eaplist_expire(rlm_eap_t *inst, REQUEST *request, time_t timestamp)
 	 *
 	 */
 	for (i = 0; i < 3; i++) {
-		handler = inst->session_head;
+		handler = shard->head;
 		if (!handler) break;
 
 		RDEBUG("Expiring EAP session with state "
@@ -296,19 +323,19 @@ static void eaplist_expire(rlm_eap_t *inst, REQUEST *request, time_t timestamp)
 		 */
 		if ((timestamp - handler->timestamp) > (int)inst->timer_limit) {
 			rbnode_t *node;
-			node = rbtree_find(inst->session_tree, handler);
+			node = rbtree_find(shard->tree, handler);
 			rad_assert(node != NULL);
-			rbtree_delete(inst->session_tree, node);
+			rbtree_delete(shard->tree, node);
 
 			/*
-			 *	handler == inst->session_head
+			 *	handler == shard->head
 			 */
-			inst->session_head = handler->next;
+			shard->head = handler->next;
 			if (handler->next) {
 				handler->next->prev = NULL;
 			} else {
-				inst->session_head = NULL;
-				inst->session_tail = NULL;
+				shard->head = NULL;
+				shard->tail = NULL;
 			}
 			talloc_free(handler);
 		} else {
@@ -328,6 +355,7 @@ int eaplist_add(rlm_eap_t *inst, eap_handler_t *handler)
 	int		status = 0;
 	VALUE_PAIR	*state;
 	REQUEST		*request = handler->request;
+	eap_session_shard_t *shard;
 
 	/*
 	 *	Generate State, since we've been asked to add it to
@@ -346,29 +374,18 @@ int eaplist_add(rlm_eap_t *inst, eap_handler_t *handler)
 	handler->src_ipaddr = request->packet->src_ipaddr;
 	handler->eap_id = handler->eap_ds->request->id;
 
-	/*
-	 *	Playing with a data structure shared among threads
-	 *	means that we need a lock, to avoid conflict.
-	 */
-	PTHREAD_MUTEX_LOCK(&(inst->session_mutex));
-
-	/*
-	 *	If we have a DoS attack, discard new sessions.
-	 */
-	if (rbtree_num_elements(inst->session_tree) >= inst->max_sessions) {
-		status = -1;
-		eaplist_expire(inst, request, handler->timestamp);
-		goto done;
-	}
-
 	/*
 	 *	Create a unique content for the State variable.
 	 *	It will be modified slightly per round trip, but less so
 	 *	than in 1.x.
+	 *
+	 *	The random pool is shared by all shards, so it has
+	 *	its own lock.
 	 */
 	if (handler->trips == 0) {
 		int i;
 
+		PTHREAD_MUTEX_LOCK(&(inst->rand_mutex));
 		for (i = 0; i < 4; i++) {
 			uint32_t lvalue;
 
@@ -377,6 +394,7 @@ int eaplist_add(rlm_eap_t *inst, eap_handler_t *handler)
 			memcpy(handler->state + i * 4, &lvalue,
 			       sizeof(lvalue));
 		}
+		PTHREAD_MUTEX_UNLOCK(&(inst->rand_mutex));
 	}
 
 	/*
@@ -388,10 +406,27 @@ int eaplist_add(rlm_eap_t *inst, eap_handler_t *handler)
 
 	pairmemcpy(state, handler->state, sizeof(handler->state));
 
+	/*
+	 *	Playing with a data structure shared among threads
+	 *	means that we need a lock, to avoid conflict.  Only
+	 *	the shard which holds this State is locked.
+	 */
+	shard = eaplist_shard(inst, handler->state);
+	PTHREAD_MUTEX_LOCK(&(shard->mutex));
+
+	/*
+	 *	If we have a DoS attack, discard new sessions.
+	 */
+	if (rbtree_num_elements(shard->tree) >= shard->max_sessions) {
+		status = -1;
+		eaplist_expire(inst, shard, request, handler->timestamp);
+		goto done;
+	}
+
 	/*
 	 *	Big-time failure.
 	 */
-	status = rbtree_insert(inst->session_tree, handler);
+	status = rbtree_insert(shard->tree, handler);
 
 	/*
 	 *	Catch Access-Challenge without response.
@@ -410,14 +445,14 @@ int eaplist_add(rlm_eap_t *inst, eap_handler_t *handler)
 	if (status) {
 		eap_handler_t *prev;
 
-		prev = inst->session_tail;
+		prev = shard->tail;
 		if (prev) {
 			prev->next = handler;
 			handler->prev = prev;
 			handler->next = NULL;
-			inst->session_tail = handler;
+			shard->tail = handler;
 		} else {
-			inst->session_head = inst->session_tail = handler;
+			shard->head = shard->tail = handler;
 			handler->next = handler->prev = NULL;
 		}
 	}
@@ -433,7 +468,7 @@ int eaplist_add(rlm_eap_t *inst, eap_handler_t *handler)
 	 */
 	if (status > 0) handler->request = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+	PTHREAD_MUTEX_UNLOCK(&(shard->mutex));
 
 	if (status <= 0) {
 		pairfree(&state);
@@ -474,6 +509,7 @@ eap_handler_t *eaplist_find(rlm_eap_t *inst, REQUEST *request,
 {
 	VALUE_PAIR	*state;
 	eap_handler_t	*handler, myHandler;
+	eap_session_shard_t *shard;
 
 	/*
 	 *	We key the sessions off of the 'state' attribute, so it
@@ -493,12 +529,13 @@ eap_handler_t *eaplist_find(rlm_eap_t *inst, REQUEST *request,
 	 *	Playing with a data structure shared among threads
 	 *	means that we need a lock, to avoid conflict.
 	 */
-	PTHREAD_MUTEX_LOCK(&(inst->session_mutex));
+	shard = eaplist_shard(inst, myHandler.state);
+	PTHREAD_MUTEX_LOCK(&(shard->mutex));
 
-	eaplist_expire(inst, request, request->timestamp);
+	eaplist_expire(inst, shard, request, request->timestamp);
 
-	handler = eaplist_delete(inst, request, &myHandler);
-	PTHREAD_MUTEX_UNLOCK(&(inst->session_mutex));
+	handler = eaplist_delete(shard, request, &myHandler);
+	PTHREAD_MUTEX_UNLOCK(&(shard->mutex));
 
 	/*
 	 *	Might not have been there.
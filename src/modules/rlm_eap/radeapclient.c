@@ -98,6 +98,27 @@ int rad_virtual_server(REQUEST UNUSED *request)
   abort();
 }
 
+rlm_rcode_t process_authorize(UNUSED int type, UNUSED REQUEST *request)
+{
+  /*We're not the server so we cannot do this*/
+  abort();
+}
+
+#ifdef WITH_RADIUS_BATCH
+/*
+ *	threads.c calls these.  We don't have batched listeners.
+ */
+void listen_batch_hold(UNUSED rad_listen_t *listener)
+{
+	/* do nothing */
+}
+
+void listen_batch_release(UNUSED rad_listen_t *listener)
+{
+	/* do nothing */
+}
+#endif
+
 static uint16_t getport(char const *name)
 {
 	struct	servent		*svp;
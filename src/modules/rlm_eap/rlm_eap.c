@@ -35,6 +35,7 @@ static const CONF_PARSER module_config[] = {
 	{ "ignore_unknown_eap_types", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_eap_t, ignore_unknown_types), "no" },
 	{ "mod_accounting_username_bug", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_eap_t, mod_accounting_username_bug), "no" },
 	{ "max_sessions", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_eap_t, max_sessions), "2048" },
+	{ "warn_unfinished_sessions", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_eap_t, warn_unfinished), "no" },
 
 	{ NULL, -1, 0, NULL, NULL }	   /* end the list */
 };
@@ -44,16 +45,23 @@ static const CONF_PARSER module_config[] = {
  */
 static int mod_detach(void *instance)
 {
+	int i;
 	rlm_eap_t *inst;
 
 	inst = (rlm_eap_t *)instance;
 
 #ifdef HAVE_PTHREAD_H
-	pthread_mutex_destroy(&(inst->session_mutex));
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		if (inst->sessions[i].tree) pthread_mutex_destroy(&(inst->sessions[i].mutex));
+	}
+	pthread_mutex_destroy(&(inst->rand_mutex));
 	if (inst->handler_tree) pthread_mutex_destroy(&(inst->handler_mutex));
 #endif
 
-	rbtree_free(inst->session_tree);
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		rbtree_free(inst->sessions[i].tree);
+		inst->sessions[i].tree = NULL;
+	}
 	if (inst->handler_tree) {
 		rbtree_free(inst->handler_tree);
 		/*
@@ -62,7 +70,6 @@ static int mod_detach(void *instance)
 		 */
 		inst->handler_tree = NULL;
 	}
-	inst->session_tree = NULL;
 	eaplist_free(inst);
 
 	return 0;
@@ -222,18 +229,51 @@ static int mod_instantiate(CONF_SECTION *cs, void *instance)
 	 *	of 'inst', above.
 	 */
 
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&(inst->rand_mutex), NULL) < 0) {
+		ERROR("rlm_eap (%s): Failed initializing mutex: %s", inst->xlat_name, fr_syserror(errno));
+		return -1;
+	}
+#endif
+
+	/*
+	 *	max_sessions is enforced per shard, so that a full
+	 *	shard never has to look at any of the others.
+	 */
+	if (inst->max_sessions < EAP_SESSION_SHARDS) inst->max_sessions = EAP_SESSION_SHARDS;
+
 	/*
-	 *	Lookup sessions in the tree.  We don't free them in
-	 *	the tree, as that's taken care of elsewhere...
+	 *	Lookup sessions in the trees.  We don't free them in
+	 *	the trees, as that's taken care of elsewhere...
 	 */
-	inst->session_tree = rbtree_create(NULL, eap_handler_cmp, NULL, 0);
-	if (!inst->session_tree) {
-		ERROR("rlm_eap (%s): Cannot initialize tree", inst->xlat_name);
-		return -1;
+	for (i = 0; i < EAP_SESSION_SHARDS; i++) {
+		eap_session_shard_t *shard = &inst->sessions[i];
+
+		shard->tree = rbtree_create(NULL, eap_handler_cmp, NULL, 0);
+		if (!shard->tree) {
+			ERROR("rlm_eap (%s): Cannot initialize tree", inst->xlat_name);
+			return -1;
+		}
+		fr_link_talloc_ctx_free(inst, shard->tree);
+
+		shard->max_sessions = (inst->max_sessions + EAP_SESSION_SHARDS - 1) / EAP_SESSION_SHARDS;
+
+#ifdef HAVE_PTHREAD_H
+		if (pthread_mutex_init(&(shard->mutex), NULL) < 0) {
+			ERROR("rlm_eap (%s): Failed initializing mutex: %s", inst->xlat_name, fr_syserror(errno));
+			rbtree_free(shard->tree);
+			shard->tree = NULL;
+			return -1;
+		}
+#endif
 	}
-	fr_link_talloc_ctx_free(inst, inst->session_tree);
 
-	if (fr_debug_flag) {
+	/*
+	 *	Tracking every handler so we can complain about the
+	 *	ones which never finished costs a lock per allocation,
+	 *	so it's only done when asked for.
+	 */
+	if (inst->warn_unfinished) {
 		inst->handler_tree = rbtree_create(NULL, eap_handler_ptr_cmp, NULL, 0);
 		if (!inst->handler_tree) {
 			ERROR("rlm_eap (%s): Cannot initialize tree", inst->xlat_name);
@@ -249,13 +289,6 @@ static int mod_instantiate(CONF_SECTION *cs, void *instance)
 #endif
 	}
 
-#ifdef HAVE_PTHREAD_H
-	if (pthread_mutex_init(&(inst->session_mutex), NULL) < 0) {
-		ERROR("rlm_eap (%s): Failed initializing mutex: %s", inst->xlat_name, fr_syserror(errno));
-		return -1;
-	}
-#endif
-
 	return 0;
 }
 
@@ -787,4 +820,6 @@ module_t rlm_eap = {
 #endif
 		mod_post_auth		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
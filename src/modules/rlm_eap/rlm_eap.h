@@ -41,15 +41,35 @@ typedef struct eap_module {
 	void			*instance;
 } eap_module_t;
 
+/*
+ *	Must be a power of 2.
+ */
+#define EAP_SESSION_SHARDS	(16)
+
+/*
+ * Remembered sessions are spread over a number of shards, by a hash
+ * of the State attribute.  Each shard has its own lock, tree, and
+ * list of sessions in the order they were added, for expiry.  So
+ * rounds of different EAP sessions don't wait for each other.
+ */
+typedef struct eap_session_shard {
+	rbtree_t	*tree;
+	eap_handler_t	*head, *tail;
+	uint32_t	max_sessions;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t	mutex;
+#endif
+} eap_session_shard_t;
+
 /*
  * This structure contains eap's persistent data.
- * sessions = remembered sessions, in a tree for speed.
+ * sessions = remembered sessions, sharded by State.
  * types = All supported EAP-Types
- * mutex = ensure only one thread is updating the sessions[] struct
+ * handler_tree = all handlers, for the "did not finish" warning.
  */
 typedef struct rlm_eap {
-	rbtree_t	*session_tree;
-	eap_handler_t	*session_head, *session_tail;
+	eap_session_shard_t sessions[EAP_SESSION_SHARDS];
 	rbtree_t	*handler_tree; /* for debugging only */
 	eap_module_t 	*methods[PW_EAP_MAX_TYPES];
 
@@ -63,11 +83,12 @@ typedef struct rlm_eap {
 
 	bool		ignore_unknown_types;
 	bool		mod_accounting_username_bug;
+	bool		warn_unfinished;
 
 	uint32_t	max_sessions;
 
 #ifdef HAVE_PTHREAD_H
-	pthread_mutex_t	session_mutex;
+	pthread_mutex_t	rand_mutex;
 	pthread_mutex_t	handler_mutex;
 #endif
 
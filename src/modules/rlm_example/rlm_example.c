@@ -198,6 +198,17 @@ static int mod_detach(UNUSED void *instance)
  *	data, the type should be changed to RLM_TYPE_THREAD_UNSAFE.
  *	The server will then take care of ensuring that the module
  *	is single-threaded.
+ *
+ *	If instead each thread needs its own handle (e.g. to a library
+ *	which isn't thread safe), the type can be RLM_TYPE_THREAD_INSTANCE,
+ *	with "thread instantiation" and "thread detach" functions.  The
+ *	first creates a thread's data from the instance, and the section
+ *	functions are then passed that data instead of the instance.
+ *
+ *	WARNING: The instance is still shared by every thread.  xlats and
+ *	paircompares registered in mod_instantiate() are called with it,
+ *	from any thread, and thread instantiation must not modify it, or
+ *	register anything.
  */
 module_t rlm_example = {
 	RLM_MODULE_INIT,
@@ -221,4 +232,6 @@ module_t rlm_example = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -484,4 +484,6 @@ module_t rlm_exec = {
 		mod_exec_dispatch
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
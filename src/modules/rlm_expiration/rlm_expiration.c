@@ -137,4 +137,6 @@ module_t rlm_expiration = {
 		NULL,			/* post-proxy */
 		mod_authorize  		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -1319,4 +1319,6 @@ module_t rlm_expr = {
 		NULL,			/* pre-accounting */
 		NULL			/* accounting */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
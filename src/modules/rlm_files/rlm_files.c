@@ -555,5 +555,7 @@ module_t rlm_files = {
 #endif
 		mod_post_auth		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
@@ -169,4 +169,6 @@ module_t rlm_idn = {
 		NULL
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
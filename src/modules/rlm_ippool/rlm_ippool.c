@@ -835,4 +835,6 @@ module_t rlm_ippool = {
 		NULL,			/* post-proxy */
 		mod_post_auth		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -410,7 +410,7 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(ldap_instance_t const *inst, REQUEST *re
 		return RLM_MODULE_INVALID;
 	}
 
-	if (radius_xlat(base_dn, sizeof(base_dn), request, inst->groupobj_base_dn, rlm_ldap_escape_func, NULL) < 0) {
+	if (radius_xlat_compiled(base_dn, sizeof(base_dn), request, inst->groupobj_base_dn_xlat) < 0) {
 		REDEBUG("Failed creating base_dn");
 
 		return RLM_MODULE_INVALID;
@@ -542,8 +542,7 @@ rlm_rcode_t rlm_ldap_check_groupobj_dynamic(ldap_instance_t const *inst, REQUEST
 		/*
 		 *	rlm_ldap_find_user does this, too.  Oh well.
 		 */
-		if (radius_xlat(base_dn, sizeof(base_dn), request, inst->groupobj_base_dn,
-				rlm_ldap_escape_func, NULL) < 0) {
+		if (radius_xlat_compiled(base_dn, sizeof(base_dn), request, inst->groupobj_base_dn_xlat) < 0) {
 			REDEBUG("Failed creating base_dn");
 
 			return RLM_MODULE_INVALID;
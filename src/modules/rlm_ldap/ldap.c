@@ -987,8 +987,7 @@ char const *rlm_ldap_find_user(ldap_instance_t const *inst, REQUEST *request, ld
 	}
 
 	if (inst->userobj_filter) {
-		if (radius_xlat(filter, sizeof(filter), request, inst->userobj_filter,
-				rlm_ldap_escape_func, NULL) < 0) {
+		if (radius_xlat_compiled(filter, sizeof(filter), request, inst->userobj_filter_xlat) < 0) {
 			REDEBUG("Unable to create filter");
 			*rcode = RLM_MODULE_INVALID;
 
@@ -998,7 +997,7 @@ char const *rlm_ldap_find_user(ldap_instance_t const *inst, REQUEST *request, ld
 		filter_p = filter;
 	}
 
-	if (radius_xlat(base_dn, sizeof(base_dn), request, inst->userobj_base_dn, rlm_ldap_escape_func, NULL) < 0) {
+	if (radius_xlat_compiled(base_dn, sizeof(base_dn), request, inst->userobj_base_dn_xlat) < 0) {
 		REDEBUG("Unable to create base_dn");
 		*rcode = RLM_MODULE_INVALID;
 
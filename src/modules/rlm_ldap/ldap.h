@@ -167,6 +167,15 @@ typedef struct ldap_instance {
 							//!< in userobj or groupobj.
 	char const	*profile_filter;		//!< Filter to retrieve only retrieve group objects.
 
+	/*
+	 *	Filters and DNs, tokenized once at instantiation.
+	 */
+	xlat_compiled_t	*userobj_filter_xlat;		//!< Compiled userobj_filter.
+	xlat_compiled_t	*userobj_base_dn_xlat;		//!< Compiled userobj_base_dn.
+	xlat_compiled_t	*groupobj_base_dn_xlat;		//!< Compiled groupobj_base_dn.
+	xlat_compiled_t	*default_profile_xlat;		//!< Compiled default_profile.
+	xlat_compiled_t	*profile_filter_xlat;		//!< Compiled profile_filter.
+
 	/*
 	 *	Accounting
 	 */
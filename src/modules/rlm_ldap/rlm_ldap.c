@@ -751,6 +751,23 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 
 	xlat_register(inst->xlat_name, ldap_xlat, rlm_ldap_escape_func, inst);
 
+	/*
+	 *	Tokenize the filters and DNs once, instead of on every
+	 *	request.
+	 */
+#define LDAP_COMPILE(_x, _escape) do { \
+		if (inst->_x) { \
+			inst->_x ## _xlat = xlat_compile(inst, inst->_x, _escape, NULL); \
+			if (!inst->_x ## _xlat) goto error; \
+		} \
+	} while (0)
+
+	LDAP_COMPILE(userobj_filter, rlm_ldap_escape_func);
+	LDAP_COMPILE(userobj_base_dn, rlm_ldap_escape_func);
+	LDAP_COMPILE(groupobj_base_dn, rlm_ldap_escape_func);
+	LDAP_COMPILE(default_profile, NULL);
+	LDAP_COMPILE(profile_filter, rlm_ldap_escape_func);
+
 	/*
 	 *	Setup the cache attribute
 	 */
@@ -1076,7 +1093,7 @@ skip_edir:
 	if (inst->default_profile) {
 		char profile[1024];
 
-		if (radius_xlat(profile, sizeof(profile), request, inst->default_profile, NULL, NULL) < 0) {
+		if (radius_xlat_compiled(profile, sizeof(profile), request, inst->default_profile_xlat) < 0) {
 			REDEBUG("Failed creating default profile string");
 
 			rcode = RLM_MODULE_INVALID;
@@ -1391,4 +1408,6 @@ module_t rlm_ldap = {
 		NULL,			/* post-proxy 		 */
 		mod_post_auth		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -60,8 +60,21 @@ typedef struct rlm_linelog_t {
 	char const	*line;
 	char const	*reference;
 	fr_logfile_t	*lf;
+
+	xlat_compiled_t	*filename_xlat;		//!< Compiled filename.
+	xlat_compiled_t	*line_xlat;		//!< Compiled format.
+	xlat_compiled_t	*reference_xlat;	//!< Compiled reference.
+	rbtree_t	*lines;			//!< Compiled lines, keyed by CONF_PAIR.
 } rlm_linelog_t;
 
+/*
+ *	A line which can be selected with a reference.
+ */
+typedef struct linelog_line_t {
+	CONF_PAIR const	*cp;
+	xlat_compiled_t	*xlat;
+} linelog_line_t;
+
 /*
  *	A mapping of configuration file names to internal variables.
  *
@@ -82,6 +95,57 @@ static const CONF_PARSER module_config[] = {
 };
 
 
+static size_t linelog_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in,
+				  UNUSED void *arg);
+
+static int linelog_line_cmp(void const *one, void const *two)
+{
+	linelog_line_t const *a = one;
+	linelog_line_t const *b = two;
+
+	if (a->cp < b->cp) return -1;
+	if (a->cp > b->cp) return +1;
+
+	return 0;
+}
+
+/*
+ *	Tokenize every line a reference could select.
+ */
+static int linelog_compile_lines(rbtree_t *tree, CONF_SECTION *cs)
+{
+	CONF_ITEM *ci;
+
+	for (ci = cf_item_find_next(cs, NULL);
+	     ci != NULL;
+	     ci = cf_item_find_next(cs, ci)) {
+		CONF_PAIR *cp;
+		linelog_line_t *line;
+
+		if (cf_item_is_section(ci)) {
+			if (linelog_compile_lines(tree, cf_itemtosection(ci)) < 0) return -1;
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		cp = cf_itemtopair(ci);
+		if (!cf_pair_value(cp)) continue;
+
+		line = talloc_zero(tree, linelog_line_t);
+		if (!line) return -1;
+
+		line->cp = cp;
+		line->xlat = xlat_compile(line, cf_pair_value(cp), linelog_escape_func, NULL);
+		if (!line->xlat || !rbtree_insert(tree, line)) {
+			talloc_free(line);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /*
  *	Instantiate the module.
  */
@@ -125,8 +189,31 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	/*
+	 *	Tokenize the expansions once, instead of on every request.
+	 */
+	inst->filename_xlat = xlat_compile(inst, inst->filename, NULL, NULL);
+	if (!inst->filename_xlat) goto compile_error;
+
+	if (inst->line) {
+		inst->line_xlat = xlat_compile(inst, inst->line, linelog_escape_func, NULL);
+		if (!inst->line_xlat) goto compile_error;
+	}
+
+	if (inst->reference) {
+		inst->reference_xlat = xlat_compile(inst, inst->reference, linelog_escape_func, NULL);
+		if (!inst->reference_xlat) goto compile_error;
+
+		inst->lines = rbtree_create(inst, linelog_line_cmp, NULL, 0);
+		if (!inst->lines || (linelog_compile_lines(inst->lines, conf) < 0)) goto compile_error;
+	}
+
 	inst->cs = conf;
 	return 0;
+
+compile_error:
+	cf_log_err_cs(conf, "Failed compiling expansions");
+	return -1;
 }
 
 
@@ -198,8 +285,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_do_linelog(void *instance, REQUEST *requ
 	int fd = -1;
 	char *p;
 	char line[4096];
+	ssize_t slen = 0;
 	rlm_linelog_t *inst = (rlm_linelog_t*) instance;
 	char const *value = inst->line;
+	xlat_compiled_t const *xlat = inst->line_xlat;
 
 #ifdef HAVE_GRP_H
 	gid_t gid;
@@ -211,10 +300,11 @@ static rlm_rcode_t CC_HINT(nonnull) mod_do_linelog(void *instance, REQUEST *requ
 	if (inst->reference) {
 		CONF_ITEM *ci;
 		CONF_PAIR *cp;
+		linelog_line_t my_line, *found;
 
 		p = line + 1;
 
-		if (radius_xlat(p, sizeof(line) - 2, request, inst->reference, linelog_escape_func, NULL) < 0) {
+		if (radius_xlat_compiled(p, sizeof(line) - 2, request, inst->reference_xlat) < 0) {
 			return RLM_MODULE_FAIL;
 		}
 
@@ -238,11 +328,16 @@ static rlm_rcode_t CC_HINT(nonnull) mod_do_linelog(void *instance, REQUEST *requ
 
 		cp = cf_itemtopair(ci);
 		value = cf_pair_value(cp);
+		xlat = NULL;
 		if (!value) {
 			RDEBUG2("Entry \"%s\" has no value", line);
 			goto do_log;
 		}
 
+		my_line.cp = cp;
+		found = rbtree_finddata(inst->lines, &my_line);
+		xlat = found ? found->xlat : NULL;
+
 		/*
 		 *	Value exists, but is empty.  Don't log anything.
 		 */
@@ -256,7 +351,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_do_linelog(void *instance, REQUEST *requ
 	if (strcmp(inst->filename, "syslog") != 0) {
 		char path[2048];
 
-		if (radius_xlat(path, sizeof(path), request, inst->filename, NULL, NULL) < 0) {
+		if (radius_xlat_compiled(path, sizeof(path), request, inst->filename_xlat) < 0) {
 			return RLM_MODULE_FAIL;
 		}
 
@@ -300,7 +395,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_do_linelog(void *instance, REQUEST *requ
 	/*
 	 *	FIXME: Check length.
 	 */
-	if (value && (radius_xlat(line, sizeof(line) - 1, request, value, linelog_escape_func, NULL) < 0)) {
+	if (xlat) {
+		slen = radius_xlat_compiled(line, sizeof(line) - 1, request, xlat);
+	} else if (value) {
+		slen = radius_xlat(line, sizeof(line) - 1, request, value, linelog_escape_func, NULL);
+	}
+	if (slen < 0) {
 		if (fd > -1) {
 			fr_logfile_close(inst->lf, fd);
 		}
@@ -354,4 +454,6 @@ module_t rlm_linelog = {
 		mod_do_linelog		/* send-coa */
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -271,4 +271,6 @@ module_t rlm_logintime = {
 		NULL,			/* post-proxy */
 		mod_authorize  		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
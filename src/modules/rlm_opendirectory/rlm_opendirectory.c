@@ -503,4 +503,6 @@ module_t rlm_opendirectory = {
 		NULL,		/* post-proxy */
 		NULL		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
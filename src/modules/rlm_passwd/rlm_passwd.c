@@ -596,5 +596,7 @@ module_t rlm_passwd = {
 		mod_passwd_map
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 #endif /* TEST */
@@ -1114,4 +1114,6 @@ module_t rlm_perl = {
 		mod_send_coa
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -737,5 +737,7 @@ module_t rlm_preprocess = {
 		NULL,				/* post-proxy */
 		NULL				/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
@@ -765,5 +765,7 @@ module_t rlm_python = {
 		, mod_recv_coa,
 		mod_send_coa
 #endif
-	}
+	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -764,5 +764,7 @@ module_t rlm_radutmp = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
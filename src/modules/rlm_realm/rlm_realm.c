@@ -517,5 +517,7 @@ module_t rlm_realm = {
 		NULL			/* send-coa */
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
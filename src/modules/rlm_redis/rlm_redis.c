@@ -305,4 +305,6 @@ module_t rlm_redis = {
 		NULL, /* post-proxy */
 		NULL /* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
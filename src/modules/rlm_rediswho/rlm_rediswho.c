@@ -223,4 +223,6 @@ module_t rlm_rediswho = {
 		NULL, /* post-proxy */
 		NULL /* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
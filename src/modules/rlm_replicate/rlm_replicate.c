@@ -293,4 +293,6 @@ module_t rlm_replicate = {
 		NULL
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
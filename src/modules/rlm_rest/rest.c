@@ -2050,7 +2050,7 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 			if (username) {
 				SET_OPTION(CURLOPT_USERNAME, username);
 			} else if (section->username) {
-				if (radius_xlat(buffer, sizeof(buffer), request, section->username, NULL, NULL) < 0) {
+				if (radius_xlat_compiled(buffer, sizeof(buffer), request, section->username_xlat) < 0) {
 					option = STRINGIFY(CURLOPT_USERNAME);
 					goto error;
 				}
@@ -2060,7 +2060,7 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 			if (password) {
 				SET_OPTION(CURLOPT_PASSWORD, password);
 			} else if (section->password) {
-				if (radius_xlat(buffer, sizeof(buffer), request, section->password, NULL, NULL) < 0) {
+				if (radius_xlat_compiled(buffer, sizeof(buffer), request, section->password_xlat) < 0) {
 					option = STRINGIFY(CURLOPT_PASSWORD);
 					goto error;
 				}
@@ -2073,7 +2073,7 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 			if (username) {
 				SET_OPTION(CURLOPT_TLSAUTH_USERNAME, username);
 			} else if (section->username) {
-				if (radius_xlat(buffer, sizeof(buffer), request, section->username, NULL, NULL) < 0) {
+				if (radius_xlat_compiled(buffer, sizeof(buffer), request, section->username_xlat) < 0) {
 					option = STRINGIFY(CURLOPT_TLSAUTH_USERNAME);
 					goto error;
 				}
@@ -2083,7 +2083,7 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 			if (password) {
 				SET_OPTION(CURLOPT_TLSAUTH_PASSWORD, password);
 			} else if (section->password) {
-				if (radius_xlat(buffer, sizeof(buffer), request, section->password, NULL, NULL) < 0) {
+				if (radius_xlat_compiled(buffer, sizeof(buffer), request, section->password_xlat) < 0) {
 					option = STRINGIFY(CURLOPT_TLSAUTH_PASSWORD);
 					goto error;
 				}
@@ -2182,7 +2182,7 @@ int rest_request_config(rlm_rest_t *instance, rlm_rest_section_t *section,
 		rest_custom_data_t *data;
 		char *expanded = NULL;
 
-		if (radius_axlat(&expanded, request, section->data, NULL, NULL) < 0) {
+		if (radius_axlat_compiled(&expanded, request, section->data_xlat) < 0) {
 			return -1;
 		}
 
@@ -2415,64 +2415,75 @@ size_t rest_uri_escape(UNUSED REQUEST *request, char *out, size_t outlen, char c
 	return strlen(out);
 }
 
-/** Builds URI; performs XLAT expansions and encoding.
+/** Splits the URI and tokenizes both components
  *
  * Splits the URI into "http://example.org" and "/%{xlat}/query/?bar=foo"
- * Both components are expanded, but values expanded for the second component
+ * Both components are tokenized, but values expanded for the second component
  * are also url encoded.
  *
+ * A malformed URI is not an error here, it's reported when the section is used.
+ *
+ * @param[in] ctx to allocate the compiled components in.
+ * @param[in] section configuration data.
+ * @return 0 on success, -1 if the URI couldn't be tokenized.
+ */
+int rest_uri_compile(TALLOC_CTX *ctx, rlm_rest_section_t *section)
+{
+	char const	*p;
+	char		*scheme;
+	size_t		len;
+
+	/*
+	 *  All URLs must contain at least <scheme>://<server>/
+	 */
+	p = strchr(section->uri, ':');
+	if (!p || (*++p != '/') || (*++p != '/')) return 0;
+
+	p = strchr(p + 1, '/');
+	if (!p) return 0;
+
+	len = (p - section->uri);
+
+	scheme = talloc_strndup(ctx, section->uri, len);
+	section->uri_scheme = xlat_compile(ctx, scheme, NULL, NULL);
+	talloc_free(scheme);
+	if (!section->uri_scheme) return -1;
+
+	section->uri_path = xlat_compile(ctx, section->uri + len, rest_uri_escape, NULL);
+	if (!section->uri_path) return -1;
+
+	return 0;
+}
+
+/** Builds URI; performs XLAT expansions and encoding.
+ *
+ * Expands the components produced by #rest_uri_compile.
+ *
  * @param[out] out Where to write the pointer to the new buffer containing the escaped URI.
  * @param[in] instance configuration data.
- * @param[in] uri configuration data.
  * @param[in] request Current request
+ * @param[in] section configuration data.
  * @return length of data written to buffer (excluding NULL) or < 0 if an error
  *	occurred.
  */
-ssize_t rest_uri_build(char **out, UNUSED rlm_rest_t *instance, REQUEST *request, char const *uri)
+ssize_t rest_uri_build(char **out, UNUSED rlm_rest_t *instance, REQUEST *request, rlm_rest_section_t const *section)
 {
-	char const	*p;
 	char		*path_exp = NULL;
-
-	char		*scheme;
-	char const	*path;
-
 	ssize_t		len;
 
-	p = uri;
-
-	/*
-	 *  All URLs must contain at least <scheme>://<server>/
-	 */
-	p = strchr(p, ':');
-	if (!p || (*++p != '/') || (*++p != '/')) {
-		malformed:
+	if (!section->uri_scheme || !section->uri_path) {
 		REDEBUG("Error URI is malformed, can't find start of path");
 		return -1;
 	}
-	p = strchr(p + 1, '/');
-	if (!p) {
-		goto malformed;
-	}
-
-	len = (p - uri);
-
-	/*
-	 *  Allocate a temporary buffer to hold the first part of the URI
-	 */
-	scheme = talloc_array(request, char, len + 1);
-	strlcpy(scheme, uri, len + 1);
-
-	path = (uri + len);
 
-	len = radius_axlat(out, request, scheme, NULL, NULL);
-	talloc_free(scheme);
+	len = radius_axlat_compiled(out, request, section->uri_scheme);
 	if (len < 0) {
 		TALLOC_FREE(*out);
 
 		return 0;
 	}
 
-	len = radius_axlat(&path_exp, request, path, rest_uri_escape, NULL);
+	len = radius_axlat_compiled(&path_exp, request, section->uri_path);
 	if (len < 0) {
 		TALLOC_FREE(*out);
 
@@ -137,6 +137,12 @@ typedef struct rlm_rest_section_t {
 
 	uint32_t		timeout;	//!< Timeout passed to CURL.
 	uint32_t		chunk;		//!< Max chunk-size (mainly for testing the encoders)
+
+	xlat_compiled_t		*uri_scheme;	//!< Compiled "<scheme>://<server>" part of the URI.
+	xlat_compiled_t		*uri_path;	//!< Compiled path part of the URI, values are url encoded.
+	xlat_compiled_t		*data_xlat;	//!< Compiled custom body data.
+	xlat_compiled_t		*username_xlat;	//!< Compiled HTTP-Auth username.
+	xlat_compiled_t		*password_xlat;	//!< Compiled HTTP-Auth password.
 } rlm_rest_section_t;
 
 /*
@@ -286,6 +292,7 @@ size_t rest_get_handle_data(char const **out, rlm_rest_handle_t *handle);
  *	Helper functions
  */
 size_t rest_uri_escape(UNUSED REQUEST *request, char *out, size_t outlen, char const *raw, UNUSED void *arg);
-ssize_t rest_uri_build(char **out, rlm_rest_t *instance, REQUEST *request, char const *uri);
+int rest_uri_compile(TALLOC_CTX *ctx, rlm_rest_section_t *section);
+ssize_t rest_uri_build(char **out, rlm_rest_t *instance, REQUEST *request, rlm_rest_section_t const *section);
 ssize_t rest_uri_host_unescape(char **out, UNUSED rlm_rest_t *instance, REQUEST *request,
 			       void *handle, char const *uri);
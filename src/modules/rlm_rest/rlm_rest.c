@@ -98,7 +98,7 @@ static int rlm_rest_perform(rlm_rest_t *instance, rlm_rest_section_t *section, v
 	 *  Build xlat'd URI, this allows REST servers to be specified by
 	 *  request attributes.
 	 */
-	uri_len = rest_uri_build(&uri, instance, request, section->uri);
+	uri_len = rest_uri_build(&uri, instance, request, section);
 	if (uri_len <= 0) return -1;
 
 	RDEBUG("Sending HTTP %s to \"%s\"", fr_int2str(http_method_table, section->method, NULL), uri);
@@ -573,7 +573,8 @@ finish:
 	return rcode;
 }
 
-static int parse_sub_section(CONF_SECTION *parent, rlm_rest_section_t *config, rlm_components_t comp)
+static int parse_sub_section(rlm_rest_t *inst, CONF_SECTION *parent, rlm_rest_section_t *config,
+			     rlm_components_t comp)
 {
 	CONF_SECTION *cs;
 
@@ -701,7 +702,27 @@ static int parse_sub_section(CONF_SECTION *parent, rlm_rest_section_t *config, r
 		}
 	}
 
+	/*
+	 *  Tokenize the URI and other expansions once, instead of on every request.
+	 */
+	if (rest_uri_compile(inst, config) < 0) goto compile_error;
+
+#define REST_COMPILE(_x) do { \
+		if (config->_x) { \
+			config->_x ## _xlat = xlat_compile(inst, config->_x, NULL, NULL); \
+			if (!config->_x ## _xlat) goto compile_error; \
+		} \
+	} while (0)
+
+	REST_COMPILE(data);
+	REST_COMPILE(username);
+	REST_COMPILE(password);
+
 	return 0;
+
+compile_error:
+	cf_log_err_cs(cs, "Failed compiling expansions");
+	return -1;
 }
 
 /*
@@ -735,13 +756,13 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	 *	Parse sub-section configs.
 	 */
 	if (
-		(parse_sub_section(conf, &inst->authorize, RLM_COMPONENT_AUTZ) < 0) ||
-		(parse_sub_section(conf, &inst->authenticate, RLM_COMPONENT_AUTH) < 0) ||
-		(parse_sub_section(conf, &inst->accounting, RLM_COMPONENT_ACCT) < 0) ||
+		(parse_sub_section(inst, conf, &inst->authorize, RLM_COMPONENT_AUTZ) < 0) ||
+		(parse_sub_section(inst, conf, &inst->authenticate, RLM_COMPONENT_AUTH) < 0) ||
+		(parse_sub_section(inst, conf, &inst->accounting, RLM_COMPONENT_ACCT) < 0) ||
 
 /* @todo add behaviour for checksimul */
-/*		(parse_sub_section(conf, &inst->checksimul, RLM_COMPONENT_SESS) < 0) || */
-		(parse_sub_section(conf, &inst->post_auth, RLM_COMPONENT_POST_AUTH) < 0))
+/*		(parse_sub_section(inst, conf, &inst->checksimul, RLM_COMPONENT_SESS) < 0) || */
+		(parse_sub_section(inst, conf, &inst->post_auth, RLM_COMPONENT_POST_AUTH) < 0))
 	{
 		return -1;
 	}
@@ -804,4 +825,6 @@ module_t rlm_rest = {
 		NULL,			/* post-proxy */
 		mod_post_auth		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -473,4 +473,6 @@ module_t rlm_ruby = {
 		mod_send_coa
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
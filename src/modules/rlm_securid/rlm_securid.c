@@ -565,4 +565,6 @@ module_t rlm_securid = {
 		NULL, 			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
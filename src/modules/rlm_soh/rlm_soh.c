@@ -228,4 +228,6 @@ module_t rlm_soh = {
 		NULL,			/* post-proxy */
 		mod_post_auth		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
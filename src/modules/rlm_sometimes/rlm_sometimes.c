@@ -195,4 +195,6 @@ module_t rlm_sometimes = {
 		mod_sometimes_reply	/* send-coa */
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -0,0 +1,544 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file batch.c
+ * @brief Write accounting requests to the database in batches.
+ *
+ * Requests are collected until there are batch_size of them, or the first
+ * has waited batch_timeout milliseconds.  A writer thread then writes all of
+ * the requests in one transaction, using one connection.  Each request waits
+ * until its batch has been committed, so it's only acknowledged once its data
+ * is in the database.
+ *
+ * A waiting request holds a thread from the pool, so a batch never waits for
+ * more requests than there are threads.  While one batch is being written,
+ * the next one fills.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_sql.h"
+
+#ifdef HAVE_PTHREAD_H
+#define USEC (1000000)
+
+typedef struct sql_batch_entry sql_batch_entry_t;
+
+/*
+ *	A request waiting to be written.  It's on the stack of the
+ *	thread processing the request, which doesn't return until the
+ *	entry is done.
+ */
+struct sql_batch_entry {
+	unsigned int		number;		//!< Of the request, for logging.
+	char			**queries;	//!< Tried in order, until one updates a row.
+	int			num_queries;
+
+	rlm_rcode_t		rcode;		//!< Result of writing the request.
+	bool			done;		//!< The batch has been written.
+
+	sql_batch_entry_t	*next;
+};
+
+struct sql_batch {
+	rlm_sql_t		*inst;
+	sql_acct_section_t	*section;
+
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;		//!< Signalled when requests are queued, or on exit.
+	pthread_cond_t		space;		//!< Signalled when the writer takes a batch.
+	pthread_cond_t		written;	//!< Signalled when a batch has been written.
+	pthread_t		thread;		//!< The writer.
+	bool			running;	//!< The writer has been started.
+	bool			stop;		//!< Write the queued requests, and exit.
+
+	sql_batch_entry_t	*head;		//!< The batch which is being filled.
+	sql_batch_entry_t	**tail;
+	uint32_t		num_entries;
+	uint32_t		size;		//!< batch_size, limited to the number of threads.
+	struct timeval		started;	//!< When the first request was added.
+
+	/*
+	 *	Statistics, protected by the mutex.
+	 */
+	uint64_t		flushes;	//!< Batches written.
+	uint64_t		flushes_size;	//!< Batches written because they were full.
+	uint64_t		flushes_timeout; //!< Batches written because batch_timeout expired.
+	uint64_t		requests;	//!< Requests written in batches.
+	uint64_t		rollbacks;	//!< Batches which were written one request at a time.
+	uint64_t		failed;		//!< Requests which couldn't be written.
+	uint64_t		latency_total;	//!< Microseconds from the first request to the commit.
+	uint64_t		latency_max;
+};
+
+/*
+ *	Run a query inside the transaction.  Unlike rlm_sql_query(),
+ *	this doesn't retry on another connection, as the rest of the
+ *	transaction would be lost.
+ */
+static sql_rcode_t sql_batch_query(rlm_sql_handle_t **handle, rlm_sql_t *inst, char const *query)
+{
+	sql_rcode_t ret;
+	char const *error;
+
+	DEBUG("rlm_sql (%s): Executing query: '%s'", inst->config->xlat_name, query);
+
+	ret = (inst->module->sql_query)(*handle, inst->config, query);
+	switch (ret) {
+	case RLM_SQL_OK:
+		break;
+
+	case RLM_SQL_RECONNECT:
+		*handle = fr_connection_reconnect(inst->pool, *handle);
+		break;
+
+	default:
+		error = (inst->module->sql_error)(*handle, inst->config);
+		DEBUG("rlm_sql (%s): Query failed, rolling back batch: %s", inst->config->xlat_name,
+		      error ? error : "<UNKNOWN>");
+		(inst->module->sql_finish_query)(*handle, inst->config);
+		break;
+	}
+
+	return ret;
+}
+
+/*
+ *	Write one request, trying each of its queries until one
+ *	updates a row, as acct_redundant() does.
+ *
+ *	In a transaction, any error means the transaction has to be
+ *	rolled back, so the remaining queries aren't tried.
+ */
+static sql_rcode_t sql_batch_entry_write(rlm_sql_handle_t **handle, rlm_sql_t *inst,
+					 sql_batch_entry_t *entry, bool transaction)
+{
+	sql_rcode_t	ret;
+	int		i, numaffected;
+	bool		succeeded = false;
+
+	entry->rcode = RLM_MODULE_NOOP;
+
+	for (i = 0; i < entry->num_queries; i++) {
+		if (i > 0) DEBUG("rlm_sql (%s): (%u) Trying next query...", inst->config->xlat_name,
+				 entry->number);
+
+		if (transaction) {
+			ret = sql_batch_query(handle, inst, entry->queries[i]);
+			if (ret != RLM_SQL_OK) return ret;
+		} else {
+			ret = rlm_sql_query(handle, inst, entry->queries[i]);
+			if (ret == RLM_SQL_RECONNECT) {
+				entry->rcode = RLM_MODULE_FAIL;
+				return ret;
+			}
+			if (ret != RLM_SQL_OK) {
+				(inst->module->sql_finish_query)(*handle, inst->config);
+				continue;
+			}
+		}
+		succeeded = true;
+
+		numaffected = (inst->module->sql_affected_rows)(*handle, inst->config);
+		(inst->module->sql_finish_query)(*handle, inst->config);
+		if (numaffected > 0) {
+			entry->rcode = RLM_MODULE_OK;
+			return RLM_SQL_OK;
+		}
+
+		DEBUG("rlm_sql (%s): (%u) No records updated", inst->config->xlat_name, entry->number);
+	}
+
+	DEBUG("rlm_sql (%s): (%u) No additional queries configured", inst->config->xlat_name,
+	      entry->number);
+
+	/*
+	 *	Queries which ran, but updated nothing, are a noop.
+	 *	If none of them ran, the request wasn't written.
+	 */
+	if (!succeeded) entry->rcode = RLM_MODULE_FAIL;
+
+	return RLM_SQL_OK;
+}
+
+/*
+ *	Write a batch which has been taken off the list.
+ */
+static void sql_batch_flush(sql_batch_t *batch, sql_batch_entry_t *head, struct timeval const *started, bool full)
+{
+	rlm_sql_t		*inst = batch->inst;
+	sql_acct_section_t	*section = batch->section;
+	rlm_sql_handle_t	*handle;
+	sql_batch_entry_t	*entry;
+	sql_rcode_t		ret;
+	bool			rollback = false;
+	uint32_t		count = 0, failed = 0;
+	uint64_t		latency;
+	struct timeval		now;
+
+	for (entry = head; entry; entry = entry->next) count++;
+
+	DEBUG("rlm_sql (%s): Writing batch of %u requests (%s)", inst->config->xlat_name, count,
+	      full ? "full" : "timeout");
+
+	handle = fr_connection_get(inst->pool);
+	if (!handle) {
+		for (entry = head; entry; entry = entry->next) entry->rcode = RLM_MODULE_FAIL;
+		goto done;
+	}
+
+	ret = sql_batch_query(&handle, inst, section->batch_begin);
+	if (ret == RLM_SQL_OK) {
+		(inst->module->sql_finish_query)(handle, inst->config);
+
+		for (entry = head; entry; entry = entry->next) {
+			ret = sql_batch_entry_write(&handle, inst, entry, true);
+			if (ret != RLM_SQL_OK) break;
+		}
+
+		if (ret == RLM_SQL_OK) {
+			ret = sql_batch_query(&handle, inst, section->batch_commit);
+			if (ret == RLM_SQL_OK) (inst->module->sql_finish_query)(handle, inst->config);
+		}
+
+		/*
+		 *	The connection was lost, and the transaction
+		 *	with it.  Otherwise it has to be rolled back.
+		 */
+		if ((ret != RLM_SQL_OK) && (ret != RLM_SQL_RECONNECT) && handle) {
+			if (sql_batch_query(&handle, inst, section->batch_rollback) == RLM_SQL_OK) {
+				(inst->module->sql_finish_query)(handle, inst->config);
+			}
+		}
+	}
+
+	/*
+	 *	Write the requests one at a time, so that one bad
+	 *	request doesn't fail the rest.
+	 */
+	if (ret != RLM_SQL_OK) {
+		rollback = true;
+
+		for (entry = head; entry; entry = entry->next) {
+			if (!handle) {
+				entry->rcode = RLM_MODULE_FAIL;
+				continue;
+			}
+			(void) sql_batch_entry_write(&handle, inst, entry, false);
+		}
+	}
+
+	if (handle) fr_connection_release(inst->pool, handle);
+
+done:
+	for (entry = head; entry; entry = entry->next) {
+		if (entry->rcode != RLM_MODULE_FAIL) continue;
+
+		ERROR("rlm_sql (%s): (%u) Failed writing accounting request", inst->config->xlat_name,
+		      entry->number);
+		failed++;
+	}
+
+	gettimeofday(&now, NULL);
+	latency = ((now.tv_sec - started->tv_sec) * (uint64_t) USEC) + now.tv_usec - started->tv_usec;
+
+	pthread_mutex_lock(&batch->mutex);
+	batch->flushes++;
+	if (full) {
+		batch->flushes_size++;
+	} else {
+		batch->flushes_timeout++;
+	}
+	if (rollback) batch->rollbacks++;
+	batch->requests += count;
+	batch->failed += failed;
+	batch->latency_total += latency;
+	if (latency > batch->latency_max) batch->latency_max = latency;
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+/*
+ *	Wait for a batch to fill, or for its first request to time
+ *	out, and write it.  Repeat until told to stop, and nothing
+ *	is left to write.
+ */
+static void *sql_batch_thread(void *arg)
+{
+	sql_batch_t		*batch = arg;
+	sql_acct_section_t	*section = batch->section;
+	sql_batch_entry_t	*head, *entry, *next;
+	struct timeval		started;
+	struct timespec		deadline;
+	bool			full;
+
+	pthread_mutex_lock(&batch->mutex);
+	for (;;) {
+		while (!batch->head && !batch->stop) pthread_cond_wait(&batch->cond, &batch->mutex);
+		if (!batch->head) break;
+
+		deadline.tv_sec = batch->started.tv_sec + (section->batch_timeout / 1000);
+		deadline.tv_nsec = (batch->started.tv_usec + ((section->batch_timeout % 1000) * 1000)) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		while ((batch->num_entries < batch->size) && !batch->stop) {
+			if (pthread_cond_timedwait(&batch->cond, &batch->mutex, &deadline) == ETIMEDOUT) break;
+		}
+
+		full = (batch->num_entries >= batch->size);
+		head = batch->head;
+		started = batch->started;
+		batch->head = NULL;
+		batch->tail = &batch->head;
+		batch->num_entries = 0;
+		pthread_cond_broadcast(&batch->space);
+		pthread_mutex_unlock(&batch->mutex);
+
+		sql_batch_flush(batch, head, &started, full);
+
+		/*
+		 *	Once an entry is done, the thread which owns it
+		 *	can return, so we can't look at it again.
+		 */
+		pthread_mutex_lock(&batch->mutex);
+		for (entry = head; entry; entry = next) {
+			next = entry->next;
+			entry->done = true;
+		}
+		pthread_cond_broadcast(&batch->written);
+	}
+	pthread_mutex_unlock(&batch->mutex);
+
+	return NULL;
+}
+
+/** Write a request's queries as part of a batch
+ *
+ * Blocks until the batch containing the request has been written.  If the
+ * server has no thread pool, the request is written immediately instead.
+ *
+ * @param batch to add the request to.
+ * @param request the current request.
+ * @param queries expanded queries, tried in order until one updates a row.
+ * @param num_queries number of queries.
+ * @return RLM_MODULE_OK if a query updated a row, RLM_MODULE_NOOP if none did,
+ *	or RLM_MODULE_FAIL if the request couldn't be written.
+ */
+rlm_rcode_t sql_batch_write(sql_batch_t *batch, REQUEST *request, char **queries, int num_queries)
+{
+	sql_batch_entry_t	entry;
+	sql_acct_section_t	*section = batch->section;
+	int			ret;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.number = request->number;
+	entry.queries = queries;
+	entry.num_queries = num_queries;
+
+	/*
+	 *	If no other requests can be running, there's nothing
+	 *	to batch the request with.
+	 */
+	if (!thread_pool_active()) {
+		struct timeval started;
+
+		gettimeofday(&started, NULL);
+		sql_batch_flush(batch, &entry, &started, true);
+
+		return entry.rcode;
+	}
+
+	pthread_mutex_lock(&batch->mutex);
+	if (!batch->running) {
+		/*
+		 *	Every request in the batch holds a thread until
+		 *	it's written, so a batch larger than the thread
+		 *	pool would never fill.
+		 */
+		batch->size = section->batch_size;
+		if (batch->size > thread_pool_max_threads()) {
+			batch->size = thread_pool_max_threads();
+			WARN("rlm_sql (%s): Limiting \"batch_size\" to %u, the value of \"max_servers\"",
+			     batch->inst->config->xlat_name, batch->size);
+		}
+
+		ret = pthread_create(&batch->thread, NULL, sql_batch_thread, batch);
+		if (ret != 0) {
+			pthread_mutex_unlock(&batch->mutex);
+			REDEBUG("Failed creating batch writer: %s", fr_syserror(ret));
+
+			return RLM_MODULE_FAIL;
+		}
+		batch->running = true;
+	}
+
+	/*
+	 *	The database is slower than the requests are arriving.
+	 *	Wait for the writer, instead of queueing without limit.
+	 */
+	while (batch->num_entries >= batch->size) {
+		RDEBUG2("Waiting for the previous batch to be written");
+		pthread_cond_wait(&batch->space, &batch->mutex);
+	}
+
+	if (!batch->head) gettimeofday(&batch->started, NULL);
+	*batch->tail = &entry;
+	batch->tail = &entry.next;
+	batch->num_entries++;
+
+	RDEBUG2("Waiting for batch to be written (%u/%u requests)", batch->num_entries, batch->size);
+
+	/*
+	 *	The writer waits for the first request, and then for
+	 *	the batch to be full.
+	 */
+	if ((batch->num_entries == 1) || (batch->num_entries >= batch->size)) {
+		pthread_cond_signal(&batch->cond);
+	}
+
+	while (!entry.done) pthread_cond_wait(&batch->written, &batch->mutex);
+	pthread_mutex_unlock(&batch->mutex);
+
+	return entry.rcode;
+}
+
+/** Return the batching statistics
+ *
+ * e.g. %{sql_batch:flushes}.  The statistics are flushes, flushes_size,
+ * flushes_timeout, requests, rollbacks, failed, size_avg (requests per batch),
+ * latency_avg and latency_max (microseconds).
+ */
+ssize_t sql_batch_xlat(void *instance, REQUEST *request, char const *fmt, char *out, size_t outlen)
+{
+	sql_batch_t	*batch = instance;
+	uint64_t	value;
+
+	pthread_mutex_lock(&batch->mutex);
+	if (strcmp(fmt, "flushes") == 0) {
+		value = batch->flushes;
+
+	} else if (strcmp(fmt, "flushes_size") == 0) {
+		value = batch->flushes_size;
+
+	} else if (strcmp(fmt, "flushes_timeout") == 0) {
+		value = batch->flushes_timeout;
+
+	} else if (strcmp(fmt, "requests") == 0) {
+		value = batch->requests;
+
+	} else if (strcmp(fmt, "rollbacks") == 0) {
+		value = batch->rollbacks;
+
+	} else if (strcmp(fmt, "failed") == 0) {
+		value = batch->failed;
+
+	} else if (strcmp(fmt, "size_avg") == 0) {
+		value = batch->flushes ? (batch->requests / batch->flushes) : 0;
+
+	} else if (strcmp(fmt, "latency_avg") == 0) {
+		value = batch->flushes ? (batch->latency_total / batch->flushes) : 0;
+
+	} else if (strcmp(fmt, "latency_max") == 0) {
+		value = batch->latency_max;
+
+	} else {
+		pthread_mutex_unlock(&batch->mutex);
+		REDEBUG("Unknown batch statistic \"%s\"", fmt);
+		*out = '\0';
+		return -1;
+	}
+	pthread_mutex_unlock(&batch->mutex);
+
+	return snprintf(out, outlen, "%" PRIu64, value);
+}
+
+/*
+ *	Wait for the writer to write the queued requests, and exit.
+ */
+static int _sql_batch_free(sql_batch_t *batch)
+{
+	pthread_mutex_lock(&batch->mutex);
+	batch->stop = true;
+	pthread_cond_signal(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+
+	if (batch->running) pthread_join(batch->thread, NULL);
+
+	rad_assert(batch->head == NULL);
+
+	pthread_mutex_destroy(&batch->mutex);
+	pthread_cond_destroy(&batch->cond);
+	pthread_cond_destroy(&batch->space);
+	pthread_cond_destroy(&batch->written);
+
+	return 0;
+}
+
+/** Allocate the batch for an accounting section
+ *
+ * @param ctx to allocate the batch in.
+ * @param inst rlm_sql instance data.
+ * @param section to batch the queries of.
+ * @return the batch, or NULL on error.
+ */
+sql_batch_t *sql_batch_alloc(TALLOC_CTX *ctx, rlm_sql_t *inst, sql_acct_section_t *section)
+{
+	sql_batch_t *batch;
+
+	batch = talloc_zero(ctx, sql_batch_t);
+	if (!batch) return NULL;
+
+	batch->inst = inst;
+	batch->section = section;
+	batch->tail = &batch->head;
+
+	pthread_mutex_init(&batch->mutex, NULL);
+	pthread_cond_init(&batch->cond, NULL);
+	pthread_cond_init(&batch->space, NULL);
+	pthread_cond_init(&batch->written, NULL);
+	talloc_set_destructor(batch, _sql_batch_free);
+
+	return batch;
+}
+#else
+sql_batch_t *sql_batch_alloc(UNUSED TALLOC_CTX *ctx, rlm_sql_t *inst, UNUSED sql_acct_section_t *section)
+{
+	ERROR("rlm_sql (%s): Batching requires the server to be built with thread support",
+	      inst->config->xlat_name);
+	return NULL;
+}
+
+rlm_rcode_t sql_batch_write(UNUSED sql_batch_t *batch, UNUSED REQUEST *request,
+			    UNUSED char **queries, UNUSED int num_queries)
+{
+	return RLM_MODULE_FAIL;
+}
+
+ssize_t sql_batch_xlat(UNUSED void *instance, UNUSED REQUEST *request, UNUSED char const *fmt,
+		       char *out, UNUSED size_t outlen)
+{
+	*out = '\0';
+	return -1;
+}
+#endif
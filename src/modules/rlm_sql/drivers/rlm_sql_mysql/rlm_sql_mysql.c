@@ -42,6 +42,13 @@ RCSID("$Id$")
 
 #include "rlm_sql.h"
 
+/*
+ *	MySQL 8 removed my_bool, MariaDB still has it.
+ */
+#if !defined(MARIADB_BASE_VERSION) && (MYSQL_VERSION_ID >= 80000)
+typedef bool my_bool;
+#endif
+
 static int mysql_instance_count = 0;
 
 typedef struct rlm_sql_mysql_conn {
@@ -49,6 +56,11 @@ typedef struct rlm_sql_mysql_conn {
 	MYSQL		*sock;
 	MYSQL_RES	*result;
 	rlm_sql_row_t	row;
+#if (MYSQL_VERSION_ID >= 40100)
+	MYSQL_STMT	*stmt;		//!< Prepared statement being executed, or NULL.
+	MYSQL_BIND	*bind;		//!< Buffers for the result of stmt.
+	int		num_fields;	//!< Number of columns in the result of stmt.
+#endif
 } rlm_sql_mysql_conn_t;
 
 typedef struct rlm_sql_mysql_config {
@@ -81,6 +93,9 @@ static const CONF_PARSER driver_config[] = {
 
 /* Prototypes */
 static sql_rcode_t sql_free_result(rlm_sql_handle_t*, rlm_sql_config_t*);
+#if (MYSQL_VERSION_ID >= 40100)
+static void sql_stmt_finish(rlm_sql_mysql_conn_t *conn);
+#endif
 
 static int _sql_socket_destructor(rlm_sql_mysql_conn_t *conn)
 {
@@ -254,6 +269,10 @@ static sql_rcode_t sql_query(rlm_sql_handle_t * handle, UNUSED rlm_sql_config_t
 		return RLM_SQL_RECONNECT;
 	}
 
+#if (MYSQL_VERSION_ID >= 40100)
+	sql_stmt_finish(conn);
+#endif
+
 	mysql_query(conn->sock, query);
 	rcode = sql_check_error(mysql_errno(conn->sock));
 	if (rcode != RLM_SQL_OK) {
@@ -370,6 +389,251 @@ static sql_rcode_t sql_select_query(rlm_sql_handle_t *handle, rlm_sql_config_t *
 }
 
 
+#if (MYSQL_VERSION_ID >= 40100)
+/*************************************************************************
+ *
+ *	Function: sql_stmt_finish
+ *
+ *	Purpose: Free the result of a prepared statement.  The statement
+ *	itself is kept by rlm_sql for the next query.
+ *
+ *************************************************************************/
+static void sql_stmt_finish(rlm_sql_mysql_conn_t *conn)
+{
+	if (!conn->stmt) return;
+
+	(void) mysql_stmt_free_result(conn->stmt);
+	conn->stmt = NULL;
+
+	TALLOC_FREE(conn->bind);
+	conn->row = NULL;
+	conn->num_fields = 0;
+}
+
+
+/*************************************************************************
+ *
+ *	Function: sql_prepare
+ *
+ *	Purpose: Prepare a statement on the connection
+ *
+ *************************************************************************/
+static sql_rcode_t sql_prepare(void **out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+			       sql_stmt_t const *stmt)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+	MYSQL_STMT *prepared;
+	my_bool update_max_length = 1;
+	sql_rcode_t rcode;
+
+	if (!conn->sock) {
+		ERROR("rlm_sql_mysql: Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	prepared = mysql_stmt_init(conn->sock);
+	if (!prepared) {
+		ERROR("rlm_sql_mysql: Out of memory");
+		return RLM_SQL_ERROR;
+	}
+
+	if (mysql_stmt_prepare(prepared, stmt->query, strlen(stmt->query)) != 0) {
+		ERROR("rlm_sql_mysql: Failed preparing statement: %s", mysql_stmt_error(prepared));
+		rcode = sql_check_error(mysql_stmt_errno(prepared));
+		mysql_stmt_close(prepared);
+
+		return (rcode == RLM_SQL_OK) ? RLM_SQL_QUERY_ERROR : rcode;
+	}
+
+	/*
+	 *	So we know how big the result buffers need to be.
+	 */
+	(void) mysql_stmt_attr_set(prepared, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+
+	*out = prepared;
+
+	return RLM_SQL_OK;
+}
+
+
+/*************************************************************************
+ *
+ *	Function: sql_stmt_execute
+ *
+ *	Purpose: Bind the values to a prepared statement and execute it
+ *
+ *************************************************************************/
+static sql_rcode_t sql_stmt_execute(rlm_sql_mysql_conn_t *conn, MYSQL_STMT *prepared,
+				    sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	MYSQL_BIND *bind;
+	int i, ret;
+
+	if (!conn->sock) {
+		ERROR("rlm_sql_mysql: Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	sql_stmt_finish(conn);
+
+	MEM(bind = talloc_zero_array(conn, MYSQL_BIND, stmt->num_params + 1));
+	for (i = 0; i < stmt->num_params; i++) {
+		switch (params[i].type) {
+		case SQL_BIND_TYPE_STRING:
+			bind[i].buffer_type = MYSQL_TYPE_STRING;
+			memcpy(&bind[i].buffer, &params[i].value, sizeof(bind[i].buffer));
+			bind[i].buffer_length = params[i].len;
+			break;
+
+		case SQL_BIND_TYPE_INTEGER:
+			{
+				int64_t const *integer = &params[i].integer;
+
+				bind[i].buffer_type = MYSQL_TYPE_LONGLONG;
+				memcpy(&bind[i].buffer, &integer, sizeof(bind[i].buffer));
+			}
+			break;
+
+		case SQL_BIND_TYPE_NULL:
+			bind[i].buffer_type = MYSQL_TYPE_NULL;
+			break;
+		}
+	}
+
+	/*
+	 *	The values are sent by mysql_stmt_execute, so the
+	 *	binds can be freed afterwards.
+	 */
+	conn->stmt = prepared;
+	if (mysql_stmt_bind_param(prepared, bind) != 0) {
+		talloc_free(bind);
+		return sql_check_error(mysql_stmt_errno(prepared));
+	}
+	ret = mysql_stmt_execute(prepared);
+	talloc_free(bind);
+	if (ret != 0) return sql_check_error(mysql_stmt_errno(prepared));
+
+	return RLM_SQL_OK;
+}
+
+
+/*************************************************************************
+ *
+ *	Function: sql_query_bind
+ *
+ *	Purpose: Execute a prepared statement
+ *
+ *************************************************************************/
+static sql_rcode_t sql_query_bind(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared,
+				  sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	return sql_stmt_execute(handle->conn, prepared, stmt, params);
+}
+
+
+/*************************************************************************
+ *
+ *	Function: sql_select_query_bind
+ *
+ *	Purpose: Execute a prepared statement, and set up buffers for
+ *	each column of the result, sized for the longest value.
+ *
+ *************************************************************************/
+static sql_rcode_t sql_select_query_bind(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared,
+					 sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+	MYSQL_RES *meta;
+	MYSQL_FIELD *fields;
+	sql_rcode_t rcode;
+	int i;
+
+	rcode = sql_stmt_execute(conn, prepared, stmt, params);
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	if (mysql_stmt_store_result(conn->stmt) != 0) {
+		ERROR("rlm_sql_mysql: Cannot store result");
+		ERROR("rlm_sql_mysql: MySQL error '%s'", mysql_stmt_error(conn->stmt));
+
+		return sql_check_error(mysql_stmt_errno(conn->stmt));
+	}
+
+	meta = mysql_stmt_result_metadata(conn->stmt);
+	if (!meta) {
+		ERROR("rlm_sql_mysql: MYSQL Error: No Fields");
+		return RLM_SQL_QUERY_ERROR;
+	}
+
+	conn->num_fields = mysql_num_fields(meta);
+	fields = mysql_fetch_fields(meta);
+
+	MEM(conn->bind = talloc_zero_array(conn, MYSQL_BIND, conn->num_fields));
+	for (i = 0; i < conn->num_fields; i++) {
+		conn->bind[i].buffer_type = MYSQL_TYPE_STRING;
+		conn->bind[i].buffer_length = fields[i].max_length + 1;
+		MEM(conn->bind[i].buffer = talloc_zero_array(conn->bind, char, conn->bind[i].buffer_length));
+		MEM(conn->bind[i].length = talloc_zero(conn->bind, unsigned long));
+		MEM(conn->bind[i].is_null = talloc_zero(conn->bind, my_bool));
+	}
+	mysql_free_result(meta);
+
+	if (mysql_stmt_bind_result(conn->stmt, conn->bind) != 0) {
+		ERROR("rlm_sql_mysql: MySQL error '%s'", mysql_stmt_error(conn->stmt));
+		return sql_check_error(mysql_stmt_errno(conn->stmt));
+	}
+
+	MEM(conn->row = talloc_zero_array(conn->bind, char *, conn->num_fields + 1));
+
+	return RLM_SQL_OK;
+}
+
+
+/*************************************************************************
+ *
+ *	Function: sql_stmt_fetch_row
+ *
+ *	Purpose: Fetch the next row of a prepared statement's result
+ *
+ *************************************************************************/
+static sql_rcode_t sql_stmt_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+	int i, ret;
+
+	if (!conn->row) return RLM_SQL_ERROR;
+
+	ret = mysql_stmt_fetch(conn->stmt);
+	if (ret == MYSQL_NO_DATA) return RLM_SQL_OK;
+	if (ret != 0) {
+		ERROR("rlm_sql_mysql: Cannot fetch row");
+		ERROR("rlm_sql_mysql: MySQL error '%s'", mysql_stmt_error(conn->stmt));
+
+		return sql_check_error(mysql_stmt_errno(conn->stmt));
+	}
+
+	for (i = 0; i < conn->num_fields; i++) {
+		if (*conn->bind[i].is_null) {
+			conn->row[i] = NULL;
+			continue;
+		}
+
+		conn->row[i] = conn->bind[i].buffer;
+		conn->row[i][*conn->bind[i].length] = '\0';
+	}
+
+	*out = handle->row = conn->row;
+
+	return RLM_SQL_OK;
+}
+
+
+static void sql_stmt_free(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared)
+{
+	mysql_stmt_close(prepared);
+}
+#endif
+
+
 /*************************************************************************
  *
  *	Function: sql_num_rows
@@ -382,6 +646,12 @@ static int sql_num_rows(rlm_sql_handle_t * handle, UNUSED rlm_sql_config_t *conf
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#if (MYSQL_VERSION_ID >= 40100)
+	if (conn->stmt) {
+		return mysql_stmt_num_rows(conn->stmt);
+	}
+#endif
+
 	if (conn->result) {
 		return mysql_num_rows(conn->result);
 	}
@@ -407,6 +677,10 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t * handle,
 
 	*out = NULL;
 
+#if (MYSQL_VERSION_ID >= 40100)
+	if (conn->stmt) return sql_stmt_fetch_row(out, handle);
+#endif
+
 	/*
 	 *  Check pointer before de-referencing it.
 	 */
@@ -456,6 +730,10 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t * handle, UNUSED rlm_sql_con
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#if (MYSQL_VERSION_ID >= 40100)
+	sql_stmt_finish(conn);
+#endif
+
 	if (conn->result) {
 		mysql_free_result(conn->result);
 		conn->result = NULL;
@@ -482,6 +760,12 @@ static char const *sql_error(rlm_sql_handle_t * handle, UNUSED rlm_sql_config_t
 		return "rlm_sql_mysql: no connection to db";
 	}
 
+#if (MYSQL_VERSION_ID >= 40100)
+	if (conn->stmt) {
+		return mysql_stmt_error(conn->stmt);
+	}
+#endif
+
 	return mysql_error(conn->sock);
 }
 
@@ -501,6 +785,14 @@ static sql_rcode_t sql_finish_query(rlm_sql_handle_t * handle, UNUSED rlm_sql_co
 	sql_rcode_t rcode;
 	int ret;
 
+	/*
+	 *	Prepared statements only have one result.
+	 */
+	if (conn->stmt) {
+		sql_stmt_finish(conn);
+		return RLM_SQL_OK;
+	}
+
 skip_next_result:
 	rcode = sql_store_result(handle, config);
 	if (rcode != RLM_SQL_OK) {
@@ -538,6 +830,12 @@ static sql_rcode_t sql_finish_select_query(rlm_sql_handle_t * handle, rlm_sql_co
 #if (MYSQL_VERSION_ID >= 40100)
 	int ret;
 	rlm_sql_mysql_conn_t *conn = handle->conn;
+#endif
+#if (MYSQL_VERSION_ID >= 40100)
+	if (conn->stmt) {
+		sql_stmt_finish(conn);
+		return RLM_SQL_OK;
+	}
 #endif
 	sql_free_result(handle, config);
 #if (MYSQL_VERSION_ID >= 40100)
@@ -567,6 +865,12 @@ static int sql_affected_rows(rlm_sql_handle_t * handle, UNUSED rlm_sql_config_t
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+#if (MYSQL_VERSION_ID >= 40100)
+	if (conn->stmt) {
+		return mysql_stmt_affected_rows(conn->stmt);
+	}
+#endif
+
 	return mysql_affected_rows(conn->sock);
 }
 
@@ -586,5 +890,11 @@ rlm_sql_module_t rlm_sql_mysql = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_select_query
+	.sql_finish_select_query	= sql_finish_select_query,
+#if (MYSQL_VERSION_ID >= 40100)
+	.sql_prepare			= sql_prepare,
+	.sql_query_bind			= sql_query_bind,
+	.sql_select_query_bind		= sql_select_query_bind,
+	.sql_stmt_free			= sql_stmt_free
+#endif
 };
@@ -59,6 +59,12 @@ typedef struct rlm_sql_postgres_config {
 	bool		send_application_name;
 } rlm_sql_postgres_config_t;
 
+/*
+ *	The OID of the int8 type, from catalog/pg_type.h, which isn't
+ *	installed with the client headers.
+ */
+#define PG_INT8OID	(20)
+
 typedef struct rlm_sql_postgres_conn {
 	PGconn		*db;
 	PGresult	*result;
@@ -258,35 +264,14 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-/*************************************************************************
- *
- *	Function: sql_query
- *
- *	Purpose: Issue a query to the database
- *
- *************************************************************************/
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
-					      char const *query)
+/*
+ *	Process the result of PQexec or PQexecPrepared.
+ */
+static sql_rcode_t sql_result(rlm_sql_postgres_conn_t *conn)
 {
-	rlm_sql_postgres_conn_t *conn = handle->conn;
 	ExecStatusType status;
 	int numfields = 0;
 
-	if (!conn->db) {
-		ERROR("rlm_sql_postgresql: Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQexec(conn->db, query);
-
 	/*
 	 *  As this error COULD be a connection error OR an out-of-memory
 	 *  condition return value WILL be wrong SOME of the time
@@ -356,6 +341,36 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED r
 	return RLM_SQL_ERROR;
 }
 
+/*************************************************************************
+ *
+ *	Function: sql_query
+ *
+ *	Purpose: Issue a query to the database
+ *
+ *************************************************************************/
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("rlm_sql_postgresql: Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQexec(conn->db, query);
+
+	return sql_result(conn);
+}
+
 
 /*************************************************************************
  *
@@ -369,6 +384,92 @@ static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t
 	return sql_query(handle, config, query);
 }
 
+/*************************************************************************
+ *
+ *	Function: sql_prepare
+ *
+ *	Purpose: Prepare a statement on the connection.  Quoted values
+ *	are left for the server to type, the others are integers.
+ *
+ *************************************************************************/
+static sql_rcode_t sql_prepare(void **out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+			       sql_stmt_t const *stmt)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	Oid *types;
+	char *name;
+	int i;
+	sql_rcode_t ret;
+
+	if (!conn->db) {
+		ERROR("rlm_sql_postgresql: Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	MEM(name = talloc_typed_asprintf(conn, "fr_stmt_%i", stmt->id));
+	MEM(types = talloc_zero_array(name, Oid, stmt->num_params + 1));
+	for (i = 0; i < stmt->num_params; i++) {
+		if (!stmt->quoted[i]) types[i] = PG_INT8OID;
+	}
+
+	conn->result = PQprepare(conn->db, name, stmt->query, stmt->num_params, types);
+	talloc_free(types);
+
+	ret = sql_result(conn);
+	if (conn->result) {
+		PQclear(conn->result);
+		conn->result = NULL;
+	}
+	if (ret != RLM_SQL_OK) {
+		talloc_free(name);
+		return ret;
+	}
+
+	*out = name;
+
+	return RLM_SQL_OK;
+}
+
+/*************************************************************************
+ *
+ *	Function: sql_query_bind
+ *
+ *	Purpose: Execute a prepared statement, with all values sent
+ *	as text.
+ *
+ *************************************************************************/
+static sql_rcode_t sql_query_bind(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared,
+				  sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	char const **values;
+	int i;
+
+	if (!conn->db) {
+		ERROR("rlm_sql_postgresql: Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	MEM(values = talloc_zero_array(conn, char const *, stmt->num_params + 1));
+	for (i = 0; i < stmt->num_params; i++) {
+		if (params[i].type != SQL_BIND_TYPE_NULL) values[i] = params[i].value;
+	}
+
+	conn->result = PQexecPrepared(conn->db, prepared, stmt->num_params, values, NULL, NULL, 0);
+	talloc_free(values);
+
+	return sql_result(conn);
+}
+
+static void sql_stmt_free(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared)
+{
+	/*
+	 *	Prepared statements only last as long as the
+	 *	connection, which is being closed.
+	 */
+	talloc_free(prepared);
+}
+
 /*************************************************************************
  *
  *	Function: sql_fetch_row
@@ -494,5 +595,10 @@ rlm_sql_module_t rlm_sql_postgresql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
-	.sql_affected_rows		= sql_affected_rows
+	.sql_affected_rows		= sql_affected_rows,
+	.sql_numbered_params		= true,
+	.sql_prepare			= sql_prepare,
+	.sql_query_bind			= sql_query_bind,
+	.sql_select_query_bind		= sql_query_bind,
+	.sql_stmt_free			= sql_stmt_free
 };
@@ -50,6 +50,7 @@ typedef sqlite3_int64 sqlite_int64
 typedef struct rlm_sql_sqlite_conn {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
+	bool prepared;			//!< statement is owned by rlm_sql, so is reset, not finalized.
 	int col_count;
 } rlm_sql_sqlite_conn_t;
 
@@ -356,6 +357,14 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 	DEBUG2("rlm_sql_sqlite: Socket destructor called, closing socket");
 
 	if (conn->db) {
+		/*
+		 *	A query which failed with a reconnect error is
+		 *	never finished, and an unfinalized statement
+		 *	would keep the database (and any open
+		 *	transaction) from being closed.
+		 */
+		if (conn->statement && !conn->prepared) (void) sqlite3_finalize(conn->statement);
+
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) {
 			WARN("rlm_sql_sqlite: Got SQLite error when closing socket: %s", sqlite3_errmsg(conn->db));
@@ -472,6 +481,91 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return sql_check_error(conn->db);
 }
 
+static sql_rcode_t sql_prepare(void **out, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+			       sql_stmt_t const *stmt)
+{
+	int status;
+	rlm_sql_sqlite_conn_t *conn = handle->conn;
+	sqlite3_stmt *statement = NULL;
+	char const *z_tail;
+
+#ifdef HAVE_SQLITE3_PREPARE_V2
+	status = sqlite3_prepare_v2(conn->db, stmt->query, strlen(stmt->query), &statement, &z_tail);
+#else
+	status = sqlite3_prepare(conn->db, stmt->query, strlen(stmt->query), &statement, &z_tail);
+#endif
+	if (status != SQLITE_OK) {
+		return sql_check_error(conn->db);
+	}
+
+	*out = statement;
+
+	return 0;
+}
+
+static sql_rcode_t sql_bind(rlm_sql_sqlite_conn_t *conn, sqlite3_stmt *statement,
+			    sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	int i, status = SQLITE_OK;
+
+	/*
+	 *	In case the last query using the statement wasn't finished.
+	 */
+	(void) sqlite3_reset(statement);
+
+	for (i = 0; i < stmt->num_params; i++) {
+		switch (params[i].type) {
+		case SQL_BIND_TYPE_STRING:
+			status = sqlite3_bind_text(statement, i + 1, params[i].value, params[i].len, SQLITE_TRANSIENT);
+			break;
+
+		case SQL_BIND_TYPE_INTEGER:
+			status = sqlite3_bind_int64(statement, i + 1, params[i].integer);
+			break;
+
+		case SQL_BIND_TYPE_NULL:
+			status = sqlite3_bind_null(statement, i + 1);
+			break;
+		}
+
+		if (status != SQLITE_OK) {
+			(void) sqlite3_clear_bindings(statement);
+			return sql_check_error(conn->db);
+		}
+	}
+
+	conn->statement = statement;
+	conn->prepared = true;
+	conn->col_count = 0;
+
+	return 0;
+}
+
+static sql_rcode_t sql_select_query_bind(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared,
+					 sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	return sql_bind(handle->conn, prepared, stmt, params);
+}
+
+static sql_rcode_t sql_query_bind(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared,
+				  sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	int ret;
+	rlm_sql_sqlite_conn_t *conn = handle->conn;
+
+	ret = sql_bind(conn, prepared, stmt, params);
+	if (ret != 0) return ret;
+
+	(void) sqlite3_step(conn->statement);
+
+	return sql_check_error(conn->db);
+}
+
+static void sql_stmt_free(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config, void *prepared)
+{
+	(void) sqlite3_finalize(prepared);
+}
+
 static sql_rcode_t sql_store_result(UNUSED rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	return 0;
@@ -594,7 +688,16 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle,
 	if (conn->statement) {
 		TALLOC_FREE(handle->row);
 
-		(void) sqlite3_finalize(conn->statement);
+		/*
+		 *	Prepared statements are kept for the next query.
+		 */
+		if (conn->prepared) {
+			(void) sqlite3_reset(conn->statement);
+			(void) sqlite3_clear_bindings(conn->statement);
+			conn->prepared = false;
+		} else {
+			(void) sqlite3_finalize(conn->statement);
+		}
 		conn->statement = NULL;
 		conn->col_count = 0;
 	}
@@ -655,5 +758,9 @@ rlm_sql_module_t rlm_sql_sqlite = {
 	.sql_free_result		= sql_free_result,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
-	.sql_finish_select_query	= sql_finish_query
+	.sql_finish_select_query	= sql_finish_query,
+	.sql_prepare			= sql_prepare,
+	.sql_query_bind			= sql_query_bind,
+	.sql_select_query_bind		= sql_select_query_bind,
+	.sql_stmt_free			= sql_stmt_free
 };
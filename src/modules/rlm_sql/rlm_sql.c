@@ -67,6 +67,12 @@ static const CONF_PARSER acct_config[] = {
 	{ "reference", FR_CONF_OFFSET(PW_TYPE_STRING | PW_TYPE_XLAT, rlm_sql_config_t, accounting.reference), ".query" },
 	{ "logfile", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_sql_config_t, accounting.logfile), NULL },
 
+	{ "batch_size", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_sql_config_t, accounting.batch_size), "0" },
+	{ "batch_timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_sql_config_t, accounting.batch_timeout), "100" },
+	{ "batch_begin", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_sql_config_t, accounting.batch_begin), NULL },
+	{ "batch_commit", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_sql_config_t, accounting.batch_commit), NULL },
+	{ "batch_rollback", FR_CONF_OFFSET(PW_TYPE_STRING, rlm_sql_config_t, accounting.batch_rollback), NULL },
+
 	{ "type", FR_CONF_POINTER(PW_TYPE_SUBSECTION, NULL), (void const *) type_config },
 
 	{NULL, -1, 0, NULL, NULL}
@@ -119,6 +125,11 @@ static const CONF_PARSER module_config[] = {
 	 */
 	{ "query_timeout", FR_CONF_OFFSET(PW_TYPE_INTEGER, rlm_sql_config_t, query_timeout), NULL },
 
+	/*
+	 *	Only works for drivers which support prepared statements.
+	 */
+	{ "prepared_statements", FR_CONF_OFFSET(PW_TYPE_BOOLEAN, rlm_sql_config_t, prepared_statements), "no" },
+
 	{ "accounting", FR_CONF_POINTER(PW_TYPE_SUBSECTION, NULL), (void const *) acct_config },
 
 	{ "post-auth", FR_CONF_POINTER(PW_TYPE_SUBSECTION, NULL), (void const *) postauth_config },
@@ -495,13 +506,13 @@ int sql_set_user(rlm_sql_t *inst, REQUEST *request, char const *username)
 
 	if (username != NULL) {
 		sqluser = username;
+		len = radius_axlat(&expanded, request, sqluser, inst->user_escape, NULL);
 	} else if (inst->config->query_user[0] != '\0') {
-		sqluser = inst->config->query_user;
+		len = radius_axlat_compiled(&expanded, request, inst->query_user);
 	} else {
 		return 0;
 	}
 
-	len = radius_axlat(&expanded, request, sqluser, NULL, NULL);
 	if (len < 0) {
 		return -1;
 	}
@@ -512,7 +523,16 @@ int sql_set_user(rlm_sql_t *inst, REQUEST *request, char const *username)
 		return -1;
 	}
 
-	pairstrsteal(vp, expanded);
+	/*
+	 *	With an escape function, the buffer xlat returns is
+	 *	larger than the string, so it can't be stolen.
+	 */
+	if (inst->user_escape) {
+		pairstrcpy(vp, expanded);
+		talloc_free(expanded);
+	} else {
+		pairstrsteal(vp, expanded);
+	}
 	RDEBUG2("SQL-User-Name set to '%s'", vp->vp_strvalue);
 	vp->op = T_OP_SET;
 	radius_pairmove(request, &request->packet->vps, vp, false);	/* needs to be pair move else op is not respected */
@@ -528,7 +548,6 @@ int sql_set_user(rlm_sql_t *inst, REQUEST *request, char const *username)
 static int sql_get_grouplist(rlm_sql_t *inst, rlm_sql_handle_t **handle, REQUEST *request,
 			     rlm_sql_grouplist_t **phead)
 {
-	char    *expanded = NULL;
 	int     num_groups = 0;
 	rlm_sql_row_t row;
 	rlm_sql_grouplist_t *entry;
@@ -538,11 +557,9 @@ static int sql_get_grouplist(rlm_sql_t *inst, rlm_sql_handle_t **handle, REQUEST
 
 	entry = *phead = NULL;
 
-	if (!inst->config->groupmemb_query) return 0;\
-	if (radius_axlat(&expanded, request, inst->config->groupmemb_query, sql_escape_func, inst) < 0) return -1;
+	if (!inst->config->groupmemb_query) return 0;
 
-	ret = rlm_sql_select_query(handle, inst, expanded);
-	talloc_free(expanded);
+	ret = rlm_sql_select_query_xlat(handle, inst, request, inst->groupmemb_query);
 	if (ret != RLM_SQL_OK) return -1;
 
 	while (rlm_sql_fetch_row(&row, handle, inst) == 0) {
@@ -645,7 +662,6 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t *inst, REQUEST *request, rlm
 	VALUE_PAIR		*check_tmp = NULL, *reply_tmp = NULL, *sql_group = NULL;
 	rlm_sql_grouplist_t	*head = NULL, *entry = NULL;
 
-	char			*expanded = NULL;
 	int			rows;
 
 	rad_assert(request->packet != NULL);
@@ -688,15 +704,7 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t *inst, REQUEST *request, rlm
 			/*
 			 *	Expand the group query
 			 */
-			if (radius_axlat(&expanded, request, inst->config->authorize_group_check_query,
-					 sql_escape_func, inst) < 0) {
-				REDEBUG("Error generating query");
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-
-			rows = sql_getvpdata(request, inst, request, handle, &check_tmp, expanded);
-			TALLOC_FREE(expanded);
+			rows = sql_getvpdata(request, inst, request, handle, &check_tmp, inst->authorize_group_check_query);
 			if (rows < 0) {
 				REDEBUG("Error retrieving check pairs for group %s", entry->name);
 				rcode = RLM_MODULE_FAIL;
@@ -735,15 +743,7 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t *inst, REQUEST *request, rlm
 			/*
 			 *	Now get the reply pairs since the paircompare matched
 			 */
-			if (radius_axlat(&expanded, request, inst->config->authorize_group_reply_query,
-					 sql_escape_func, inst) < 0) {
-				REDEBUG("Error generating query");
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-
-			rows = sql_getvpdata(request->reply, inst, request, handle, &reply_tmp, expanded);
-			TALLOC_FREE(expanded);
+			rows = sql_getvpdata(request->reply, inst, request, handle, &reply_tmp, inst->authorize_group_reply_query);
 			if (rows < 0) {
 				REDEBUG("Error retrieving reply pairs for group %s", entry->name);
 				rcode = RLM_MODULE_FAIL;
@@ -772,10 +772,143 @@ finish:
 }
 
 
+/*
+ *	Queries in the accounting and post-auth sections are picked
+ *	at run time, so we compile all of them, and look them up by
+ *	the CONF_PAIR they came from.
+ */
+static int sql_query_cmp(void const *one, void const *two)
+{
+	sql_query_t const *a = one;
+	sql_query_t const *b = two;
+
+	if (a->cp < b->cp) return -1;
+	if (a->cp > b->cp) return +1;
+
+	return 0;
+}
+
+static int sql_compile_queries(rlm_sql_t *inst, rbtree_t *tree, CONF_SECTION *cs, bool prepare)
+{
+	CONF_ITEM *ci;
+
+	for (ci = cf_item_find_next(cs, NULL);
+	     ci != NULL;
+	     ci = cf_item_find_next(cs, ci)) {
+		CONF_PAIR *cp;
+		sql_query_t *query;
+
+		if (cf_item_is_section(ci)) {
+			if (sql_compile_queries(inst, tree, cf_itemtosection(ci), prepare) < 0) return -1;
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		cp = cf_itemtopair(ci);
+		if (!cf_pair_value(cp)) continue;
+
+		query = talloc_zero(tree, sql_query_t);
+		if (!query) return -1;
+
+		query->cp = cp;
+		query->xlat = xlat_compile(query, cf_pair_value(cp), sql_escape_func, inst);
+		if (!query->xlat || !rbtree_insert(tree, query)) {
+			talloc_free(query);
+			return -1;
+		}
+		if (prepare) query->stmt = sql_stmt_compile(query, inst, cf_pair_value(cp));
+	}
+
+	return 0;
+}
+
+static int sql_compile_section(rlm_sql_t *inst, sql_acct_section_t *section)
+{
+	section->queries = rbtree_create(inst, sql_query_cmp, NULL, 0);
+	if (!section->queries) return -1;
+
+	if (!section->cs) return 0;
+
+	if (section->reference) {
+		section->reference_xlat = xlat_compile(inst, section->reference, NULL, NULL);
+		if (!section->reference_xlat) return -1;
+	}
+
+	/*
+	 *	Queries which are logged have to be expanded as strings.
+	 */
+	return sql_compile_queries(inst, section->queries, section->cs,
+				   !section->logfile && !inst->config->logfile);
+}
+
+static sql_query_t *sql_compile_query(rlm_sql_t *inst, char const *fmt)
+{
+	sql_query_t *query;
+
+	query = talloc_zero(inst, sql_query_t);
+	if (!query) return NULL;
+
+	query->xlat = xlat_compile(query, fmt, sql_escape_func, inst);
+	if (!query->xlat) {
+		talloc_free(query);
+		return NULL;
+	}
+	query->stmt = sql_stmt_compile(query, inst, fmt);
+
+	return query;
+}
+
+#define SQL_COMPILE(_x) do { \
+		if (inst->config->_x) { \
+			inst->_x = sql_compile_query(inst, inst->config->_x); \
+			if (!inst->_x) return -1; \
+		} \
+	} while (0)
+
+/*
+ *	Tokenize the queries once, instead of on every request.
+ */
+static int sql_compile(rlm_sql_t *inst)
+{
+	/*
+	 *	Prepared statements bind SQL-User-Name as it is, so it
+	 *	must hold the user name, not the user name quoted.
+	 */
+	if (inst->config->prepared_statements && inst->module->sql_prepare) {
+		inst->user_escape = sql_stmt_escape_func;
+	}
+
+	inst->query_user = xlat_compile(inst, inst->config->query_user, inst->user_escape, NULL);
+	if (!inst->query_user) return -1;
+
+	SQL_COMPILE(authorize_check_query);
+	SQL_COMPILE(authorize_reply_query);
+	SQL_COMPILE(authorize_group_check_query);
+	SQL_COMPILE(authorize_group_reply_query);
+	SQL_COMPILE(simul_count_query);
+	SQL_COMPILE(simul_verify_query);
+	SQL_COMPILE(groupmemb_query);
+
+	if (sql_compile_section(inst, &inst->config->accounting) < 0) return -1;
+	if (sql_compile_section(inst, &inst->config->postauth) < 0) return -1;
+
+	return 0;
+}
+
 static int mod_detach(void *instance)
 {
 	rlm_sql_t *inst = instance;
 
+	/*
+	 *  The batch writer needs the connection pool to write the
+	 *  requests which are still queued.
+	 */
+	if (inst->config->accounting.batch) {
+		xlat_unregister_module(inst->config->accounting.batch);
+		TALLOC_FREE(inst->config->accounting.batch);
+	}
+
 	if (inst->pool) fr_connection_pool_delete(inst->pool);
 
 	/*
@@ -935,6 +1068,49 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		}
 	}
 
+	/*
+	 *	After the driver is loaded, as the statements depend on
+	 *	what it supports.
+	 */
+	if (sql_compile(inst) < 0) {
+		cf_log_err_cs(conf, "Failed compiling queries");
+		return -1;
+	}
+
+	if (inst->config->prepared_statements && !inst->module->sql_prepare) {
+		WARN("rlm_sql (%s): Driver %s does not support prepared statements", inst->config->xlat_name,
+		     inst->module->name);
+	}
+
+	if (inst->config->accounting.batch_size > 1) {
+		char *name;
+
+		FR_INTEGER_BOUND_CHECK("batch_size", inst->config->accounting.batch_size, <=, 10000);
+		FR_INTEGER_BOUND_CHECK("batch_timeout", inst->config->accounting.batch_timeout, >=, 1);
+		FR_INTEGER_BOUND_CHECK("batch_timeout", inst->config->accounting.batch_timeout, <=, 10000);
+
+		/*
+		 *	There's no standard way of starting a transaction,
+		 *	and some drivers commit every query, so the dialect
+		 *	has to say how, if it can.
+		 */
+		if (!inst->config->accounting.batch_begin || !inst->config->accounting.batch_commit ||
+		    !inst->config->accounting.batch_rollback) {
+			cf_log_err_cs(conf, "\"batch_size\" requires \"batch_begin\", \"batch_commit\" and "
+				      "\"batch_rollback\", which are set by the queries of dialects that support batching");
+			return -1;
+		}
+
+		inst->config->accounting.batch = sql_batch_alloc(inst, inst, &inst->config->accounting);
+		if (!inst->config->accounting.batch) return -1;
+
+		/*
+		 *	Statistics, e.g. %{sql_batch:flushes}
+		 */
+		name = talloc_asprintf(inst, "%s_batch", inst->config->xlat_name);
+		xlat_register(name, sql_batch_xlat, NULL, inst->config->accounting.batch);
+	}
+
 	inst->lf = fr_logfile_init(inst);
 	if (!inst->lf) {
 		cf_log_err_cs(conf, "Failed creating log file context");
@@ -985,8 +1161,6 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, REQUEST *reque
 
 	int	rows;
 
-	char	*expanded = NULL;
-
 	rad_assert(request->packet != NULL);
 	rad_assert(request->reply != NULL);
 
@@ -1023,15 +1197,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, REQUEST *reque
 		vp_cursor_t cursor;
 		VALUE_PAIR *vp;
 
-		if (radius_axlat(&expanded, request, inst->config->authorize_check_query,
-				 sql_escape_func, inst) < 0) {
-			REDEBUG("Error generating query");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
-
-		rows = sql_getvpdata(request, inst, request, &handle, &check_tmp, expanded);
-		TALLOC_FREE(expanded);
+		rows = sql_getvpdata(request, inst, request, &handle, &check_tmp, inst->authorize_check_query);
 		if (rows < 0) {
 			REDEBUG("SQL query error getting check attributes");
 			rcode = RLM_MODULE_FAIL;
@@ -1071,15 +1237,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, REQUEST *reque
 		/*
 		 *	Now get the reply pairs since the paircompare matched
 		 */
-		if (radius_axlat(&expanded, request, inst->config->authorize_reply_query,
-				 sql_escape_func, inst) < 0) {
-			REDEBUG("Error generating query");
-			rcode = RLM_MODULE_FAIL;
-			goto error;
-		}
-
-		rows = sql_getvpdata(request->reply, inst, request, &handle, &reply_tmp, expanded);
-		TALLOC_FREE(expanded);
+		rows = sql_getvpdata(request->reply, inst, request, &handle, &reply_tmp, inst->authorize_reply_query);
 		if (rows < 0) {
 			REDEBUG("SQL query error getting reply attributes");
 			rcode = RLM_MODULE_FAIL;
@@ -1212,6 +1370,65 @@ error:
 	return rcode;
 }
 
+/*
+ *	Expand all of the queries which match the reference, and
+ *	write them as part of a batch.  The batch tries them in order,
+ *	as acct_redundant() does.
+ */
+static rlm_rcode_t acct_batch(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t *section,
+			      CONF_PAIR *pair, char const *attr)
+{
+	TALLOC_CTX	*ctx;
+	sql_query_t	my_query, *query;
+	char		**queries = NULL;
+	char		*expanded;
+	char const	*value;
+	int		num_queries = 0;
+	rlm_rcode_t	rcode;
+	ssize_t		len;
+
+	MEM(ctx = talloc_new(request));
+
+	for (; pair; pair = cf_pair_find_next(section->cs, pair, attr)) {
+		value = cf_pair_value(pair);
+		if (!value) break;
+
+		expanded = NULL;
+		my_query.cp = pair;
+		query = rbtree_finddata(section->queries, &my_query);
+		if (query) {
+			len = radius_axlat_compiled(&expanded, request, query->xlat);
+		} else {
+			len = radius_axlat(&expanded, request, value, sql_escape_func, inst);
+		}
+		if (len < 0) {
+			talloc_free(ctx);
+			return RLM_MODULE_FAIL;
+		}
+
+		if (!*expanded) {
+			talloc_free(expanded);
+			break;
+		}
+
+		rlm_sql_query_log(inst, request, section, expanded);
+
+		MEM(queries = talloc_realloc(ctx, queries, char *, num_queries + 1));
+		queries[num_queries++] = talloc_steal(queries, expanded);
+	}
+
+	if (!num_queries) {
+		RDEBUG("Ignoring null query");
+		talloc_free(ctx);
+		return RLM_MODULE_NOOP;
+	}
+
+	rcode = sql_batch_write(section->batch, request, queries, num_queries);
+	talloc_free(ctx);
+
+	return rcode;
+}
+
 /*
  *	Generic function for failing between a bunch of queries.
  *
@@ -1228,6 +1445,8 @@ static int acct_redundant(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t
 
 	rlm_sql_handle_t	*handle = NULL;
 	int			sql_ret;
+	int			bound;
+	sql_bind_t		*params = NULL;
 	int			numaffected = 0;
 
 	CONF_ITEM		*item;
@@ -1238,6 +1457,7 @@ static int acct_redundant(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t
 	char			path[MAX_STRING_LEN];
 	char			*p = path;
 	char			*expanded = NULL;
+	ssize_t			len;
 
 	rad_assert(section);
 
@@ -1245,7 +1465,7 @@ static int acct_redundant(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t
 		*p++ = '.';
 	}
 
-	if (radius_xlat(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
+	if (radius_xlat_compiled(p, sizeof(path) - (p - path), request, section->reference_xlat) < 0) {
 		rcode = RLM_MODULE_FAIL;
 
 		goto finish;
@@ -1270,6 +1490,13 @@ static int acct_redundant(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t
 
 	RDEBUG2("Using query template '%s'", attr);
 
+	if (section->batch) {
+		sql_set_user(inst, request, NULL);
+		rcode = acct_batch(inst, request, section, pair, attr);
+
+		goto finish;
+	}
+
 	handle = fr_connection_get(inst->pool);
 	if (!handle) {
 		rcode = RLM_MODULE_FAIL;
@@ -1280,6 +1507,8 @@ static int acct_redundant(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t
 	sql_set_user(inst, request, NULL);
 
 	while (true) {
+		sql_query_t my_query, *query;
+
 		value = cf_pair_value(pair);
 		if (!value) {
 			RDEBUG("Ignoring null query");
@@ -1288,33 +1517,60 @@ static int acct_redundant(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t
 			goto finish;
 		}
 
-		if (radius_axlat(&expanded, request, value, sql_escape_func, inst) < 0) {
-			rcode = RLM_MODULE_FAIL;
+		my_query.cp = pair;
+		query = rbtree_finddata(section->queries, &my_query);
+		bound = 0;
+		if (query && query->stmt) {
+			bound = sql_stmt_bind(request, &params, request, query->stmt);
+			if (bound < 0) {
+				rcode = RLM_MODULE_FAIL;
 
-			goto finish;
+				goto finish;
+			}
 		}
 
-		if (!*expanded) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
-			talloc_free(expanded);
+		/*
+		 *	Prepared statements don't need the query
+		 *	expanded into a string.
+		 */
+		if (bound > 0) {
+			sql_ret = rlm_sql_query_bound(&handle, inst, query->stmt, params);
+			talloc_free(params);
+		} else {
+			if (query) {
+				len = radius_axlat_compiled(&expanded, request, query->xlat);
+			} else {
+				len = radius_axlat(&expanded, request, value, sql_escape_func, inst);
+			}
+			if (len < 0) {
+				rcode = RLM_MODULE_FAIL;
 
-			goto finish;
-		}
+				goto finish;
+			}
 
-		rlm_sql_query_log(inst, request, section, expanded);
+			if (!*expanded) {
+				RDEBUG("Ignoring null query");
+				rcode = RLM_MODULE_NOOP;
+				talloc_free(expanded);
+
+				goto finish;
+			}
+
+			rlm_sql_query_log(inst, request, section, expanded);
+
+			/*
+			 *  If rlm_sql_query cannot use the socket it'll try and
+			 *  reconnect. Reconnecting will automatically release
+			 *  the current socket, and try to select a new one.
+			 *
+			 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
+			 *  were exhausted, and we couldn't create a new connection,
+			 *  so we do not need to call fr_connection_release.
+			 */
+			sql_ret = rlm_sql_query(&handle, inst, expanded);
+			TALLOC_FREE(expanded);
+		}
 
-		/*
-		 *  If rlm_sql_query cannot use the socket it'll try and
-		 *  reconnect. Reconnecting will automatically release
-		 *  the current socket, and try to select a new one.
-		 *
-		 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
-		 *  were exhausted, and we couldn't create a new connection,
-		 *  so we do not need to call fr_connection_release.
-		 */
-		sql_ret = rlm_sql_query(&handle, inst, expanded);
-		TALLOC_FREE(expanded);
 		if (sql_ret == RLM_SQL_RECONNECT) {
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
@@ -1405,8 +1661,6 @@ static rlm_rcode_t CC_HINT(nonnull) mod_checksimul(void *instance, REQUEST * req
 	uint32_t		nas_addr = 0;
 	uint32_t		nas_port = 0;
 
-	char 			*expanded = NULL;
-
 	/* If simul_count_query is not defined, we don't do any checking */
 	if (!inst->config->simul_count_query) return RLM_MODULE_NOOP;
 
@@ -1421,20 +1675,14 @@ static rlm_rcode_t CC_HINT(nonnull) mod_checksimul(void *instance, REQUEST * req
 		return RLM_MODULE_FAIL;
 	}
 
-	if (radius_axlat(&expanded, request, inst->config->simul_count_query, sql_escape_func, inst) < 0) {
-		sql_unset_user(inst, request);
-		return RLM_MODULE_FAIL;
-	}
-
 	/* initialize the sql socket */
 	handle = fr_connection_get(inst->pool);
 	if (!handle) {
-		talloc_free(expanded);
 		sql_unset_user(inst, request);
 		return RLM_MODULE_FAIL;
 	}
 
-	if (rlm_sql_select_query(&handle, inst, expanded) != RLM_SQL_OK) {
+	if (rlm_sql_select_query_xlat(&handle, inst, request, inst->simul_count_query) != RLM_SQL_OK) {
 		rcode = RLM_MODULE_FAIL;
 		goto finish;
 	}
@@ -1452,7 +1700,6 @@ static rlm_rcode_t CC_HINT(nonnull) mod_checksimul(void *instance, REQUEST * req
 	request->simul_count = atoi(row[0]);
 
 	(inst->module->sql_finish_select_query)(handle, inst->config);
-	TALLOC_FREE(expanded);
 
 	if (request->simul_count < request->simul_max) {
 		rcode = RLM_MODULE_OK;
@@ -1469,13 +1716,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_checksimul(void *instance, REQUEST * req
 		goto finish;
 	}
 
-	if (radius_axlat(&expanded, request, inst->config->simul_verify_query, sql_escape_func, inst) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
-	}
-
-	if (rlm_sql_select_query(&handle, inst, expanded) != RLM_SQL_OK) goto finish;
+	if (rlm_sql_select_query_xlat(&handle, inst, request, inst->simul_verify_query) != RLM_SQL_OK) goto finish;
 
 	/*
 	 *      Setup some stuff, like for MPP detection.
@@ -1570,7 +1811,6 @@ static rlm_rcode_t CC_HINT(nonnull) mod_checksimul(void *instance, REQUEST * req
 
 	(inst->module->sql_finish_select_query)(handle, inst->config);
 	fr_connection_release(inst->pool, handle);
-	talloc_free(expanded);
 	sql_unset_user(inst, request);
 
 	/*
@@ -1627,4 +1867,6 @@ module_t rlm_sql = {
 		NULL,			/* post-proxy */
 		mod_post_auth	/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
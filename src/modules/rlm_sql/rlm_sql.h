@@ -36,6 +36,46 @@ typedef enum {
 
 typedef char **rlm_sql_row_t;
 
+/*
+ *	How a value is bound to a prepared statement.
+ */
+typedef enum {
+	SQL_BIND_TYPE_STRING = 0,		//!< A quoted value.
+	SQL_BIND_TYPE_INTEGER,			//!< An unquoted value, which expanded to an integer.
+	SQL_BIND_TYPE_NULL			//!< An unquoted value, which expanded to NULL.
+} sql_bind_type_t;
+
+typedef struct sql_bind {
+	sql_bind_type_t	type;
+	char const	*value;			//!< The expanded value.
+	size_t		len;			//!< Length of the expanded value.
+	int64_t		integer;		//!< The value, if type is SQL_BIND_TYPE_INTEGER.
+} sql_bind_t;
+
+/*
+ *	A query, split into statement text with placeholders, and the
+ *	expansions which are bound to them.
+ */
+typedef struct sql_stmt {
+	int		id;			//!< Index into the per-handle statement cache.
+	char const	*query;			//!< Statement text, with placeholders for the values.
+	int		num_params;		//!< Number of values to bind.
+	bool		*quoted;		//!< Whether each value was a quoted string.
+	xlat_compiled_t	**params;		//!< Each value, tokenized without escaping.
+} sql_stmt_t;
+
+/*
+ *	A query from the configuration, compiled when the module is
+ *	instantiated.
+ */
+typedef struct sql_query {
+	CONF_PAIR const	*cp;			//!< Where the query came from.
+	xlat_compiled_t	*xlat;			//!< The compiled query.
+	sql_stmt_t	*stmt;			//!< The query as a prepared statement, or NULL.
+} sql_query_t;
+
+typedef struct sql_batch sql_batch_t;
+
 /*
  * Sections where we dynamically resolve the config entry to use,
  * by xlating reference.
@@ -49,6 +89,16 @@ typedef struct sql_acct_section {
 	char const	*logfile;
 
 	char const	*query;	/* for xlat parsing */
+
+	uint32_t	batch_size;		//!< Maximum number of requests written in one transaction.
+	uint32_t	batch_timeout;		//!< Milliseconds to wait for a batch to fill.
+	char const	*batch_begin;		//!< Starts the transaction a batch is written in.
+	char const	*batch_commit;		//!< Commits the transaction.
+	char const	*batch_rollback;	//!< Rolls back the transaction.
+
+	xlat_compiled_t	*reference_xlat;	//!< Compiled reference.
+	rbtree_t	*queries;		//!< Compiled queries, indexed by CONF_PAIR.
+	sql_batch_t	*batch;			//!< Requests waiting to be written, or NULL.
 } sql_acct_section_t;
 
 typedef struct sql_config {
@@ -83,6 +133,7 @@ typedef struct sql_config {
 	bool		deletestalesessions;
 	char const	*allowed_chars;
 	uint32_t	query_timeout;
+	bool		prepared_statements;
 
 	void		*driver;	//!< Where drivers should write a
 					//!< pointer to their configurations.
@@ -105,6 +156,7 @@ typedef struct rlm_sql_handle {
 	void		*conn;	//!< Database specific connection handle.
 	rlm_sql_row_t	row;	//!< Row data from the last query.
 	rlm_sql_t	*inst;	//!< The rlm_sql instance this connection belongs to.
+	void		**stmts; //!< Driver specific prepared statements, indexed by sql_stmt_t id.
 } rlm_sql_handle_t;
 
 typedef struct rlm_sql_module_t {
@@ -129,6 +181,20 @@ typedef struct rlm_sql_module_t {
 
 	sql_rcode_t (*sql_finish_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional, for drivers which support prepared statements.
+	 *	The results of the bound queries are read with the
+	 *	functions above.
+	 */
+	bool		sql_numbered_params;	//!< Placeholders are $1, $2 ... instead of ?.
+	sql_rcode_t (*sql_prepare)(void **out, rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+				   sql_stmt_t const *stmt);
+	sql_rcode_t (*sql_query_bind)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *prepared,
+				      sql_stmt_t const *stmt, sql_bind_t const *params);
+	sql_rcode_t (*sql_select_query_bind)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *prepared,
+					     sql_stmt_t const *stmt, sql_bind_t const *params);
+	void (*sql_stmt_free)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, void *prepared);
 } rlm_sql_module_t;
 
 struct sql_inst {
@@ -139,6 +205,20 @@ struct sql_inst {
 
 	DICT_ATTR const		*sql_user;	//!< Cached pointer to SQL-User-Name
 						//!< dictionary attribute.
+
+	/*
+	 *	Queries, tokenized once at instantiation.
+	 */
+	xlat_compiled_t		*query_user;
+	RADIUS_ESCAPE_STRING	user_escape;	//!< Used when expanding SQL-User-Name.
+	sql_query_t		*authorize_check_query;
+	sql_query_t		*authorize_reply_query;
+	sql_query_t		*authorize_group_check_query;
+	sql_query_t		*authorize_group_reply_query;
+	sql_query_t		*simul_count_query;
+	sql_query_t		*simul_verify_query;
+	sql_query_t		*groupmemb_query;
+	int			num_stmts;	//!< Number of prepared statements.
 	fr_logfile_t		*lf;
 
 	void *handle;
@@ -159,13 +239,27 @@ typedef struct sql_grouplist {
 void		*mod_conn_create(TALLOC_CTX *ctx, void *instance);
 int		sql_userparse(TALLOC_CTX *ctx, VALUE_PAIR **first_pair, rlm_sql_row_t row);
 int		sql_read_realms(rlm_sql_handle_t *handle);
-int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair, char const *query);
+int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair, sql_query_t const *query);
 int		sql_read_naslist(rlm_sql_handle_t *handle);
 int		sql_read_clients(rlm_sql_handle_t *handle);
 int		sql_dict_init(rlm_sql_handle_t *handle);
 void 		CC_HINT(nonnull (1, 2, 4)) rlm_sql_query_log(rlm_sql_t *inst, REQUEST *request, sql_acct_section_t *section, char const *query);
 sql_rcode_t	CC_HINT(nonnull) rlm_sql_select_query(rlm_sql_handle_t **handle, rlm_sql_t *inst, char const *query);
 sql_rcode_t	CC_HINT(nonnull) rlm_sql_query(rlm_sql_handle_t **handle, rlm_sql_t *inst, char const *query);
+size_t		sql_stmt_escape_func(REQUEST *request, char *out, size_t outlen, char const *in, void *arg);
+sql_stmt_t	*sql_stmt_compile(TALLOC_CTX *ctx, rlm_sql_t *inst, char const *query);
+int		sql_stmt_bind(TALLOC_CTX *ctx, sql_bind_t **out, REQUEST *request, sql_stmt_t const *stmt);
+sql_rcode_t	CC_HINT(nonnull) rlm_sql_select_query_bound(rlm_sql_handle_t **handle, rlm_sql_t *inst,
+							    sql_stmt_t const *stmt, sql_bind_t const *params);
+sql_rcode_t	CC_HINT(nonnull) rlm_sql_query_bound(rlm_sql_handle_t **handle, rlm_sql_t *inst,
+						     sql_stmt_t const *stmt, sql_bind_t const *params);
+sql_rcode_t	CC_HINT(nonnull) rlm_sql_select_query_xlat(rlm_sql_handle_t **handle, rlm_sql_t *inst,
+							   REQUEST *request, sql_query_t const *query);
 sql_rcode_t 	rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t **handle, rlm_sql_t *inst);
 int		sql_set_user(rlm_sql_t *inst, REQUEST *request, char const *username);
+
+/* batch.c */
+sql_batch_t	*sql_batch_alloc(TALLOC_CTX *ctx, rlm_sql_t *inst, sql_acct_section_t *section);
+rlm_rcode_t	sql_batch_write(sql_batch_t *batch, REQUEST *request, char **queries, int num_queries);
+ssize_t		sql_batch_xlat(void *instance, REQUEST *request, char const *fmt, char *out, size_t outlen);
 #endif
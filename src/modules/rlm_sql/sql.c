@@ -42,9 +42,21 @@ RCSID("$Id$")
 static int _mod_conn_free(rlm_sql_handle_t *conn)
 {
 	rlm_sql_t *inst = conn->inst;
+	int i;
 
 	rad_assert(inst);
 
+	/*
+	 *	This is called before the driver's destructor, so the
+	 *	statements are freed while the connection is still open.
+	 */
+	if (conn->stmts) {
+		for (i = 0; i < inst->num_stmts; i++) {
+			if (conn->stmts[i]) (inst->module->sql_stmt_free)(conn, inst->config, conn->stmts[i]);
+		}
+		TALLOC_FREE(conn->stmts);
+	}
+
 	exec_trigger(NULL, inst->cs, "modules.sql.close", false);
 
 	return 0;
@@ -434,6 +446,363 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_handle_t **handle, rlm_sql_t *inst, cha
 }
 
 
+/*
+ *	Find the end of the expansion starting at p, which points to
+ *	the "%{".
+ */
+static char const *sql_stmt_expansion_end(char const *p)
+{
+	int depth = 0;
+
+	for (p++; *p; p++) {
+		if (*p == '\\') {
+			if (!p[1]) return NULL;
+			p++;
+			continue;
+		}
+
+		if (*p == '{') depth++;
+		if ((*p == '}') && (--depth == 0)) return p + 1;
+	}
+
+	return NULL;
+}
+
+/** Copy a value without escaping it
+ *
+ * Bound values aren't escaped.  Passing this function to xlat stops it from quoting
+ * the values of attributes, as it does when there is no escape function.
+ */
+size_t sql_stmt_escape_func(UNUSED REQUEST *request, char *out, size_t outlen, char const *in,
+			    UNUSED void *arg)
+{
+	return strlcpy(out, in, outlen);
+}
+
+static int sql_stmt_add_param(sql_stmt_t *stmt, char **text, rlm_sql_t *inst,
+			      char const *start, char const *end, bool quoted)
+{
+	char *fmt;
+	int i = stmt->num_params;
+
+	stmt->params = talloc_realloc(stmt, stmt->params, xlat_compiled_t *, i + 1);
+	stmt->quoted = talloc_realloc(stmt, stmt->quoted, bool, i + 1);
+	if (!stmt->params || !stmt->quoted) return -1;
+
+	fmt = talloc_strndup(stmt, start, end - start);
+	stmt->params[i] = xlat_compile(stmt, fmt, sql_stmt_escape_func, NULL);
+	talloc_free(fmt);
+	if (!stmt->params[i]) return -1;
+
+	stmt->quoted[i] = quoted;
+	stmt->num_params++;
+
+	if (inst->module->sql_numbered_params) {
+		*text = talloc_asprintf_append_buffer(*text, "$%i", stmt->num_params);
+	} else {
+		*text = talloc_strdup_append_buffer(*text, "?");
+	}
+
+	return *text ? 0 : -1;
+}
+
+/** Split a query into a statement with placeholders, and the values to bind to them
+ *
+ * Values are expansions which are the whole of a quoted string, e.g. '%{User-Name}',
+ * which are bound as strings, or unquoted expansions, e.g. %{integer:Event-Timestamp},
+ * which are bound as integers or NULL.  If an unquoted expansion expands to anything
+ * else, the query is expanded as a string instead.
+ *
+ * @param ctx to allocate the statement in.
+ * @param inst rlm_sql instance data.
+ * @param query to split.
+ * @return the statement, or NULL if prepared statements are disabled, or the query
+ *	contains expansions which can't be bound.
+ */
+sql_stmt_t *sql_stmt_compile(TALLOC_CTX *ctx, rlm_sql_t *inst, char const *query)
+{
+	char const	*p, *q, *end;
+	char		*text;
+	sql_stmt_t	*stmt;
+	bool		words = false;
+
+	if (!inst->config->prepared_statements || !inst->module->sql_prepare) return NULL;
+
+	stmt = talloc_zero(ctx, sql_stmt_t);
+	if (!stmt) return NULL;
+
+	text = talloc_strdup(stmt, "");
+	if (!text) goto fail;
+
+	p = query;
+	while (*p) {
+		switch (*p) {
+		case '\'':
+			if ((p[1] == '%') && (p[2] == '{')) {
+				end = sql_stmt_expansion_end(p + 1);
+				if (end && (*end == '\'')) {
+					if (sql_stmt_add_param(stmt, &text, inst, p + 1, end, true) < 0) goto fail;
+					p = end + 1;
+					break;
+				}
+			}
+			/* FALL-THROUGH */
+
+		case '"':
+			/*
+			 *	Other quoted strings are part of the statement,
+			 *	so they can't contain expansions.
+			 */
+			q = strchr(p + 1, *p);
+			if (!q || memchr(p, '%', q - p) || memchr(p, '\\', q - p)) goto fail;
+
+			text = talloc_asprintf_append_buffer(text, "%.*s", (int) ((q + 1) - p), p);
+			if (!text) goto fail;
+			p = q + 1;
+			break;
+
+		case '%':
+			if (p[1] != '{') goto fail;
+
+			end = sql_stmt_expansion_end(p);
+			if (!end) goto fail;
+
+			if (sql_stmt_add_param(stmt, &text, inst, p, end, false) < 0) goto fail;
+			p = end;
+			break;
+
+		case '\\':
+			goto fail;
+
+		default:
+			if (isalpha((int) *p)) words = true;
+
+			text = talloc_asprintf_append_buffer(text, "%c", *p);
+			if (!text) goto fail;
+			p++;
+			break;
+		}
+	}
+
+	/*
+	 *	The query is made up entirely of expansions.
+	 */
+	if (!words) goto fail;
+
+	stmt->query = text;
+	stmt->id = inst->num_stmts++;
+
+	return stmt;
+
+fail:
+	talloc_free(stmt);
+	return NULL;
+}
+
+/** Expand the values to bind to a prepared statement
+ *
+ * @param ctx to allocate the values in.
+ * @param out where to write the values.
+ * @param request the current request.
+ * @param stmt to expand the values of, may be NULL.
+ * @return 1 if the values were expanded, 0 if the query should be expanded as a string
+ *	instead, -1 on error.
+ */
+int sql_stmt_bind(TALLOC_CTX *ctx, sql_bind_t **out, REQUEST *request, sql_stmt_t const *stmt)
+{
+	int		i;
+	sql_bind_t	*params;
+
+	*out = NULL;
+
+	if (!stmt) return 0;
+
+	params = talloc_zero_array(ctx, sql_bind_t, stmt->num_params);
+	if (!params) return -1;
+
+	for (i = 0; i < stmt->num_params; i++) {
+		char	*value = NULL;
+		char	*end;
+		ssize_t	len;
+
+		len = radius_axlat_compiled(&value, request, stmt->params[i]);
+		if (len < 0) {
+			talloc_free(params);
+			return -1;
+		}
+		talloc_steal(params, value);
+
+		params[i].value = value;
+		params[i].len = len;
+
+		if (stmt->quoted[i]) {
+			params[i].type = SQL_BIND_TYPE_STRING;
+			continue;
+		}
+
+		if (strcasecmp(value, "NULL") == 0) {
+			params[i].type = SQL_BIND_TYPE_NULL;
+			continue;
+		}
+
+		errno = 0;
+		params[i].integer = strtoll(value, &end, 10);
+		if (!*value || *end || (errno != 0)) {
+			RDEBUG2("Value \"%s\" is not an integer, expanding query as a string", value);
+			talloc_free(params);
+			return 0;
+		}
+		params[i].type = SQL_BIND_TYPE_INTEGER;
+	}
+
+	*out = params;
+
+	return 1;
+}
+
+/*
+ *	Get the prepared statement from the handle's cache, preparing
+ *	it if this is the first time it's been used on the handle.
+ */
+static sql_rcode_t sql_stmt_get(void **out, rlm_sql_handle_t *handle, rlm_sql_t *inst, sql_stmt_t const *stmt)
+{
+	sql_rcode_t ret;
+
+	if (!handle->stmts) {
+		handle->stmts = talloc_zero_array(handle, void *, inst->num_stmts);
+		if (!handle->stmts) return RLM_SQL_ERROR;
+	}
+
+	if (!handle->stmts[stmt->id]) {
+		DEBUG("rlm_sql (%s): Preparing query: '%s'", inst->config->xlat_name, stmt->query);
+
+		ret = (inst->module->sql_prepare)(&handle->stmts[stmt->id], handle, inst->config, stmt);
+		if (ret != RLM_SQL_OK) return ret;
+	}
+
+	*out = handle->stmts[stmt->id];
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_query_bound(rlm_sql_handle_t **handle, rlm_sql_t *inst, bool select,
+				   sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	int ret = RLM_SQL_ERROR;
+	int i, count;
+	void *prepared;
+
+	/* There's no handle, we need a new one */
+	if (!*handle) return RLM_SQL_RECONNECT;
+
+	count = inst->pool ? fr_connection_get_num(inst->pool) : 0;
+
+	for (i = 0; i < (count + 1); i++) {
+		DEBUG("rlm_sql (%s): Executing prepared query: '%s'", inst->config->xlat_name, stmt->query);
+
+		ret = sql_stmt_get(&prepared, *handle, inst, stmt);
+		if (ret == RLM_SQL_OK) {
+			if (select) {
+				ret = (inst->module->sql_select_query_bind)(*handle, inst->config, prepared,
+									    stmt, params);
+			} else {
+				ret = (inst->module->sql_query_bind)(*handle, inst->config, prepared, stmt, params);
+			}
+		}
+
+		switch (ret) {
+		case RLM_SQL_OK:
+			break;
+
+		case RLM_SQL_RECONNECT:
+			*handle = fr_connection_reconnect(inst->pool, *handle);
+			/* Reconnection failed */
+			if (!*handle) return RLM_SQL_RECONNECT;
+			/* Reconnection succeeded, try again with the new handle */
+			continue;
+
+		case RLM_SQL_DUPLICATE:
+			rlm_sql_query_debug(*handle, inst);
+			break;
+
+		case RLM_SQL_QUERY_ERROR:
+		case RLM_SQL_ERROR:
+		default:
+			rlm_sql_query_error(*handle, inst);
+			break;
+		}
+
+		return ret;
+	}
+
+	ERROR("rlm_sql (%s): Hit reconnection limit", inst->config->xlat_name);
+
+	return RLM_SQL_ERROR;
+}
+
+/** Call the driver's sql_select_query_bind method, reconnecting if necessary.
+ *
+ * @param handle to query the database with.
+ * @param inst rlm_sql instance data.
+ * @param stmt to execute, it's prepared on the handle if this is the first time it's used.
+ * @param params values to bind, from #sql_stmt_bind.
+ * @return as #rlm_sql_select_query.
+ */
+sql_rcode_t rlm_sql_select_query_bound(rlm_sql_handle_t **handle, rlm_sql_t *inst,
+				       sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	return sql_query_bound(handle, inst, true, stmt, params);
+}
+
+/** Call the driver's sql_query_bind method, reconnecting if necessary.
+ *
+ * @param handle to query the database with.
+ * @param inst rlm_sql instance data.
+ * @param stmt to execute, it's prepared on the handle if this is the first time it's used.
+ * @param params values to bind, from #sql_stmt_bind.
+ * @return as #rlm_sql_query.
+ */
+sql_rcode_t rlm_sql_query_bound(rlm_sql_handle_t **handle, rlm_sql_t *inst,
+				sql_stmt_t const *stmt, sql_bind_t const *params)
+{
+	return sql_query_bound(handle, inst, false, stmt, params);
+}
+
+/** Expand and run a SELECT query, as a prepared statement if possible
+ *
+ * @param handle to query the database with.
+ * @param inst rlm_sql instance data.
+ * @param request the current request.
+ * @param query to expand.
+ * @return as #rlm_sql_select_query, or RLM_SQL_QUERY_ERROR if the query couldn't be expanded.
+ */
+sql_rcode_t rlm_sql_select_query_xlat(rlm_sql_handle_t **handle, rlm_sql_t *inst, REQUEST *request,
+				      sql_query_t const *query)
+{
+	sql_rcode_t	rcode;
+	sql_bind_t	*params;
+	char		*expanded = NULL;
+	int		ret;
+
+	ret = sql_stmt_bind(request, &params, request, query->stmt);
+	if (ret > 0) {
+		rcode = rlm_sql_select_query_bound(handle, inst, query->stmt, params);
+		talloc_free(params);
+
+		return rcode;
+	}
+
+	if ((ret < 0) || (radius_axlat_compiled(&expanded, request, query->xlat) < 0)) {
+		REDEBUG("Error generating query");
+		return RLM_SQL_QUERY_ERROR;
+	}
+
+	rcode = rlm_sql_select_query(handle, inst, expanded);
+	talloc_free(expanded);
+
+	return rcode;
+}
+
 /*************************************************************************
  *
  *	Function: sql_getvpdata
@@ -442,14 +811,14 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_handle_t **handle, rlm_sql_t *inst, cha
  *
  *************************************************************************/
 int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t *inst, REQUEST *request, rlm_sql_handle_t **handle,
-		  VALUE_PAIR **pair, char const *query)
+		  VALUE_PAIR **pair, sql_query_t const *query)
 {
 	rlm_sql_row_t	row;
 	int		rows = 0;
 	sql_rcode_t	rcode;
 
-	rcode = rlm_sql_select_query(handle, inst, query);
-	if (!rcode) return -1; /* error handled by rlm_sql_select_query */
+	rcode = rlm_sql_select_query_xlat(handle, inst, request, query);
+	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query_xlat */
 
 	while (rlm_sql_fetch_row(&row, handle, inst) == 0) {
 		if (!row) break;
@@ -602,5 +602,7 @@ module_t rlm_sqlcounter = {
 		NULL,			/* post-proxy */
 		NULL			/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
 
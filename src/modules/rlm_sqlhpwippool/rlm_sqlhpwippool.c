@@ -783,4 +783,6 @@ module_t rlm_sqlhpwippool = {
 		NULL,			/* post-proxy */
 		mod_post_auth	/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -756,4 +756,6 @@ module_t rlm_unbound = {
 	mod_detach,			/* detach */
 	/* This module does not directly interact with requests */
 	{ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -79,4 +79,6 @@ module_t rlm_utf8 = {
 		NULL
 #endif
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
@@ -480,4 +480,6 @@ module_t rlm_wimax = {
 		NULL,			/* post-proxy */
 		mod_post_auth 		/* post-auth */
 	},
+	NULL,				/* thread instantiation */
+	NULL				/* thread detach */
 };
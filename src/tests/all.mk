@@ -1,4 +1,4 @@
-SUBMAKEFILES := rbmonkey.mk unit/all.mk keywords/all.mk auth/all.mk
+SUBMAKEFILES := rbmonkey.mk unit/all.mk keywords/all.mk auth/all.mk sql/all.mk
 
 #
 #  Include all of the autoconf definitions into the Make variable space
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+#  Stress the EAP session store.
+#
+#  Runs a number of radeapclient processes in parallel, each of which
+#  performs a series of EAP-MD5 authentications.  Every authentication
+#  is two rounds, so the server adds, finds and deletes one session per
+#  authentication, from many workers at once.
+#
+#  The server must be running, with a user "bob" / "hello" which is
+#  allowed to use EAP-MD5, e.g. as for ../eap-md5.conf.
+#
+#	./client.sh [clients] [sessions] [server] [secret]
+#
+#  At the end, "Total approved auths" should equal clients * sessions.
+#
+
+CLIENTS=${1:-16}
+SESSIONS=${2:-500}
+SERVER=${3:-localhost}
+SECRET=${4:-testing123}
+RADEAPCLIENT=${RADEAPCLIENT:-../../modules/rlm_eap/radeapclient}
+
+DIR=$(mktemp -d ${TMPDIR:-/tmp}/eap-stress.XXXXXX) || exit 1
+trap 'rm -rf $DIR' 0 1 2 15
+
+#
+#  Each client gets its own NAS-Port, so that the sessions can be told
+#  apart in the server logs.
+#
+c=0
+while [ $c -lt $CLIENTS ]; do
+	i=0
+	while [ $i -lt $SESSIONS ]; do
+		[ $i -gt 0 ] && echo
+		echo 'User-Name = "bob"'
+		echo 'Cleartext-Password = "hello"'
+		echo 'NAS-IP-Address = 127.0.0.1'
+		echo 'EAP-Code = Response'
+		echo "EAP-Id = $(( i % 256 ))"
+		echo 'EAP-Type-Identity = "bob"'
+		echo 'Message-Authenticator = 0'
+		echo "NAS-Port = $c"
+		i=$(( i + 1 ))
+	done > $DIR/req.$c
+	c=$(( c + 1 ))
+done
+
+START=$(date +%s)
+
+c=0
+while [ $c -lt $CLIENTS ]; do
+	$RADEAPCLIENT -q -s -f $DIR/req.$c $SERVER auth $SECRET > $DIR/out.$c 2>&1 &
+	c=$(( c + 1 ))
+done
+wait
+
+END=$(date +%s)
+
+APPROVED=$(cat $DIR/out.* | sed -n 's/.*Total approved auths: *//p' | awk '{ n += $1 } END { print n + 0 }')
+DENIED=$(cat $DIR/out.* | sed -n 's/.*Total denied auths: *//p' | awk '{ n += $1 } END { print n + 0 }')
+
+echo "Clients:              $CLIENTS"
+echo "Sessions per client:  $SESSIONS"
+echo "Total approved auths: $APPROVED"
+echo "Total denied auths:   $DENIED"
+echo "Elapsed seconds:      $(( END - START ))"
+
+[ "$APPROVED" -eq $(( CLIENTS * SESSIONS )) ]
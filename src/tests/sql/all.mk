@@ -0,0 +1,87 @@
+#
+#  Tests for rlm_sql, using the SQLite driver
+#
+
+#
+#  The test files are files without extensions.
+#
+SQL_FILES := $(filter-out %.conf %.md %.attrs %.mk %.sql %~ %.rej,$(subst $(DIR)/,,$(wildcard $(DIR)/*)))
+
+#
+#  Create the output directory
+#
+.PHONY: $(BUILD_DIR)/tests/sql
+$(BUILD_DIR)/tests/sql:
+	@mkdir -p $@
+
+#
+#  The tests share one database, which the SQLite driver creates
+#  and loads when it doesn't exist.  Remove it before running the
+#  tests, so that they always start from the same data.
+#
+SQL_DB	:= $(BUILD_DIR)/tests/sql/radius.db
+
+$(BUILD_DIR)/tests/sql/db: $(addprefix $(DIR)/,$(SQL_FILES) data.sql sql.conf radiusd.conf) raddb/mods-config/sql/main/sqlite/schema.sql | $(BUILD_DIR)/tests/sql
+	@rm -f $(SQL_DB)
+	@touch $@
+
+#
+#  For each file, look for precursor test.
+#  Ensure that each test depends on its precursors.  The tests
+#  share a database, so they are also run in order.
+#
+-include $(BUILD_DIR)/tests/sql/depends.mk
+
+$(BUILD_DIR)/tests/sql/depends.mk: $(addprefix $(DIR)/,$(SQL_FILES)) | $(BUILD_DIR)/tests/sql
+	@rm -f $@
+	@for x in $^; do \
+		y=`grep 'PRE: ' $$x | sed 's/.*://;s/  / /g;s, , $(BUILD_DIR)/tests/sql/,g'`; \
+		if [ "$$y" != "" ]; then \
+			z=`echo $$x | sed 's,src/,$(BUILD_DIR)/',`; \
+			echo "$$z: $$y" >> $@; \
+			echo "" >> $@; \
+		fi \
+	done
+
+#
+#  Copy the input files over.
+#
+$(BUILD_DIR)/tests/sql/%.attrs: $(DIR)/%.attrs | $(BUILD_DIR)/tests/sql
+	@cp $< $@
+
+.PRECIOUS: $(BUILD_DIR)/tests/sql/%.attrs
+
+SQL_LIBS	:= rlm_always.la rlm_pap.la rlm_expr.la rlm_sql.la rlm_sql_sqlite.la
+
+#
+#  Files in the output dir depend on the unit tests
+#
+#	src/tests/sql/FOO		unlang for the test
+#	src/tests/sql/FOO.attrs		input RADIUS and output filter
+#	build/tests/sql/FOO		updated if the test succeeds
+#	build/tests/sql/FOO.log		debug output for the test
+#
+$(BUILD_DIR)/tests/sql/%: $(DIR)/% $(BUILD_DIR)/tests/sql/%.attrs $(BUILD_DIR)/tests/sql/db $(TESTBINDIR)/unittest | $(BUILD_DIR)/tests/sql $(SQL_LIBS) build.raddb
+	@echo SQL-TEST $(notdir $@)
+	@if ! SQL_DB=$(SQL_DB) TESTDIR=$(notdir $@) $(TESTBIN)/unittest -D share -d src/tests/sql/ -i $@.attrs -f $@.attrs -xx > $@.log 2>&1; then \
+		cat $@.log; \
+		echo "# $@.log"; \
+		exit 1; \
+	fi
+	@touch $@
+
+#
+#  Get all of the unit test output files
+#
+TESTS.SQL_FILES := $(addprefix $(BUILD_DIR)/tests/sql/,$(SQL_FILES))
+
+#
+#  Depend on the output files, and create the directory first.
+#
+tests.sql: $(TESTS.SQL_FILES)
+
+$(TESTS.SQL_FILES): $(TESTS.AUTH_FILES)
+
+.PHONY: clean.tests.sql
+clean.tests.sql:
+	@rm -rf $(BUILD_DIR)/tests/sql/
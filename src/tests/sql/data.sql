@@ -0,0 +1,13 @@
+--
+--  Test data for the rlm_sql tests.
+--
+--  The user name contains a quote and a backslash.  The "sql_prepared"
+--  instance binds it as-is.  The "sql_plain" instance puts SQL-User-Name
+--  into the query, which is the user name quoted (the backslash is
+--  doubled), and escaped with the default escape function.
+--
+INSERT INTO radcheck (username, attribute, op, value) VALUES ('o''brien\smith', 'Cleartext-Password', ':=', 'prepared');
+INSERT INTO radreply (username, attribute, op, value) VALUES ('o''brien\smith', 'Reply-Message', ':=', 'it''s a \ test');
+
+INSERT INTO radcheck (username, attribute, op, value) VALUES ('o=27brien=5C=5Csmith', 'Cleartext-Password', ':=', 'plain');
+INSERT INTO radreply (username, attribute, op, value) VALUES ('o=27brien=5C=5Csmith', 'Reply-Message', ':=', 'it''s a \ test');
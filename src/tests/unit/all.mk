@@ -7,7 +7,7 @@
 #  functionality from earlier tests.
 #
 FILES  := rfc.txt errors.txt extended.txt lucent.txt wimax.txt \
-	condition.txt xlat.txt vendor.txt
+	condition.txt xlat.txt vendor.txt decode.txt dictionary.txt
 
 #
 #  Create the output directory
@@ -27,6 +27,11 @@ $(BUILD_DIR)/tests/unit/%: $(DIR)/% $(TESTBINDIR)/radattr | $(BUILD_DIR)/tests/u
 	fi
 	@touch $@
 
+#
+#  dictionary.txt reads more definitions from dictionary.test.
+#
+$(BUILD_DIR)/tests/unit/dictionary.txt: $(DIR)/dictionary.test
+
 #
 #  Get all of the unit test output files
 #